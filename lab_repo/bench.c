@@ -0,0 +1,480 @@
+/**
+ * @file
+ * @brief Pruebas de rendimiento de versions
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * Uso: vbench [opciones] DIRECTORIO
+ *
+ * Genera un repositorio sintetico en DIRECTORIO (ver benchgen.h) y mide:
+ *
+ * - sha256: el hash de bloques de varios tamanos con cada implementacion
+ *   disponible, en el mismo proceso.
+ * - versions: add de cada version de cada archivo, add de un archivo sin
+ *   cambios, list de un archivo, list de todo el repositorio y get de una
+ *   version al azar. Cada operacion se ejecuta en un proceso nuevo, como
+ *   una invocacion del comando, incluyendo repo_open.
+ * - libversions: get de una version al azar con el repositorio abierto
+ *   una sola vez en el mismo proceso (ver libversions.h).
+ *
+ * Por cada operacion se reportan las latencias p50 y p99 y, en promedio,
+ * las llamadas al sistema de lectura y escritura y los bytes leidos
+ * (/proc/self/io) y los fallos de pagina. Los resultados se imprimen como
+ * tabla y se escriben en JSON para comparar ejecuciones.
+ *
+ * Opciones:
+ *      -n N            : Numero de archivos (100)
+ *      -m M            : Versiones por archivo (5)
+ *      -d DIST         : Distribucion de tamanos: fixed:S, uniform:A:B, log:A:B (log:1k:1m)
+ *      -c FRACCION     : Fraccion de bytes modificados por version (0.02)
+ *      -b              : Contenido binario aleatorio en lugar de texto
+ *      -r R            : Repeticiones de las demas operaciones (200)
+ *      -s SEMILLA      : Semilla del generador (1)
+ *      -o ARCHIVO      : Resultados en JSON (bench.json)
+ *      -g              : Solo genera el repositorio, sin medir
+ *      --chunk, --delta[=N], --no-compress : Como en versions
+ */
+
+#include "benchgen.h"
+#include "libversions.h"
+#include "sha256.h"
+#include "vdelta.h"
+
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define SHA_SIZES 3 /**< Tamanos de bloque medidos para sha256 */
+#define SHA_BYTES (4 << 20) /**< Bytes procesados por muestra de sha256 */
+
+/**
+ * @brief Medicion de una operacion
+ */
+typedef struct {
+    double usec;          /**< Duracion en microsegundos */
+    uint64_t syscr;       /**< Llamadas al sistema de lectura */
+    uint64_t syscw;       /**< Llamadas al sistema de escritura */
+    uint64_t rchar;       /**< Bytes leidos (incluye la cache de paginas) */
+    uint64_t read_bytes;  /**< Bytes leidos del disco */
+    uint64_t minflt;      /**< Fallos de pagina menores */
+} sample;
+
+/**
+ * @brief Mediciones de un tipo de operacion
+ */
+typedef struct {
+    char name[48];   /**< Nombre de la operacion */
+    sample *samples; /**< Mediciones */
+    size_t count;    /**< Numero de mediciones */
+    size_t capacity; /**< Capacidad del arreglo */
+    double bytes;    /**< Bytes procesados por operacion (0 si no aplica) */
+} series;
+
+/**
+ * @brief Operacion medida en un proceso nuevo
+ */
+typedef struct {
+    int kind;        /**< OP_ADD, OP_LIST, OP_GET */
+    char file[16];   /**< Archivo (vacio: todo el repositorio) */
+    int version;     /**< Version para get */
+} operation;
+
+#define OP_ADD 0 /**< add ARCHIVO */
+#define OP_LIST 1 /**< list [ARCHIVO] */
+#define OP_GET 2 /**< get VERSION ARCHIVO */
+
+/** Opciones de almacenamiento de los repositorios medidos */
+static repo_options options;
+
+static double now_usec(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+/**
+ * @brief Lee los contadores de E/S y de fallos de pagina del proceso.
+ * Si /proc no esta disponible, los contadores de E/S quedan en cero.
+ */
+static void read_counters(sample *s) {
+    char key[32];
+    unsigned long long value;
+    struct rusage ru;
+    FILE *in;
+
+    memset(s, 0, sizeof *s);
+    if ((in = fopen("/proc/self/io", "r")) != NULL) {
+        while (fscanf(in, "%31[^:]: %llu\n", key, &value) == 2) {
+            if (EQUALS(key, "syscr")) s->syscr = value;
+            else if (EQUALS(key, "syscw")) s->syscw = value;
+            else if (EQUALS(key, "rchar")) s->rchar = value;
+            else if (EQUALS(key, "read_bytes")) s->read_bytes = value;
+        }
+        fclose(in);
+    }
+    if (getrusage(RUSAGE_SELF, &ru) == 0) s->minflt = ru.ru_minflt;
+}
+
+static int add_sample(series *s, const sample *m) {
+    if (s->count == s->capacity) {
+        size_t capacity = s->capacity ? 2 * s->capacity : 256;
+        sample *grown = realloc(s->samples, capacity * sizeof *grown);
+        if (grown == NULL) return -1;
+        s->samples = grown;
+        s->capacity = capacity;
+    }
+    s->samples[s->count++] = *m;
+    return 0;
+}
+
+static int print_version(void *ctx, const version_entry *e) {
+    char hash[2 * DIGEST_SIZE + 1];
+    (void)ctx;
+    digest_to_hex(e->digest, hash);
+    printf("%d %.*s %s %.*s\n", e->number, e->filename_len, e->filename, hash, e->comment_len, e->comment);
+    return 0;
+}
+
+/**
+ * @brief Ejecuta una operacion sobre un repositorio abierto.
+ */
+static return_code execute(repo *r, const operation *op) {
+    if (op->kind == OP_ADD) return repo_add(r, op->file, "bench");
+    if (op->kind == OP_GET) return repo_get(r, op->file, op->version, NULL);
+    return repo_list(r, op->file[0] ? op->file : NULL, print_version, NULL) < 0 ? VERSION_ERROR : VERSION_OK;
+}
+
+/**
+ * @brief Resta los contadores de before a los de after.
+ */
+static void elapsed_counters(const sample *before, const sample *after, sample *m) {
+    m->syscr = after->syscr - before->syscr;
+    m->syscw = after->syscw - before->syscw;
+    m->rchar = after->rchar - before->rchar;
+    m->read_bytes = after->read_bytes - before->read_bytes;
+    m->minflt = after->minflt - before->minflt;
+}
+
+/**
+ * @brief Ejecuta una operacion de versions en un proceso nuevo y agrega su
+ * medicion a la serie.
+ * @return 0 en caso de exito, -1 si la operacion falla.
+ */
+static int run_operation(series *s, const operation *op) {
+    sample before, after, m;
+    int fds[2], status;
+    pid_t pid;
+    ssize_t n;
+
+    if (pipe(fds) < 0) return -1;
+    if ((pid = fork()) < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        return_code r = VERSION_ERROR;
+        repo *handle;
+        double start;
+
+        // La salida de list no se mide
+        close(fds[0]);
+        if (freopen("/dev/null", "w", stdout) == NULL) _exit(EXIT_FAILURE);
+
+        read_counters(&before);
+        start = now_usec();
+        if ((handle = repo_open(NULL, &options)) != NULL) {
+            r = execute(handle, op);
+            repo_close(handle);
+        }
+        m.usec = now_usec() - start;
+        fflush(stdout);
+        read_counters(&after);
+        elapsed_counters(&before, &after, &m);
+        n = write(fds[1], &m, sizeof m);
+        _exit(r != VERSION_ERROR && r != VERSION_NOT_FOUND && n == sizeof m ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    while ((n = read(fds[0], &m, sizeof m)) < 0 && errno == EINTR);
+    close(fds[0]);
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+    if (n != sizeof m || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) return -1;
+    return add_sample(s, &m);
+}
+
+/**
+ * @brief Mide sha256 con cada implementacion disponible.
+ * @return Numero de series agregadas.
+ */
+static int bench_sha256(series *out, int reps) {
+    static const size_t sizes[SHA_SIZES] = {64, 4 << 10, 1 << 20};
+    char initial[32];
+    uint8_t digest[32], *buf;
+    const char *kernel;
+    size_t i, k, j, iters;
+    int count = 0, r;
+
+    if ((buf = malloc(sizes[SHA_SIZES - 1])) == NULL) return 0;
+    for (i = 0; i < sizes[SHA_SIZES - 1]; i++) buf[i] = i * 131 + (i >> 8);
+    snprintf(initial, sizeof initial, "%s", sha256_kernel());
+
+    for (k = 0; (kernel = sha256_kernel_at(k)) != NULL; k++) {
+        if (sha256_set_kernel(kernel) < 0) continue;
+        for (i = 0; i < SHA_SIZES; i++) {
+            series *s = &out[count++];
+            snprintf(s->name, sizeof s->name, "sha256/%s/%zu", kernel, sizes[i]);
+            s->bytes = sizes[i];
+
+            // Cada muestra procesa SHA_BYTES en bloques del tamano medido
+            iters = SHA_BYTES / sizes[i];
+            for (r = 0; r < reps / 10 + 1; r++) {
+                sample m;
+                double start = now_usec();
+                memset(&m, 0, sizeof m);
+                for (j = 0; j < iters; j++) sha256_hash(buf, sizes[i], digest);
+                m.usec = (now_usec() - start) / iters;
+                add_sample(s, &m);
+            }
+        }
+    }
+
+    sha256_set_kernel(initial);
+    free(buf);
+    return count;
+}
+
+static int compare_samples(const void *a, const void *b) {
+    double x = ((const sample *)a)->usec, y = ((const sample *)b)->usec;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Resumen de una serie
+ */
+typedef struct {
+    double p50, p99, mean;             /**< Latencias en microsegundos */
+    double syscr, syscw, rchar, read_bytes, minflt; /**< Promedios */
+} summary;
+
+static void summarize(series *s, summary *r) {
+    size_t i;
+
+    memset(r, 0, sizeof *r);
+    if (s->count == 0) return;
+    qsort(s->samples, s->count, sizeof *s->samples, compare_samples);
+    r->p50 = s->samples[(s->count - 1) * 50 / 100].usec;
+    r->p99 = s->samples[(s->count - 1) * 99 / 100].usec;
+    for (i = 0; i < s->count; i++) {
+        r->mean += s->samples[i].usec;
+        r->syscr += s->samples[i].syscr;
+        r->syscw += s->samples[i].syscw;
+        r->rchar += s->samples[i].rchar;
+        r->read_bytes += s->samples[i].read_bytes;
+        r->minflt += s->samples[i].minflt;
+    }
+    r->mean /= s->count;
+    r->syscr /= s->count;
+    r->syscw /= s->count;
+    r->rchar /= s->count;
+    r->read_bytes /= s->count;
+    r->minflt /= s->count;
+}
+
+/**
+ * @brief Imprime la tabla de resultados y los escribe en JSON.
+ * @return 0 en caso de exito, -1 si no se puede escribir el JSON.
+ */
+static int report(series *all, int count, const gen_config *c, const char *mode, const char *json_path) {
+    summary r;
+    FILE *out;
+    int i;
+
+    if ((out = fopen(json_path, "w")) == NULL) return -1;
+    fprintf(out, "{\n  \"config\": {\"files\": %d, \"versions\": %d, \"min_size\": %zu, \"max_size\": %zu, "
+            "\"dist\": %d, \"change\": %g, \"text\": %d, \"seed\": %llu, \"mode\": \"%s\", \"sha256\": \"%s\"},\n"
+            "  \"results\": [\n", c->files, c->versions, c->min_size, c->max_size, c->dist, c->change, c->text,
+            (unsigned long long)c->seed, mode, sha256_kernel());
+
+    printf("%-28s %8s %12s %12s %10s %10s %12s %12s %8s\n", "operacion", "n", "p50 (us)", "p99 (us)",
+           "syscr", "syscw", "rchar", "read_bytes", "minflt");
+    for (i = 0; i < count; i++) {
+        summarize(&all[i], &r);
+        printf("%-28s %8zu %12.1f %12.1f %10.1f %10.1f %12.0f %12.0f %8.1f", all[i].name, all[i].count,
+               r.p50, r.p99, r.syscr, r.syscw, r.rchar, r.read_bytes, r.minflt);
+        if (all[i].bytes > 0) printf("  %.1f MB/s", all[i].bytes / r.p50);
+        printf("\n");
+
+        fprintf(out, "    {\"op\": \"%s\", \"n\": %zu, \"p50_us\": %.3f, \"p99_us\": %.3f, \"mean_us\": %.3f, "
+                "\"syscr\": %.1f, \"syscw\": %.1f, \"rchar\": %.0f, \"read_bytes\": %.0f, \"minflt\": %.1f",
+                all[i].name, all[i].count, r.p50, r.p99, r.mean, r.syscr, r.syscw, r.rchar, r.read_bytes, r.minflt);
+        if (all[i].bytes > 0) fprintf(out, ", \"mb_per_s\": %.1f", all[i].bytes / r.p50);
+        fprintf(out, "}%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    return fclose(out) == 0 ? 0 : -1;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Uso: vbench [-n N] [-m M] [-d DIST] [-c FRACCION] [-b] [-r R] [-s SEMILLA] [-o ARCHIVO] [-g]\n"
+                    "              [--chunk] [--delta[=N]] [--no-compress] DIRECTORIO\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    series all[64];
+    gen_config c;
+    operation op;
+    char json_path[PATH_MAX] = "bench.json", mode[32] = "";
+    char cwd[PATH_MAX];
+    int reps = 200, generate_only = 0, count = 0, failed = 0, i, f, v;
+    series *add_series, *same, *list_file, *list_all, *get_series, *get_open;
+    uint64_t pick = 0x5eed;
+    repo *handle = NULL;
+
+    gen_defaults(&c);
+    repo_default_options(&options);
+    memset(all, 0, sizeof all);
+
+    for (i = 1; i < argc - 1; i++) {
+        if (EQUALS(argv[i], "-n") && i + 2 < argc) c.files = atoi(argv[++i]);
+        else if (EQUALS(argv[i], "-m") && i + 2 < argc) c.versions = atoi(argv[++i]);
+        else if (EQUALS(argv[i], "-d") && i + 2 < argc) {
+            if (gen_parse_dist(argv[++i], &c) < 0) usage();
+        } else if (EQUALS(argv[i], "-c") && i + 2 < argc) c.change = atof(argv[++i]);
+        else if (EQUALS(argv[i], "-b")) c.text = 0;
+        else if (EQUALS(argv[i], "-r") && i + 2 < argc) reps = atoi(argv[++i]);
+        else if (EQUALS(argv[i], "-s") && i + 2 < argc) c.seed = strtoull(argv[++i], NULL, 10);
+        else if (EQUALS(argv[i], "-o") && i + 2 < argc) snprintf(json_path, PATH_MAX, "%s", argv[++i]);
+        else if (EQUALS(argv[i], "-g")) generate_only = 1;
+        else if (EQUALS(argv[i], "--chunk")) {
+            options.chunking = 1;
+            snprintf(mode, sizeof mode, "%s", "chunk");
+        } else if (strncmp(argv[i], "--delta", 7) == 0) {
+            options.delta_depth = argv[i][7] == '=' ? atoi(argv[i] + 8) : DELTA_DEFAULT_DEPTH;
+            snprintf(mode, sizeof mode, "%s", "delta");
+        } else if (EQUALS(argv[i], "--no-compress")) {
+            options.compression = 0;
+            snprintf(mode, sizeof mode, "%s", "no-compress");
+        } else usage();
+    }
+    if (i != argc - 1 || c.files <= 0 || c.versions <= 0 || reps <= 0) usage();
+    if (mode[0] == 0) snprintf(mode, sizeof mode, "%s", "default");
+
+    // El JSON se escribe relativo al directorio desde el que se invoca
+    if (json_path[0] != '/' && getcwd(cwd, PATH_MAX) != NULL) {
+        char relative[PATH_MAX];
+        snprintf(relative, PATH_MAX, "%s", json_path);
+        snprintf(json_path, PATH_MAX, "%.2000s/%.2000s", cwd, relative);
+    }
+
+    mkdir(argv[argc - 1], 0755);
+    if (chdir(argv[argc - 1]) < 0) {
+        fprintf(stderr, "No se puede usar el directorio %s\n", argv[argc - 1]);
+        exit(EXIT_FAILURE);
+    }
+    if (access(VERSIONS_DIR, F_OK) == 0) {
+        fprintf(stderr, "%s ya tiene un repositorio\n", argv[argc - 1]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!generate_only) count = bench_sha256(all, reps);
+    add_series = &all[count++];
+    same = &all[count++];
+    list_file = &all[count++];
+    list_all = &all[count++];
+    get_series = &all[count++];
+    get_open = &all[count++];
+    snprintf(add_series->name, sizeof add_series->name, "versions/add");
+    snprintf(same->name, sizeof same->name, "versions/add-unchanged");
+    snprintf(list_file->name, sizeof list_file->name, "versions/list-file");
+    snprintf(list_all->name, sizeof list_all->name, "versions/list-all");
+    snprintf(get_series->name, sizeof get_series->name, "versions/get");
+    snprintf(get_open->name, sizeof get_open->name, "libversions/get");
+    if (generate_only && (handle = repo_open(NULL, &options)) == NULL) {
+        fprintf(stderr, "No se puede crear el repositorio en %s\n", argv[argc - 1]);
+        exit(EXIT_FAILURE);
+    }
+
+    // Cada version se escribe y se adiciona antes de generar la siguiente
+    for (v = 1; v <= c.versions; v++) {
+        for (f = 0; f < c.files; f++) {
+            memset(&op, 0, sizeof op);
+            op.kind = OP_ADD;
+            gen_filename(f, op.file);
+            if (gen_write_version(&c, f, v) < 0
+                    || (generate_only ? execute(handle, &op) == VERSION_ERROR
+                                      : run_operation(add_series, &op) < 0)) {
+                fprintf(stderr, "No se puede adicionar la version %d de %s\n", v, op.file);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    if (generate_only) {
+        repo_close(handle);
+        printf("%d archivos, %d versiones generados en %s\n", c.files, c.versions, argv[argc - 1]);
+        exit(EXIT_SUCCESS);
+    }
+
+    // Operaciones sobre archivos y versiones al azar
+    for (i = 0; i < reps; i++) {
+        int file = pick * 0x9e3779b97f4a7c15ULL % c.files;
+        pick = pick * 6364136223846793005ULL + 1442695040888963407ULL;
+
+        memset(&op, 0, sizeof op);
+        gen_filename(file, op.file);
+        op.kind = OP_ADD;
+        if (run_operation(same, &op) < 0) failed++;
+        op.kind = OP_LIST;
+        if (run_operation(list_file, &op) < 0) failed++;
+        if (i < reps / 10 + 1) {
+            operation all_files = {OP_LIST, "", 0};
+            if (run_operation(list_all, &all_files) < 0) failed++;
+        }
+    }
+    for (i = 0; i < reps; i++) {
+        int file = pick * 0x9e3779b97f4a7c15ULL % c.files;
+        pick = pick * 6364136223846793005ULL + 1442695040888963407ULL;
+
+        // get sobrescribe el archivo; ya no se adicionan versiones
+        memset(&op, 0, sizeof op);
+        op.kind = OP_GET;
+        op.version = 1 + (pick >> 33) % c.versions;
+        gen_filename(file, op.file);
+        if (run_operation(get_series, &op) < 0) failed++;
+    }
+
+    // Las mismas operaciones con el repositorio abierto una sola vez
+    if ((handle = repo_open(NULL, &options)) == NULL) failed++;
+    for (i = 0; handle != NULL && i < reps; i++) {
+        int file = pick * 0x9e3779b97f4a7c15ULL % c.files;
+        sample before, after, m;
+        double start;
+
+        pick = pick * 6364136223846793005ULL + 1442695040888963407ULL;
+        memset(&op, 0, sizeof op);
+        op.kind = OP_GET;
+        op.version = 1 + (pick >> 33) % c.versions;
+        gen_filename(file, op.file);
+
+        read_counters(&before);
+        start = now_usec();
+        if (execute(handle, &op) == VERSION_ERROR) failed++;
+        m.usec = now_usec() - start;
+        read_counters(&after);
+        elapsed_counters(&before, &after, &m);
+        add_sample(get_open, &m);
+    }
+    repo_close(handle);
+    if (failed > 0) fprintf(stderr, "%d operaciones fallaron; los resultados estan incompletos\n", failed);
+
+    if (report(all, count, &c, mode, json_path) < 0) {
+        fprintf(stderr, "No se pueden escribir los resultados en %s\n", json_path);
+        exit(EXIT_FAILURE);
+    }
+    printf("Resultados en %s\n", json_path);
+    exit(EXIT_SUCCESS);
+}
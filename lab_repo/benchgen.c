@@ -0,0 +1,201 @@
+/**
+ * @file
+ * @brief Implementacion del generador de repositorios sinteticos
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ */
+
+#include "benchgen.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define GEN_EDIT 64 /**< Bytes modificados por cada edicion */
+#define GEN_BUFSIZE (64 << 10) /**< Bloque de escritura */
+
+/** Vocabulario del contenido de texto */
+static const char *words[] = {
+    "archivo", "version", "repositorio", "directorio", "proceso", "memoria",
+    "sistema", "operativo", "kernel", "hilo", "senal", "tuberia", "socket",
+    "bloque", "disco", "cache", "pagina", "marco", "tabla", "indice", "hash",
+    "objeto", "paquete", "registro", "comentario", "cliente", "servidor",
+    "usuario", "ruta", "nombre", "tamano", "fecha", "int", "char", "return",
+    "if", "else", "for", "while", "struct", "static", "void", "NULL", "0",
+    "1", "42", "{", "}", "(", ")", ";", "=", "==", "+", "-", "*", "/", "//",
+    "#include", "printf", "malloc", "free", "open", "close",
+};
+
+#define NWORDS (sizeof words / sizeof words[0])
+
+/**
+ * @brief Generador pseudoaleatorio (splitmix64)
+ */
+static uint64_t next(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Estado del generador para un archivo y una version.
+ */
+static uint64_t seed_for(const gen_config *c, int file, int version) {
+    uint64_t state = c->seed ^ ((uint64_t)file * 0x100000001b3ULL) ^ ((uint64_t)version << 40);
+    next(&state);
+    return state;
+}
+
+void gen_defaults(gen_config *c) {
+    c->files = 100;
+    c->versions = 5;
+    c->dist = GEN_LOG;
+    c->min_size = 1 << 10;
+    c->max_size = 1 << 20;
+    c->change = 0.02;
+    c->text = 1;
+    c->seed = 1;
+}
+
+/**
+ * @brief Interpreta un tamano con sufijo opcional k, m o g.
+ * @return Tamano, 0 si no es valido.
+ */
+static size_t parse_size(const char *s, char **end) {
+    size_t value = strtoull(s, end, 10);
+
+    switch (**end) {
+    case 'k': case 'K': value <<= 10; (*end)++; break;
+    case 'm': case 'M': value <<= 20; (*end)++; break;
+    case 'g': case 'G': value <<= 30; (*end)++; break;
+    }
+    return value;
+}
+
+int gen_parse_dist(const char *spec, gen_config *c) {
+    const char *args;
+    char *end;
+
+    if (strncmp(spec, "fixed:", 6) == 0) {
+        c->dist = GEN_FIXED;
+        args = spec + 6;
+    } else if (strncmp(spec, "uniform:", 8) == 0) {
+        c->dist = GEN_UNIFORM;
+        args = spec + 8;
+    } else if (strncmp(spec, "log:", 4) == 0) {
+        c->dist = GEN_LOG;
+        args = spec + 4;
+    } else {
+        return -1;
+    }
+
+    c->min_size = c->max_size = parse_size(args, &end);
+    if (c->dist != GEN_FIXED) {
+        if (*end != ':') return -1;
+        c->max_size = parse_size(end + 1, &end);
+    }
+    return *end == 0 && c->min_size > 0 && c->min_size <= c->max_size ? 0 : -1;
+}
+
+char *gen_filename(int file, char *name) {
+    snprintf(name, 16, "f%06d", file);
+    return name;
+}
+
+/**
+ * @brief Tamano de la primera version de un archivo.
+ */
+static size_t file_size(const gen_config *c, int file) {
+    uint64_t state = seed_for(c, file, 0);
+    double u = (next(&state) >> 11) * (1.0 / 9007199254740992.0);
+
+    switch (c->dist) {
+    case GEN_UNIFORM:
+        return c->min_size + (size_t)(u * (c->max_size - c->min_size + 1));
+    case GEN_LOG:
+        return (size_t)exp(log(c->min_size) + u * (log(c->max_size) - log(c->min_size)));
+    default:
+        return c->min_size;
+    }
+}
+
+/**
+ * @brief Llena un buffer con texto o bytes aleatorios.
+ */
+static void fill(const gen_config *c, uint64_t *state, char *buf, size_t len) {
+    size_t i = 0;
+
+    if (!c->text) {
+        for (; i + 8 <= len; i += 8) {
+            uint64_t r = next(state);
+            memcpy(buf + i, &r, 8);
+        }
+        for (; i < len; i++) buf[i] = next(state);
+        return;
+    }
+
+    // Palabras del vocabulario; una linea nueva cada ~10 palabras
+    while (i < len) {
+        uint64_t r = next(state);
+        const char *w = words[r % NWORDS];
+        size_t wlen = strlen(w);
+
+        if (wlen > len - i) wlen = len - i;
+        memcpy(buf + i, w, wlen);
+        i += wlen;
+        if (i < len) buf[i++] = (r >> 32) % 10 == 0 ? '\n' : ' ';
+    }
+}
+
+/**
+ * @brief Escribe len bytes generados desde la posicion offset.
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int write_generated(const gen_config *c, uint64_t *state, int fd, off_t offset, size_t len) {
+    char buf[GEN_BUFSIZE];
+
+    while (len > 0) {
+        size_t n = len < sizeof buf ? len : sizeof buf;
+        fill(c, state, buf, n);
+        if (pwrite(fd, buf, n, offset) != (ssize_t)n) return -1;
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int gen_write_version(const gen_config *c, int file, int version) {
+    char name[16];
+    uint64_t state = seed_for(c, file, version);
+    struct stat s;
+    size_t edits, i;
+    int fd, ok = 1;
+
+    gen_filename(file, name);
+    if (version <= 1) {
+        if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) return -1;
+        ok = write_generated(c, &state, fd, 0, file_size(c, file)) == 0;
+        return close(fd) == 0 && ok ? 0 : -1;
+    }
+
+    // Ediciones en posiciones aleatorias y un poco de contenido al final
+    if ((fd = open(name, O_RDWR)) < 0) return -1;
+    if (fstat(fd, &s) < 0) {
+        close(fd);
+        return -1;
+    }
+    edits = s.st_size * c->change / GEN_EDIT + 1;
+    for (i = 0; ok && i < edits && s.st_size > 0; i++) {
+        off_t offset = next(&state) % s.st_size;
+        size_t len = s.st_size - offset < GEN_EDIT ? s.st_size - offset : GEN_EDIT;
+        ok = write_generated(c, &state, fd, offset, len) == 0;
+    }
+    ok = ok && write_generated(c, &state, fd, s.st_size, s.st_size * c->change / 2 + 1) == 0;
+    return close(fd) == 0 && ok ? 0 : -1;
+}
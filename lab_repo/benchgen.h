@@ -0,0 +1,84 @@
+/**
+ * @file
+ * @brief Generador de repositorios sinteticos para las pruebas de rendimiento
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * Genera N archivos con M versiones cada uno en el directorio actual. El
+ * tamano de cada archivo se toma de una distribucion configurable; cada
+ * version nueva modifica una fraccion de los bytes de la anterior y agrega
+ * algunos al final, como un archivo que se edita.
+ *
+ * El contenido depende solo de la semilla, el archivo y la version, por lo
+ * que dos ejecuciones con la misma configuracion generan los mismos
+ * archivos y sus resultados se pueden comparar.
+ */
+
+#ifndef BENCHGEN_H
+#define BENCHGEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GEN_FIXED 0 /**< Distribucion: todos los archivos de min_size bytes */
+#define GEN_UNIFORM 1 /**< Distribucion: uniforme entre min_size y max_size */
+#define GEN_LOG 2 /**< Distribucion: log-uniforme (muchos pequenos, pocos grandes) */
+
+/**
+ * @brief Configuracion del generador
+ */
+typedef struct {
+    int files;        /**< Numero de archivos */
+    int versions;     /**< Versiones por archivo */
+    int dist;         /**< GEN_FIXED, GEN_UNIFORM o GEN_LOG */
+    size_t min_size;  /**< Tamano minimo */
+    size_t max_size;  /**< Tamano maximo */
+    double change;    /**< Fraccion de bytes modificados por version */
+    int text;         /**< 1: texto (compresible), 0: bytes aleatorios */
+    uint64_t seed;    /**< Semilla */
+} gen_config;
+
+/**
+ * @brief Llena la configuracion por defecto: 100 archivos, 5 versiones,
+ * tamanos log-uniformes entre 1 KiB y 1 MiB, 2% de cambios, texto.
+ *
+ * @param c Configuracion
+ */
+void gen_defaults(gen_config *c);
+
+/**
+ * @brief Interpreta una distribucion de tamanos: "fixed:S", "uniform:A:B"
+ * o "log:A:B". Los tamanos aceptan los sufijos k, m y g.
+ *
+ * @param spec Especificacion
+ * @param c Configuracion
+ *
+ * @return 0 en caso de exito, -1 si la especificacion no es valida.
+ */
+int gen_parse_dist(const char *spec, gen_config *c);
+
+/**
+ * @brief Obtiene el nombre de un archivo generado.
+ *
+ * @param file Numero del archivo (desde 0)
+ * @param name Buffer de al menos 16 bytes
+ *
+ * @return Referencia al buffer
+ */
+char *gen_filename(int file, char *name);
+
+/**
+ * @brief Escribe una version de un archivo en el directorio actual.
+ * La version 1 crea el archivo; las siguientes modifican la anterior, por
+ * lo que se deben escribir en orden.
+ *
+ * @param c Configuracion
+ * @param file Numero del archivo (desde 0)
+ * @param version Numero de la version (desde 1)
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+int gen_write_version(const gen_config *c, int file, int version);
+
+#endif
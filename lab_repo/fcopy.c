@@ -0,0 +1,261 @@
+/**
+ * @file
+ * @brief Implementacion de la copia de archivos
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ */
+
+#define _GNU_SOURCE
+#include "fcopy.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+/**
+ * @brief Copia con copy_file_range.
+ * @return Bytes copiados, -1 si el mecanismo no esta disponible, -2 si
+ * falla despues de copiar datos.
+ */
+static off_t copy_range(int src, int dst, off_t size) {
+    off_t total = 0;
+    ssize_t n;
+
+    while ((n = copy_file_range(src, NULL, dst, NULL, size > total ? size - total : FCOPY_BUFSIZE, 0)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return total == 0 ? -1 : -2;
+        }
+        total += n;
+    }
+    return total;
+}
+
+/**
+ * @brief Copia con sendfile.
+ * @return Bytes copiados, -1 si el mecanismo no esta disponible, -2 si
+ * falla despues de copiar datos.
+ */
+static off_t copy_sendfile(int src, int dst, off_t size) {
+    off_t total = 0;
+    ssize_t n;
+
+    while ((n = sendfile(dst, src, NULL, size > total ? size - total : FCOPY_BUFSIZE)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return total == 0 ? -1 : -2;
+        }
+        total += n;
+    }
+    return total;
+}
+
+/**
+ * @brief Copia con read/write.
+ * @return Bytes copiados, -1 si ocurre un error.
+ */
+static off_t copy_rw(int src, int dst) {
+    char *buf;
+    off_t total = 0;
+    ssize_t nread;
+
+    if ((buf = malloc(FCOPY_BUFSIZE)) == NULL) return -1;
+
+    while ((nread = read(src, buf, FCOPY_BUFSIZE)) != 0) {
+        char *out_ptr = buf;
+
+        if (nread < 0) {
+            if (errno == EINTR) continue;
+            total = -1;
+            break;
+        }
+
+        while (nread > 0) {
+            ssize_t nwritten = write(dst, out_ptr, nread);
+            if (nwritten < 0) {
+                if (errno == EINTR) continue;
+                free(buf);
+                return -1;
+            }
+            nread -= nwritten;
+            out_ptr += nwritten;
+            total += nwritten;
+        }
+    }
+
+    free(buf);
+    return total;
+}
+
+/**
+ * @brief Copia un rango con copy_file_range o, si no esta disponible,
+ * con pread/write.
+ * @return Bytes copiados, -1 si ocurre un error.
+ */
+static off_t copy_span(int src, off_t offset, off_t length, int dst) {
+    off_t total = 0;
+    char *buf;
+    ssize_t n = 0;
+
+    while (total < length) {
+        n = copy_file_range(src, &offset, dst, NULL, length - total, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        total += n;
+    }
+    if (total == length) return total;
+    if (n == 0 || total > 0) return -1;
+
+    // copy_file_range no esta disponible: se copia por bloques con pread
+    if ((buf = malloc(FCOPY_BUFSIZE)) == NULL) return -1;
+    while (total < length) {
+        size_t chunk = length - total < FCOPY_BUFSIZE ? length - total : FCOPY_BUFSIZE;
+        char *out_ptr = buf;
+
+        if ((n = pread(src, buf, chunk, offset)) <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            break;
+        }
+        offset += n;
+        while (n > 0) {
+            ssize_t nwritten = write(dst, out_ptr, n);
+            if (nwritten < 0) {
+                if (errno == EINTR) continue;
+                free(buf);
+                return -1;
+            }
+            n -= nwritten;
+            out_ptr += nwritten;
+            total += nwritten;
+        }
+    }
+    free(buf);
+    return total == length ? total : -1;
+}
+
+/**
+ * @brief Copia solo los rangos con datos de un archivo disperso. El
+ * destino, vacio, recibe los mismos huecos y el mismo tamano.
+ * @return Bytes copiados, -1 si el sistema de archivos no reporta los
+ * huecos, -2 si falla despues de copiar datos.
+ */
+static off_t copy_sparse(int src, int dst, off_t size) {
+    off_t data, hole;
+
+    if ((data = lseek(src, 0, SEEK_DATA)) < 0 && errno != ENXIO) return -1;
+
+    // ENXIO: no hay datos despues de la posicion, el resto es hueco
+    while (data >= 0 && data < size) {
+        if ((hole = lseek(src, data, SEEK_HOLE)) < 0) hole = size;
+        if (lseek(dst, data, SEEK_SET) < 0 || copy_span(src, data, hole - data, dst) < 0) return -2;
+        if ((data = lseek(src, hole, SEEK_DATA)) < 0 && errno != ENXIO) return -2;
+    }
+    return ftruncate(dst, size) < 0 ? -2 : size;
+}
+
+ssize_t fcopy_read_sparse(int fd, char *buf, size_t len, off_t *offset, off_t size, int *hole) {
+    off_t data, end;
+    ssize_t n;
+
+    if (*offset >= size) return 0;
+
+    // Sin soporte de huecos (EINVAL) todo el archivo se trata como datos
+    if ((data = lseek(fd, *offset, SEEK_DATA)) < 0) data = errno == ENXIO ? size : *offset;
+    if (data > *offset) {
+        n = data - *offset < (off_t)len ? data - *offset : (off_t)len;
+        memset(buf, 0, n);
+        *hole = 1;
+        *offset += n;
+        return n;
+    }
+
+    if ((end = lseek(fd, *offset, SEEK_HOLE)) < 0 || end > size) end = size;
+    n = end - *offset < (off_t)len ? end - *offset : (off_t)len;
+    while ((n = pread(fd, buf, n, *offset)) < 0 && errno == EINTR);
+    if (n < 0) return -1;
+    *hole = 0;
+    *offset += n;
+    return n;
+}
+
+off_t fcopy_fd(int src, int dst) {
+    struct stat s;
+    off_t copied;
+
+    if (fstat(src, &s) < 0) return -1;
+
+#ifdef FICLONE
+    // Clonacion de bloques: no se copian datos
+    if (S_ISREG(s.st_mode) && ioctl(dst, FICLONE, src) == 0) return s.st_size;
+#endif
+
+    // Archivo disperso: los huecos no se leen ni se escriben
+    if (S_ISREG(s.st_mode) && (off_t)s.st_blocks * 512 < s.st_size) {
+        if ((copied = copy_sparse(src, dst, s.st_size)) >= 0) return copied;
+        if (copied == -2) return -1;
+    }
+
+    if ((copied = copy_range(src, dst, s.st_size)) >= 0) return copied;
+    if (copied == -2) return -1;
+
+    if ((copied = copy_sendfile(src, dst, s.st_size)) >= 0) return copied;
+    if (copied == -2) return -1;
+
+    return copy_rw(src, dst);
+}
+
+off_t fcopy_range(int src, off_t offset, off_t length, int dst) {
+    off_t end = offset + length, data, hole;
+    struct stat s;
+
+    // Los huecos del origen no se leen ni se escriben: el destino solo
+    // avanza. Sin soporte de huecos (EINVAL) todo el rango son datos
+    while (length >= FCOPY_SPARSE_MIN && offset < end) {
+        if ((data = lseek(src, offset, SEEK_DATA)) < 0) data = errno == ENXIO ? end : offset;
+        if (data > end) data = end;
+        if (data > offset) {
+            if (lseek(dst, data - offset, SEEK_CUR) < 0) break;
+            offset = data;
+            continue;
+        }
+        if ((hole = lseek(src, offset, SEEK_HOLE)) < 0 || hole > end) hole = end;
+        if (copy_span(src, offset, hole - offset, dst) < 0) return -1;
+        offset = hole;
+    }
+    if (offset < end && copy_span(src, offset, end - offset, dst) < 0) return -1;
+
+    // Un hueco al final no extiende el destino
+    if (length >= FCOPY_SPARSE_MIN && fstat(dst, &s) == 0 && S_ISREG(s.st_mode)
+            && (data = lseek(dst, 0, SEEK_CUR)) > s.st_size && ftruncate(dst, data) < 0) {
+        return -1;
+    }
+    return length;
+}
+
+int fcopy(const char *source, const char *destination) {
+    int src, dst;
+    off_t copied;
+
+    if ((src = open(source, O_RDONLY)) < 0) return -1;
+
+    if ((dst = open(destination, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+        close(src);
+        return -1;
+    }
+
+    copied = fcopy_fd(src, dst);
+
+    close(src);
+    if (close(dst) < 0) return -1;
+    return copied < 0 ? -1 : 0;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file
+ * @brief Copia de archivos sin pasar los datos por el espacio de usuario
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * La copia intenta, en orden:
+ *
+ * 1. FICLONE: el destino comparte los bloques del origen (btrfs, xfs).
+ * 2. copy_file_range: el kernel copia los datos (o los clona en NFS/SMB).
+ * 3. sendfile: copia dentro del kernel entre descriptores.
+ * 4. read/write con un buffer grande.
+ *
+ * Cada mecanismo solo se descarta si falla antes de copiar algun byte.
+ *
+ * Si el origen es disperso (tiene huecos), antes de copiar byte por byte
+ * se copian solo los rangos con datos (SEEK_DATA/SEEK_HOLE) y los huecos
+ * se recrean en el destino.
+ */
+
+#ifndef FCOPY_H
+#define FCOPY_H
+
+#include <sys/types.h>
+
+#define FCOPY_BUFSIZE (1 << 20) /**< Buffer de la copia con read/write */
+#define FCOPY_SPARSE_MIN (64 << 10) /**< Rangos mas cortos se copian sin buscar huecos */
+
+/**
+ * @brief Copia el contenido de un descriptor a otro.
+ * Ambos descriptores deben estar posicionados al inicio; el destino debe
+ * estar vacio.
+ *
+ * @param src Descriptor de origen (lectura)
+ * @param dst Descriptor de destino (escritura)
+ *
+ * @return Bytes copiados, -1 si ocurre un error.
+ */
+off_t fcopy_fd(int src, int dst);
+
+/**
+ * @brief Copia un rango de un descriptor a la posicion actual de otro.
+ * Usa copy_file_range con la posicion del origen explicita; si no esta
+ * disponible, pread/write. En un rango de al menos FCOPY_SPARSE_MIN bytes,
+ * los huecos del origen quedan como huecos en el destino.
+ *
+ * @param src Descriptor de origen (lectura)
+ * @param offset Posicion del rango en el origen
+ * @param length Bytes a copiar
+ * @param dst Descriptor de destino (escritura)
+ *
+ * @return Bytes copiados, -1 si ocurre un error o el origen termina antes
+ * del rango.
+ */
+off_t fcopy_range(int src, off_t offset, off_t length, int dst);
+
+/**
+ * @brief Lee el siguiente bloque de un archivo que puede tener huecos.
+ * Los huecos no se leen del disco: el bloque se llena con ceros. Un bloque
+ * nunca mezcla datos y hueco.
+ *
+ * @param fd Descriptor del archivo
+ * @param buf Buffer de al menos len bytes
+ * @param len Bytes a leer como maximo
+ * @param offset Posicion del bloque; avanza con los bytes leidos
+ * @param size Tamano del archivo
+ * @param hole 1 si el bloque es un hueco, 0 si son datos
+ *
+ * @return Bytes del bloque, 0 al final del archivo, -1 si ocurre un error.
+ */
+ssize_t fcopy_read_sparse(int fd, char *buf, size_t len, off_t *offset, off_t size, int *hole);
+
+/**
+ * @brief Copia un archivo.
+ * El destino se crea o se trunca.
+ *
+ * @param source Ruta del archivo de origen
+ * @param destination Ruta del archivo de destino
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+int fcopy(const char *source, const char *destination);
+
+#endif
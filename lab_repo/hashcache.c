@@ -0,0 +1,309 @@
+/**
+ * @file
+ * @brief Implementacion de la cache de hashes
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ */
+
+#include "hashcache.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sha256.h"
+#include "vthash.h"
+
+#define HASHCACHE_MAGIC 0x43434856 /**< "VHCC" en little endian */
+#define HASHCACHE_FORMAT 3 /**< Version del formato (1: SHA-256 tambien para archivos grandes, 2: raiz del arbol como nombre) */
+#define HASHCACHE_MIN_SLOTS 256 /**< Ranuras de una cache nueva (potencia de 2) */
+#define NS_PER_SEC 1000000000LL
+
+/**
+ * @brief Encabezado del archivo de la cache
+ */
+typedef struct {
+    uint32_t magic;  /**< HASHCACHE_MAGIC */
+    uint32_t format; /**< HASHCACHE_FORMAT */
+    uint64_t nslots; /**< Numero de ranuras (potencia de 2) */
+    uint64_t nused;  /**< Ranuras ocupadas */
+} hashcache_header;
+
+/**
+ * @brief Entrada de la cache
+ */
+typedef struct {
+    uint64_t dev;       /**< Dispositivo */
+    uint64_t ino;       /**< Inodo */
+    uint64_t size;      /**< Tamano */
+    int64_t mtime_ns;   /**< Ultima modificacion */
+    int64_t ctime_ns;   /**< Ultimo cambio de estado */
+    int64_t hashed_at;  /**< Momento en que se leyo el archivo, 0 si esta libre */
+    uint8_t digest[32]; /**< Hash binario */
+    uint64_t check;     /**< Suma de verificacion de los campos anteriores */
+} hashcache_slot;
+
+/**
+ * @brief Cache abierta por el proceso
+ */
+static struct {
+    int fd;                   /**< Descriptor de la cache */
+    char path[PATH_MAX];      /**< Ruta de la cache */
+    hashcache_header *header; /**< Inicio del mapeo */
+    hashcache_slot *slots;    /**< Ranuras */
+    size_t map_size;          /**< Tamano del mapeo */
+} cache = {-1, "", NULL, NULL, 0};
+
+/**
+ * @brief Serializa el acceso de los hilos del proceso: grow reemplaza el
+ * mapeo, por lo que tambien las consultas deben excluirse con el.
+ * Entre procesos se usa flock sobre el archivo de la cache.
+ */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Suma de verificacion de una entrada (FNV-1a).
+ * Protege contra entradas escritas a medias por otro proceso.
+ */
+static uint64_t slot_check(const hashcache_slot *slot) {
+    const unsigned char *p = (const unsigned char *)slot;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < offsetof(hashcache_slot, check); i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t slot_key(uint64_t dev, uint64_t ino) {
+    uint64_t h = (dev * 0x9e3779b97f4a7c15ULL) ^ ino;
+    h ^= h >> 31;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 29;
+    return h;
+}
+
+static int64_t ts_ns(const struct timespec *ts) {
+    return (int64_t)ts->tv_sec * NS_PER_SEC + ts->tv_nsec;
+}
+
+/**
+ * @brief Mapea un archivo de cache con el numero de ranuras dado.
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int map_cache(int fd, uint64_t nslots, hashcache_header **header, size_t *map_size) {
+    void *map;
+
+    *map_size = sizeof(hashcache_header) + nslots * sizeof(hashcache_slot);
+    if (ftruncate(fd, *map_size) < 0) return -1;
+    map = mmap(NULL, *map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) return -1;
+    *header = map;
+    return 0;
+}
+
+/**
+ * @brief Ubica la ranura de un archivo, o la ranura libre en la que iria.
+ */
+static hashcache_slot *find_slot(hashcache_slot *slots, uint64_t nslots, uint64_t dev, uint64_t ino) {
+    uint64_t mask = nslots - 1;
+    uint64_t i;
+
+    for (i = slot_key(dev, ino) & mask; slots[i].hashed_at != 0; i = (i + 1) & mask) {
+        if (slots[i].dev == dev && slots[i].ino == ino) break;
+    }
+    return &slots[i];
+}
+
+/**
+ * @brief Duplica el numero de ranuras; la nueva cache reemplaza a la
+ * anterior mediante rename.
+ */
+static int grow(void) {
+    char tmp_path[PATH_MAX + 8];
+    hashcache_header *header;
+    hashcache_slot *slots;
+    size_t map_size;
+    uint64_t i;
+    int fd;
+
+    snprintf(tmp_path, sizeof tmp_path, "%s.tmp", cache.path);
+    if ((fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) return -1;
+    if (map_cache(fd, cache.header->nslots * 2, &header, &map_size) < 0) {
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    header->magic = HASHCACHE_MAGIC;
+    header->format = HASHCACHE_FORMAT;
+    header->nslots = cache.header->nslots * 2;
+    header->nused = 0;
+    slots = (hashcache_slot *)(header + 1);
+    for (i = 0; i < cache.header->nslots; i++) {
+        hashcache_slot *slot = &cache.slots[i];
+        if (slot->hashed_at != 0 && slot->check == slot_check(slot)) {
+            *find_slot(slots, header->nslots, slot->dev, slot->ino) = *slot;
+            header->nused++;
+        }
+    }
+
+    if (rename(tmp_path, cache.path) < 0) {
+        munmap(header, map_size);
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    munmap(cache.header, cache.map_size);
+    close(cache.fd);
+    cache.fd = fd;
+    cache.header = header;
+    cache.slots = slots;
+    cache.map_size = map_size;
+    return 0;
+}
+
+int hashcache_open(const char *path) {
+    hashcache_header h;
+    struct stat s;
+
+    if (cache.header != NULL) return 0;
+
+    if ((cache.fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) return -1;
+    snprintf(cache.path, PATH_MAX, "%s", path);
+
+    flock(cache.fd, LOCK_EX);
+    if (fstat(cache.fd, &s) == 0 && pread(cache.fd, &h, sizeof h, 0) == sizeof h
+            && h.magic == HASHCACHE_MAGIC && h.format == HASHCACHE_FORMAT
+            && h.nslots >= HASHCACHE_MIN_SLOTS && (h.nslots & (h.nslots - 1)) == 0
+            && (size_t)s.st_size == sizeof h + h.nslots * sizeof(hashcache_slot)) {
+        if (map_cache(cache.fd, h.nslots, &cache.header, &cache.map_size) < 0) cache.header = NULL;
+    } else if (ftruncate(cache.fd, 0) == 0
+            && map_cache(cache.fd, HASHCACHE_MIN_SLOTS, &cache.header, &cache.map_size) == 0) {
+        // Cache nueva o invalida: se crea vacia
+        cache.header->magic = HASHCACHE_MAGIC;
+        cache.header->format = HASHCACHE_FORMAT;
+        cache.header->nslots = HASHCACHE_MIN_SLOTS;
+        cache.header->nused = 0;
+    } else {
+        cache.header = NULL;
+    }
+    flock(cache.fd, LOCK_UN);
+
+    if (cache.header == NULL) {
+        close(cache.fd);
+        cache.fd = -1;
+        return -1;
+    }
+    cache.slots = (hashcache_slot *)(cache.header + 1);
+    return 0;
+}
+
+void hashcache_close(void) {
+    if (cache.header != NULL) munmap(cache.header, cache.map_size);
+    if (cache.fd >= 0) close(cache.fd);
+    cache.header = NULL;
+    cache.slots = NULL;
+    cache.fd = -1;
+}
+
+int64_t hashcache_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts_ns(&ts);
+}
+
+int hashcache_lookup(const struct stat *s, uint8_t *digest) {
+    hashcache_slot slot;
+
+    pthread_mutex_lock(&cache_lock);
+    if (cache.header == NULL) {
+        pthread_mutex_unlock(&cache_lock);
+        return -1;
+    }
+    slot = *find_slot(cache.slots, cache.header->nslots, s->st_dev, s->st_ino);
+    pthread_mutex_unlock(&cache_lock);
+
+    if (slot.hashed_at == 0 || slot.check != slot_check(&slot)) return -1;
+
+    // La firma debe coincidir por completo
+    if (slot.size != (uint64_t)s->st_size
+            || slot.mtime_ns != ts_ns(&s->st_mtim)
+            || slot.ctime_ns != ts_ns(&s->st_ctim)) {
+        return -1;
+    }
+
+    // Entrada "racy": el archivo cambio en el mismo segundo en que se leyo
+    if (slot.mtime_ns / NS_PER_SEC >= slot.hashed_at / NS_PER_SEC
+            || slot.ctime_ns / NS_PER_SEC >= slot.hashed_at / NS_PER_SEC) {
+        return -1;
+    }
+
+    memcpy(digest, slot.digest, sizeof slot.digest);
+    return 0;
+}
+
+void hashcache_store(const struct stat *s, const uint8_t *digest, int64_t hashed_at) {
+    hashcache_slot *slot;
+    hashcache_slot entry;
+
+    memset(&entry, 0, sizeof entry);
+    entry.dev = s->st_dev;
+    entry.ino = s->st_ino;
+    entry.size = s->st_size;
+    entry.mtime_ns = ts_ns(&s->st_mtim);
+    entry.ctime_ns = ts_ns(&s->st_ctim);
+    entry.hashed_at = hashed_at;
+    memcpy(entry.digest, digest, sizeof entry.digest);
+    entry.check = slot_check(&entry);
+
+    pthread_mutex_lock(&cache_lock);
+    if (cache.header == NULL) {
+        pthread_mutex_unlock(&cache_lock);
+        return;
+    }
+    flock(cache.fd, LOCK_EX);
+    slot = find_slot(cache.slots, cache.header->nslots, entry.dev, entry.ino);
+    if (slot->hashed_at == 0 && (cache.header->nused + 1) * 2 > cache.header->nslots) {
+        slot = grow() == 0 ? find_slot(cache.slots, cache.header->nslots, entry.dev, entry.ino) : NULL;
+    }
+    if (slot != NULL) {
+        if (slot->hashed_at == 0) cache.header->nused++;
+        *slot = entry;
+    }
+    flock(cache.fd, LOCK_UN);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+char *hashcache_file_hash(const char *filename, char *hash) {
+    struct stat s;
+    uint8_t digest[32];
+    int64_t hashed_at;
+    int fd, result;
+
+    if (stat(filename, &s) < 0 || !S_ISREG(s.st_mode)) return NULL;
+    if (hashcache_lookup(&s, digest) == 0) {
+        digest_to_hex(digest, hash);
+        return hash;
+    }
+
+    hashed_at = hashcache_now();
+    if ((fd = open(filename, O_RDONLY)) < 0) return NULL;
+    result = thash_content(fd, s.st_size, digest);
+    close(fd);
+    if (result < 0) return NULL;
+    hashcache_store(&s, digest, hashed_at);
+    digest_to_hex(digest, hash);
+    return hash;
+}
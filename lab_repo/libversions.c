@@ -0,0 +1,232 @@
+/**
+ * @file
+ * @brief Implementacion de la biblioteca libversions
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ */
+
+#include "libversions.h"
+#include "hashcache.h"
+#include "vbloom.h"
+#include "vdb.h"
+#include "vindex.h"
+#include "vpack.h"
+
+#include <errno.h>
+
+/**
+ * @brief Repositorio abierto
+ */
+struct repo {
+    int dir;              /**< Directorio del repositorio */
+    int cwd;              /**< Directorio actual del programa durante una operacion */
+    repo_options options; /**< Opciones de almacenamiento */
+};
+
+/** Repositorio abierto en el proceso, NULL si no hay ninguno */
+static repo *current = NULL;
+
+/**
+ * @brief Entra al directorio del repositorio para una operacion: las
+ * rutas de .versions y de los archivos son relativas a el.
+ * @return 0 en caso de exito, -1 si r no es el repositorio abierto o no se
+ * puede entrar a su directorio.
+ */
+static int enter(repo *r) {
+    if (r == NULL || r != current) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((r->cwd = open(".", O_RDONLY | O_DIRECTORY)) < 0) return -1;
+    if (fchdir(r->dir) < 0) {
+        close(r->cwd);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Vuelve al directorio actual del programa al terminar una
+ * operacion.
+ */
+static void leave(repo *r) {
+    if (fchdir(r->cwd) < 0) perror("fchdir");
+    close(r->cwd);
+}
+
+void repo_default_options(repo_options *options) {
+    options->delta_depth = 0;
+    options->chunking = 0;
+    options->compression = 1;
+}
+
+repo *repo_open(const char *path, const repo_options *options) {
+    repo *r;
+    int initialized;
+
+    if (current != NULL) {
+        errno = EBUSY;
+        return NULL;
+    }
+    if ((r = malloc(sizeof *r)) == NULL) return NULL;
+    if ((r->dir = open(path != NULL ? path : ".", O_RDONLY | O_DIRECTORY)) < 0) {
+        free(r);
+        return NULL;
+    }
+    current = r;
+    if (enter(r) < 0) {
+        close(r->dir);
+        free(r);
+        current = NULL;
+        return NULL;
+    }
+
+    if ((initialized = init_versions() == 0)) {
+        if (options != NULL) r->options = *options;
+        else repo_default_options(&r->options);
+        set_delta(r->options.delta_depth);
+        set_chunking(r->options.chunking);
+        set_compression(r->options.compression);
+
+        // La base de datos, el indice, el filtro y la cache de hashes se
+        // cargan una sola vez; sin indice (otro proceso lo esta
+        // actualizando) se usa el mapeo
+        vdb_map();
+        vindex_open();
+        bloom_open();
+        hashcache_open(HASHCACHE_PATH);
+    }
+    leave(r);
+
+    if (!initialized) {
+        close(r->dir);
+        free(r);
+        current = NULL;
+        return NULL;
+    }
+    return r;
+}
+
+void repo_close(repo *r) {
+    if (r == NULL || r != current) return;
+
+    vindex_close();
+    bloom_close();
+    vdb_unmap();
+    hashcache_close();
+    pack_unload();
+
+    close(r->dir);
+    free(r);
+    current = NULL;
+}
+
+return_code repo_add(repo *r, const char *filename, const char *comment) {
+    return_code result;
+
+    if (enter(r) < 0) return VERSION_ERROR;
+    result = add((char *)filename, (char *)comment);
+    leave(r);
+    return result;
+}
+
+return_code repo_add_files(repo *r, char **paths, int count, const char *comment, int *added, int *unchanged) {
+    return_code result;
+
+    if (enter(r) < 0) return VERSION_ERROR;
+    result = add_files(paths, count, (char *)comment, added, unchanged);
+    leave(r);
+    return result;
+}
+
+int repo_list(repo *r, const char *filename, version_visitor visit, void *ctx) {
+    int result;
+
+    if (enter(r) < 0) return -1;
+    result = list((char *)filename, visit, ctx);
+    leave(r);
+    return result;
+}
+
+return_code repo_lookup(repo *r, const char *filename, int version, file_version *v) {
+    int found;
+
+    if (enter(r) < 0) return VERSION_ERROR;
+    found = get_version(v, (char *)filename, version);
+    leave(r);
+    if (found < 0) return VERSION_ERROR;
+    return found == VERSION_OK ? VERSION_OK : VERSION_NOT_FOUND;
+}
+
+return_code repo_get(repo *r, const char *filename, int version, const char *destination) {
+    return_code result;
+
+    if (enter(r) < 0) return VERSION_ERROR;
+    result = get((char *)filename, version, (char *)destination);
+    leave(r);
+    return result;
+}
+
+return_code repo_commit(repo *r, const char *comment) {
+    return_code result;
+
+    if (enter(r) < 0) return VERSION_ERROR;
+    result = commit((char *)comment);
+    leave(r);
+    return result;
+}
+
+return_code repo_commit_changes(repo *r, int number, change_visitor visit, void *ctx) {
+    return_code result;
+
+    if (enter(r) < 0) return VERSION_ERROR;
+    result = commit_changes(number, visit, ctx);
+    leave(r);
+    return result;
+}
+
+int repo_status(repo *r, change_visitor visit, void *ctx) {
+    int result;
+
+    if (enter(r) < 0) return -1;
+    result = status(visit, ctx);
+    leave(r);
+    return result;
+}
+
+return_code repo_checkout(repo *r, int number) {
+    return_code result;
+
+    if (enter(r) < 0) return VERSION_ERROR;
+    result = checkout(number);
+    leave(r);
+    return result;
+}
+
+int repo_repack(repo *r) {
+    int result;
+
+    if (enter(r) < 0) return -1;
+    result = repack();
+    leave(r);
+    return result;
+}
+
+int repo_gc(repo *r, long budget, gc_report *report) {
+    int result;
+
+    if (enter(r) < 0) return -1;
+    result = gc_run(budget, report);
+    leave(r);
+    return result;
+}
+
+int repo_fsck(repo *r, double max_rate, fsck_report *report) {
+    int result;
+
+    if (enter(r) < 0) return -1;
+    result = fsck_run(0, max_rate, report);
+    leave(r);
+    return result;
+}
@@ -0,0 +1,227 @@
+/**
+ * @file
+ * @brief API de la biblioteca libversions
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * Permite usar un repositorio desde otro programa sin invocar el comando
+ * versions. repo_open abre el repositorio una sola vez: la base de datos
+ * queda mapeada, el indice y la cache de hashes cargados, y la ubicacion
+ * de los objetos leidos en cache. Las operaciones siguientes solo
+ * verifican si otro proceso modifico el repositorio, por lo que un
+ * programa que hace miles de operaciones no paga la apertura en cada una.
+ *
+ * Limitaciones (el contrato de la biblioteca):
+ *
+ * - Un solo repositorio abierto por proceso. El estado de la base de
+ *   datos, el indice, la cache de hashes y los paquetes es del proceso; un
+ *   segundo repo_open falla con EBUSY, y las operaciones con un repositorio
+ *   que no es el abierto fallan con EINVAL.
+ * - Las operaciones cambian el directorio actual del proceso mientras se
+ *   ejecutan: el repositorio guarda un descriptor de su directorio, cada
+ *   operacion entra en el con fchdir y al terminar vuelve al directorio
+ *   actual del programa. Entre operaciones el directorio actual es el del
+ *   programa. Por eso las operaciones se llaman desde un solo hilo, y
+ *   ningun otro hilo debe usar rutas relativas mientras se ejecutan.
+ * - Las rutas de los archivos, y el destino de repo_get, son relativas al
+ *   directorio del repositorio, no al directorio actual del programa.
+ *
+ * Ejemplo:
+ *
+ *      repo *r = repo_open("proyecto", NULL);
+ *      repo_add(r, "main.c", "Primera version");
+ *      repo_get(r, "main.c", 1, "/tmp/main.c");
+ *      repo_close(r);
+ */
+
+#ifndef LIBVERSIONS_H
+#define LIBVERSIONS_H
+
+#include "versions.h"
+#include "vfsck.h"
+#include "vgc.h"
+
+/**
+ * @brief Repositorio abierto
+ */
+typedef struct repo repo;
+
+/**
+ * @brief Opciones de almacenamiento de las versiones nuevas
+ */
+typedef struct {
+    int delta_depth; /**< Profundidad maxima de las cadenas de diferencias, 0 para desactivar el modo delta */
+    int chunking;    /**< 1 para guardar los archivos como bloques definidos por el contenido */
+    int compression; /**< 1 para comprimir los objetos nuevos */
+} repo_options;
+
+/**
+ * @brief Llena las opciones por defecto: sin diferencias ni bloques, con
+ * compresion.
+ *
+ * @param options Opciones
+ */
+void repo_default_options(repo_options *options);
+
+/**
+ * @brief Abre un repositorio, y lo crea si no existe.
+ *
+ * @param path Directorio del repositorio (el que contiene .versions), NULL
+ * para el directorio actual
+ * @param options Opciones, NULL para las opciones por defecto
+ *
+ * @return Repositorio abierto, NULL si ocurre un error o ya hay un
+ * repositorio abierto (errno EBUSY). El directorio actual del programa no
+ * cambia.
+ */
+repo *repo_open(const char *path, const repo_options *options);
+
+/**
+ * @brief Cierra un repositorio.
+ *
+ * @param r Repositorio
+ */
+void repo_close(repo *r);
+
+/**
+ * @brief Adiciona una version de un archivo.
+ *
+ * @param r Repositorio
+ * @param filename Archivo, relativo al repositorio
+ * @param comment Comentario
+ *
+ * @return VERSION_ADDED, VERSION_ALREADY_EXISTS o VERSION_ERROR.
+ */
+return_code repo_add(repo *r, const char *filename, const char *comment);
+
+/**
+ * @brief Adiciona varios archivos y directorios en lote (ver add_files).
+ *
+ * @param r Repositorio
+ * @param paths Archivos o directorios, relativos al repositorio
+ * @param count Numero de rutas
+ * @param comment Comentario
+ * @param added Versiones adicionadas (puede ser NULL)
+ * @param unchanged Archivos sin cambios (puede ser NULL)
+ *
+ * @return VERSION_ADDED, VERSION_ALREADY_EXISTS o VERSION_ERROR.
+ */
+return_code repo_add_files(repo *r, char **paths, int count, const char *comment, int *added, int *unchanged);
+
+/**
+ * @brief Recorre las versiones de un archivo, o todas las del repositorio.
+ *
+ * @param r Repositorio
+ * @param filename Archivo, NULL para todo el repositorio
+ * @param visit Funcion que recibe cada version
+ * @param ctx Contexto de visit
+ *
+ * @return Versiones recorridas, -1 si ocurre un error.
+ */
+int repo_list(repo *r, const char *filename, version_visitor visit, void *ctx);
+
+/**
+ * @brief Busca una version de un archivo sin recuperarla.
+ *
+ * @param r Repositorio
+ * @param filename Archivo
+ * @param version Numero de la version
+ * @param v Version encontrada
+ *
+ * @return VERSION_OK, VERSION_NOT_FOUND o VERSION_ERROR.
+ */
+return_code repo_lookup(repo *r, const char *filename, int version, file_version *v);
+
+/**
+ * @brief Recupera una version de un archivo.
+ *
+ * @param r Repositorio
+ * @param filename Archivo
+ * @param version Numero de la version
+ * @param destination Archivo de destino, NULL para sobreescribir el archivo
+ *
+ * @return FILE_ADDED, VERSION_NOT_FOUND o VERSION_ERROR.
+ */
+return_code repo_get(repo *r, const char *filename, int version, const char *destination);
+
+/**
+ * @brief Guarda el estado de todo el repositorio como un commit (ver
+ * commit). Los commits se recorren con repo_list(r, COMMIT_NAME, ...).
+ *
+ * @param r Repositorio
+ * @param comment Comentario
+ *
+ * @return VERSION_ADDED, VERSION_ALREADY_EXISTS o VERSION_ERROR.
+ */
+return_code repo_commit(repo *r, const char *comment);
+
+/**
+ * @brief Recorre los archivos que cambiaron en un commit.
+ *
+ * @param r Repositorio
+ * @param number Numero del commit
+ * @param visit Funcion que recibe cada cambio
+ * @param ctx Contexto de visit
+ *
+ * @return VERSION_OK, VERSION_NOT_FOUND o VERSION_ERROR.
+ */
+return_code repo_commit_changes(repo *r, int number, change_visitor visit, void *ctx);
+
+/**
+ * @brief Compara los archivos del repositorio con su ultima version (ver
+ * status).
+ *
+ * @param r Repositorio
+ * @param visit Funcion que recibe cada archivo
+ * @param ctx Contexto de visit
+ *
+ * @return Numero de archivos modificados, sin versiones o borrados, -1 si
+ * ocurre un error.
+ */
+int repo_status(repo *r, change_visitor visit, void *ctx);
+
+/**
+ * @brief Recupera todos los archivos de un commit, en paralelo.
+ *
+ * @param r Repositorio
+ * @param number Numero del commit
+ *
+ * @return FILE_ADDED, VERSION_NOT_FOUND o VERSION_ERROR.
+ */
+return_code repo_checkout(repo *r, int number);
+
+/**
+ * @brief Agrupa los objetos sueltos pequenos en un paquete.
+ *
+ * @param r Repositorio
+ *
+ * @return Numero de objetos agrupados, -1 si ocurre un error.
+ */
+int repo_repack(repo *r);
+
+/**
+ * @brief Continua la recoleccion de basura (ver gc_run).
+ *
+ * @param r Repositorio
+ * @param budget Registros o entradas de .versions a procesar (<= 0: GC_BUDGET)
+ * @param report Resultado de la ejecucion
+ *
+ * @return 1 si termino, 0 si queda trabajo pendiente, 2 si otro proceso
+ * esta ejecutando gc, -1 si ocurre un error.
+ */
+int repo_gc(repo *r, long budget, gc_report *report);
+
+/**
+ * @brief Verifica la integridad de los objetos y registros (ver fsck_run).
+ *
+ * @param r Repositorio
+ * @param max_rate Bytes por segundo a leer como maximo (<= 0: sin limite)
+ * @param report Resultado de la verificacion
+ *
+ * @return 0 si el repositorio esta integro, 1 si hay problemas, -1 si
+ * ocurre un error.
+ */
+int repo_fsck(repo *r, double max_rate, fsck_report *report);
+
+#endif
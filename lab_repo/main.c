@@ -7,17 +7,42 @@
  * Sistema de Control de Versiones
  * Uso: 
  *      versions add ARCHIVO "Comentario" : Adiciona una version del archivo al repositorio
+ *      versions add RUTA... "Comentario" : Adiciona archivos y directorios (recursivamente)
  *      versions list ARCHIVO             : Lista las versiones del archivo existentes
  *      versions list                     : Lista todos los archivos almacenados en el repositorio
  *      versions get NUMBER ARCHIVO       : Obtiene una version del archivo del repositorio
+ *      versions commit "Comentario"      : Guarda el estado de todo el directorio
+ *      versions list -c                  : Lista los commits
+ *      versions list -c NUMBER           : Lista los archivos que cambiaron en un commit
+ *      versions get -c NUMBER            : Recupera todos los archivos de un commit
+ *      versions status                   : Lista los archivos modificados (M), sin
+ *                                          versiones (?) y borrados (D) respecto a su
+ *                                          ultima version
+ *      versions repack                   : Agrupa los objetos pequenos en un paquete
+ *      versions gc [N]                   : Borra los objetos sin usar y compacta la base de
+ *                                          datos (hasta N objetos por ejecucion)
+ *      versions fsck [MB/s]              : Verifica la integridad de los objetos y registros
+ *                                          (leyendo a lo sumo MB/s megabytes por segundo)
+ * Opciones:
+ *      --chunk                           : Guarda los archivos como bloques definidos por el contenido
+ *      --delta[=N]                       : Guarda las versiones nuevas como diferencias
+ *                                          (cadenas de hasta N diferencias)
+ *      --no-compress                     : Guarda los objetos nuevos sin comprimir
+ *      --stats[=json]                    : Reporta el tiempo de cada fase, la E/S y el
+ *                                          throughput del hash (tambien con
+ *                                          VERSIONS_STATS=text|json; las lineas JSON se
+ *                                          adicionan a VERSIONS_STATS_FILE si existe)
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <libgen.h>
 
-#include "versions.h"
+#include "libversions.h"
+#include "vdelta.h"
+#include "vstats.h"
 
 /**
  * @brief Imprime la ayuda
@@ -32,26 +57,100 @@ void usage();
  */
 int isoncurrentdir(char* filepath);
 
+/**
+ * @brief Obtiene la ruta de un archivo o directorio relativa al directorio
+ * actual. Si el directorio del archivo ya no existe, la ruta se toma tal
+ * como fue escrita.
+ * @param path Ruta del archivo
+ * @param result Buffer de PATH_MAX bytes para la ruta relativa ("." para
+ * el directorio actual)
+ * @return 0 en caso de exito, -1 si la ruta esta fuera del directorio actual
+ */
+int relative_path(const char *path, char *result);
+
+/**
+ * @brief Verifica si una ruta es un directorio
+ * @param path Ruta
+ * @return 1 si es un directorio, 0 en caso contrario
+ */
+int is_directory(const char *path);
+
+/**
+ * @brief Imprime una version del repositorio
+ * @param ctx Sin uso
+ * @param e Version
+ * @return 0 para continuar el recorrido
+ */
+int print_version(void *ctx, const version_entry *e);
+
+/**
+ * @brief Imprime un archivo que cambio en un commit
+ * @param ctx Sin uso
+ * @param status 'A', 'M' o 'D'
+ * @param path Ruta del archivo
+ * @param digest Digest del contenido
+ * @return 0 para continuar el recorrido
+ */
+int print_change(void *ctx, char status, const char *path, const uint8_t *digest);
+
+/**
+ * @brief Imprime un archivo modificado, sin versiones o borrado
+ * @param ctx Sin uso
+ * @param status ' ', 'M', '?' o 'D'
+ * @param path Ruta del archivo
+ * @param digest Digest del contenido actual
+ * @return 0 para continuar el recorrido
+ */
+int print_status(void *ctx, char status, const char *path, const uint8_t *digest);
+
 int main(int argc, char *argv[]) {
-	struct stat s;
+	repo_options options;
+	repo *r;
 	int r_code;
+	int stats = getenv(STATS_ENV) != NULL ? stats_parse(getenv(STATS_ENV)) : STATS_OFF;
 
+	// Opciones generales, antes del comando
+	repo_default_options(&options);
+	while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+		if (EQUALS(argv[1], "--chunk")) {
+			options.chunking = 1;
+		} else if (EQUALS(argv[1], "--delta")) {
+			options.delta_depth = DELTA_DEFAULT_DEPTH;
+		} else if (strncmp(argv[1], "--delta=", 8) == 0 && atoi(argv[1] + 8) >= 0) {
+			options.delta_depth = atoi(argv[1] + 8);
+		} else if (EQUALS(argv[1], "--no-compress")) {
+			options.compression = 0;
+		} else if (EQUALS(argv[1], "--stats")) {
+			stats = STATS_TEXT;
+		} else if (strncmp(argv[1], "--stats=", 8) == 0 && stats_parse(argv[1] + 8) >= 0) {
+			stats = stats_parse(argv[1] + 8);
+		} else {
+			usage();
+			exit(EXIT_FAILURE);
+		}
+		argv[1] = argv[0];
+		argv++;
+		argc--;
+	}
 
-	//Crear el directorio ".versions/" si no existe
-#ifdef __linux__
-	mkdir(VERSIONS_DIR, 0755);
-#elif _WIN32
-	mkdir(VERSIONS_DIR);
-#endif
+	// El reporte se emite al terminar, tambien si el comando falla
+	if (stats < 0) {
+		fprintf(stderr, "Valor invalido en %s\n", STATS_ENV);
+		stats = STATS_OFF;
+	}
+	if (argc > 1) stats_enable(stats, argv[1]);
 
-	// Crea el archivo .versions/versions.db si no existe
-	if (stat(VERSIONS_DB_PATH, &s) != 0) {
-		creat(VERSIONS_DB_PATH, 0755);
+	// Crea el repositorio (.versions/versions.db) si no existe
+	if ((r = repo_open(NULL, &options)) == NULL) {
+		fprintf(stderr, "No se puede abrir el repositorio %s\n", VERSIONS_DB_PATH);
+		exit(EXIT_FAILURE);
 	}
 
 	// Validar argumentos de linea de comandos
 	if (argc == 4
-			&& EQUALS(argv[1], "add")) {
+			&& EQUALS(argv[1], "add")
+			&& strchr(argv[2], '/') == NULL
+			&& !is_directory(argv[2])) {
 		char *filename = basename(argv[2]);
 		// Verifica si se trata de aniadir un archivo de otro directorio
 		if (!isoncurrentdir(argv[2])) {
@@ -60,31 +159,95 @@ int main(int argc, char *argv[]) {
 		}
 
 		// Aniade archivos del repositorio actual
-		r_code = add(filename, argv[3]);
+		r_code = repo_add(r, filename, argv[3]);
 		if (r_code == VERSION_ERROR) {
 		    fprintf(stderr, "No se puede adicionar %s\n", filename);
 		} else if (r_code == VERSION_ALREADY_EXISTS) {
 		    fprintf(stdout, "La version ya existe\n");
 		}
+	}else if (argc >= 4
+			&& EQUALS(argv[1], "add")) {
+		int count = argc - 3;
+		char **paths = malloc(count * sizeof *paths);
+		char rel[PATH_MAX];
+		int i, added, unchanged;
+
+		// Varios archivos, directorios o archivos de subdirectorios
+		for (i = 0; paths != NULL && i < count; i++) {
+			if (relative_path(argv[i + 2], rel) < 0) {
+				fprintf(stderr, "Solo es posible adicionar archivos de este directorio\n");
+				exit(EXIT_FAILURE);
+			}
+			paths[i] = strdup(rel);
+		}
+		r_code = paths != NULL ? repo_add_files(r, paths, count, argv[argc - 1], &added, &unchanged) : VERSION_ERROR;
+		if (paths != NULL) printf("%d versiones adicionadas, %d sin cambios\n", added, unchanged);
+		if (r_code == VERSION_ERROR) {
+			exit(EXIT_FAILURE);
+		}
+	}else if (argc == 3
+			&& EQUALS(argv[1], "commit")) {
+		//Guarda el estado de todo el directorio
+		r_code = repo_commit(r, argv[2]);
+		if (r_code == VERSION_ERROR) {
+		    fprintf(stderr, "No se puede crear el commit\n");
+			exit(EXIT_FAILURE);
+		} else if (r_code == VERSION_ALREADY_EXISTS) {
+		    fprintf(stdout, "No hay cambios desde el ultimo commit\n");
+		}
+	}else if (argc == 3
+			&& EQUALS(argv[1], "list") && EQUALS(argv[2], "-c")) {
+		//Lista los commits
+		repo_list(r, COMMIT_NAME, print_version, NULL);
+	}else if (argc == 4
+			&& EQUALS(argv[1], "list") && EQUALS(argv[2], "-c")) {
+		//Lista los archivos que cambiaron en un commit
+		int number = atoi(argv[3]);
+		r_code = number > 0 ? repo_commit_changes(r, number, print_change, NULL) : VERSION_NOT_FOUND;
+		if (r_code != VERSION_OK) {
+		    fprintf(stderr, "No se puede leer el commit %s\n", argv[3]);
+			exit(EXIT_FAILURE);
+		}
+	}else if (argc == 4
+			&& EQUALS(argv[1], "get") && EQUALS(argv[2], "-c")) {
+		//Recupera todos los archivos de un commit
+		int number = atoi(argv[3]);
+		r_code = number > 0 ? repo_checkout(r, number) : VERSION_NOT_FOUND;
+		if (r_code == VERSION_ERROR) {
+		    fprintf(stderr, "No se puede obtener el commit %d\n", number);
+			exit(EXIT_FAILURE);
+		} else if (r_code == VERSION_NOT_FOUND) {
+		    fprintf(stderr, "No se encontro el commit %s\n", argv[3]);
+			exit(EXIT_FAILURE);
+		}
+	}else if (argc == 2
+			&& EQUALS(argv[1], "status")) {
+		//Compara el directorio con la ultima version de cada archivo
+		if (repo_status(r, print_status, NULL) < 0) {
+		    fprintf(stderr, "No se puede leer el directorio\n");
+			exit(EXIT_FAILURE);
+		}
 	}else if (argc == 2
 			&& EQUALS(argv[1], "list")) {
 		//Listar todos los archivos almacenados en el repositorio
-		list(NULL);
+		repo_list(r, NULL, print_version, NULL);
 	}else if (argc == 3
 			&& EQUALS(argv[1], "list")) {
 		//Listar el archivo solicitado
-		char *filename = basename(argv[2]);
-		list(filename);
+		char rel[PATH_MAX];
+		char *filename = relative_path(argv[2], rel) == 0 ? rel : basename(argv[2]);
+		repo_list(r, filename, print_version, NULL);
 	}else if (argc == 4
 			&& EQUALS(argv[1], "get")) {
 		int version = atoi(argv[2]);
-		char *filename = basename(argv[3]);
+		char rel[PATH_MAX];
+		char *filename = relative_path(argv[3], rel) == 0 ? rel : basename(argv[3]);
 		if (version <= 0) {
 		    fprintf(stderr, "Numero de version invalido\n");
 			exit(EXIT_FAILURE);
 		}
 		//Obtiene la version especificada de un archivo
-		r_code = get(filename, version);
+		r_code = repo_get(r, filename, version, NULL);
 		if (r_code == VERSION_ERROR) {
 		    fprintf(stderr, "No se puede obtener la version %d de %s\n", version, filename);
 			exit(EXIT_FAILURE);
@@ -92,10 +255,54 @@ int main(int argc, char *argv[]) {
 		    fprintf(stderr, "No se encontro la version %d de %s\n", version, filename);
 			exit(EXIT_FAILURE);
 		}
+	}else if (argc == 2
+			&& EQUALS(argv[1], "repack")) {
+		//Agrupa los objetos sueltos pequenos en un paquete
+		int packed = repo_repack(r);
+		if (packed < 0) {
+		    fprintf(stderr, "No se pueden agrupar los objetos\n");
+			exit(EXIT_FAILURE);
+		}
+		printf("%d objetos agrupados\n", packed);
+	}else if ((argc == 2 || argc == 3)
+			&& EQUALS(argv[1], "gc")) {
+		//Avanza la recoleccion de basura; se continua en la siguiente ejecucion
+		gc_report report;
+		r_code = repo_gc(r, argc == 3 ? atol(argv[2]) : 0, &report);
+		if (r_code < 0) {
+		    fprintf(stderr, "No se puede completar la recoleccion de basura\n");
+			exit(EXIT_FAILURE);
+		} else if (r_code == 2) {
+		    fprintf(stderr, "Otro proceso esta ejecutando gc\n");
+			exit(EXIT_FAILURE);
+		}
+		printf("%ld registros marcados, %ld objetos revisados, %ld objetos borrados, "
+		       "%ld paquetes borrados, %ld registros duplicados eliminados\n",
+		       report.marked, report.swept, report.removed, report.packs, report.compacted);
+		printf(r_code == 1 ? "Recoleccion completa\n" : "Recoleccion pendiente: ejecute de nuevo versions gc\n");
+	}else if ((argc == 2 || argc == 3)
+			&& EQUALS(argv[1], "fsck")) {
+		//Verifica los objetos en paralelo, con la tasa de lectura limitada
+		fsck_report report;
+		double rate = argc == 3 ? atof(argv[2]) * 1e6 : 0;
+		r_code = repo_fsck(r, rate, &report);
+		if (r_code < 0) {
+		    fprintf(stderr, "No se puede verificar el repositorio\n");
+			exit(EXIT_FAILURE);
+		}
+		printf("%ld objetos verificados, %ld danados, %ld registros verificados, %ld sin objeto valido\n",
+		       report.objects, report.corrupt, report.records, report.missing);
+		printf("%.1f MB en %.2f s (%.1f MB/s)\n", report.bytes / 1e6, report.seconds,
+		       report.seconds > 0 ? report.bytes / 1e6 / report.seconds : 0.0);
+		if (r_code == 1) {
+			repo_close(r);
+			exit(EXIT_FAILURE);
+		}
 	}else {
 		usage();
 	}
 
+	repo_close(r);
 	exit(EXIT_SUCCESS);
 
 }
@@ -109,10 +316,95 @@ int isoncurrentdir(char* filepath) {
 	return 0;
 }
 
+int relative_path(const char *path, char *result) {
+	char cwd[PATH_MAX], dir[PATH_MAX], base[PATH_MAX], real[PATH_MAX];
+	const char *rel;
+	size_t len;
+
+	if (realpath(".", cwd) == NULL) return -1;
+	len = strlen(cwd);
+
+	// Los directorios se resuelven completos; los archivos por su directorio,
+	// para no seguir enlaces simbolicos
+	snprintf(dir, PATH_MAX, "%s", path);
+	snprintf(base, PATH_MAX, "%s", path);
+	if (is_directory(path)) {
+		if (realpath(path, real) == NULL) return -1;
+		base[0] = 0;
+	} else if (realpath(dirname(dir), real) != NULL) {
+		memmove(base, basename(base), strlen(basename(base)) + 1);
+	} else {
+		// El directorio ya no existe (p.e. get de un subdirectorio borrado)
+		for (rel = path; strncmp(rel, "./", 2) == 0; rel += 2);
+		if (path[0] == '/' || strstr(rel, "..") != NULL) return -1;
+		snprintf(result, PATH_MAX, "%s", rel);
+		return 0;
+	}
+
+	if (EQUALS(real, cwd)) rel = "";
+	else if (strncmp(real, cwd, len) == 0 && real[len] == '/') rel = real + len + 1;
+	else return -1;
+
+	if (rel[0] == 0 && base[0] == 0) snprintf(result, PATH_MAX, ".");
+	else if (rel[0] == 0 || base[0] == 0) snprintf(result, PATH_MAX, "%s%s", rel, base);
+	else snprintf(result, PATH_MAX, "%s/%s", rel, base);
+	return 0;
+}
+
+int is_directory(const char *path) {
+	struct stat s;
+	return stat(path, &s) == 0 && S_ISDIR(s.st_mode);
+}
+
+int print_version(void *ctx, const version_entry *e) {
+	char hash[2 * DIGEST_SIZE + 1];
+	(void)ctx;
+	digest_to_hex(e->digest, hash);
+	if (e->number > 0) printf("%i ", e->number);
+	printf("%.*s %.3s...%.3s %.*s\n", e->filename_len, e->filename, hash,
+	       hash + 2 * DIGEST_SIZE - 3, e->comment_len, e->comment);
+	return 0;
+}
+
+int print_change(void *ctx, char status, const char *path, const uint8_t *digest) {
+	char hash[2 * DIGEST_SIZE + 1];
+	(void)ctx;
+	digest_to_hex(digest, hash);
+	printf("%c %s %.3s...%.3s\n", status, path, hash, hash + 2 * DIGEST_SIZE - 3);
+	return 0;
+}
+
+int print_status(void *ctx, char status, const char *path, const uint8_t *digest) {
+	(void)ctx;
+	(void)digest;
+	if (status != ' ') printf("%c %s\n", status, path);
+	return 0;
+}
+
 void usage() {
 	printf("Uso: \n");
 	printf("versions add ARCHIVO \"Comentario\" : Adiciona una version del archivo al repositorio\n");
+	printf("versions add RUTA... \"Comentario\" : Adiciona archivos y directorios (recursivamente)\n");
 	printf("versions list ARCHIVO             : Lista las versiones del archivo existentes\n");
 	printf("versions list                     : Lista todos los archivos almacenados en el repositorio\n");
 	printf("versions get NUMBER ARCHIVO       : Obtiene una version del archivo del repositorio\n");
+	printf("versions commit \"Comentario\"      : Guarda el estado de todo el directorio\n");
+	printf("versions list -c                  : Lista los commits\n");
+	printf("versions list -c NUMBER           : Lista los archivos que cambiaron en un commit\n");
+	printf("versions get -c NUMBER            : Recupera todos los archivos de un commit\n");
+	printf("versions status                   : Lista los archivos modificados (M), sin\n");
+	printf("                                    versiones (?) y borrados (D) respecto a su\n");
+	printf("                                    ultima version\n");
+	printf("versions repack                   : Agrupa los objetos pequenos en un paquete\n");
+	printf("versions gc [N]                   : Borra los objetos sin usar y compacta la base de\n");
+	printf("                                    datos (hasta N objetos por ejecucion, por defecto %d)\n", GC_BUDGET);
+	printf("versions fsck [MB/s]              : Verifica la integridad de los objetos y registros\n");
+	printf("                                    (leyendo a lo sumo MB/s megabytes por segundo)\n");
+	printf("Opciones (antes del comando):\n");
+	printf("--chunk                           : Guarda los archivos como bloques definidos por\n");
+	printf("                                    el contenido, compartidos entre versiones y archivos\n");
+	printf("--delta[=N]                       : Guarda las versiones nuevas como diferencias\n");
+	printf("                                    contra la anterior (cadenas de hasta N, por defecto %d)\n", DELTA_DEFAULT_DEPTH);
+	printf("--no-compress                     : Guarda los objetos nuevos sin comprimir\n");
+	printf("--stats[=json]                    : Reporta el tiempo de cada fase, la E/S y el throughput del hash\n");
 }
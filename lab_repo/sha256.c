@@ -55,45 +55,283 @@ const static uint32_t k[64] = {
 
 #define rotate_r(val, bits) (val >> bits | val << (32 - bits))
 
-static void sha256_calc_chunk(struct sha256_buff* buff, const uint8_t* chunk) {
+/* Portable block function, used as fallback and as reference for the other kernels */
+static void sha256_blocks_scalar(uint32_t* h, const uint8_t* chunk, size_t nblocks) {
 	uint32_t w[64];
 	uint32_t tv[8];
 	uint32_t i;
 
-	for (i=0; i<16; ++i){
-		w[i] = (uint32_t) chunk[0] << 24 | (uint32_t) chunk[1] << 16 | (uint32_t) chunk[2] << 8 | (uint32_t) chunk[3];
-		chunk += 4;
+	for (; nblocks > 0; --nblocks) {
+		for (i=0; i<16; ++i){
+			w[i] = (uint32_t) chunk[0] << 24 | (uint32_t) chunk[1] << 16 | (uint32_t) chunk[2] << 8 | (uint32_t) chunk[3];
+			chunk += 4;
+		}
+
+		for (i=16; i<64; ++i){
+			uint32_t s0 = rotate_r(w[i-15], 7) ^ rotate_r(w[i-15], 18) ^ (w[i-15] >> 3);
+			uint32_t s1 = rotate_r(w[i-2], 17) ^ rotate_r(w[i-2], 19) ^ (w[i-2] >> 10);
+			w[i] = w[i-16] + s0 + w[i-7] + s1;
+		}
+
+		for (i = 0; i < 8; ++i)
+			tv[i] = h[i];
+
+		for (i=0; i<64; ++i){
+			uint32_t S1 = rotate_r(tv[4], 6) ^ rotate_r(tv[4], 11) ^ rotate_r(tv[4], 25);
+			uint32_t ch = (tv[4] & tv[5]) ^ (~tv[4] & tv[6]);
+			uint32_t temp1 = tv[7] + S1 + ch + k[i] + w[i];
+			uint32_t S0 = rotate_r(tv[0], 2) ^ rotate_r(tv[0], 13) ^ rotate_r(tv[0], 22);
+			uint32_t maj = (tv[0] & tv[1]) ^ (tv[0] & tv[2]) ^ (tv[1] & tv[2]);
+			uint32_t temp2 = S0 + maj;
+
+			tv[7] = tv[6];
+			tv[6] = tv[5];
+			tv[5] = tv[4];
+			tv[4] = tv[3] + temp1;
+			tv[3] = tv[2];
+			tv[2] = tv[1];
+			tv[1] = tv[0];
+			tv[0] = temp1 + temp2;
+		}
+
+		for (i = 0; i < 8; ++i)
+			h[i] += tv[i];
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+
+/* Compression rounds over a precomputed schedule with the constants already added (w[i] + k[i]) */
+static inline void sha256_rounds_wk(uint32_t* h, const uint32_t* wk) {
+	uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+	uint32_t i;
+
+	for (i = 0; i < 64; ++i) {
+		uint32_t temp1 = hh + (rotate_r(e, 6) ^ rotate_r(e, 11) ^ rotate_r(e, 25)) + ((e & f) ^ (~e & g)) + wk[i];
+		uint32_t temp2 = (rotate_r(a, 2) ^ rotate_r(a, 13) ^ rotate_r(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		hh = g;
+		g = f;
+		f = e;
+		e = d + temp1;
+		d = c;
+		c = b;
+		b = a;
+		a = temp1 + temp2;
+	}
+
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+	h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+/* Message schedule step shared by the SSSE3 and AVX2 kernels: computes w[t..t+3] from
+   x0 = w[t-16..t-13], x1 = w[t-12..t-9], x2 = w[t-8..t-5], x3 = w[t-4..t-1].
+   AVX2 runs the same step on two blocks at once, one per 128-bit lane. */
+#define SHA256_ROR(V, n, SRL, SLL, OR) OR(SRL(V, n), SLL(V, 32 - (n)))
+#define SHA256_SCHEDULE(T, ADD, XOR, OR, SRL, SLL, BSRL, BSLL, ALIGNR, x0, x1, x2, x3, out) do { \
+	T w15 = ALIGNR(x1, x0, 4); \
+	T w7 = ALIGNR(x3, x2, 4); \
+	T s0 = XOR(XOR(SHA256_ROR(w15, 7, SRL, SLL, OR), SHA256_ROR(w15, 18, SRL, SLL, OR)), SRL(w15, 3)); \
+	T lo = BSRL(x3, 8); \
+	T s1 = XOR(XOR(SHA256_ROR(lo, 17, SRL, SLL, OR), SHA256_ROR(lo, 19, SRL, SLL, OR)), SRL(lo, 10)); \
+	T hi; \
+	out = ADD(ADD(x0, w7), ADD(s0, s1)); \
+	hi = BSLL(out, 8); \
+	s1 = XOR(XOR(SHA256_ROR(hi, 17, SRL, SLL, OR), SHA256_ROR(hi, 19, SRL, SLL, OR)), SRL(hi, 10)); \
+	out = ADD(out, s1); \
+} while (0)
+
+__attribute__((target("ssse3")))
+static void sha256_blocks_ssse3(uint32_t* h, const uint8_t* chunk, size_t nblocks) {
+	const __m128i bswap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	uint32_t wk[64] __attribute__((aligned(16)));
+	__m128i x[4];
+	uint32_t i;
+
+	for (; nblocks > 0; --nblocks, chunk += 64) {
+		for (i = 0; i < 4; ++i) {
+			x[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 16*i)), bswap);
+			_mm_store_si128((__m128i*)&wk[4*i], _mm_add_epi32(x[i], _mm_loadu_si128((const __m128i*)&k[4*i])));
+		}
+		for (i = 4; i < 16; ++i) {
+			__m128i w;
+			SHA256_SCHEDULE(__m128i, _mm_add_epi32, _mm_xor_si128, _mm_or_si128, _mm_srli_epi32, _mm_slli_epi32,
+				_mm_srli_si128, _mm_slli_si128, _mm_alignr_epi8, x[i & 3], x[(i+1) & 3], x[(i+2) & 3], x[(i+3) & 3], w);
+			x[i & 3] = w;
+			_mm_store_si128((__m128i*)&wk[4*i], _mm_add_epi32(w, _mm_loadu_si128((const __m128i*)&k[4*i])));
+		}
+		sha256_rounds_wk(h, wk);
+	}
+}
+
+__attribute__((target("avx2")))
+static void sha256_blocks_avx2(uint32_t* h, const uint8_t* chunk, size_t nblocks) {
+	const __m256i bswap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+		12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	uint32_t wk[2][64] __attribute__((aligned(32)));
+	__m256i x[4];
+	uint32_t i;
+
+	/* Two blocks per iteration: the schedules run in parallel, the rounds are serial */
+	for (; nblocks >= 2; nblocks -= 2, chunk += 128) {
+		for (i = 0; i < 16; ++i) {
+			__m256i kk = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)&k[4*i]));
+			__m256i w;
+			if (i < 4) {
+				w = _mm256_set_m128i(_mm_loadu_si128((const __m128i*)(chunk + 64 + 16*i)),
+					_mm_loadu_si128((const __m128i*)(chunk + 16*i)));
+				w = _mm256_shuffle_epi8(w, bswap);
+			} else {
+				SHA256_SCHEDULE(__m256i, _mm256_add_epi32, _mm256_xor_si256, _mm256_or_si256, _mm256_srli_epi32, _mm256_slli_epi32,
+					_mm256_bsrli_epi128, _mm256_bslli_epi128, _mm256_alignr_epi8, x[i & 3], x[(i+1) & 3], x[(i+2) & 3], x[(i+3) & 3], w);
+			}
+			x[i & 3] = w;
+			w = _mm256_add_epi32(w, kk);
+			_mm_store_si128((__m128i*)&wk[0][4*i], _mm256_castsi256_si128(w));
+			_mm_store_si128((__m128i*)&wk[1][4*i], _mm256_extracti128_si256(w, 1));
+		}
+		sha256_rounds_wk(h, wk[0]);
+		sha256_rounds_wk(h, wk[1]);
+	}
+
+	if (nblocks > 0)
+		sha256_blocks_ssse3(h, chunk, nblocks);
+}
+
+/* Four rounds with the SHA extensions; msg[g & 3] holds w[4g..4g+3] */
+#define SHANI_QUAD(g) do { \
+	__m128i m = _mm_add_epi32(msg[(g) & 3], _mm_loadu_si128((const __m128i*)&k[4*(g)])); \
+	state1 = _mm_sha256rnds2_epu32(state1, state0, m); \
+	if ((g) >= 3 && (g) <= 14) { \
+		msg[((g)+1) & 3] = _mm_add_epi32(msg[((g)+1) & 3], _mm_alignr_epi8(msg[(g) & 3], msg[((g)-1) & 3], 4)); \
+		msg[((g)+1) & 3] = _mm_sha256msg2_epu32(msg[((g)+1) & 3], msg[(g) & 3]); \
+	} \
+	state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(m, 0x0E)); \
+	if ((g) >= 1 && (g) <= 12) \
+		msg[((g)-1) & 3] = _mm_sha256msg1_epu32(msg[((g)-1) & 3], msg[(g) & 3]); \
+} while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_shani(uint32_t* h, const uint8_t* chunk, size_t nblocks) {
+	const __m128i bswap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	__m128i state0, state1, tmp, abef, cdgh;
+	__m128i msg[4];
+
+	/* The SHA instructions expect the state as ABEF / CDGH */
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&h[0]), 0xB1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&h[4]), 0x1B);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+	for (; nblocks > 0; --nblocks, chunk += 64) {
+		abef = state0;
+		cdgh = state1;
+
+		msg[0] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 0)), bswap);
+		msg[1] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 16)), bswap);
+		msg[2] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 32)), bswap);
+		msg[3] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 48)), bswap);
+
+		SHANI_QUAD(0); SHANI_QUAD(1); SHANI_QUAD(2); SHANI_QUAD(3);
+		SHANI_QUAD(4); SHANI_QUAD(5); SHANI_QUAD(6); SHANI_QUAD(7);
+		SHANI_QUAD(8); SHANI_QUAD(9); SHANI_QUAD(10); SHANI_QUAD(11);
+		SHANI_QUAD(12); SHANI_QUAD(13); SHANI_QUAD(14); SHANI_QUAD(15);
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
 	}
 
-	for (i=16; i<64; ++i){
-		uint32_t s0 = rotate_r(w[i-15], 7) ^ rotate_r(w[i-15], 18) ^ (w[i-15] >> 3);
-		uint32_t s1 = rotate_r(w[i-2], 17) ^ rotate_r(w[i-2], 19) ^ (w[i-2] >> 10);
-		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	_mm_storeu_si128((__m128i*)&h[0], _mm_blend_epi16(tmp, state1, 0xF0));
+	_mm_storeu_si128((__m128i*)&h[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+static int cpu_has_ssse3(void) {
+	unsigned int a, b, c, d;
+	return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSSE3);
+}
+
+static int cpu_has_shani(void) {
+	unsigned int a, b, c, d;
+	if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSSE3) || !(c & bit_SSE4_1))
+		return 0;
+	return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_SHA);
+}
+
+static int cpu_has_avx2(void) {
+	unsigned int a, b, c, d, xcr0_lo, xcr0_hi;
+	if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_OSXSAVE) || !(c & bit_AVX))
+		return 0;
+	/* The OS must save the YMM registers on context switches */
+	__asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+	if ((xcr0_lo & 6) != 6)
+		return 0;
+	return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_AVX2);
+}
+#endif
+
+typedef void (*sha256_blocks_fn)(uint32_t* h, const uint8_t* chunk, size_t nblocks);
+
+static const struct {
+	const char* name;
+	sha256_blocks_fn blocks;
+	int (*supported)(void);
+} kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+	{"sha-ni", sha256_blocks_shani, cpu_has_shani},
+	{"avx2", sha256_blocks_avx2, cpu_has_avx2},
+	{"ssse3", sha256_blocks_ssse3, cpu_has_ssse3},
+#endif
+	{"scalar", sha256_blocks_scalar, NULL},
+};
+
+#define NKERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static sha256_blocks_fn sha256_blocks = sha256_blocks_scalar;
+static const char* sha256_kernel_name = "scalar";
+
+int sha256_set_kernel(const char* name) {
+	size_t i;
+	for (i = 0; i < NKERNELS; ++i) {
+		if (strcmp(kernels[i].name, name) != 0)
+			continue;
+		if (kernels[i].supported != NULL && !kernels[i].supported())
+			return -1;
+		sha256_blocks = kernels[i].blocks;
+		sha256_kernel_name = kernels[i].name;
+		return 0;
 	}
+	return -1;
+}
+
+const char* sha256_kernel(void) {
+	return sha256_kernel_name;
+}
+
+const char* sha256_kernel_at(size_t i) {
+	return i < NKERNELS ? kernels[i].name : NULL;
+}
+
+/* Picks the fastest kernel supported by the CPU when the program starts, with
+   CPUID only (test_sha256 checks every kernel against the scalar code).
+   SHA256_KERNEL in the environment forces a specific one. */
+__attribute__((constructor))
+static void sha256_select_kernel(void) {
+	const char* forced = getenv("SHA256_KERNEL");
+	size_t i;
 
-	for (i = 0; i < 8; ++i)
-		tv[i] = buff->h[i];
-
-	for (i=0; i<64; ++i){
-		uint32_t S1 = rotate_r(tv[4], 6) ^ rotate_r(tv[4], 11) ^ rotate_r(tv[4], 25);
-		uint32_t ch = (tv[4] & tv[5]) ^ (~tv[4] & tv[6]);
-		uint32_t temp1 = tv[7] + S1 + ch + k[i] + w[i];
-		uint32_t S0 = rotate_r(tv[0], 2) ^ rotate_r(tv[0], 13) ^ rotate_r(tv[0], 22);
-		uint32_t maj = (tv[0] & tv[1]) ^ (tv[0] & tv[2]) ^ (tv[1] & tv[2]);
-		uint32_t temp2 = S0 + maj;
-
-		tv[7] = tv[6];
-		tv[6] = tv[5];
-		tv[5] = tv[4];
-		tv[4] = tv[3] + temp1;
-		tv[3] = tv[2];
-		tv[2] = tv[1];
-		tv[1] = tv[0];
-		tv[0] = temp1 + temp2;
+	if (forced != NULL && sha256_set_kernel(forced) == 0)
+		return;
+	for (i = 0; i < NKERNELS; ++i) {
+		if (sha256_set_kernel(kernels[i].name) == 0)
+			return;
 	}
+}
 
-	for (i = 0; i < 8; ++i)
-		buff->h[i] += tv[i];
+static void sha256_calc_chunk(struct sha256_buff* buff, const uint8_t* chunk) {
+	sha256_blocks(buff->h, chunk, 1);
 }
 
 void sha256_update(struct sha256_buff* buff, const void* data, size_t size) {
@@ -110,10 +348,10 @@ void sha256_update(struct sha256_buff* buff, const void* data, size_t size) {
 		sha256_calc_chunk(buff, tmp_chunk);
 	}
 	/* Run over data chunks */
-	while (size  >= 64) {
-		sha256_calc_chunk(buff, ptr);
-		ptr += 64;
-		size -= 64; 
+	if (size >= 64) {
+		sha256_blocks(buff->h, ptr, size / 64);
+		ptr += size & ~(size_t)63;
+		size &= 63;
 	}
 
 	/* Save remaining data in buff, will be reused on next call or finalize */
@@ -0,0 +1,79 @@
+#!/bin/sh
+# @file
+# @brief Prueba de los commits
+# @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+# @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+# @copyright MIT License
+#
+# Uso: test_commit.sh [DIRECTORIO]
+#
+# - Un archivo grande (digest de arbol) guardado en un commit no se vuelve
+#   a leer ni a guardar en el siguiente: su digest queda en la cache.
+# - Un commit de un arbol con archivos modificados y borrados solo guarda
+#   los objetos nuevos: los subdirectorios sin cambios reutilizan su arbol
+#   y list -c solo muestra lo que cambio. get -c recupera el commit
+#   anterior igual a una copia del directorio (diff -r).
+
+VERSIONS="$(cd "$(dirname "$0")" && pwd)/versions"
+DIR=${1:-/tmp/versions-test-commit}
+FAILED=0
+
+# Cuenta los objetos y archivos del repositorio
+count_objects() {
+    find .versions -type f | wc -l
+}
+
+rm -rf "$DIR"
+mkdir -p "$DIR/grande" "$DIR/arbol" && cd "$DIR/grande" || exit 1
+
+# Archivo grande: el segundo commit no lee nada. Los archivos deben ser de
+# un segundo anterior al commit para que la cache confie en ellos
+head -c 80M /dev/urandom >big
+echo pequeno >small
+sleep 1
+"$VERSIONS" commit "uno" >/dev/null || FAILED=1
+objects=$(count_objects)
+stats=$(VERSIONS_STATS=text "$VERSIONS" commit "dos" 2>&1)
+echo "$stats" | grep -q "No hay cambios" || { echo "big: el segundo commit tiene cambios"; FAILED=1; }
+if echo "$stats" | grep -q "hash:"; then
+    echo "big: el segundo commit leyo el archivo grande"
+    FAILED=1
+fi
+[ "$(count_objects)" -eq "$objects" ] || { echo "big: el segundo commit guardo objetos"; FAILED=1; }
+"$VERSIONS" fsck >/dev/null || { echo "fsck: el repositorio tiene errores"; FAILED=1; }
+
+# Arbol: igual/ (con un subdirectorio) no cambia entre los commits
+cd "$DIR/arbol" || exit 1
+mkdir -p igual/sub cambia
+echo a >igual/a
+echo b >igual/sub/b
+echo x1 >cambia/x
+echo y >cambia/y
+echo raiz >raiz
+sleep 1
+"$VERSIONS" commit "uno" >/dev/null || FAILED=1
+mkdir "$DIR/copia" && cp -r igual cambia raiz "$DIR/copia" || FAILED=1
+objects=$(count_objects)
+
+echo x2 >cambia/x
+rm raiz
+sleep 1
+"$VERSIONS" commit "dos" >/dev/null || FAILED=1
+
+# Objetos nuevos: el contenido de cambia/x, los arboles de cambia/ y de la
+# raiz y el commit
+[ "$(count_objects)" -eq $((objects + 4)) ] || { echo "arbol: igual/ no reutilizo su arbol"; FAILED=1; }
+changes=$("$VERSIONS" list -c 2)
+[ "$(echo "$changes" | wc -l)" -eq 2 ] && echo "$changes" | grep -q "^M cambia/x " \
+    && echo "$changes" | grep -q "^D raiz " || { echo "arbol: list -c 2 muestra otros cambios"; FAILED=1; }
+
+"$VERSIONS" get -c 1 >/dev/null || FAILED=1
+diff -r -x .versions . "$DIR/copia" || { echo "arbol: get -c 1 no recupero el commit"; FAILED=1; }
+"$VERSIONS" fsck >/dev/null || { echo "fsck: el repositorio tiene errores"; FAILED=1; }
+
+cd / && rm -rf "$DIR"
+if [ $FAILED -ne 0 ]; then
+    echo "test_commit: FALLA"
+    exit 1
+fi
+echo "test_commit: ok"
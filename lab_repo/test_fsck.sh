@@ -0,0 +1,77 @@
+#!/bin/sh
+# @file
+# @brief Prueba de la verificacion de integridad
+# @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+# @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+# @copyright MIT License
+#
+# Uso: test_fsck.sh [DIRECTORIO]
+#
+# Guarda un objeto en cada forma, verifica que fsck no reporta errores, y
+# cambia un byte de cada uno:
+#
+# - Objeto suelto sin comprimir (--no-compress).
+# - Objeto comprimido (.z).
+# - Diferencia (.d, --delta).
+# - Objeto dentro de un paquete (repack).
+#
+# fsck debe reportar cada objeto danado y terminar con un codigo distinto
+# de cero.
+
+VERSIONS="$(cd "$(dirname "$0")" && pwd)/versions"
+DIR=${1:-/tmp/versions-test-fsck}
+FAILED=0
+
+# Cambia el byte de la mitad de un archivo
+corrupt() {
+    chmod u+w "$1"
+    printf 'X' | dd of="$1" bs=1 seek=$(( $(stat -c %s "$1") / 2 )) conv=notrunc 2>/dev/null
+}
+
+# Hash SHA-256 de un archivo, el nombre de su objeto
+hash() {
+    sha256sum "$1" | cut -c1-64
+}
+
+rm -rf "$DIR"
+mkdir -p "$DIR" && cd "$DIR" || exit 1
+
+# Solo el primer objeto queda en el paquete
+seq 1 900 >empacado
+"$VERSIONS" add empacado "paquete" >/dev/null || FAILED=1
+"$VERSIONS" repack >/dev/null || FAILED=1
+seq 1 2000 >suelto
+"$VERSIONS" --no-compress add suelto "suelto" >/dev/null || FAILED=1
+seq 1 3000 >comprimido
+"$VERSIONS" add comprimido "comprimido" >/dev/null || FAILED=1
+seq 1 5000 >diferencia
+"$VERSIONS" add diferencia "base" >/dev/null || FAILED=1
+sed -i 's/^2500$/cambio/' diferencia
+"$VERSIONS" --delta add diferencia "diferencia" >/dev/null || FAILED=1
+
+packed=$(hash empacado)
+loose=$(hash suelto)
+compressed=$(hash comprimido)
+delta=$(hash diferencia)
+for f in "$loose" "$compressed.z" "$delta.d"; do
+    [ -f ".versions/$f" ] || { echo "$f: el objeto no se guardo en la forma esperada"; FAILED=1; }
+done
+[ ! -f ".versions/$packed" ] && [ ! -f ".versions/$packed.z" ] || { echo "$packed: no se agrupo"; FAILED=1; }
+"$VERSIONS" fsck >/dev/null || { echo "fsck: reporta errores antes de danar los objetos"; FAILED=1; }
+
+corrupt ".versions/$loose"
+corrupt ".versions/$compressed.z"
+corrupt ".versions/$delta.d"
+for f in .versions/pack/*.pack; do corrupt "$f"; done
+
+out=$("$VERSIONS" fsck 2>&1) && { echo "fsck: termino con 0 con objetos danados"; FAILED=1; }
+for h in "$loose" "$compressed" "$delta" "$packed"; do
+    echo "$out" | grep -q "Objeto danado: $h" || { echo "fsck: no reporto $h"; FAILED=1; }
+done
+
+cd / && rm -rf "$DIR"
+if [ $FAILED -ne 0 ]; then
+    echo "test_fsck: FALLA"
+    exit 1
+fi
+echo "test_fsck: ok"
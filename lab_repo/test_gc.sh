@@ -0,0 +1,81 @@
+#!/bin/sh
+# @file
+# @brief Prueba de la recoleccion de basura
+# @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+# @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+# @copyright MIT License
+#
+# Uso: test_gc.sh [DIRECTORIO]
+#
+# Crea un registro duplicado (una copia del ultimo registro despues del
+# tamano confirmado, que se confirma al abrir el repositorio), objetos
+# huerfanos y un temporal abandonado, y ejecuta versions gc 1 hasta que
+# termina. Verifica que cada ejecucion revisa a lo sumo una entrada, que
+# se borran los huerfanos y el temporal pero no los objetos usados, que el
+# duplicado se elimina al compactar, que add reconoce las versiones
+# existentes con el filtro de Bloom reconstruido al compactar, y que las
+# versiones se recuperan (get, fsck).
+
+VERSIONS="$(cd "$(dirname "$0")" && pwd)/versions"
+DIR=${1:-/tmp/versions-test-gc}
+MAX_RUNS=100 # Ejecuciones de gc antes de dar la recoleccion por colgada
+FAILED=0
+
+rm -rf "$DIR"
+mkdir -p "$DIR" && cd "$DIR" || exit 1
+
+echo uno >a
+"$VERSIONS" add a "uno" >/dev/null || FAILED=1
+echo dos >a
+"$VERSIONS" add a "dos" >/dev/null || FAILED=1
+echo copia >dup
+"$VERSIONS" add dup "c" >/dev/null || FAILED=1
+
+# Duplicado: encabezado (40 bytes) + "dup" + "c"
+tail -c 44 .versions/versions.db >>.versions/versions.db
+[ "$("$VERSIONS" list dup | wc -l)" -eq 2 ] || { echo "dup: no se creo el duplicado"; FAILED=1; }
+
+# Huerfanos con el nombre de un objeto suelto y comprimido, y un temporal.
+# Todo debe ser anterior al margen de gc (GC_GRACE)
+orphan=$(echo huerfano | sha256sum | cut -c1-64)
+echo huerfano >".versions/$orphan"
+echo huerfano >".versions/$orphan.z"
+echo temporal >.versions/tmp-abandonado
+touch -d "2 hours ago" .versions/*
+
+runs=0
+while :; do
+    out=$("$VERSIONS" gc 1) || { echo "gc: fallo"; FAILED=1; break; }
+    runs=$((runs + 1))
+    swept=$(echo "$out" | sed -n 's/.* \([0-9]*\) objetos revisados.*/\1/p')
+    [ "$swept" -le 1 ] || { echo "gc: una ejecucion reviso $swept objetos"; FAILED=1; }
+    echo "$out" | grep -q "Recoleccion completa" && break
+    [ $runs -lt $MAX_RUNS ] || { echo "gc: no termino en $MAX_RUNS ejecuciones"; FAILED=1; break; }
+done
+
+for f in "$orphan" "$orphan.z" tmp-abandonado; do
+    [ ! -e ".versions/$f" ] || { echo "gc: no se borro $f"; FAILED=1; }
+done
+[ "$(find .versions -maxdepth 1 -name '[0-9a-f]*' | wc -l)" -eq 3 ] || { echo "gc: se borro un objeto usado"; FAILED=1; }
+[ "$("$VERSIONS" list dup | wc -l)" -eq 1 ] || { echo "gc: no se elimino el duplicado"; FAILED=1; }
+[ "$("$VERSIONS" list a | wc -l)" -eq 2 ] || { echo "gc: se perdio una version de a"; FAILED=1; }
+
+# El filtro reconstruido contiene todos los registros compactados
+for f in a dup; do
+    "$VERSIONS" add $f "otra vez" | grep -q "La version ya existe" \
+        || { echo "bloom: add no reconoce la version de $f"; FAILED=1; }
+done
+[ "$("$VERSIONS" list | wc -l)" -eq 3 ] || { echo "bloom: add duplico un registro"; FAILED=1; }
+
+# Las versiones se recuperan despues de compactar
+rm a dup
+"$VERSIONS" get 1 a >/dev/null && [ "$(cat a)" = uno ] || { echo "get: a 1 no se recupero"; FAILED=1; }
+"$VERSIONS" get 1 dup >/dev/null && [ "$(cat dup)" = copia ] || { echo "get: dup 1 no se recupero"; FAILED=1; }
+"$VERSIONS" fsck >/dev/null || { echo "fsck: el repositorio tiene errores"; FAILED=1; }
+
+cd / && rm -rf "$DIR"
+if [ $FAILED -ne 0 ]; then
+    echo "test_gc: FALLA"
+    exit 1
+fi
+echo "test_gc: ok"
@@ -0,0 +1,125 @@
+/**
+ * @file
+ * @brief Prueba de las implementaciones de sha256
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * Uso: test_sha256
+ *
+ * Verifica la implementacion escalar con vectores conocidos y compara
+ * cada implementacion soportada por el procesador (sha256_kernel_at) con
+ * la escalar, sobre muchas longitudes y divisiones del contenido en
+ * llamadas a sha256_update. Termina con EXIT_FAILURE si alguna difiere.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sha256.h"
+
+#define MAX_LEN 4200 /**< Longitud maxima probada con todas las divisiones */
+#define LARGE_LEN (1 << 20) /**< Longitud de la prueba de un bloque grande */
+
+/** Tamanos de las llamadas a sha256_update; 0 es una sola llamada */
+static const size_t splits[] = {0, 1, 3, 7, 31, 55, 63, 64, 65, 127, 128, 129, 1000};
+
+#define NSPLITS (sizeof splits / sizeof splits[0])
+
+/**
+ * @brief Calcula el hash de data en llamadas de split bytes.
+ */
+static void hash_split(const uint8_t *data, size_t len, size_t split, uint8_t *digest) {
+    struct sha256_buff sha;
+    size_t offset, n;
+
+    sha256_init(&sha);
+    if (split == 0) split = len > 0 ? len : 1;
+    for (offset = 0; offset < len; offset += n) {
+        n = len - offset < split ? len - offset : split;
+        sha256_update(&sha, data + offset, n);
+    }
+    sha256_finalize(&sha);
+    sha256_read(&sha, digest);
+}
+
+/**
+ * @brief Verifica la implementacion escalar con vectores de FIPS 180-2.
+ * @return Numero de errores.
+ */
+static int check_vectors(void) {
+    static const struct {
+        const char *input;
+        const char *hex;
+    } vectors[] = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+    };
+    char hex[65];
+    size_t i;
+    int errors = 0;
+
+    for (i = 0; i < sizeof vectors / sizeof vectors[0]; i++) {
+        sha256_hash_hex(vectors[i].input, strlen(vectors[i].input), hex);
+        hex[64] = 0;
+        if (strcmp(hex, vectors[i].hex) != 0) {
+            fprintf(stderr, "scalar: \"%s\" da %s\n", vectors[i].input, hex);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+int main(void) {
+    uint8_t *data, (*expected)[NSPLITS][32], large[32], digest[32];
+    const char *kernel;
+    size_t i, len, s;
+    int errors = 0, tested = 0;
+
+    data = malloc(LARGE_LEN);
+    expected = malloc((MAX_LEN + 1) * sizeof *expected);
+    if (data == NULL || expected == NULL) {
+        fprintf(stderr, "Sin memoria\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < LARGE_LEN; i++) data[i] = (uint8_t)(i * 167 + (i >> 7) + (i >> 13));
+
+    // Referencia: la implementacion escalar
+    if (sha256_set_kernel("scalar") < 0) return EXIT_FAILURE;
+    errors += check_vectors();
+    for (len = 0; len <= MAX_LEN; len++) {
+        for (s = 0; s < NSPLITS; s++) hash_split(data, len, splits[s], expected[len][s]);
+    }
+    sha256_hash(data, LARGE_LEN, large);
+
+    for (i = 0; (kernel = sha256_kernel_at(i)) != NULL; i++) {
+        int kernel_errors = 0;
+
+        if (sha256_set_kernel(kernel) < 0) {
+            printf("%-8s no soportada\n", kernel);
+            continue;
+        }
+        for (len = 0; len <= MAX_LEN; len++) {
+            for (s = 0; s < NSPLITS; s++) {
+                hash_split(data, len, splits[s], digest);
+                if (memcmp(digest, expected[len][s], 32) != 0 && kernel_errors++ < 5) {
+                    fprintf(stderr, "%s: difiere con %zu bytes en llamadas de %zu\n", kernel, len, splits[s]);
+                }
+            }
+        }
+        sha256_hash(data, LARGE_LEN, digest);
+        if (memcmp(digest, large, 32) != 0 && kernel_errors++ < 5) {
+            fprintf(stderr, "%s: difiere con %d bytes\n", kernel, LARGE_LEN);
+        }
+        printf("%-8s %s\n", kernel, kernel_errors == 0 ? "ok" : "FALLA");
+        errors += kernel_errors;
+        tested++;
+    }
+
+    free(data);
+    free(expected);
+    return errors == 0 && tested > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,104 @@
+#!/bin/sh
+# @file
+# @brief Prueba de los archivos dispersos
+# @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+# @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+# @copyright MIT License
+#
+# Uso: test_sparse.sh [DIRECTORIO]
+#
+# Adiciona y recupera archivos con huecos grandes y verifica que el
+# contenido recuperado es igual (cmp) y que ni el objeto guardado ni el
+# archivo recuperado ocupan el espacio de los huecos (stat -c %b), en cada
+# forma de los objetos:
+#
+# - Objeto suelto de varios GB (fcopy_read_sparse al guardar, fcopy_fd al
+#   recuperar).
+# - Objeto comprimido (.z) de un archivo denso en ceros (lz_sink_sparse).
+# - Diferencia (.d) contra una base dispersa (fcopy_range).
+# - Objeto comprimido dentro de un paquete (lz_sink_sparse).
+
+VERSIONS="$(cd "$(dirname "$0")" && pwd)/versions"
+DIR=${1:-/tmp/versions-test-sparse}
+MAX_KB=1024 # Espacio maximo (en KB) de un objeto o archivo recuperado
+FAILED=0
+
+# Espacio ocupado por un archivo, en KB
+used_kb() {
+    echo $(( $(stat -c %b "$1") * $(stat -c %B "$1") / 1024 ))
+}
+
+# Verifica que un archivo no ocupa el espacio de sus huecos
+check_sparse() {
+    if [ "$(used_kb "$2")" -gt $MAX_KB ]; then
+        echo "$1: $2 ocupa $(used_kb "$2") KB de $(( $(stat -c %s "$2") / 1024 )) KB"
+        FAILED=1
+    fi
+}
+
+# Recupera una version en otro nombre y la compara con el original
+check_get() {
+    mv "$3" "$3.orig"
+    if ! "$VERSIONS" get "$2" "$3" || ! cmp -s "$3" "$3.orig"; then
+        echo "$1: la version $2 de $3 difiere"
+        FAILED=1
+    fi
+    check_sparse "$1" "$3"
+    mv "$3.orig" "$3"
+}
+
+# Escribe datos aleatorios en una posicion (en MB) de un archivo
+write_at() {
+    head -c "$3" /dev/urandom | dd of="$1" bs=1M seek="$2" conv=notrunc status=none
+}
+
+rm -rf "$DIR"
+mkdir -p "$DIR" && cd "$DIR" || exit 1
+
+# Objeto suelto: 4 GB con datos al inicio, en la mitad y al final
+truncate -s 4G loose
+write_at loose 0 1000
+write_at loose 2048 1000
+write_at loose 4095 1000
+"$VERSIONS" add loose "disperso" >/dev/null || FAILED=1
+for object in .versions/*; do
+    [ "$(stat -c %s "$object")" -eq $((4 << 30)) ] && check_sparse loose "$object"
+done
+check_get loose 1 loose
+
+# Objeto comprimido: 80 MB escritos en ceros, sin huecos
+head -c 1000 /dev/urandom >dense
+head -c 80M /dev/zero >>dense
+head -c 1000 /dev/urandom >>dense
+"$VERSIONS" add dense "denso" >/dev/null || FAILED=1
+ls .versions/*.z >/dev/null 2>&1 || { echo "dense: no se comprimio"; FAILED=1; }
+check_get lz 1 dense
+
+# Diferencia: 200 MB dispersos, la version 2 cambia unos bytes; el hueco
+# del final no se escribe
+truncate -s 200M delta
+write_at delta 0 100000
+write_at delta 150 100000
+"$VERSIONS" add delta "base" >/dev/null || FAILED=1
+printf 'cambio' | dd of=delta bs=1 seek=50000 conv=notrunc status=none
+"$VERSIONS" --delta add delta "diferencia" >/dev/null || FAILED=1
+ls .versions/*.d >/dev/null 2>&1 || { echo "delta: no se guardo como diferencia"; FAILED=1; }
+check_get delta 2 delta
+
+# Paquete: un objeto comprimido de 48 MB en ceros
+head -c 1000 /dev/urandom >packed
+head -c 48M /dev/zero >>packed
+head -c 1000 /dev/urandom >>packed
+"$VERSIONS" add packed "paquete" >/dev/null || FAILED=1
+"$VERSIONS" repack >/dev/null || FAILED=1
+ls .versions/pack/*.pack >/dev/null 2>&1 || { echo "packed: no se agrupo"; FAILED=1; }
+check_get pack 1 packed
+
+"$VERSIONS" fsck >/dev/null || { echo "fsck: el repositorio tiene errores"; FAILED=1; }
+
+cd / && rm -rf "$DIR"
+if [ $FAILED -ne 0 ]; then
+    echo "test_sparse: FALLA"
+    exit 1
+fi
+echo "test_sparse: ok"
@@ -0,0 +1,71 @@
+#!/bin/sh
+# @file
+# @brief Prueba de versions status
+# @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+# @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+# @copyright MIT License
+#
+# Uso: test_status.sh [DIRECTORIO]
+#
+# Verifica cada estado de status: un archivo sin cambios no se lista, uno
+# modificado se lista con M, uno sin versiones con ? y uno borrado con D.
+# Un archivo modificado en el mismo segundo en que add lo leyo, sin
+# cambiar su tamano ni su fecha de modificacion, tambien se lista con M:
+# la cache de hashes no confia en la firma de un archivo leido en el mismo
+# segundo en que cambio.
+
+VERSIONS="$(cd "$(dirname "$0")" && pwd)/versions"
+DIR=${1:-/tmp/versions-test-status}
+FAILED=0
+
+# Verifica la linea de status de un archivo
+check_status() {
+    if [ "$(echo "$out" | grep " $2\$")" != "$1 $2" ]; then
+        echo "$2: se esperaba '$1', status dio '$(echo "$out" | grep " $2\$")'"
+        FAILED=1
+    fi
+}
+
+rm -rf "$DIR"
+mkdir -p "$DIR/sub" && cd "$DIR" || exit 1
+
+echo igual >igual
+echo original >sub/cambia
+echo borrado >borrado
+sleep 1
+"$VERSIONS" add igual sub borrado "uno" >/dev/null || FAILED=1
+
+echo modificado >sub/cambia
+echo nuevo >nuevo
+rm borrado
+
+# Archivo racy: se adiciona al inicio de un segundo y se cambia en el
+# mismo segundo, con el mismo tamano y la misma fecha de modificacion
+while [ "$(date +%N)" -gt 300000000 ]; do sleep 0.05; done
+echo aaaa >racy
+"$VERSIONS" add racy "racy" >/dev/null || FAILED=1
+touch -r racy racy.fecha
+echo bbbb >racy
+touch -r racy.fecha racy
+rm racy.fecha
+
+out=$("$VERSIONS" status) || { echo "status: fallo"; FAILED=1; }
+echo "$out" | grep -q " igual\$" && { echo "igual: se listo sin cambios"; FAILED=1; }
+check_status M sub/cambia
+check_status "?" nuevo
+check_status D borrado
+check_status M racy
+[ "$(echo "$out" | wc -l)" -eq 4 ] || { echo "status: lista otros archivos"; echo "$out"; FAILED=1; }
+
+# Despues de adicionar los cambios solo queda el borrado
+sleep 1
+"$VERSIONS" add sub nuevo racy "dos" >/dev/null || FAILED=1
+out=$("$VERSIONS" status)
+[ "$out" = "D borrado" ] || { echo "status: despues de adicionar: $out"; FAILED=1; }
+
+cd / && rm -rf "$DIR"
+if [ $FAILED -ne 0 ]; then
+    echo "test_status: FALLA"
+    exit 1
+fi
+echo "test_status: ok"
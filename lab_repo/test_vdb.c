@@ -0,0 +1,104 @@
+/**
+ * @file
+ * @brief Prueba de la migracion de versions.db
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * Uso: test_vdb [DIRECTORIO]
+ *
+ * Escribe una base de datos del formato 1 (registros de tamano fijo) cuyo
+ * ultimo registro quedo a medio escribir, como tras una caida durante una
+ * adicion, y verifica que init_versions la migra con los registros
+ * completos y descarta el incompleto. Termina con EXIT_FAILURE si la
+ * migracion falla o los registros migrados no coinciden.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "versions.h"
+
+#define RECORDS 3 /**< Registros completos de la base de datos */
+
+/**
+ * @brief Registro del formato 1 (ver vdb.c)
+ */
+typedef struct __attribute__((aligned(512))) {
+    char filename[PATH_MAX];    /**< Nombre del archivo original */
+    char hash[HASH_SIZE];       /**< Hash en hexadecimal */
+    char comment[COMMENT_SIZE]; /**< Comentario del usuario */
+} record_v1;
+
+/**
+ * @brief Registros migrados
+ */
+typedef struct {
+    int count;                          /**< Registros recorridos */
+    int errors;                         /**< Registros que no coinciden */
+    uint8_t digests[RECORDS][DIGEST_SIZE]; /**< Digest esperado de cada registro */
+} migrated;
+
+static int check_entry(void *ctx, const version_entry *e) {
+    migrated *m = ctx;
+    char filename[32];
+
+    snprintf(filename, sizeof filename, "archivo%d", m->count);
+    if (m->count >= RECORDS || e->filename_len != strlen(filename) || memcmp(e->filename, filename, e->filename_len) != 0
+            || memcmp(e->digest, m->digests[m->count], DIGEST_SIZE) != 0) {
+        fprintf(stderr, "Registro %d migrado con otro contenido\n", m->count + 1);
+        m->errors++;
+    }
+    m->count++;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *dir = argc > 1 ? argv[1] : "/tmp/versions-test-vdb";
+    char command[PATH_MAX + 16];
+    record_v1 r;
+    migrated m = {0, 0, {{0}}};
+    FILE *db;
+    int i, failed = 0;
+
+    snprintf(command, sizeof command, "rm -rf '%s'", dir);
+    if (system(command) != 0 || mkdir(dir, 0755) < 0 || chdir(dir) < 0 || mkdir(VERSIONS_DIR, 0755) < 0) {
+        perror(dir);
+        return EXIT_FAILURE;
+    }
+
+    // RECORDS registros completos y la mitad de otro
+    if ((db = fopen(VERSIONS_DIR "/versions.db", "wb")) == NULL) return EXIT_FAILURE;
+    for (i = 0; i <= RECORDS; i++) {
+        memset(&r, 0, sizeof r);
+        snprintf(r.filename, PATH_MAX, "archivo%d", i);
+        snprintf(r.comment, COMMENT_SIZE, "version %d", i);
+        sha256_hash_hex(r.filename, strlen(r.filename), r.hash);
+        if (i < RECORDS) {
+            hex_to_digest(r.hash, m.digests[i]);
+            fwrite(&r, sizeof r, 1, db);
+        } else {
+            fwrite(&r, sizeof r / 2, 1, db);
+        }
+    }
+    fclose(db);
+
+    if (init_versions() != 0) {
+        fprintf(stderr, "No se pudo migrar una base de datos con un registro incompleto\n");
+        failed = 1;
+    } else {
+        list(NULL, check_entry, &m);
+        if (m.count != RECORDS || m.errors > 0) {
+            fprintf(stderr, "Se migraron %d de %d registros\n", m.count, RECORDS);
+            failed = 1;
+        }
+    }
+
+    snprintf(command, sizeof command, "rm -rf '%s'", dir);
+    if (chdir("/") < 0 || system(command) != 0) failed = 1;
+    printf("test_vdb: %s\n", failed ? "FALLA" : "ok");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
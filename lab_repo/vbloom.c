@@ -0,0 +1,246 @@
+/**
+ * @file
+ * @brief Implementacion del filtro de Bloom de las versiones
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ */
+
+#include "vbloom.h"
+#include "vdb.h"
+
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#define BLOOM_MAGIC 0x4d4c4256 /**< "VBLM" en little endian */
+#define BLOOM_FORMAT 1 /**< Version del formato */
+#define BLOOM_BLOCK_BITS 512 /**< Bits de un bloque (64 bytes) */
+#define BLOOM_BLOCK_WORDS (BLOOM_BLOCK_BITS / 64) /**< Palabras de 64 bits de un bloque */
+#define BLOOM_MIN_BLOCKS 64 /**< Bloques de un filtro nuevo (potencia de 2) */
+
+/**
+ * @brief Encabezado del filtro; ocupa un bloque para que los bloques
+ * queden alineados a la linea de cache.
+ */
+typedef struct {
+    uint32_t magic;   /**< BLOOM_MAGIC */
+    uint32_t format;  /**< BLOOM_FORMAT */
+    uint64_t nblocks; /**< Numero de bloques (potencia de 2) */
+    uint64_t count;   /**< Registros agregados */
+    uint64_t db_size; /**< Bytes de versions.db agregados */
+    uint64_t db_ino;  /**< Inodo de versions.db */
+    uint8_t reserved[BLOOM_BLOCK_BITS / 8 - 32]; /**< Relleno hasta 64 bytes */
+} bloom_header;
+
+/**
+ * @brief Filtro abierto por el proceso
+ */
+static struct {
+    int fd;               /**< Descriptor del filtro */
+    bloom_header *header; /**< Inicio del mapeo */
+    uint64_t *blocks;     /**< Bloques (siguen al encabezado) */
+    size_t map_size;      /**< Tamano del mapeo */
+} bloom = {-1, NULL, NULL, 0};
+
+/**
+ * @brief Hash FNV-1a de 64 bits del nombre y el digest, con mezcla final
+ * (splitmix64).
+ */
+static uint64_t key_of(const char *filename, size_t filename_len, const uint8_t *digest, uint64_t seed) {
+    uint64_t h = 0xcbf29ce484222325ULL ^ seed;
+    size_t i;
+
+    for (i = 0; i < filename_len; i++) h = (h ^ (uint8_t)filename[i]) * 0x100000001b3ULL;
+    h *= 0x100000001b3ULL; // Separador: el caracter nulo
+    for (i = 0; i < DIGEST_SIZE; i++) h = (h ^ digest[i]) * 0x100000001b3ULL;
+
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+/**
+ * @brief Ubica el bloque de un elemento; bits recibe las posiciones de
+ * sus bits dentro del bloque, 9 bits del hash por posicion.
+ */
+static uint64_t *block_of(const bloom_header *h, uint64_t *blocks, const char *filename, size_t filename_len,
+                          const uint8_t *digest, uint64_t *bits) {
+    uint64_t block = key_of(filename, filename_len, digest, 0) & (h->nblocks - 1);
+
+    *bits = key_of(filename, filename_len, digest, 0x9e3779b97f4a7c15ULL);
+    return blocks + block * BLOOM_BLOCK_WORDS;
+}
+
+static void add_record(const bloom_header *h, uint64_t *blocks, const vdb_record *r) {
+    uint64_t bits, bit;
+    uint64_t *block = block_of(h, blocks, r->filename, r->header->filename_len, r->header->digest, &bits);
+    int i;
+
+    for (i = 0; i < BLOOM_K; i++, bits >>= 9) {
+        bit = bits & (BLOOM_BLOCK_BITS - 1);
+        __atomic_fetch_or(&block[bit / 64], 1ULL << (bit % 64), __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Agrega los registros de versions.db desde h->db_size.
+ * @return 0 en caso de exito, -1 si algun registro no es valido.
+ */
+static int add_records(bloom_header *h, uint64_t *blocks) {
+    vdb_record r;
+    off_t offset;
+    ssize_t len;
+
+    if (h->db_size < (uint64_t)vdb_first()) h->db_size = vdb_first();
+    for (offset = h->db_size; (len = vdb_record_at(offset, &r)) > 0; offset += len) {
+        add_record(h, blocks, &r);
+        h->count++;
+    }
+
+    // Los bits se publican antes que el tamano cubierto
+    __atomic_store_n(&h->db_size, offset, __ATOMIC_RELEASE);
+    return len < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Verifica si el filtro tiene espacio para count registros.
+ */
+#define fits(nblocks, count) ((count) * BLOOM_BITS_PER_RECORD <= (nblocks) * BLOOM_BLOCK_BITS)
+
+int bloom_rebuild(void) {
+    char tmp_path[PATH_MAX];
+    bloom_header *h;
+    vdb_record r;
+    off_t offset;
+    ssize_t len;
+    uint64_t count = 0, nblocks = BLOOM_MIN_BLOCKS;
+    size_t map_size;
+    void *map;
+    int fd;
+
+    if (vdb_map() < 0) return -1;
+
+    // Se deja espacio para el doble de los registros actuales
+    for (offset = vdb_first(); (len = vdb_record_at(offset, &r)) > 0; offset += len) count++;
+    while (!fits(nblocks, 2 * count)) nblocks *= 2;
+
+    // Se construye aparte y se publica con rename: otros procesos pueden
+    // tener el filtro anterior mapeado
+    snprintf(tmp_path, PATH_MAX, "%s.%d.tmp", VERSIONS_BLOOM_PATH, (int)getpid());
+    if ((fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) return -1;
+    map_size = (nblocks + 1) * (BLOOM_BLOCK_BITS / 8);
+    if (ftruncate(fd, map_size) < 0
+            || (map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+    h = map;
+    h->magic = BLOOM_MAGIC;
+    h->format = BLOOM_FORMAT;
+    h->nblocks = nblocks;
+    h->db_ino = vdb_ino();
+
+    // Un filtro danado daria falsos negativos: se sincroniza antes de
+    // publicarlo
+    if (add_records(h, (uint64_t *)(h + 1)) < 0 || msync(map, map_size, MS_SYNC) < 0
+            || rename(tmp_path, VERSIONS_BLOOM_PATH) < 0) {
+        munmap(map, map_size);
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    bloom_close();
+    bloom.fd = fd;
+    bloom.header = h;
+    bloom.blocks = (uint64_t *)(h + 1);
+    bloom.map_size = map_size;
+    return 0;
+}
+
+/**
+ * @brief Verifica si el filtro cubre todos los registros confirmados.
+ */
+static int covered(void) {
+    vdb_record r;
+    return bloom.header->db_ino == (uint64_t)vdb_ino()
+        && vdb_record_at(__atomic_load_n(&bloom.header->db_size, __ATOMIC_ACQUIRE), &r) == 0;
+}
+
+/**
+ * @brief Agrega los registros nuevos. Si versions.db fue reemplazada o el
+ * filtro se lleno, lo reconstruye.
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int sync_filter(void) {
+    int result;
+
+    if (vdb_map() < 0) return -1;
+    if (covered()) return 0;
+
+    if (bloom.header->db_ino != (uint64_t)vdb_ino() || bloom.header->db_size > (uint64_t)vdb_size()
+            || !fits(bloom.header->nblocks, bloom.header->count + 1)) {
+        return bloom_rebuild();
+    }
+
+    // Un solo proceso agrega registros; si otro lo esta haciendo no se
+    // espera y las consultas pasan al indice mientras tanto
+    if (flock(bloom.fd, LOCK_EX | LOCK_NB) < 0) return -1;
+    result = covered() ? 0 : add_records(bloom.header, bloom.blocks);
+    flock(bloom.fd, LOCK_UN);
+    return result;
+}
+
+int bloom_open(void) {
+    struct stat s, current;
+    bloom_header h;
+    void *map;
+
+    // Si otro proceso reconstruyo el filtro, se abre el nuevo
+    if (bloom.header != NULL) {
+        if (stat(VERSIONS_BLOOM_PATH, &current) == 0 && fstat(bloom.fd, &s) == 0 && current.st_ino == s.st_ino) {
+            return sync_filter();
+        }
+        bloom_close();
+    }
+
+    if ((bloom.fd = open(VERSIONS_BLOOM_PATH, O_RDWR)) < 0) return bloom_rebuild();
+    if (fstat(bloom.fd, &s) < 0 || pread(bloom.fd, &h, sizeof h, 0) != sizeof h
+            || h.magic != BLOOM_MAGIC || h.format != BLOOM_FORMAT
+            || h.nblocks < BLOOM_MIN_BLOCKS || (h.nblocks & (h.nblocks - 1)) != 0
+            || (uint64_t)s.st_size != (h.nblocks + 1) * (BLOOM_BLOCK_BITS / 8)
+            || (map = mmap(NULL, s.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, bloom.fd, 0)) == MAP_FAILED) {
+        bloom_close();
+        return bloom_rebuild();
+    }
+    bloom.header = map;
+    bloom.blocks = (uint64_t *)(bloom.header + 1);
+    bloom.map_size = s.st_size;
+    return sync_filter();
+}
+
+void bloom_close(void) {
+    if (bloom.header != NULL) munmap(bloom.header, bloom.map_size);
+    if (bloom.fd >= 0) close(bloom.fd);
+    bloom.header = NULL;
+    bloom.blocks = NULL;
+    bloom.fd = -1;
+}
+
+int bloom_maybe_contains(const char *filename, const uint8_t *digest) {
+    uint64_t bits, bit, *block;
+    int i;
+
+    if (bloom.header == NULL || !covered()) return 1;
+
+    block = block_of(bloom.header, bloom.blocks, filename, strlen(filename), digest, &bits);
+    for (i = 0; i < BLOOM_K; i++, bits >>= 9) {
+        bit = bits & (BLOOM_BLOCK_BITS - 1);
+        if (!(__atomic_load_n(&block[bit / 64], __ATOMIC_RELAXED) & (1ULL << (bit % 64)))) return 0;
+    }
+    return 1;
+}
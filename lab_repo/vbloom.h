@@ -0,0 +1,70 @@
+/**
+ * @file
+ * @brief Filtro de Bloom persistente de las versiones existentes
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * Casi toda adicion de contenido nuevo pregunta si ya existe una version
+ * con el mismo nombre y hash, y la respuesta casi siempre es que no. El
+ * filtro, guardado en .versions/versions.bloom y mapeado en memoria,
+ * responde esa pregunta con una sola lectura: si dice que la version no
+ * existe, es seguro; si dice que puede existir, se consulta el indice o
+ * versions.db.
+ *
+ * El filtro esta dividido en bloques de 64 bytes (una linea de cache).
+ * Cada par (nombre, digest) ocupa BLOOM_K bits de un solo bloque, por lo
+ * que una consulta lee una sola linea de cache del mapeo.
+ *
+ * Como el indice, el encabezado guarda cuantos bytes de versions.db
+ * cubre el filtro; al abrirlo se agregan los registros adicionados
+ * despues. Los bits solo se encienden, por lo que las consultas no
+ * necesitan candado. Si versions.db fue reemplazada (compactacion,
+ * migracion) o el filtro se lleno, se reconstruye.
+ */
+
+#ifndef VBLOOM_H
+#define VBLOOM_H
+
+#include <stdint.h>
+
+#include "versions.h"
+
+#define VERSIONS_BLOOM_PATH VERSIONS_DIR "/versions.bloom" /**< Ruta del filtro */
+#define BLOOM_K 7 /**< Bits por elemento (con 16 bits por elemento, ~0.1% de falsos positivos) */
+#define BLOOM_BITS_PER_RECORD 16 /**< Bits del filtro por registro de versions.db */
+
+/**
+ * @brief Abre el filtro y agrega los registros nuevos de versions.db.
+ * Si el filtro no existe o no corresponde a la base de datos, se
+ * reconstruye.
+ *
+ * @return 0 en caso de exito, -1 si el filtro no esta disponible.
+ */
+int bloom_open(void);
+
+/**
+ * @brief Reconstruye el filtro desde versions.db (p.e. despues de
+ * compactarla).
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+int bloom_rebuild(void);
+
+/**
+ * @brief Libera el filtro.
+ */
+void bloom_close(void);
+
+/**
+ * @brief Consulta si puede existir una version.
+ *
+ * @param filename Nombre del archivo
+ * @param digest Digest del contenido
+ *
+ * @return 0 si la version no existe, 1 si puede existir (o el filtro no
+ * cubre todos los registros confirmados).
+ */
+int bloom_maybe_contains(const char *filename, const uint8_t *digest);
+
+#endif
@@ -0,0 +1,187 @@
+/**
+ * @file
+ * @brief Implementacion del almacenamiento por bloques
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ */
+
+#include "vchunk.h"
+#include "vdb.h"
+
+#include <sys/mman.h>
+
+#define CHUNK_MAGIC 0x4c4b4356 /**< "VCKL" en little endian */
+#define CHUNK_FORMAT 1 /**< Version del formato */
+
+/** Antes del tamano promedio: 16 bits altos en cero (cortes cada ~64 KiB) */
+#define MASK_SMALL 0xffff000000000000ULL
+/** Despues del tamano promedio: 12 bits altos en cero (cortes cada ~4 KiB) */
+#define MASK_LARGE 0xfff0000000000000ULL
+
+/**
+ * @brief Encabezado de una lista de bloques
+ */
+typedef struct {
+    uint32_t magic;  /**< CHUNK_MAGIC */
+    uint32_t format; /**< CHUNK_FORMAT */
+    uint64_t count;  /**< Numero de bloques */
+    uint64_t size;   /**< Tamano del objeto reconstruido */
+} chunk_header;
+
+/**
+ * @brief Bloque de una lista
+ */
+typedef struct {
+    uint8_t digest[DIGEST_SIZE]; /**< Digest del bloque */
+    uint32_t length;             /**< Longitud del bloque */
+    uint32_t reserved;           /**< Sin uso */
+} chunk_entry;
+
+/** Valores pseudoaleatorios del hash gear, fijos para que los cortes sean estables */
+static uint64_t gear[256];
+
+/**
+ * @brief Llena la tabla gear con splitmix64 a partir de una semilla fija.
+ */
+__attribute__((constructor))
+static void gear_init(void) {
+    uint64_t x = 0x76657273696f6e73ULL; // "versions"
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+char *chunk_path(const char *hash, char *path) {
+    snprintf(path, PATH_MAX, "%s/%s" CHUNK_SUFFIX, VERSIONS_DIR, hash);
+    return path;
+}
+
+size_t chunk_cut(const uint8_t *data, size_t len) {
+    size_t i, normal = CHUNK_AVG;
+    uint64_t fp = 0;
+
+    if (len <= CHUNK_MIN) return len;
+    if (len > CHUNK_MAX) len = CHUNK_MAX;
+    if (len < normal) normal = len;
+
+    // Los primeros CHUNK_MIN bytes nunca se cortan
+    for (i = CHUNK_MIN; i < normal; i++) {
+        fp = (fp << 1) + gear[data[i]];
+        if (!(fp & MASK_SMALL)) return i + 1;
+    }
+    for (; i < len; i++) {
+        fp = (fp << 1) + gear[data[i]];
+        if (!(fp & MASK_LARGE)) return i + 1;
+    }
+    return len;
+}
+
+int chunk_store(staged_object *o, int compress) {
+    char tmp_path[PATH_MAX], path[PATH_MAX], hash[2 * DIGEST_SIZE + 1];
+    chunk_header h = {CHUNK_MAGIC, CHUNK_FORMAT, 0, 0};
+    chunk_entry e;
+    uint8_t *data;
+    size_t offset, len;
+    FILE *out;
+    int fd, ok = 1;
+
+    if (o->size < CHUNK_MIN_FILE || o->compressed) return 1;
+
+    if ((fd = open(o->tmp_path, O_RDONLY)) < 0) return -1;
+    data = mmap(NULL, o->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+    madvise(data, o->size, MADV_SEQUENTIAL);
+
+    snprintf(tmp_path, PATH_MAX, "%s/" OBJECT_TMP_PREFIX "XXXXXX", VERSIONS_DIR);
+    if ((fd = mkstemp(tmp_path)) < 0 || (out = fdopen(fd, "wb")) == NULL) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        munmap(data, o->size);
+        return -1;
+    }
+    fchmod(fd, 0444);
+
+    // El encabezado se completa al final, cuando se conoce el numero de bloques
+    ok = fwrite(&h, sizeof h, 1, out) == 1;
+    memset(&e, 0, sizeof e);
+    for (offset = 0; ok && offset < (size_t)o->size; offset += len) {
+        len = chunk_cut(data + offset, o->size - offset);
+        sha256_hash(data + offset, len, e.digest);
+        e.length = len;
+
+        // Cada bloque se guarda una sola vez
+        digest_to_hex(e.digest, hash);
+        ok = object_store_buffer(hash, data + offset, len, compress) != VERSION_ERROR
+            && fwrite(&e, sizeof e, 1, out) == 1;
+        h.count++;
+        h.size += len;
+    }
+    munmap(data, o->size);
+
+    ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(&h, sizeof h, 1, out) == 1;
+    if (fclose(out) != 0) ok = 0;
+    if (!ok || rename(tmp_path, chunk_path(o->hash, path)) < 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+
+    object_discard(o);
+    return 0;
+}
+
+int chunk_reconstruct(const char *hash, int dst) {
+    char path[PATH_MAX], chunk_hash[2 * DIGEST_SIZE + 1];
+    chunk_header h;
+    chunk_entry e;
+    uint64_t i, total = 0;
+    FILE *in;
+    int ok;
+
+    if ((in = fopen(chunk_path(hash, path), "rb")) == NULL) return -1;
+    ok = fread(&h, sizeof h, 1, in) == 1 && h.magic == CHUNK_MAGIC && h.format == CHUNK_FORMAT;
+    for (i = 0; ok && i < h.count; i++) {
+        // Los bloques son objetos comunes: sueltos, comprimidos o en un paquete
+        ok = fread(&e, sizeof e, 1, in) == 1;
+        if (ok) {
+            digest_to_hex(e.digest, chunk_hash);
+            ok = object_append(chunk_hash, dst) == 0;
+        }
+        total += e.length;
+    }
+    fclose(in);
+    return ok && total == h.size ? 0 : -1;
+}
+
+ssize_t chunk_list(const char *hash, uint8_t **digests) {
+    char path[PATH_MAX];
+    chunk_header h;
+    chunk_entry e;
+    uint64_t i;
+    uint8_t *result = NULL;
+    FILE *in;
+    int ok;
+
+    if ((in = fopen(chunk_path(hash, path), "rb")) == NULL) return -1;
+    ok = fread(&h, sizeof h, 1, in) == 1 && h.magic == CHUNK_MAGIC && h.format == CHUNK_FORMAT
+        && (result = malloc(h.count * DIGEST_SIZE + 1)) != NULL;
+    for (i = 0; ok && i < h.count; i++) {
+        ok = fread(&e, sizeof e, 1, in) == 1;
+        if (ok) memcpy(result + i * DIGEST_SIZE, e.digest, DIGEST_SIZE);
+    }
+    fclose(in);
+    if (!ok) {
+        free(result);
+        return -1;
+    }
+    *digests = result;
+    return h.count;
+}
@@ -0,0 +1,89 @@
+/**
+ * @file
+ * @brief Almacenamiento de versiones por bloques definidos por el contenido
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * En modo por bloques, un archivo se divide en bloques de tamano variable
+ * cuyos limites dependen del contenido (FastCDC): un hash "gear" recorre el
+ * archivo y se corta donde los bits altos del hash son cero. Una insercion
+ * solo cambia los bloques vecinos; el resto de los limites se conserva, por
+ * lo que versiones de un archivo, o archivos distintos, comparten casi
+ * todos sus bloques.
+ *
+ * Cada bloque se guarda una sola vez como un objeto comun con su hash como
+ * nombre (y puede agruparse en un paquete). La version se guarda en
+ * .versions/<hash>.c como la lista de bloques que la forman.
+ *
+ * Como en FastCDC, antes del tamano promedio se usa una mascara con mas
+ * bits (cortes menos probables) y despues una con menos bits, lo que
+ * concentra el tamano de los bloques cerca del promedio.
+ */
+
+#ifndef VCHUNK_H
+#define VCHUNK_H
+
+#include "vobject.h"
+
+#define CHUNK_SUFFIX ".c" /**< Sufijo de las listas de bloques */
+#define CHUNK_MIN (4 << 10) /**< Tamano minimo de un bloque */
+#define CHUNK_AVG (16 << 10) /**< Tamano promedio de un bloque */
+#define CHUNK_MAX (64 << 10) /**< Tamano maximo de un bloque */
+#define CHUNK_MIN_FILE (2 * CHUNK_MAX) /**< Archivos mas pequenos se guardan completos */
+
+/**
+ * @brief Obtiene la ruta de la lista de bloques de un objeto.
+ *
+ * @param hash Hash del objeto
+ * @param path Buffer de PATH_MAX bytes
+ *
+ * @return Referencia al buffer
+ */
+char *chunk_path(const char *hash, char *path);
+
+/**
+ * @brief Calcula el tamano del primer bloque de un buffer.
+ *
+ * @param data Datos
+ * @param len Bytes disponibles
+ *
+ * @return Tamano del bloque (len si len <= CHUNK_MIN).
+ */
+size_t chunk_cut(const uint8_t *data, size_t len);
+
+/**
+ * @brief Almacena un objeto pendiente como lista de bloques.
+ * Solo se escriben los bloques que no existen en el repositorio.
+ *
+ * @param o Objeto pendiente (sin comprimir); el temporal se borra si se
+ * guarda la lista
+ * @param compress 1 para comprimir los bloques nuevos
+ *
+ * @return 0 si se guardo la lista, 1 si el objeto se debe guardar
+ * completo, -1 si ocurre un error.
+ */
+int chunk_store(staged_object *o, int compress);
+
+/**
+ * @brief Reconstruye un objeto guardado como lista de bloques.
+ *
+ * @param hash Hash del objeto
+ * @param dst Descriptor de destino, vacio y abierto para escritura
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+int chunk_reconstruct(const char *hash, int dst);
+
+/**
+ * @brief Lee los digests de los bloques de una lista.
+ *
+ * @param hash Hash del objeto
+ * @param digests Arreglo de DIGEST_SIZE bytes por bloque, reservado con
+ * malloc
+ *
+ * @return Numero de bloques, -1 si el objeto no es una lista de bloques.
+ */
+ssize_t chunk_list(const char *hash, uint8_t **digests);
+
+#endif
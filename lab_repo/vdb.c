@@ -0,0 +1,578 @@
+/**
+ * @file
+ * @brief Implementacion del formato en disco de la base de datos de versiones
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ */
+
+#include "vdb.h"
+#include "vindex.h"
+
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#define CRC32C_POLY 0x82f63b78 /**< Polinomio de CRC-32C (Castagnoli), reflejado */
+
+/**
+ * @brief Encabezado de un registro del formato 2 (sin checksum)
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t filename_len;       /**< Longitud del nombre del archivo */
+    uint8_t comment_len;         /**< Longitud del comentario */
+    uint8_t type;                /**< VDB_TYPE(tipo de registro, tipo de digest) */
+    uint8_t digest[DIGEST_SIZE]; /**< Digest binario del contenido */
+} vdb_record_header_v2;
+
+/**
+ * @brief Registro de tamano fijo del formato 1 (file_version con el hash
+ * en hexadecimal)
+ */
+typedef struct __attribute__((aligned(512))) {
+    char filename[PATH_MAX];    /**< Nombre del archivo original */
+    char hash[HASH_SIZE];       /**< Hash en hexadecimal */
+    char comment[COMMENT_SIZE]; /**< Comentario del usuario */
+} vdb_record_v1;
+
+/**
+ * @brief Migra una base de datos de un formato anterior: registros
+ * file_version de tamano fijo (formato 1) o registros sin checksum
+ * (formato 2). La nueva base de datos se escribe aparte y reemplaza a la
+ * anterior mediante rename, por lo que una migracion interrumpida no
+ * pierde datos.
+ *
+ * @param format Formato de la base de datos actual
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int migrate(int format);
+
+/** Tabla de CRC-32C por byte */
+static uint32_t crc_table[256];
+
+/**
+ * @brief Llena la tabla de CRC-32C.
+ */
+__attribute__((constructor))
+static void crc_init(void) {
+    uint32_t i, j, crc;
+
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (j = 0; j < 8; j++) crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc_table[i] = crc;
+    }
+}
+
+static uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+    const uint8_t *p = data;
+
+    while (len-- > 0) crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+/**
+ * @brief Calcula el checksum de un registro codificado, con el campo
+ * checksum en 0.
+ */
+static uint32_t record_checksum(const char *record, size_t len) {
+    const vdb_record_header *h = (const vdb_record_header *)record;
+    size_t before = offsetof(vdb_record_header, checksum);
+    uint32_t zero = 0, crc = ~0u;
+
+    crc = crc32c(crc, record, before);
+    crc = crc32c(crc, &zero, sizeof zero);
+    crc = crc32c(crc, h->digest, len - offsetof(vdb_record_header, digest));
+    return ~crc;
+}
+
+/**
+ * @brief Valida la estructura del registro que inicia en buf.
+ * @return Longitud del registro, -1 si esta incompleto o no es valido.
+ */
+static ssize_t record_length(const char *buf, size_t avail) {
+    const vdb_record_header *h = (const vdb_record_header *)buf;
+    size_t len;
+
+    if (avail < sizeof *h) return -1;
+    len = sizeof *h + h->filename_len + h->comment_len;
+    if (len > avail
+            || (VDB_KIND(h->type) != VDB_KIND_VERSION && VDB_KIND(h->type) != VDB_KIND_COMMIT)
+            || h->filename_len == 0 || h->filename_len >= PATH_MAX
+            || h->comment_len >= COMMENT_SIZE) {
+        return -1;
+    }
+    return len;
+}
+
+/**
+ * @brief Mapeo de versions.db del proceso
+ */
+static struct {
+    int fd;          /**< Descriptor de versions.db */
+    ino_t ino;       /**< Inodo mapeado */
+    const char *map; /**< Inicio del mapeo */
+    size_t size;     /**< Bytes mapeados */
+} db = {-1, 0, NULL, 0};
+
+void digest_to_hex(const uint8_t *digest, char *hex) {
+    static const char lut[] = "0123456789abcdef";
+    int i;
+
+    for (i = 0; i < DIGEST_SIZE; i++) {
+        hex[2 * i] = lut[digest[i] >> 4];
+        hex[2 * i + 1] = lut[digest[i] & 15];
+    }
+    hex[2 * DIGEST_SIZE] = 0;
+}
+
+int hex_to_digest(const char *hex, uint8_t *digest) {
+    int i;
+
+    for (i = 0; i < 2 * DIGEST_SIZE; i++) {
+        char c = hex[i];
+        int nibble;
+
+        if (c >= '0' && c <= '9') nibble = c - '0';
+        else if (c >= 'a' && c <= 'f') nibble = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') nibble = c - 'A' + 10;
+        else return -1;
+
+        if (i % 2 == 0) digest[i / 2] = nibble << 4;
+        else digest[i / 2] |= nibble;
+    }
+    return hex[2 * DIGEST_SIZE] == 0 ? 0 : -1;
+}
+
+ssize_t vdb_encode(const file_version *v, char *buf) {
+    return vdb_encode_kind(v, VDB_KIND_VERSION, buf);
+}
+
+ssize_t vdb_encode_kind(const file_version *v, int kind, char *buf) {
+    vdb_record_header *h = (vdb_record_header *)buf;
+    size_t filename_len = strlen(v->filename);
+    size_t comment_len = strnlen(v->comment, COMMENT_SIZE - 1);
+
+    if (filename_len == 0 || filename_len >= PATH_MAX) return -1;
+
+    memcpy(h->digest, v->digest, DIGEST_SIZE);
+    h->filename_len = filename_len;
+    h->comment_len = comment_len;
+    h->type = VDB_TYPE(kind, v->hash_type);
+    memcpy(buf + sizeof *h, v->filename, filename_len);
+    memcpy(buf + sizeof *h + filename_len, v->comment, comment_len);
+    h->checksum = record_checksum(buf, sizeof *h + filename_len + comment_len);
+    return sizeof *h + filename_len + comment_len;
+}
+
+int vdb_map(void) {
+    struct stat s;
+    vdb_header *h;
+    void *map;
+
+    // Si versions.db fue reemplazada (migracion, compactacion) se abre de nuevo
+    if (db.fd >= 0 && (stat(VERSIONS_DB_PATH, &s) < 0 || s.st_ino != db.ino)) vdb_unmap();
+
+    if (db.fd < 0) {
+        if ((db.fd = open(VERSIONS_DB_PATH, O_RDONLY)) < 0) return -1;
+    }
+    if (fstat(db.fd, &s) < 0 || (size_t)s.st_size < sizeof(vdb_header)) {
+        vdb_unmap();
+        return -1;
+    }
+    db.ino = s.st_ino;
+
+    // La base de datos es de solo adicion: el mapeo solo cambia si crecio
+    if (db.map != NULL && (size_t)s.st_size == db.size) return 0;
+
+    map = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, db.fd, 0);
+    if (map == MAP_FAILED) {
+        vdb_unmap();
+        return -1;
+    }
+    if (db.map != NULL) munmap((void *)db.map, db.size);
+    db.map = map;
+    db.size = s.st_size;
+
+    h = (vdb_header *)db.map;
+    if (h->magic != VDB_MAGIC || h->format != VDB_FORMAT) {
+        vdb_unmap();
+        return -1;
+    }
+    return 0;
+}
+
+void vdb_unmap(void) {
+    if (db.map != NULL) munmap((void *)db.map, db.size);
+    if (db.fd >= 0) close(db.fd);
+    db.map = NULL;
+    db.size = 0;
+    db.fd = -1;
+}
+
+off_t vdb_size(void) {
+    return db.size;
+}
+
+ino_t vdb_ino(void) {
+    return db.ino;
+}
+
+void vdb_advise(int advice) {
+    if (db.map != NULL) madvise((void *)db.map, db.size, advice);
+}
+
+ssize_t vdb_record_at(off_t offset, vdb_record *r) {
+    const vdb_record_header *h;
+    size_t end = ((const vdb_header *)db.map)->committed;
+    ssize_t len;
+
+    // Solo se leen los registros confirmados: la cola puede estar a medio
+    // escribir
+    if (end > db.size) end = db.size;
+    if (offset < vdb_first() || (size_t)offset >= end) return 0;
+    if ((len = record_length(db.map + offset, end - offset)) < 0) return -1;
+
+    h = (const vdb_record_header *)(db.map + offset);
+    r->header = h;
+    r->filename = (const char *)(h + 1);
+    r->comment = r->filename + h->filename_len;
+    return len;
+}
+
+void vdb_to_version(const vdb_record *r, file_version *v) {
+    memset(v, 0, sizeof *v);
+    memcpy(v->filename, r->filename, r->header->filename_len);
+    memcpy(v->comment, r->comment, r->header->comment_len);
+    memcpy(v->digest, r->header->digest, DIGEST_SIZE);
+    v->hash_type = VDB_HASH(r->header->type);
+}
+
+int vdb_filename_equals(const vdb_record *r, const char *filename) {
+    size_t len = r->header->filename_len;
+    return strncmp(r->filename, filename, len) == 0 && filename[len] == 0;
+}
+
+/**
+ * @brief Lee el siguiente registro de una base de datos de formato
+ * anterior.
+ * @return 1 si se leyo un registro, 0 al final (un registro incompleto se
+ * descarta), -1 si el registro no es valido.
+ */
+static int read_old_record(FILE *src, int format, file_version *v) {
+    vdb_record_header_v2 h;
+    vdb_record_v1 old;
+
+    if (format == 1) {
+        if (fread(&old, sizeof old, 1, src) != 1) return 0;
+        memset(v, 0, sizeof *v);
+        memcpy(v->filename, old.filename, PATH_MAX - 1);
+        memcpy(v->comment, old.comment, COMMENT_SIZE - 1);
+        return hex_to_digest(old.hash, v->digest) == 0 ? 1 : -1;
+    }
+
+    memset(v, 0, sizeof *v);
+    if (fread(&h, sizeof h, 1, src) != 1 || h.filename_len == 0 || h.filename_len >= PATH_MAX
+            || h.comment_len >= COMMENT_SIZE
+            || fread(v->filename, 1, h.filename_len, src) != h.filename_len
+            || fread(v->comment, 1, h.comment_len, src) != h.comment_len) {
+        return 0;
+    }
+    memcpy(v->digest, h.digest, DIGEST_SIZE);
+    return 1;
+}
+
+static int migrate(int format) {
+    char tmp_path[PATH_MAX];
+    char buf[VDB_RECORD_MAX];
+    vdb_header h = {VDB_MAGIC, VDB_FORMAT, sizeof h};
+    file_version v;
+    FILE *src, *dst;
+    ssize_t len;
+    int ok = 1, status;
+
+    snprintf(tmp_path, PATH_MAX, "%s.tmp", VERSIONS_DB_PATH);
+    if ((src = fopen(VERSIONS_DB_PATH, "rb")) == NULL) return -1;
+    if ((dst = fopen(tmp_path, "wb")) == NULL) {
+        fclose(src);
+        return -1;
+    }
+
+    // El formato 2 tiene un encabezado de 8 bytes; el formato 1 no tiene
+    if (format == 2) fseek(src, 2 * sizeof(uint32_t), SEEK_SET);
+
+    ok = fwrite(&h, sizeof h, 1, dst) == 1;
+    while (ok && (status = read_old_record(src, format, &v)) != 0) {
+        len = status > 0 ? vdb_encode(&v, buf) : -1;
+        ok = len > 0 && fwrite(buf, len, 1, dst) == 1;
+        h.committed += len;
+    }
+
+    // El tamano confirmado se conoce al final
+    ok = ok && !ferror(src) && fseek(dst, 0, SEEK_SET) == 0 && fwrite(&h, sizeof h, 1, dst) == 1
+        && fflush(dst) == 0 && fsync(fileno(dst)) == 0;
+    fclose(src);
+    if (fclose(dst) != 0) ok = 0;
+
+    if (!ok || rename(tmp_path, VERSIONS_DB_PATH) < 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+
+    // Las posiciones de los registros cambiaron: el indice se reconstruye
+    unlink(VERSIONS_IDX_PATH);
+    return 0;
+}
+
+/**
+ * @brief Lee todo el rango pedido de un descriptor.
+ * @return 0 en caso de exito, -1 si ocurre un error o el archivo es mas
+ * corto.
+ */
+static int pread_all(int fd, void *buf, size_t len, off_t offset) {
+    char *p = buf;
+
+    while (len > 0) {
+        ssize_t nread = pread(fd, p, len, offset);
+        if (nread < 0 && errno == EINTR) continue;
+        if (nread <= 0) return -1;
+        p += nread;
+        len -= nread;
+        offset += nread;
+    }
+    return 0;
+}
+
+/**
+ * @brief Recupera la cola sin confirmar de versions.db. Se revisan solo
+ * los bytes despues del tamano confirmado: los registros completos con
+ * checksum valido se sincronizan y confirman, y el archivo se trunca en el
+ * primer registro incompleto o danado. Se debe llamar con el candado de
+ * escritura.
+ *
+ * @param fd Descriptor de versions.db abierto para lectura y escritura
+ * @param h Encabezado, actualizado con el nuevo tamano confirmado
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int recover(int fd, vdb_header *h) {
+    struct stat s;
+    char *tail;
+    size_t len, offset = 0;
+    ssize_t n;
+
+    if (fstat(fd, &s) < 0 || pread_all(fd, h, sizeof *h, 0) < 0) return -1;
+    if (h->committed < sizeof *h || h->committed > (uint64_t)s.st_size) h->committed = sizeof *h;
+    if (h->committed == (uint64_t)s.st_size) return 0;
+
+    len = s.st_size - h->committed;
+    if ((tail = malloc(len)) == NULL) return -1;
+    if (pread_all(fd, tail, len, h->committed) < 0) {
+        free(tail);
+        return -1;
+    }
+    while ((n = record_length(tail + offset, len - offset)) > 0
+            && ((vdb_record_header *)(tail + offset))->checksum == record_checksum(tail + offset, n)) {
+        offset += n;
+    }
+    free(tail);
+
+    if (offset < len && ftruncate(fd, h->committed + offset) < 0) return -1;
+    if (fdatasync(fd) < 0) return -1;
+    h->committed += offset;
+    return pwrite(fd, h, sizeof *h, 0) == sizeof *h ? 0 : -1;
+}
+
+/**
+ * @brief Abre versions.db para escritura con el candado de escritura.
+ * Si mientras se esperaba el candado otro proceso reemplazo la base de
+ * datos (compactacion), se abre la nueva.
+ * @return Descriptor con el candado, -1 si ocurre un error.
+ */
+static int lock_db(void) {
+    struct stat s, current;
+    int fd;
+
+    for (;;) {
+        if ((fd = open(VERSIONS_DB_PATH, O_RDWR)) < 0) return -1;
+        if (flock(fd, LOCK_EX) < 0 || fstat(fd, &s) < 0 || stat(VERSIONS_DB_PATH, &current) < 0) {
+            close(fd);
+            return -1;
+        }
+        if (s.st_ino == current.st_ino) return fd;
+        close(fd);
+    }
+}
+
+int vdb_append(const char *records, size_t len) {
+    vdb_header h;
+    size_t written = 0;
+    int fd, ok;
+
+    // Un solo escritor a la vez: los registros se escriben justo despues
+    // de los confirmados
+    if ((fd = lock_db()) < 0) return -1;
+    if (recover(fd, &h) < 0) {
+        close(fd);
+        return -1;
+    }
+    while (written < len) {
+        ssize_t nwritten = pwrite(fd, records + written, len - written, h.committed + written);
+        if (nwritten < 0 && errno == EINTR) continue;
+        if (nwritten <= 0) break;
+        written += nwritten;
+    }
+
+    // Group commit: un solo fdatasync para todo el lote. El encabezado se
+    // actualiza despues; si esa escritura se pierde, la recuperacion
+    // confirma los registros por su checksum
+    ok = written == len && fdatasync(fd) == 0;
+    if (ok) {
+        h.committed += len;
+        ok = pwrite(fd, &h, sizeof h, 0) == sizeof h;
+    }
+    close(fd);
+    return ok ? 0 : -1;
+}
+
+int vdb_init(void) {
+    struct stat s;
+    vdb_header h;
+    uint32_t old[2];
+    int fd, result;
+
+    if ((fd = open(VERSIONS_DB_PATH, O_RDWR | O_CREAT, 0644)) < 0) return -1;
+
+    if (fstat(fd, &s) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    // Base de datos nueva: solo contiene el encabezado
+    if (s.st_size == 0) {
+        h.magic = VDB_MAGIC;
+        h.format = VDB_FORMAT;
+        h.committed = sizeof h;
+        if (write(fd, &h, sizeof h) != sizeof h) {
+            close(fd);
+            return -1;
+        }
+        close(fd);
+        return 0;
+    }
+
+    if (pread(fd, old, sizeof old, 0) == sizeof old && old[0] == VDB_MAGIC) {
+        if (old[1] != VDB_FORMAT) {
+            close(fd);
+            return old[1] == 2 ? migrate(2) : -1;
+        }
+
+        // Solo se recupera si hay una cola sin confirmar
+        result = 0;
+        if (pread(fd, &h, sizeof h, 0) != sizeof h || h.committed != (uint64_t)s.st_size) {
+            close(fd);
+            if ((fd = lock_db()) < 0) return -1;
+            result = recover(fd, &h);
+        }
+        close(fd);
+        return result;
+    }
+    close(fd);
+
+    // Formato anterior: registros de tamano fijo (vdb_record_v1). Un
+    // registro incompleto al final (una adicion interrumpida) se descarta
+    // al migrar, como en el formato 2
+    return migrate(1);
+}
+
+void vdb_compact_begin(vdb_compaction *c) {
+    memset(c, 0, sizeof *c);
+    c->ino = vdb_map() == 0 ? (uint64_t)db.ino : 0;
+    c->from = vdb_first();
+}
+
+/**
+ * @brief Copia a out los registros que no son duplicados desde c->from,
+ * hasta agotar *budget (NULL: sin limite) o llegar al final de los
+ * registros confirmados.
+ * @return Longitud del siguiente registro (0 al final), -1 si ocurre un
+ * error.
+ */
+static ssize_t copy_unique(vdb_compaction *c, long *budget, FILE *out, vdb_duplicate duplicate, void *ctx,
+                           long *removed) {
+    vdb_record r;
+    ssize_t len;
+
+    while ((len = vdb_record_at(c->from, &r)) > 0 && (budget == NULL || *budget > 0)) {
+        if (duplicate(&r, c->from, ctx)) {
+            (*removed)++;
+        } else if (fwrite(r.header, len, 1, out) != 1) {
+            return -1;
+        }
+        c->from += len;
+        if (budget != NULL) (*budget)--;
+    }
+    return len;
+}
+
+int vdb_compact_step(vdb_compaction *c, long *budget, vdb_duplicate duplicate, void *ctx, long *removed) {
+    char tmp_path[PATH_MAX];
+    vdb_header h = {VDB_MAGIC, VDB_FORMAT, 0};
+    ssize_t len;
+    long position = 0;
+    FILE *out;
+    int fd, lock = -1, ok;
+
+    if (vdb_map() < 0) return -1;
+
+    // Las posiciones copiadas solo valen para la misma base de datos
+    if (c->ino != (uint64_t)db.ino) vdb_compact_begin(c);
+
+    // La copia continua desde los bytes confirmados en la ejecucion
+    // anterior; lo escrito despues se descarta
+    snprintf(tmp_path, PATH_MAX, "%s.compact", VERSIONS_DB_PATH);
+    if ((fd = open(tmp_path, O_RDWR | O_CREAT, 0644)) < 0) return -1;
+    if (c->written < sizeof h) {
+        ok = ftruncate(fd, 0) == 0 && write(fd, &h, sizeof h) == sizeof h;
+        c->written = sizeof h;
+    } else {
+        ok = ftruncate(fd, c->written) == 0 && lseek(fd, c->written, SEEK_SET) >= 0;
+    }
+    if (!ok || (out = fdopen(fd, "r+b")) == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    // 1. Sin candado: a lo sumo *budget registros confirmados
+    vdb_advise(MADV_SEQUENTIAL);
+    len = copy_unique(c, budget, out, duplicate, ctx, removed);
+    if (len != 0) {
+        ok = len > 0 && fflush(out) == 0 && fdatasync(fileno(out)) == 0 && (position = ftell(out)) > 0;
+        if (fclose(out) != 0) ok = 0;
+        if (!ok) return -1;
+        c->written = position;
+        return 0;
+    }
+
+    // 2. Con el candado de escritura solo se copian los registros
+    // adicionados mientras tanto, y la nueva base de datos se publica
+    ok = (lock = lock_db()) >= 0 && recover(lock, &h) == 0 && vdb_map() == 0 && (uint64_t)db.ino == c->ino
+        && copy_unique(c, NULL, out, duplicate, ctx, removed) == 0;
+    if (ok && (h.committed = ftell(out)) > 0) {
+        ok = fseek(out, 0, SEEK_SET) == 0 && fwrite(&h, sizeof h, 1, out) == 1
+            && fflush(out) == 0 && fsync(fileno(out)) == 0;
+    }
+    if (fclose(out) != 0) ok = 0;
+
+    if (!ok || rename(tmp_path, VERSIONS_DB_PATH) < 0) {
+        unlink(tmp_path);
+        if (lock >= 0) close(lock);
+        vdb_compact_begin(c);
+        return -1;
+    }
+
+    // El indice detecta el cambio de inodo y se reconstruye
+    close(lock);
+    return 1;
+}
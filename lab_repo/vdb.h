@@ -0,0 +1,256 @@
+/**
+ * @file
+ * @brief Formato en disco de la base de datos de versiones
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * versions.db inicia con un encabezado (vdb_header) seguido de registros
+ * de longitud variable. Cada registro tiene un encabezado fijo
+ * (vdb_record_header) con el digest binario y un CRC-32C del registro,
+ * seguido del nombre del archivo y del comentario, ambos sin el caracter
+ * nulo.
+ *
+ * La base de datos funciona como un log de escritura anticipada: un lote
+ * de registros se adiciona con una sola escritura y un solo fdatasync
+ * (group commit), y despues se actualiza en el encabezado el tamano
+ * confirmado. Los lectores solo ven los registros confirmados. Al abrir
+ * el repositorio solo se revisa la cola sin confirmar: los registros con
+ * checksum valido se confirman y desde el primero incompleto o danado se
+ * trunca el archivo.
+ *
+ * Las bases de datos de formatos anteriores (registros file_version de
+ * tamano fijo, registros sin checksum) se migran automaticamente al abrir
+ * el repositorio.
+ */
+
+#ifndef VDB_H
+#define VDB_H
+
+#include <stdint.h>
+#include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "versions.h"
+
+#define VDB_MAGIC 0x42445256 /**< "VRDB" en little endian */
+#define VDB_FORMAT 3 /**< Version del formato (1: tamano fijo, 2: sin checksum) */
+
+#define VDB_KIND_VERSION 1 /**< Registro de version de un archivo */
+#define VDB_KIND_COMMIT 2 /**< Registro de un commit del directorio (ver vtree.h) */
+#define VDB_HASH_SHA256 0 /**< Digest SHA-256 del contenido */
+#define VDB_HASH_TREE 1 /**< Digest de arbol del contenido (ver vthash.h) */
+
+#define VDB_KIND(type) ((type) & 0x0f) /**< Tipo de registro */
+#define VDB_HASH(type) ((type) >> 4) /**< Tipo de digest */
+#define VDB_TYPE(kind, hash) ((kind) | ((hash) << 4)) /**< Combina tipo de registro y digest */
+
+/**
+ * @brief Encabezado de versions.db
+ */
+typedef struct {
+    uint32_t magic;     /**< VDB_MAGIC */
+    uint32_t format;    /**< VDB_FORMAT */
+    uint64_t committed; /**< Bytes sincronizados y visibles, incluido el encabezado */
+} vdb_header;
+
+/**
+ * @brief Encabezado de un registro
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t filename_len;       /**< Longitud del nombre del archivo */
+    uint8_t comment_len;         /**< Longitud del comentario */
+    uint8_t type;                /**< VDB_TYPE(tipo de registro, tipo de digest) */
+    uint32_t checksum;           /**< CRC-32C del registro, calculado con este campo en 0 */
+    uint8_t digest[DIGEST_SIZE]; /**< Digest binario del contenido */
+} vdb_record_header;
+
+/** Tamano maximo de un registro codificado */
+#define VDB_RECORD_MAX (sizeof(vdb_record_header) + PATH_MAX + COMMENT_SIZE)
+
+/**
+ * @brief Crea la base de datos o migra el formato anterior.
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+int vdb_init(void);
+
+/**
+ * @brief Codifica una version como registro.
+ *
+ * @param v Version a codificar
+ * @param buf Buffer de al menos VDB_RECORD_MAX bytes
+ *
+ * @return Longitud del registro, -1 si la version no es valida.
+ */
+ssize_t vdb_encode(const file_version *v, char *buf);
+
+/**
+ * @brief Codifica un registro de un tipo dado.
+ *
+ * @param v Nombre, digest y comentario del registro
+ * @param kind VDB_KIND_VERSION o VDB_KIND_COMMIT
+ * @param buf Buffer de al menos VDB_RECORD_MAX bytes
+ *
+ * @return Longitud del registro, -1 si el registro no es valido.
+ */
+ssize_t vdb_encode_kind(const file_version *v, int kind, char *buf);
+
+/**
+ * @brief Adiciona registros a versions.db y los confirma con un solo
+ * fdatasync.
+ *
+ * @param records Registros codificados con vdb_encode
+ * @param len Bytes de los registros
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+int vdb_append(const char *records, size_t len);
+
+/**
+ * @brief Registro de versions.db visto en el mapeo, sin copiarlo.
+ * Las cadenas no terminan en caracter nulo. Los apuntadores dejan de ser
+ * validos cuando vdb_map vuelve a mapear la base de datos.
+ */
+typedef struct {
+    const vdb_record_header *header; /**< Encabezado del registro */
+    const char *filename;            /**< Nombre (header->filename_len bytes) */
+    const char *comment;             /**< Comentario (header->comment_len bytes) */
+} vdb_record;
+
+/**
+ * @brief Mapea versions.db en memoria.
+ * El mapeo se crea una vez por proceso; llamadas posteriores solo lo
+ * extienden si la base de datos crecio o la vuelven a abrir si fue
+ * reemplazada.
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+int vdb_map(void);
+
+/**
+ * @brief Libera el mapeo de versions.db.
+ */
+void vdb_unmap(void);
+
+/**
+ * @brief Tamano de versions.db al momento del ultimo vdb_map.
+ */
+off_t vdb_size(void);
+
+/**
+ * @brief Inodo de versions.db al momento del ultimo vdb_map.
+ */
+ino_t vdb_ino(void);
+
+/**
+ * @brief Indica al kernel como se va a recorrer el mapeo (madvise).
+ *
+ * @param advice MADV_SEQUENTIAL, MADV_RANDOM, ...
+ */
+void vdb_advise(int advice);
+
+/**
+ * @brief Posicion del primer registro.
+ */
+#define vdb_first() ((off_t)sizeof(vdb_header))
+
+/**
+ * @brief Obtiene el registro que inicia en offset, sin copiarlo.
+ *
+ * @param offset Posicion del registro
+ * @param r Registro leido
+ *
+ * @return Longitud del registro, 0 al final de los registros confirmados,
+ * -1 si el registro no es valido.
+ */
+ssize_t vdb_record_at(off_t offset, vdb_record *r);
+
+/**
+ * @brief Copia un registro a una estructura file_version.
+ *
+ * @param r Registro
+ * @param v Version en memoria
+ */
+void vdb_to_version(const vdb_record *r, file_version *v);
+
+/**
+ * @brief Verifica si el nombre de un registro es filename.
+ *
+ * @return 1 si coincide, 0 en caso contrario.
+ */
+int vdb_filename_equals(const vdb_record *r, const char *filename);
+
+/**
+ * @brief Avance de una compactacion de versions.db, guardado por quien la
+ * ejecuta entre llamadas a vdb_compact_step
+ */
+typedef struct {
+    uint64_t ino;     /**< Inodo de versions.db al iniciar */
+    uint64_t from;    /**< Posicion del siguiente registro a copiar */
+    uint64_t written; /**< Bytes confirmados en la copia (versions.db.compact) */
+} vdb_compaction;
+
+/**
+ * @brief Decide si un registro es un duplicado que se elimina.
+ *
+ * @param r Registro
+ * @param offset Posicion del registro en versions.db
+ * @param ctx Contexto de quien compacta
+ *
+ * @return 1 si se elimina, 0 si se conserva.
+ */
+typedef int (*vdb_duplicate)(const vdb_record *r, off_t offset, void *ctx);
+
+/**
+ * @brief Inicia una compactacion desde el primer registro.
+ */
+void vdb_compact_begin(vdb_compaction *c);
+
+/**
+ * @brief Avanza una compactacion de versions.db: copia a
+ * versions.db.compact hasta *budget registros, sin los duplicados. La copia
+ * se confirma con fdatasync en cada llamada, asi que la siguiente continua
+ * desde c->written. Al llegar al final, con el candado de escritura se
+ * copian los registros adicionados mientras tanto y la nueva base de datos
+ * reemplaza a la anterior mediante rename. Si la base de datos fue
+ * reemplazada, la compactacion inicia de nuevo.
+ *
+ * @param c Avance de la compactacion
+ * @param budget Registros a procesar; se descuentan los procesados
+ * @param duplicate Decide que registros se eliminan
+ * @param ctx Contexto de duplicate
+ * @param removed Se incrementa con cada registro eliminado
+ *
+ * @return 1 si la nueva base de datos se publico, 0 si queda trabajo
+ * pendiente, -1 si ocurre un error.
+ */
+int vdb_compact_step(vdb_compaction *c, long *budget, vdb_duplicate duplicate, void *ctx, long *removed);
+
+/**
+ * @brief Compara dos digests con cargas de ancho fijo (una de 256 bits
+ * con AVX2, dos de 128 bits con SSE2), sin recorrerlos byte a byte.
+ *
+ * @return 1 si son iguales, 0 en caso contrario.
+ */
+static inline int digest_equals(const uint8_t *a, const uint8_t *b) {
+#ifdef __AVX2__
+    __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)a), _mm256_loadu_si256((const __m256i *)b));
+    return _mm256_testz_si256(x, x);
+#elif defined(__SSE2__)
+    __m128i lo = _mm_xor_si128(_mm_loadu_si128((const __m128i *)a), _mm_loadu_si128((const __m128i *)b));
+    __m128i hi = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(a + 16)), _mm_loadu_si128((const __m128i *)(b + 16)));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(lo, hi), _mm_setzero_si128())) == 0xffff;
+#else
+    uint64_t x[4], y[4];
+    memcpy(x, a, DIGEST_SIZE);
+    memcpy(y, b, DIGEST_SIZE);
+    return ((x[0] ^ y[0]) | (x[1] ^ y[1]) | (x[2] ^ y[2]) | (x[3] ^ y[3])) == 0;
+#endif
+}
+
+#endif
@@ -0,0 +1,309 @@
+/**
+ * @file
+ * @brief Implementacion de las diferencias binarias
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ */
+
+#include "vdelta.h"
+#include "fcopy.h"
+#include "vdb.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+
+#define DELTA_MAGIC 0x544c4456 /**< "VDLT" en little endian */
+#define DELTA_FORMAT 1 /**< Version del formato */
+
+#define DELTA_INSERT 0 /**< Operacion: insertar bytes literales */
+#define DELTA_COPY 1 /**< Operacion: copiar un rango de la base */
+
+#define ROLL_BASE 0x01000193u /**< Multiplicador del hash rodante */
+
+/**
+ * @brief Encabezado de un objeto guardado como diferencia
+ */
+typedef struct {
+    uint32_t magic;            /**< DELTA_MAGIC */
+    uint32_t format;           /**< DELTA_FORMAT */
+    uint32_t depth;            /**< Profundidad de la cadena (1: la base esta completa) */
+    uint32_t reserved;         /**< Sin uso */
+    uint64_t size;             /**< Tamano del objeto reconstruido */
+    uint8_t base[DIGEST_SIZE]; /**< Digest de la base */
+} delta_header;
+
+char *delta_path(const char *hash, char *path) {
+    snprintf(path, PATH_MAX, "%s/%s" DELTA_SUFFIX, VERSIONS_DIR, hash);
+    return path;
+}
+
+/**
+ * @brief Lee el encabezado de una diferencia.
+ * @return Descriptor de la diferencia posicionado despues del encabezado,
+ * -1 si el objeto no es una diferencia valida.
+ */
+static int open_delta(const char *hash, delta_header *h) {
+    char path[PATH_MAX];
+    int fd;
+
+    if ((fd = open(delta_path(hash, path), O_RDONLY)) < 0) return -1;
+    if (read(fd, h, sizeof *h) != sizeof *h || h->magic != DELTA_MAGIC || h->format != DELTA_FORMAT) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int delta_depth(const char *hash) {
+    delta_header h;
+    int fd;
+
+    if ((fd = open_delta(hash, &h)) < 0) return 0;
+    close(fd);
+    return h.depth;
+}
+
+int delta_base(const char *hash, char *base_hash) {
+    delta_header h;
+    int fd;
+
+    if ((fd = open_delta(hash, &h)) < 0) return -1;
+    close(fd);
+    digest_to_hex(h.base, base_hash);
+    return 0;
+}
+
+static void put_varint(FILE *out, uint64_t value) {
+    while (value >= 0x80) {
+        putc((value & 0x7f) | 0x80, out);
+        value >>= 7;
+    }
+    putc(value, out);
+}
+
+static int get_varint(FILE *in, uint64_t *value) {
+    int shift, c;
+
+    *value = 0;
+    for (shift = 0; shift < 64; shift += 7) {
+        if ((c = getc(in)) == EOF) return -1;
+        *value |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) return 0;
+    }
+    return -1;
+}
+
+static void put_insert(FILE *out, const uint8_t *data, size_t len) {
+    if (len == 0) return;
+    putc(DELTA_INSERT, out);
+    put_varint(out, len);
+    fwrite(data, 1, len, out);
+}
+
+static uint32_t block_hash(const uint8_t *p) {
+    uint32_t h = 0;
+    int i;
+
+    for (i = 0; i < DELTA_BLOCK; i++) h = h * ROLL_BASE + p[i];
+    return h;
+}
+
+/**
+ * @brief Codifica target como diferencia contra base.
+ * Se indexan los bloques alineados de la base; el hash rodante recorre el
+ * objeto byte a byte buscando bloques iguales.
+ *
+ * @return 0 en caso de exito, -1 si no hay memoria.
+ */
+static int encode(const uint8_t *base, size_t base_size, const uint8_t *target, size_t target_size, FILE *out) {
+    uint32_t *table, h = 0, out_factor = 1;
+    size_t nblocks = base_size / DELTA_BLOCK;
+    size_t i, start = 0, off;
+    int bits = 1;
+
+    // Tabla de bloques de la base: posicion + 1, 0 si la entrada esta libre
+    while (((size_t)1 << bits) < 2 * nblocks) bits++;
+    if ((table = calloc((size_t)1 << bits, sizeof *table)) == NULL) return -1;
+    for (off = 0; off + DELTA_BLOCK <= base_size; off += DELTA_BLOCK) {
+        table[(block_hash(base + off) * 0x9e3779b1u) >> (32 - bits)] = off + 1;
+    }
+
+    for (i = 0; i < DELTA_BLOCK - 1; i++) out_factor *= ROLL_BASE;
+
+    i = 0;
+    if (target_size >= DELTA_BLOCK) h = block_hash(target);
+    while (i + DELTA_BLOCK <= target_size) {
+        uint32_t slot = table[(h * 0x9e3779b1u) >> (32 - bits)];
+
+        if (slot != 0 && memcmp(base + slot - 1, target + i, DELTA_BLOCK) == 0) {
+            size_t base_off = slot - 1, len = DELTA_BLOCK;
+
+            // La coincidencia se extiende hacia atras, sobre los literales
+            // pendientes, y hacia adelante
+            while (i > start && base_off > 0 && base[base_off - 1] == target[i - 1]) {
+                i--;
+                base_off--;
+                len++;
+            }
+            while (i + len < target_size && base_off + len < base_size
+                    && base[base_off + len] == target[i + len]) {
+                len++;
+            }
+
+            put_insert(out, target + start, i - start);
+            putc(DELTA_COPY, out);
+            put_varint(out, base_off);
+            put_varint(out, len);
+
+            i += len;
+            start = i;
+            if (i + DELTA_BLOCK <= target_size) h = block_hash(target + i);
+            continue;
+        }
+
+        if (i + DELTA_BLOCK == target_size) break;
+        h = (h - target[i] * out_factor) * ROLL_BASE + target[i + DELTA_BLOCK];
+        i++;
+    }
+    put_insert(out, target + start, target_size - start);
+
+    free(table);
+    return 0;
+}
+
+/**
+ * @brief Mapea un descriptor completo en memoria.
+ * @return Inicio del mapeo, NULL si ocurre un error.
+ */
+static uint8_t *map_fd(int fd, size_t size) {
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return NULL;
+    madvise(map, size, MADV_SEQUENTIAL);
+    return map;
+}
+
+int delta_store(staged_object *o, const char *base_hash, int max_depth) {
+    char tmp_path[PATH_MAX], path[PATH_MAX];
+    delta_header h;
+    struct stat bs;
+    uint8_t *base = NULL, *target = NULL;
+    FILE *out = NULL;
+    long delta_size;
+    int base_fd = -1, target_fd = -1, fd;
+    int result = 1;
+
+    memset(&h, 0, sizeof h);
+    h.magic = DELTA_MAGIC;
+    h.format = DELTA_FORMAT;
+    h.depth = delta_depth(base_hash) + 1;
+    h.size = o->size;
+    if (h.depth > (uint32_t)max_depth || o->compressed || o->size < DELTA_MIN_SIZE || o->size > DELTA_MAX_SIZE
+            || hex_to_digest(base_hash, h.base) < 0) {
+        return 1;
+    }
+
+    if ((base_fd = object_open(base_hash)) < 0) return 1;
+    if (fstat(base_fd, &bs) < 0 || bs.st_size < DELTA_BLOCK || bs.st_size > DELTA_MAX_SIZE
+            || (base = map_fd(base_fd, bs.st_size)) == NULL
+            || (target_fd = open(o->tmp_path, O_RDONLY)) < 0
+            || (target = map_fd(target_fd, o->size)) == NULL) {
+        goto done;
+    }
+
+    snprintf(tmp_path, PATH_MAX, "%s/" OBJECT_TMP_PREFIX "XXXXXX", VERSIONS_DIR);
+    if ((fd = mkstemp(tmp_path)) < 0 || (out = fdopen(fd, "wb")) == NULL) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        result = -1;
+        goto done;
+    }
+    fchmod(fd, 0444);
+
+    if (fwrite(&h, sizeof h, 1, out) != 1 || encode(base, bs.st_size, target, o->size, out) < 0) {
+        result = -1;
+    } else if ((delta_size = ftell(out)) < 0 || delta_size >= o->size / 2) {
+        // La diferencia no ahorra suficiente espacio
+        result = 1;
+    } else {
+        result = 0;
+    }
+    if (fclose(out) != 0 && result == 0) result = -1;
+
+    if (result == 0 && rename(tmp_path, delta_path(o->hash, path)) == 0) {
+        object_discard(o);
+    } else {
+        unlink(tmp_path);
+        if (result == 0) result = -1;
+    }
+
+done:
+    if (target != NULL) munmap(target, o->size);
+    if (base != NULL) munmap(base, bs.st_size);
+    if (target_fd >= 0) close(target_fd);
+    close(base_fd);
+    return result;
+}
+
+/**
+ * @brief Escribe todo el buffer en un descriptor.
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t nwritten = write(fd, buf, len);
+        if (nwritten < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += nwritten;
+        len -= nwritten;
+    }
+    return 0;
+}
+
+int delta_reconstruct(const char *hash, int dst) {
+    char buf[1 << 16];
+    delta_header h;
+    char base_hash[2 * DIGEST_SIZE + 1];
+    uint64_t offset, len, total = 0;
+    FILE *in;
+    int fd, base_fd, op, ok = 1;
+
+    if ((fd = open_delta(hash, &h)) < 0) return -1;
+    if ((in = fdopen(fd, "rb")) == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    // La base se reconstruye primero (si es otra diferencia) en un archivo
+    // temporal; de ella solo se leen los rangos copiados
+    digest_to_hex(h.base, base_hash);
+    if ((base_fd = object_open(base_hash)) < 0) {
+        fclose(in);
+        return -1;
+    }
+
+    while (ok && (op = getc(in)) != EOF) {
+        if (op == DELTA_COPY) {
+            ok = get_varint(in, &offset) == 0 && get_varint(in, &len) == 0
+                && fcopy_range(base_fd, offset, len, dst) == (off_t)len;
+        } else if (op == DELTA_INSERT && get_varint(in, &len) == 0) {
+            uint64_t left = len;
+            while (ok && left > 0) {
+                size_t chunk = left < sizeof buf ? left : sizeof buf;
+                ok = fread(buf, 1, chunk, in) == chunk && write_all(dst, buf, chunk) == 0;
+                left -= chunk;
+            }
+        } else {
+            ok = 0;
+        }
+        total += len;
+    }
+
+    close(base_fd);
+    fclose(in);
+    return ok && total == h.size ? 0 : -1;
+}
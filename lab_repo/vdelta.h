@@ -0,0 +1,92 @@
+/**
+ * @file
+ * @brief Almacenamiento de versiones como diferencias binarias
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * En modo delta, una version nueva se guarda como una diferencia contra la
+ * version anterior del mismo archivo (la base), en .versions/<hash>.d. La
+ * diferencia es una secuencia de operaciones:
+ *
+ * - Copiar: (posicion, longitud) de la base.
+ * - Insertar: longitud seguida de los bytes literales.
+ *
+ * Las coincidencias se buscan con un hash rodante sobre bloques de
+ * DELTA_BLOCK bytes de la base, y se extienden byte a byte en ambas
+ * direcciones. Las posiciones y longitudes se codifican como varint.
+ *
+ * La base puede ser a su vez una diferencia; la profundidad de la cadena
+ * se limita al almacenar. Para reconstruir una version, cada eslabon se
+ * aplica leyendo la diferencia por bloques y copiando los rangos de la base
+ * con copy_file_range, por lo que la memoria usada no depende del tamano
+ * de los archivos.
+ */
+
+#ifndef VDELTA_H
+#define VDELTA_H
+
+#include "vobject.h"
+
+#define DELTA_SUFFIX ".d" /**< Sufijo de los objetos guardados como diferencia */
+#define DELTA_DEFAULT_DEPTH 10 /**< Profundidad maxima por defecto de una cadena */
+#define DELTA_BLOCK 32 /**< Bloque de la base que se indexa */
+#define DELTA_MIN_SIZE 512 /**< Archivos mas pequenos se guardan completos */
+#define DELTA_MAX_SIZE (256 << 20) /**< Archivos mas grandes se guardan completos */
+
+/**
+ * @brief Obtiene la ruta de un objeto guardado como diferencia.
+ *
+ * @param hash Hash del objeto
+ * @param path Buffer de PATH_MAX bytes
+ *
+ * @return Referencia al buffer
+ */
+char *delta_path(const char *hash, char *path);
+
+/**
+ * @brief Profundidad de la cadena de un objeto.
+ *
+ * @param hash Hash del objeto
+ *
+ * @return 0 si el objeto esta completo, n si es una diferencia sobre una
+ * cadena de n - 1 diferencias.
+ */
+int delta_depth(const char *hash);
+
+/**
+ * @brief Obtiene la base de una diferencia.
+ *
+ * @param hash Hash del objeto
+ * @param base_hash Buffer de HASH_SIZE bytes para el hash de la base
+ *
+ * @return 0 si el objeto es una diferencia, -1 en caso contrario.
+ */
+int delta_base(const char *hash, char *base_hash);
+
+/**
+ * @brief Intenta almacenar un objeto pendiente como diferencia contra base.
+ * La diferencia solo se guarda si ocupa menos de la mitad del objeto y la
+ * cadena resultante no supera max_depth.
+ *
+ * @param o Objeto pendiente (sin comprimir); el temporal se borra si se
+ * guarda la diferencia
+ * @param base_hash Hash de la version anterior del archivo
+ * @param max_depth Profundidad maxima de la cadena
+ *
+ * @return 0 si se guardo la diferencia, 1 si el objeto se debe guardar
+ * completo, -1 si ocurre un error.
+ */
+int delta_store(staged_object *o, const char *base_hash, int max_depth);
+
+/**
+ * @brief Reconstruye un objeto guardado como diferencia.
+ *
+ * @param hash Hash del objeto
+ * @param dst Descriptor de destino, vacio y abierto para escritura
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+int delta_reconstruct(const char *hash, int dst);
+
+#endif
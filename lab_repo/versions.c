@@ -8,44 +8,44 @@
  */
 
 #include "versions.h"
+#include "fcopy.h"
+#include "hashcache.h"
+#include "vbloom.h"
+#include "vdb.h"
+#include "vindex.h"
+#include "vobject.h"
+#include "vchunk.h"
+#include "vdelta.h"
+#include "vpack.h"
+#include "vstats.h"
+#include "vthash.h"
+#include "vtree.h"
 #include <libgen.h>
-
-/**
- * @brief Imprime la estructura que guarda la version
- * @param v version de archivo que se imprimirá
- */
- void print_struct(const file_version *v);
+#include <pthread.h>
+#include <sys/mman.h>
+#include <time.h>
 
 /**
  * @brief Crea una version en memoria del archivo
- * Valida si el archivo especificado existe y crea su hash
+ * Valida si el archivo especificado existe
  * @param filename Nombre del archivo
- * @param hash Hash del contenido del archivo
  * @param comment Comentario
+ * @param digest Digest del contenido del archivo
  * @param result Nueva version en memoria
  *
  * @return Resultado de la operacion
  */
-return_code create_version(char *filename, char *comment, file_version *result);
+return_code create_version(char *filename, char *comment, const uint8_t *digest, file_version *result);
 
 /**
  * @brief Verifica si existe una version para un archivo
  *
  * @param filename Nombre del archivo
- * @param hash Hash del contenido
+ * @param digest Digest del contenido
  *
  * @return 1 si la version existe, 0 en caso contrario.
  */
-int version_exists(char *filename, char *hash);
-
-/**
- * @brief retorna la version del archivo indicada
- * @param filename Nombre del archivo del cual se busca la version
- * @param version Version del archivo
- * @param v en la cual se va a guardar el resultado
- * @return estructura con los datos del archivo
- */
-int get_version(file_version *v, char *filename, int version);
+int version_exists(char *filename, const uint8_t *digest);
 
 /**
  * @brief Obtiene el hash de un archivo.
@@ -66,13 +66,48 @@ char *get_file_hash(char *filename, char *hash);
 return_code copy(char *source, char *destination);
 /**
  * @brief Almacena un archivo en el repositorio
+ * El archivo ya fue leido y copiado a un temporal por object_stage; el
+ * objeto queda con su hash como nombre.
+ *
+ * En modo por bloques, el objeto se guarda como lista de bloques
+ * definidos por el contenido. En modo delta, el objeto se guarda como
+ * diferencia contra la ultima version del mismo archivo cuando eso ahorra
+ * espacio.
  *
+ * @param o Archivo pendiente de almacenar
  * @param filename Nombre del archivo
- * @param hash Hash del archivo: nombre del archivo en el repositorio
  *
- * @return
+ * @return FILE_ADDED si se creo el objeto, VERSION_ALREADY_EXISTS si ya
+ * existia, VERSION_ERROR si ocurre un error.
+ */
+return_code store_file(staged_object *o, char *filename);
+
+/**
+ * @brief Obtiene la ultima version de un archivo.
+ *
+ * @param v Estructura en la que se guarda el resultado
+ * @param filename Nombre del archivo
+ *
+ * @return VERSION_OK si el archivo tiene versiones, VERSION_NOT_FOUND en
+ * caso contrario.
  */
-return_code store_file(char *filename, char *hash);
+return_code get_latest_version(file_version *v, char *filename);
+
+/** Profundidad maxima de las cadenas de diferencias, 0 si el modo delta esta desactivado */
+static int delta_max_depth = 0;
+
+/** 1 si los archivos se guardan como listas de bloques */
+static int chunking = 0;
+
+/** 1 si los objetos nuevos se comprimen (cuando eso ahorra espacio) */
+static int compression = 1;
+
+/**
+ * @brief Indica si el temporal de un archivo se escribe comprimido. Los
+ * modos delta y por bloques necesitan el contenido original, y comprimen
+ * (por bloques) o reducen (con diferencias) el objeto despues.
+ */
+#define stage_compressed() (compression && !chunking && delta_max_depth == 0)
 
 /**
  * @brief Almacena un archivo en el repositorio
@@ -95,231 +130,1125 @@ int retrieve_file(char *hash, char *filename);
  */
 return_code add_new_version(file_version *v);
 
-return_code create_version(char *filename, char *comment, file_version *result) {
+/**
+ * @brief Adiciona registros ya codificados a versions.db con una sola
+ * escritura y un solo fdatasync, y sincroniza el indice.
+ *
+ * @param records Registros codificados con vdb_encode
+ * @param len Bytes a escribir
+ *
+ * @return VERSION_CREATED en caso de exito, VERSION_ERROR si ocurre un error.
+ */
+return_code append_records(const char *records, size_t len);
+
+/**
+ * @brief Archivo de una adicion en lote
+ */
+typedef struct {
+    char *filename;             /**< Ruta relativa al directorio actual */
+    uint8_t digest[DIGEST_SIZE]; /**< Digest del contenido */
+    uint8_t hash_type;          /**< Tipo del digest (VDB_HASH_*) */
+    staged_object *o;           /**< Temporal con el contenido, NULL si el hash vino de la cache */
+    int large;                  /**< 1 si se lee despues, desde el hilo principal (ver read_large_jobs) */
+    int error;                  /**< 1 si no se pudo leer el archivo */
+} add_job;
+
+/**
+ * @brief Adicion en lote compartida por los hilos trabajadores
+ */
+typedef struct {
+    add_job *jobs;              /**< Archivos a adicionar */
+    size_t count;               /**< Numero de archivos */
+    size_t next;                /**< Siguiente archivo sin asignar */
+} add_batch;
+
+/**
+ * @brief Lista dinamica de rutas
+ */
+typedef struct {
+    char **paths;               /**< Rutas */
+    size_t count;               /**< Rutas almacenadas */
+    size_t capacity;            /**< Capacidad del arreglo */
+} path_list;
+
+/**
+ * @brief Agrega a la lista los archivos regulares de path, recorriendo los
+ * subdirectorios. El directorio del repositorio se omite.
+ *
+ * @param path Archivo o directorio, relativo al directorio actual
+ * @param type Tipo de path segun readdir (DT_REG, DT_DIR...), DT_UNKNOWN
+ * para consultarlo con lstat
+ * @param list Lista de resultados
+ *
+ * @return 0 en caso de exito, -1 si path no se puede leer.
+ */
+static int collect_files(const char *path, int type, path_list *list);
+
+/**
+ * @brief Hilo trabajador: obtiene el hash de cada archivo pendiente, de la
+ * cache o leyendo el archivo una sola vez hacia un temporal del repositorio.
+ */
+static void *add_worker(void *arg);
+
+int init_versions() {
+    //Crear el directorio ".versions/" si no existe
+#ifdef __linux__
+    mkdir(VERSIONS_DIR, 0755);
+#elif _WIN32
+    mkdir(VERSIONS_DIR);
+#endif
+
+    // Crea el archivo .versions/versions.db si no existe, o migra el
+    // formato anterior
+    return vdb_init();
+}
+
+return_code create_version(char *filename, char *comment, const uint8_t *digest, file_version *result) {
     struct stat s;
-    char hash[HASH_SIZE];
-    char new[PATH_MAX] = "";
 
     // 1. Valida que el archivo exista y sea un archivo regular
     if (stat(filename, &s) < 0 || !S_ISREG(s.st_mode)) {
         return VERSION_ERROR;
     }
 
-    // 2. Obtiene y guarda en la estructura el HASH del archivo
-    strcat(new, VERSIONS_DIR "/");
-    strcat(new, get_file_hash(filename, hash));
-
-    // Se limpia la estructura
+    // 2. Se limpia la estructura
     memset(result, 0, sizeof *result);
 
     // Llena todos los atributos de la estructura y retorna VERSION_CREATED
     strcpy(result->filename, filename);
     strcpy(result->comment, comment);
-    strcpy(result->hash, hash);
+    memcpy(result->digest, digest, DIGEST_SIZE);
 
     // En caso de fallar alguna validacion, retorna VERSION_ERROR
 
     return VERSION_CREATED;
 }
 
+/**
+ * @brief Verifica si un archivo grande conserva el contenido de su ultima
+ * version, cuando esta se nombro con SHA-256 antes del digest de arbol (ver
+ * vthash.h). En ese caso el archivo sigue usando ese nombre: no se guarda
+ * otra copia del contenido ni se crea otra version. Consulta la base de
+ * datos, por lo que solo se usa desde el hilo principal.
+ *
+ * @param filename Nombre del archivo
+ * @param s Firma del archivo
+ * @param digest Buffer de DIGEST_SIZE bytes; recibe el digest de esa
+ * version si el contenido es el mismo
+ *
+ * @return 1 si el contenido es el de esa version, 0 en caso contrario.
+ */
+static int legacy_match(char *filename, const struct stat *s, uint8_t *digest) {
+    file_version latest;
+    uint8_t sha[DIGEST_SIZE];
+    int fd, same;
+
+    if (THASH_TYPE(s->st_size) != VDB_HASH_TREE
+            || get_latest_version(&latest, filename) != VERSION_OK
+            || latest.hash_type != VDB_HASH_SHA256)
+        return 0;
+
+    if ((fd = open(filename, O_RDONLY)) < 0) return 0;
+    same = thash_content_type(fd, s->st_size, VDB_HASH_SHA256, sha) == 0 && digest_equals(sha, latest.digest);
+    close(fd);
+    if (same) memcpy(digest, sha, DIGEST_SIZE);
+    return same;
+}
+
 return_code add(char *filename, char *comment) {
+    staged_object o;
     file_version v;
+    uint8_t digest[DIGEST_SIZE];
+    char hash[HASH_SIZE];
+    struct stat s;
+    int64_t hashed_at, phase_start = stats_start();
+    int staged = 0, cached, hash_type;
+    return_code stored;
 
-    // 1. Crea la nueva version en memoria
+    if (stat(filename, &s) < 0 || !S_ISREG(s.st_mode))
+        return VERSION_ERROR;
+
+    // 1. Si la firma del archivo no cambio, su hash se toma de la cache.
+    // En otro caso se lee el archivo una sola vez: se calcula su hash
+    // mientras se copia a un temporal del repositorio
+    hashcache_open(HASHCACHE_PATH);
+    cached = hashcache_lookup(&s, digest) == 0;
+    stats_stop(STATS_STAT, phase_start);
+    hash_type = THASH_TYPE(s.st_size);
+    if (!cached) {
+        hashed_at = hashcache_now();
+        if (legacy_match(filename, &s, digest)) {
+            hash_type = VDB_HASH_SHA256;
+        } else {
+            if (object_stage(filename, &o, stage_compressed()) < 0)
+                return VERSION_ERROR;
+            memcpy(digest, o.digest, DIGEST_SIZE);
+            hash_type = THASH_TYPE(o.size);
+            staged = 1;
+        }
+        hashcache_store(&s, digest, hashed_at);
+    }
+
+    // 2. Crea la nueva version en memoria
     // Si la operacion falla, retorna VERSION_ERROR
-    // create_version(filename, comment, &v)
-    if (create_version(filename, comment, &v) == VERSION_ERROR)
+    if (create_version(filename, comment, digest, &v) == VERSION_ERROR) {
+        if (staged) object_discard(&o);
         return VERSION_ERROR;
+    }
+    v.hash_type = hash_type;
 
-    // 2. Verifica si ya existe una version con el mismo hash
+    // 3. Verifica si ya existe una version con el mismo hash
     // Retorna VERSION_ALREADY_EXISTS si ya existe
-    if (version_exists(filename, v.hash) == VERSION_ALREADY_EXISTS)
+    if (version_exists(filename, v.digest) == VERSION_ALREADY_EXISTS) {
+        if (staged) object_discard(&o);
         return VERSION_ALREADY_EXISTS;
+    }
+
+    // El hash vino de la cache y el contenido no esta en el repositorio. Si
+    // esta, se marca como usado para que gc no lo borre. Los objetos se
+    // nombran con el digest en hexadecimal. El digest de un archivo grande
+    // en la cache puede ser el SHA-256 de una version anterior (ver
+    // legacy_match): para una version nueva el archivo se lee de nuevo
+    digest_to_hex(v.digest, hash);
+    if (!staged && (hash_type == VDB_HASH_TREE || !object_freshen(hash))) {
+        if (object_stage(filename, &o, stage_compressed()) < 0)
+            return VERSION_ERROR;
+        memcpy(v.digest, o.digest, DIGEST_SIZE);
+        v.hash_type = THASH_TYPE(o.size);
+        staged = 1;
+    }
 
-    // 3. Almacena el archivo en el repositorio.
+    // 4. Almacena el archivo en el repositorio.
     // El nombre del archivo dentro del repositorio es su hash (sin extension)
     // Retorna VERSION_ERROR si la operacion falla
-    if (store_file(filename, v.hash) == VERSION_ERROR)
-        return VERSION_ERROR;
+    if (staged) {
+        phase_start = stats_start();
+        stored = store_file(&o, filename);
+        stats_stop(STATS_STORE, phase_start);
+        if (stored == VERSION_ERROR) return VERSION_ERROR;
+    }
 
-    // 4. Agrega un nuevo registro al archivo versions.db
-    // Si no puede adicionar el registro, se debe borrar el archivo almacenado en
-    // el paso anterior
+    // 5. Agrega un nuevo registro al archivo versions.db
+    // Si no puede adicionar el registro, el objeto almacenado en el paso
+    // anterior no se borra: otro proceso pudo encontrarlo y usarlo para su
+    // propia version. Un objeto sin versiones solo ocupa espacio
     if (add_new_version(&v) == VERSION_ERROR) {
-        char dst_filename[PATH_MAX];
-        snprintf(dst_filename, PATH_MAX, "%s/%s", VERSIONS_DIR, v.hash);
-        if (remove(filename)) {
-            perror("Error deleting file");
-        } else {
-            printf("File %s successfully deleted.\n", filename);
-        }
-        remove(dst_filename);
         return VERSION_ERROR;
     }
-    // Si la operacion falla, retorna VERSION_ERROR
 
     // Si la operacion es exitosa, retorna VERSION_ADDED
-
     return VERSION_ADDED;
 }
 
 return_code add_new_version(file_version *v) {
-    FILE *fp;
-    fp = fopen(VERSIONS_DB_PATH, "ab");
-    if (fp == NULL) {
+    char record[VDB_RECORD_MAX];
+    ssize_t len;
+
+    if ((len = vdb_encode(v, record)) < 0) return VERSION_ERROR;
+    return append_records(record, len);
+}
+
+return_code append_records(const char *records, size_t len) {
+    int64_t phase_start = stats_start();
+    int appended;
+
+    // Adiciona los registros al log de versions.db con un solo fdatasync
+    appended = vdb_append(records, len);
+    stats_stop(STATS_DB, phase_start);
+    if (appended < 0) {
         return VERSION_ERROR;
     }
 
-    // Adiciona un nuevo registro (estructura) al archivo versions.db
-    fwrite(v, sizeof *v, 1, fp);
-
-    fclose(fp);
+    // Mantiene el indice sincronizado con el nuevo registro
+    phase_start = stats_start();
+    if (vindex_open() == 0) vindex_sync();
+    stats_stop(STATS_INDEX, phase_start);
     return VERSION_CREATED;
 }
 
-void list(char *filename) {
-    FILE *fd;
-    file_version v;
-    ssize_t nread;
-    int counter = 0;
-
-    // Abre el la base de datos de versiones (versions.db)
-    if ((fd = fopen(VERSIONS_DB_PATH, "rb")) == NULL) return;
-
-    // Muestra los registros cuyo nombre coincide con filename.
-    // Si filename es NULL, muestra todos los registros.
-    while (nread = fread(&v, sizeof v, 1, fd), nread == 1) {
-        if (filename == NULL) {
-            print_struct(&v);
-        } else if (EQUALS(filename, v.filename)) {
-            printf("%i ", ++counter);
-            print_struct(&v);
+static int collect_files(const char *path, int type, path_list *list) {
+    char child[PATH_MAX];
+    struct dirent *entry;
+    struct stat s;
+    DIR *dir;
+
+    // El tipo que da readdir evita un lstat por archivo; algunos sistemas
+    // de archivos no lo llenan
+    if (type == DT_UNKNOWN) {
+        if (lstat(path, &s) < 0) return -1;
+        type = S_ISREG(s.st_mode) ? DT_REG : S_ISDIR(s.st_mode) ? DT_DIR : DT_LNK;
+    }
+
+    if (type == DT_REG) {
+        if (list->count == list->capacity) {
+            size_t capacity = list->capacity ? 2 * list->capacity : 64;
+            char **paths = realloc(list->paths, capacity * sizeof *paths);
+            if (paths == NULL) return -1;
+            list->paths = paths;
+            list->capacity = capacity;
+        }
+        if ((list->paths[list->count] = strdup(path)) == NULL) return -1;
+        list->count++;
+        return 0;
+    }
+
+    // Los enlaces simbolicos y archivos especiales no se versionan
+    if (type != DT_DIR) return 0;
+
+    if ((dir = opendir(path)) == NULL) return -1;
+    while ((entry = readdir(dir)) != NULL) {
+        if (EQUALS(entry->d_name, ".") || EQUALS(entry->d_name, "..")) continue;
+
+        // Los archivos del directorio actual se nombran sin "./"
+        if (EQUALS(path, ".")) {
+            if (EQUALS(entry->d_name, VERSIONS_DIR)) continue;
+            snprintf(child, PATH_MAX, "%s", entry->d_name);
+        } else if (snprintf(child, PATH_MAX, "%s/%s", path, entry->d_name) >= PATH_MAX) {
+            fprintf(stderr, "Ruta demasiado larga: %s/%s\n", path, entry->d_name);
+            continue;
         }
+
+        if (collect_files(child, entry->d_type, list) < 0) fprintf(stderr, "No se puede leer %s\n", child);
     }
+    closedir(dir);
+    return 0;
+}
 
-    fclose(fd);
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
 }
 
-char *get_file_hash(char *filename, char *hash) {
-    char *comando;
-    FILE *fp;
+/**
+ * @brief Calcula el digest de un archivo sin copiarlo, con el tipo que
+ * corresponde a su tamano.
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int hash_file(const char *filename, off_t size, uint8_t *digest) {
+    int fd, result;
 
+    if ((fd = open(filename, O_RDONLY)) < 0) return -1;
+    result = thash_content(fd, size, digest);
+    close(fd);
+    return result;
+}
+
+/**
+ * @brief Lee un archivo del lote cuya firma no esta en la cache: calcula
+ * su digest y, si stage es 1, copia su contenido a un temporal del
+ * repositorio (job->o).
+ */
+static void read_job(add_job *job, const struct stat *s, int stage) {
+    int64_t hashed_at = hashcache_now(), phase_start;
+
+    // Solo el hilo principal consulta la base de datos (ver read_large_jobs)
+    if (job->large && legacy_match(job->filename, s, job->digest)) {
+        job->hash_type = VDB_HASH_SHA256;
+    } else if (stage) {
+        if ((job->o = malloc(sizeof *job->o)) == NULL || object_stage(job->filename, job->o, stage_compressed()) < 0) {
+            free(job->o);
+            job->o = NULL;
+            job->error = 1;
+            return;
+        }
+        memcpy(job->digest, job->o->digest, DIGEST_SIZE);
+        job->hash_type = THASH_TYPE(job->o->size);
+    } else {
+        phase_start = stats_start();
+        if (hash_file(job->filename, s->st_size, job->digest) < 0) job->error = 1;
+        stats_stop(STATS_HASH, phase_start);
+        if (job->error) return;
+    }
+    hashcache_store(s, job->digest, hashed_at);
+}
+
+/**
+ * @brief Lee desde este hilo, uno a la vez, los archivos grandes del lote
+ * que no estan en la cache. El digest de arbol de cada uno ya usa un hilo
+ * por procesador (ver thash_fd), y aqui se puede consultar su ultima
+ * version (ver legacy_match).
+ *
+ * @param batch Lote ya procesado por los hilos trabajadores
+ * @param stage 1 para copiar los contenidos a temporales, 0 para solo
+ * calcular los digests
+ */
+static void read_large_jobs(add_batch *batch, int stage) {
     struct stat s;
+    size_t i;
 
-    // Verificar que el archivo existe y que se puede obtener el hash
-    if (stat(filename, &s) < 0 || !S_ISREG(s.st_mode)) {
-        perror("stat");
-        return NULL;
+    for (i = 0; i < batch->count; i++) {
+        add_job *job = &batch->jobs[i];
+
+        if (!job->large || job->error) continue;
+        if (stat(job->filename, &s) < 0 || !S_ISREG(s.st_mode)) {
+            job->error = 1;
+            continue;
+        }
+        read_job(job, &s, stage);
+    }
+}
+
+/**
+ * @brief Hilo trabajador de una adicion: obtiene el digest de cada archivo
+ * de la cache, o lo calcula mientras copia el archivo a un temporal. Los
+ * archivos grandes se dejan para read_large_jobs.
+ */
+static void *add_worker(void *arg) {
+    add_batch *batch = arg;
+    struct stat s;
+    int64_t phase_start;
+    size_t i;
+    int cached;
+
+    while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->count) {
+        add_job *job = &batch->jobs[i];
+
+        phase_start = stats_start();
+        if (stat(job->filename, &s) < 0 || !S_ISREG(s.st_mode)) {
+            stats_stop(STATS_STAT, phase_start);
+            job->error = 1;
+            continue;
+        }
+        cached = hashcache_lookup(&s, job->digest) == 0;
+        stats_stop(STATS_STAT, phase_start);
+        job->hash_type = THASH_TYPE(s.st_size);
+        if (cached) continue;
+
+        if (job->hash_type == VDB_HASH_TREE) job->large = 1;
+        else read_job(job, &s, 1);
     }
+    return NULL;
+}
 
-    sha256_hash_file_hex(filename, hash);
+/**
+ * @brief Ejecuta worker con un hilo por procesador, sin pasar de count
+ * hilos. El hilo principal tambien trabaja. Los hilos se reparten el
+ * trabajo de arg entre ellos.
+ *
+ * @param worker Funcion de los hilos
+ * @param arg Trabajo compartido
+ * @param count Unidades de trabajo
+ */
+static void run_workers(void *(*worker)(void *), void *arg, size_t count) {
+    pthread_t *threads = NULL;
+    long nthreads, started = 0, i;
 
-    return hash;
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads > (long)count) nthreads = count;
+    if (nthreads > 1 && (threads = malloc((nthreads - 1) * sizeof *threads)) != NULL) {
+        for (; started < nthreads - 1; started++) {
+            if (pthread_create(&threads[started], NULL, worker, arg) != 0) break;
+        }
+    }
+    worker(arg);
+    for (i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    free(threads);
 }
 
-return_code copy(char *source, char *destination) {
-    // Copia el contenido de source a destination (se debe usar
-    // open-read-write-close, o fopen-fread-fwrite-fclose)
-    // int fd_source, fd_destination;
-    FILE *fd_source, *fd_destination;
+/**
+ * @brief Almacena el contenido de un archivo del lote, si no esta en el
+ * repositorio. Si el hash vino de la cache y el contenido no esta, el
+ * archivo se lee de nuevo y job->digest se actualiza.
+ *
+ * @param job Archivo del lote
+ * @param typed 1 si el digest se guarda en un registro de versions.db,
+ * que lleva su tipo; los arboles solo guardan el digest
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int store_job(add_job *job, int typed) {
+    char hash[HASH_SIZE];
+    return_code stored;
 
-    char buf[READ_CHUNK + 1];
-    ssize_t nread;
-    int saved_errno;
+    // El digest de un archivo grande en la cache puede ser el SHA-256 de una
+    // version anterior (ver legacy_match): para un registro nuevo el
+    // archivo se lee de nuevo, porque el tipo no se conoce
+    if (job->o == NULL) digest_to_hex(job->digest, hash);
+    if (job->o == NULL && ((typed && job->hash_type == VDB_HASH_TREE) || !object_freshen(hash))) {
+        if ((job->o = malloc(sizeof *job->o)) == NULL || object_stage(job->filename, job->o, stage_compressed()) < 0) {
+            free(job->o);
+            job->o = NULL;
+            return -1;
+        }
+        memcpy(job->digest, job->o->digest, DIGEST_SIZE);
+        job->hash_type = THASH_TYPE(job->o->size);
+    }
 
-    if ((fd_source = fopen(source, "r")) == NULL)
-        return VERSION_ERROR;
+    if (job->o != NULL) {
+        int64_t phase_start = stats_start();
+        stored = store_file(job->o, job->filename);
+        stats_stop(STATS_STORE, phase_start);
+        free(job->o);
+        job->o = NULL;
+        if (stored == VERSION_ERROR) return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Adiciona los archivos de un lote: calcula sus hashes en paralelo,
+ * almacena los contenidos nuevos y adiciona todas las versiones nuevas con
+ * una sola escritura.
+ *
+ * @param batch Lote con los archivos a adicionar
+ * @param comment Comentario de las versiones
+ * @param records Buffer de batch->count * VDB_RECORD_MAX bytes
+ * @param errors Archivos que ya fallaron antes de crear el lote
+ *
+ * @return Codigo de la operacion
+ */
+static return_code add_batch_files(add_batch *batch, char *comment, char *records, int errors,
+                                   int *added, int *unchanged) {
+    size_t records_len = 0;
+    size_t i;
+
+    // 1. Calcula los hashes y copia los contenidos nuevos en paralelo; los
+    // archivos grandes, despues y uno a la vez
+    hashcache_open(HASHCACHE_PATH);
+    run_workers(add_worker, batch, batch->count);
+    read_large_jobs(batch, 1);
+
+    // 2. Crea las versiones nuevas y almacena sus objetos. La base de datos
+    // y el indice solo se consultan desde este hilo
+    for (i = 0; i < batch->count; i++) {
+        add_job *job = &batch->jobs[i];
+        file_version v;
+        ssize_t len;
 
-    if ((fd_destination = fopen(destination, "w")) == NULL) {
-        fclose(fd_source);
+        if (job->error
+                || create_version(job->filename, comment, job->digest, &v) == VERSION_ERROR) {
+            fprintf(stderr, "No se puede adicionar %s\n", job->filename);
+            errors++;
+            continue;
+        }
+        if (version_exists(job->filename, v.digest) == VERSION_ALREADY_EXISTS) {
+            (*unchanged)++;
+            continue;
+        }
+
+        if (store_job(job, 1) < 0) {
+            fprintf(stderr, "No se puede adicionar %s\n", job->filename);
+            errors++;
+            continue;
+        }
+        memcpy(v.digest, job->digest, DIGEST_SIZE);
+        v.hash_type = job->hash_type;
+
+        if ((len = vdb_encode(&v, records + records_len)) < 0) {
+            fprintf(stderr, "No se puede adicionar %s\n", job->filename);
+            errors++;
+            continue;
+        }
+        records_len += len;
+        (*added)++;
+    }
+
+    // 3. Todos los registros nuevos se adicionan con una sola escritura. Si
+    // falla, los objetos creados por este lote se conservan (ver add)
+    if (*added > 0 && append_records(records, records_len) == VERSION_ERROR) {
+        *added = 0;
         return VERSION_ERROR;
     }
 
+    if (errors > 0) return VERSION_ERROR;
+    return *added > 0 ? VERSION_ADDED : VERSION_ALREADY_EXISTS;
+}
+
+return_code add_files(char **paths, int count, char *comment, int *added, int *unchanged) {
+    path_list files = {NULL, 0, 0};
+    add_batch batch = {NULL, 0, 0};
+    char *records;
+    int errors = 0, ignored_added, ignored_unchanged;
+    int64_t phase_start;
+    size_t i, j;
+    return_code result = VERSION_ERROR;
+
+    // Expande los directorios y elimina rutas repetidas
+    phase_start = stats_start();
+    for (i = 0; i < (size_t)count; i++) {
+        if (collect_files(paths[i], DT_UNKNOWN, &files) < 0) {
+            fprintf(stderr, "No se puede adicionar %s\n", paths[i]);
+            errors++;
+        }
+    }
+    stats_stop(STATS_STAT, phase_start);
+    qsort(files.paths, files.count, sizeof *files.paths, compare_paths);
+    for (i = 0, j = 0; i < files.count; i++) {
+        if (j > 0 && EQUALS(files.paths[i], files.paths[j - 1])) free(files.paths[i]);
+        else files.paths[j++] = files.paths[i];
+    }
+    files.count = j;
+
+    batch.count = files.count;
+    batch.jobs = calloc(files.count + 1, sizeof *batch.jobs);
+    records = malloc((files.count + 1) * VDB_RECORD_MAX);
+    if (added == NULL) added = &ignored_added;
+    if (unchanged == NULL) unchanged = &ignored_unchanged;
+    *added = *unchanged = 0;
+    if (batch.jobs != NULL && records != NULL) {
+        for (i = 0; i < files.count; i++) batch.jobs[i].filename = files.paths[i];
+        result = add_batch_files(&batch, comment, records, errors, added, unchanged);
+    }
+
+    for (i = 0; i < files.count; i++) {
+        if (batch.jobs != NULL && batch.jobs[i].o != NULL) {
+            object_discard(batch.jobs[i].o);
+            free(batch.jobs[i].o);
+        }
+        free(files.paths[i]);
+    }
+    free(files.paths);
+    free(batch.jobs);
+    free(records);
+    return result;
+}
+
+/**
+ * @brief Archivos con versiones que no estan en el directorio
+ */
+typedef struct {
+    const path_list *files; /**< Archivos del directorio, ordenados */
+    path_list missing;      /**< Archivos faltantes, con repetidos */
+    int error;              /**< 1 si no hay memoria */
+} missing_files;
 
-    while (nread = fread(buf, sizeof(char), READ_CHUNK, fd_source), nread > 0) {
-        char *out_ptr = buf;
-        ssize_t nwritten;
+static int collect_missing(void *ctx, const version_entry *e) {
+    missing_files *m = ctx;
+    char filename[PATH_MAX], *key = filename, **paths;
 
-        do {
-            nwritten = fwrite(out_ptr, sizeof(char), nread, fd_destination);
-            if (nwritten >= 0) {
-                nread -= nwritten;
-                out_ptr += nwritten;
-            }
-        } while (nread > 0);
+    snprintf(filename, PATH_MAX, "%.*s", e->filename_len, e->filename);
+    if (bsearch(&key, m->files->paths, m->files->count, sizeof *m->files->paths, compare_paths) != NULL) return 0;
+    if (m->missing.count == m->missing.capacity) {
+        size_t capacity = m->missing.capacity ? 2 * m->missing.capacity : 64;
+        if ((paths = realloc(m->missing.paths, capacity * sizeof *paths)) == NULL) return m->error = 1;
+        m->missing.paths = paths;
+        m->missing.capacity = capacity;
     }
+    if ((m->missing.paths[m->missing.count] = strdup(filename)) == NULL) return m->error = 1;
+    m->missing.count++;
+    return 0;
+}
 
-    if (nread == 0) {
-        fclose(fd_source);
-        fclose(fd_destination);
-        /* Success! */
-        return FILE_ADDED;
+/**
+ * @brief Hilo trabajador de status: obtiene el digest de cada archivo de
+ * la cache; solo lee los archivos cuya firma cambio. Los archivos grandes
+ * se dejan para read_large_jobs.
+ */
+static void *status_worker(void *arg) {
+    add_batch *batch = arg;
+    struct stat s;
+    int64_t phase_start;
+    size_t i;
+    int cached;
+
+    while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->count) {
+        add_job *job = &batch->jobs[i];
+
+        phase_start = stats_start();
+        if (stat(job->filename, &s) < 0 || !S_ISREG(s.st_mode)) {
+            stats_stop(STATS_STAT, phase_start);
+            job->error = 1;
+            continue;
+        }
+        cached = hashcache_lookup(&s, job->digest) == 0;
+        stats_stop(STATS_STAT, phase_start);
+        if (cached) continue;
+
+        if (THASH_TYPE(s.st_size) == VDB_HASH_TREE) job->large = 1;
+        else read_job(job, &s, 0);
+    }
+    return NULL;
+}
+
+int status(change_visitor visit, void *ctx) {
+    path_list files = {NULL, 0, 0};
+    add_batch batch = {NULL, 0, 0};
+    file_version v;
+    uint8_t latest[DIGEST_SIZE];
+    int64_t phase_start;
+    int changed = 0, indexed, found, stop = 0;
+    size_t i;
+
+    // 1. Los archivos del directorio, con el tipo que da readdir
+    phase_start = stats_start();
+    found = collect_files(".", DT_UNKNOWN, &files);
+    stats_stop(STATS_STAT, phase_start);
+    if (found < 0) return -1;
+    qsort(files.paths, files.count, sizeof *files.paths, compare_paths);
+
+    // 2. stat en paralelo; solo se calcula el hash de los archivos cuya
+    // firma no esta en la cache
+    if ((batch.jobs = calloc(files.count + 1, sizeof *batch.jobs)) == NULL) changed = -1;
+    if (batch.jobs != NULL) {
+        batch.count = files.count;
+        for (i = 0; i < files.count; i++) batch.jobs[i].filename = files.paths[i];
+        hashcache_open(HASHCACHE_PATH);
+        run_workers(status_worker, &batch, batch.count);
+        read_large_jobs(&batch, 0);
+    }
+
+    // 3. Se compara con la ultima version de cada archivo. El indice solo
+    // se consulta desde este hilo
+    indexed = vindex_open() == 0;
+    for (i = 0; batch.jobs != NULL && i < files.count && !stop; i++) {
+        add_job *job = &batch.jobs[i];
+        char state;
+
+        if (job->error) {
+            fprintf(stderr, "No se puede leer %s\n", job->filename);
+            continue;
+        }
+
+        phase_start = stats_start();
+        if (indexed) {
+            found = vindex_latest(job->filename, latest) == VERSION_OK;
+        } else if ((found = get_latest_version(&v, job->filename) == VERSION_OK)) {
+            memcpy(latest, v.digest, DIGEST_SIZE);
+        }
+        stats_stop(STATS_INDEX, phase_start);
+
+        state = !found ? '?' : digest_equals(latest, job->digest) ? ' ' : 'M';
+        if (state != ' ') changed++;
+        stop = visit(ctx, state, job->filename, job->digest) != 0;
+    }
+
+    // 4. Los archivos con versiones que ya no estan en el directorio, con
+    // el digest de su ultima version
+    if (batch.jobs != NULL && !stop) {
+        missing_files m = {&files, {NULL, 0, 0}, 0};
+
+        if (list(NULL, collect_missing, &m) < 0 || m.error) changed = -1;
+        if (m.missing.count > 0) qsort(m.missing.paths, m.missing.count, sizeof *m.missing.paths, compare_paths);
+        for (i = 0; changed >= 0 && i < m.missing.count && !stop; i++) {
+            if (i > 0 && EQUALS(m.missing.paths[i], m.missing.paths[i - 1])) continue;
+            if (indexed) {
+                found = vindex_latest(m.missing.paths[i], latest) == VERSION_OK;
+            } else if ((found = get_latest_version(&v, m.missing.paths[i]) == VERSION_OK)) {
+                memcpy(latest, v.digest, DIGEST_SIZE);
+            }
+            if (!found) continue;
+            changed++;
+            stop = visit(ctx, 'D', m.missing.paths[i], latest) != 0;
+        }
+        for (i = 0; i < m.missing.count; i++) free(m.missing.paths[i]);
+        free(m.missing.paths);
     }
 
-    return VERSION_ERROR;
+    for (i = 0; i < files.count; i++) free(files.paths[i]);
+    free(files.paths);
+    free(batch.jobs);
+    return changed;
 }
 
-int version_exists(char *filename, char *hash) {
-    FILE *fp;
-    ssize_t nread;
+int list(char *filename, version_visitor visit, void *ctx) {
+    version_entry e;
     file_version v;
+    vdb_record r;
+    off_t offset;
+    ssize_t len;
+    int counter = 0, visited = 0;
+
+    // Las versiones de un archivo se recorren con el indice
+    if (filename != NULL && vindex_open() == 0) {
+        int count = vindex_count(filename);
+        for (counter = 1; counter <= count; counter++) {
+            if (vindex_get(&v, filename, counter) != VERSION_OK) break;
+            e.number = counter;
+            e.filename = v.filename;
+            e.filename_len = strlen(v.filename);
+            e.digest = v.digest;
+            e.comment = v.comment;
+            e.comment_len = strlen(v.comment);
+            visited++;
+            if (visit(ctx, &e) != 0) break;
+        }
+        return visited;
+    }
+
+    // Mapea la base de datos de versiones (versions.db)
+    if (vdb_map() < 0) return -1;
+    vdb_advise(MADV_SEQUENTIAL);
+
+    // Recorre los registros cuyo nombre coincide con filename, sin
+    // copiarlos. Si filename es NULL, recorre todos los registros.
+    for (offset = vdb_first(); (len = vdb_record_at(offset, &r)) > 0; offset += len) {
+        if (filename != NULL && !vdb_filename_equals(&r, filename)) continue;
+
+        // Los commits solo se listan por su nombre (COMMIT_NAME)
+        if (filename == NULL && VDB_KIND(r.header->type) != VDB_KIND_VERSION) continue;
+        e.number = filename != NULL ? ++counter : 0;
+        e.filename = r.filename;
+        e.filename_len = r.header->filename_len;
+        e.digest = r.header->digest;
+        e.comment = r.comment;
+        e.comment_len = r.header->comment_len;
+        visited++;
+        if (visit(ctx, &e) != 0) break;
+    }
+    return visited;
+}
+
+char *get_file_hash(char *filename, char *hash) {
+    struct stat s;
+
+    // Verificar que el archivo existe y que se puede obtener el hash
+    if (stat(filename, &s) < 0 || !S_ISREG(s.st_mode)) {
+        perror("stat");
+        return NULL;
+    }
 
-    // abrimos el archivo de versiones para leer el contenido
-    if ((fp = fopen(VERSIONS_DB_PATH, "r")) == NULL)
+    // Solo se lee el archivo si cambio desde la ultima vez
+    hashcache_open(HASHCACHE_PATH);
+    return hashcache_file_hash(filename, hash);
+}
+
+return_code copy(char *source, char *destination) {
+    // Copia el contenido de source a destination con el mecanismo mas
+    // eficiente que soporte el sistema de archivos (ver fcopy.h)
+    if (fcopy(source, destination) < 0)
+        return VERSION_ERROR;
+
+    return FILE_ADDED;
+}
+
+/**
+ * @brief Busca una version por nombre y digest: en el filtro, el indice o
+ * la base de datos (ver version_exists).
+ */
+static int find_version(char *filename, const uint8_t *digest) {
+    vdb_record r;
+    off_t offset;
+    ssize_t len;
+
+    // Casi siempre la version no existe: el filtro lo confirma con una
+    // sola lectura, sin consultar el indice ni la base de datos
+    if (bloom_open() == 0 && !bloom_maybe_contains(filename, digest)) return 1;
+
+    if (vindex_open() == 0) {
+        return vindex_find(filename, digest) == VERSION_ALREADY_EXISTS ? VERSION_ALREADY_EXISTS : 1;
+    }
+
+    // Sin indice: se recorre el mapeo de la base de datos
+    if (vdb_map() < 0)
         return -1;
 
-    while (nread = fread(&v, sizeof v, 1, fp), nread > 0) {
-        if (EQUALS(filename, v.filename) && EQUALS(hash, v.hash)) {
-            fclose(fp);
+    // Verifica si en la bd existe un registro que coincide con filename y hash
+    for (offset = vdb_first(); (len = vdb_record_at(offset, &r)) > 0; offset += len) {
+        if (digest_equals(digest, r.header->digest) && vdb_filename_equals(&r, filename)) {
             return VERSION_ALREADY_EXISTS;
         }
     }
 
-    fclose(fp);
-    // Verifica si en la bd existe un registro que coincide con filename y hash
     return 1;
 }
 
-int get_version(file_version *v, char *filename, int version) {
-    FILE *fp;
-    ssize_t nread;
+int version_exists(char *filename, const uint8_t *digest) {
+    int64_t phase_start = stats_start();
+    int found = find_version(filename, digest);
+
+    stats_stop(STATS_INDEX, phase_start);
+    return found;
+}
+
+/**
+ * @brief Busca una version por nombre y numero en el indice o la base de
+ * datos (ver get_version).
+ */
+static int find_numbered_version(file_version *v, char *filename, int version) {
+    vdb_record r;
+    off_t offset;
+    ssize_t len;
     int count = 0;
-    if ((fp = fopen(VERSIONS_DB_PATH, "r")) == NULL)
+
+    if (vindex_open() == 0) return vindex_get(v, filename, version);
+
+    if (vdb_map() < 0)
         return -1;
-    while (nread = fread(v, sizeof *v, 1, fp), nread > 0) {
-        if (EQUALS(filename, v->filename) && ++count == version) {
-            fclose(fp);
+    for (offset = vdb_first(); (len = vdb_record_at(offset, &r)) > 0; offset += len) {
+        if (vdb_filename_equals(&r, filename) && ++count == version) {
+            vdb_to_version(&r, v);
             return VERSION_OK;
         }
     }
-    fclose(fp);
     return VERSION_NOT_FOUND;
 }
 
-return_code get(char *filename, int version) {
+int get_version(file_version *v, char *filename, int version) {
+    int64_t phase_start = stats_start();
+    int found = find_numbered_version(v, filename, version);
+
+    stats_stop(STATS_INDEX, phase_start);
+    return found;
+}
+
+return_code get(char *filename, int version, char *destination) {
+    char hash[HASH_SIZE];
     file_version r;
+    int found;
 
     // 1. Abre la BD y busca el registro r que coincide con filename y version
-    if (get_version(&r, filename, version) == VERSION_NOT_FOUND)
+    if ((found = get_version(&r, filename, version)) < 0)
+        return VERSION_ERROR;
+    if (found != VERSION_OK)
     	return VERSION_NOT_FOUND;
 
     // 2. recupera el archivo
-    return retrieve_file(r.hash, r.filename);
+    digest_to_hex(r.digest, hash);
+    return retrieve_file(hash, destination != NULL ? destination : r.filename);
 }
 
-return_code store_file(char *filename, char *hash) {
-    char dst_filename[PATH_MAX];
-    snprintf(dst_filename, PATH_MAX, "%s/%s", VERSIONS_DIR, hash);
-    return copy(filename, dst_filename);
+return_code store_file(staged_object *o, char *filename) {
+    char base_hash[HASH_SIZE];
+    file_version base;
+
+    // Modo por bloques: solo se escriben los bloques que no existen
+    if (chunking && !object_exists(o->hash) && chunk_store(o, compression) == 0) {
+        return FILE_ADDED;
+    }
+
+    // Modo delta: se intenta guardar la diferencia contra la version
+    // anterior del mismo archivo. Si no conviene, se guarda completo
+    if (delta_max_depth > 0 && !object_exists(o->hash)
+            && get_latest_version(&base, filename) == VERSION_OK) {
+        digest_to_hex(base.digest, base_hash);
+        if (delta_store(o, base_hash, delta_max_depth) == 0) return FILE_ADDED;
+    }
+    return object_commit(o);
+}
+
+return_code get_latest_version(file_version *v, char *filename) {
+    vdb_record r;
+    off_t offset, latest = 0;
+    ssize_t len;
+    int count;
+
+    if (vindex_open() == 0) {
+        if ((count = vindex_count(filename)) == 0) return VERSION_NOT_FOUND;
+        return vindex_get(v, filename, count);
+    }
+
+    if (vdb_map() < 0)
+        return VERSION_NOT_FOUND;
+    for (offset = vdb_first(); (len = vdb_record_at(offset, &r)) > 0; offset += len) {
+        if (vdb_filename_equals(&r, filename)) latest = offset;
+    }
+    if (latest == 0 || vdb_record_at(latest, &r) <= 0) return VERSION_NOT_FOUND;
+    vdb_to_version(&r, v);
+    return VERSION_OK;
+}
+
+void set_delta(int max_depth) {
+    delta_max_depth = max_depth;
+}
+
+void set_chunking(int enabled) {
+    chunking = enabled;
+}
+
+void set_compression(int enabled) {
+    compression = enabled;
 }
 
 int retrieve_file(char *hash, char *filename) {
     char src_filename[PATH_MAX];
-    snprintf(src_filename, PATH_MAX, "%s/%s", VERSIONS_DIR, hash);
-    return copy(src_filename, filename);
+    char dir[PATH_MAX];
+    char *slash;
+    int64_t phase_start = stats_start();
+    int result;
+
+    // Los archivos de subdirectorios se recuperan aunque el directorio ya
+    // no exista
+    snprintf(dir, PATH_MAX, "%s", filename);
+    for (slash = strchr(dir, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = 0;
+        mkdir(dir, 0755);
+        *slash = '/';
+    }
+
+    // Los objetos sueltos se copian completos; los de un paquete o
+    // guardados como diferencia se reconstruyen (ver vobject.h)
+    if (access(object_path(hash, src_filename), F_OK) < 0)
+        result = object_retrieve(hash, filename) < 0 ? VERSION_ERROR : FILE_ADDED;
+    else
+        result = copy(src_filename, filename);
+    stats_stop(STATS_RETRIEVE, phase_start);
+    return result;
+}
+
+int repack(void) {
+    return pack_repack();
+}
+   
+
+return_code commit(char *comment) {
+    path_list files = {NULL, 0, 0};
+    add_batch batch = {NULL, 0, 0};
+    uint8_t (*digests)[DIGEST_SIZE] = NULL;
+    uint8_t digest[DIGEST_SIZE];
+    char record[VDB_RECORD_MAX];
+    file_version latest, v;
+    commit_info c, parent;
+    ssize_t len;
+    size_t i;
+    int errors = 0, collected;
+    int64_t phase_start;
+    return_code result = VERSION_ERROR;
+
+    // 1. Todos los archivos del directorio, en el orden de los arboles
+    phase_start = stats_start();
+    collected = collect_files(".", DT_UNKNOWN, &files);
+    stats_stop(STATS_STAT, phase_start);
+    if (collected < 0) return VERSION_ERROR;
+    qsort(files.paths, files.count, sizeof *files.paths, compare_paths);
+
+    batch.count = files.count;
+    batch.jobs = calloc(files.count + 1, sizeof *batch.jobs);
+    digests = malloc((files.count + 1) * sizeof *digests);
+    if (batch.jobs == NULL || digests == NULL) goto done;
+    for (i = 0; i < files.count; i++) batch.jobs[i].filename = files.paths[i];
+
+    // 2. Calcula los hashes en paralelo, los de los archivos grandes
+    // despues, y almacena los contenidos nuevos. Un commit con archivos
+    // faltantes no seria el estado del directorio
+    hashcache_open(HASHCACHE_PATH);
+    run_workers(add_worker, &batch, batch.count);
+    read_large_jobs(&batch, 1);
+    for (i = 0; i < files.count; i++) {
+        add_job *job = &batch.jobs[i];
+
+        if (job->error || store_job(job, 0) < 0) {
+            fprintf(stderr, "No se puede adicionar %s\n", job->filename);
+            errors++;
+        }
+        memcpy(digests[i], job->digest, DIGEST_SIZE);
+    }
+    if (errors > 0) goto done;
+
+    // 3. Guarda los arboles. Los subdirectorios sin cambios producen el
+    // mismo arbol, que ya existe
+    if (tree_build(files.paths, digests, files.count, compression, c.tree) < 0) goto done;
+
+    // 4. El commit anterior es el ultimo registro de COMMIT_NAME
+    if ((c.has_parent = get_latest_version(&latest, COMMIT_NAME) == VERSION_OK)) memcpy(c.parent, latest.digest, DIGEST_SIZE);
+    if (c.has_parent && commit_read(c.parent, &parent) == 0 && digest_equals(parent.tree, c.tree)) {
+        result = VERSION_ALREADY_EXISTS;
+        goto done;
+    }
+    c.time = time(NULL);
+    if (commit_write(&c, compression, digest) < 0) goto done;
+
+    // 5. Un solo registro en versions.db apunta al commit
+    memset(&v, 0, sizeof v);
+    strcpy(v.filename, COMMIT_NAME);
+    snprintf(v.comment, COMMENT_SIZE, "%s", comment);
+    memcpy(v.digest, digest, DIGEST_SIZE);
+    if ((len = vdb_encode_kind(&v, VDB_KIND_COMMIT, record)) >= 0 && append_records(record, len) != VERSION_ERROR) {
+        result = VERSION_ADDED;
+    }
+
+done:
+    for (i = 0; i < files.count; i++) {
+        if (batch.jobs != NULL && batch.jobs[i].o != NULL) {
+            object_discard(batch.jobs[i].o);
+            free(batch.jobs[i].o);
+        }
+        free(files.paths[i]);
+    }
+    free(files.paths);
+    free(batch.jobs);
+    free(digests);
+    return result;
+}
+
+/**
+ * @brief Lee el commit de un registro de COMMIT_NAME.
+ * @return VERSION_OK, VERSION_NOT_FOUND o VERSION_ERROR.
+ */
+static return_code read_commit(int number, commit_info *c) {
+    file_version v;
+    int found;
+
+    if ((found = get_version(&v, COMMIT_NAME, number)) < 0) return VERSION_ERROR;
+    if (found != VERSION_OK) return VERSION_NOT_FOUND;
+    if (commit_read(v.digest, c) < 0) return VERSION_ERROR;
+    return VERSION_OK;
 }
 
-void print_struct(const file_version *v) {
-    int hash_length = strlen(v->hash);
-    printf("%s %.3s...%.3s %s\n", v->filename, v->hash, (v->hash + hash_length - 3), v->comment);
-}   
+return_code commit_changes(int number, change_visitor visit, void *ctx) {
+    commit_info c, parent;
+    return_code found;
+
+    if ((found = read_commit(number, &c)) != VERSION_OK) return found;
+    if (c.has_parent && commit_read(c.parent, &parent) < 0) return VERSION_ERROR;
+
+    // Solo se recorren los subdirectorios cuyo arbol cambio
+    return tree_diff(c.has_parent ? parent.tree : NULL, c.tree, visit, ctx) < 0 ? VERSION_ERROR : VERSION_OK;
+}
+
+/**
+ * @brief Archivos de un commit, recuperados por los hilos trabajadores
+ */
+typedef struct {
+    char **paths;                   /**< Rutas relativas al directorio actual */
+    uint8_t (*digests)[DIGEST_SIZE]; /**< Digest de cada archivo */
+    size_t count;                   /**< Archivos */
+    size_t capacity;                /**< Capacidad de los arreglos */
+    size_t next;                    /**< Siguiente archivo sin asignar */
+    int errors;                     /**< Archivos que no se pudieron recuperar */
+} checkout_batch;
+
+static int collect_checkout(void *ctx, const char *path, int kind, const uint8_t *digest) {
+    checkout_batch *batch = ctx;
+
+    if (kind != TREE_FILE) return 0;
+    if (batch->count == batch->capacity) {
+        size_t capacity = batch->capacity ? 2 * batch->capacity : 64;
+        char **paths = realloc(batch->paths, capacity * sizeof *paths);
+        uint8_t (*digests)[DIGEST_SIZE];
+
+        if (paths == NULL) return 1;
+        batch->paths = paths;
+        if ((digests = realloc(batch->digests, capacity * sizeof *digests)) == NULL) return 1;
+        batch->digests = digests;
+        batch->capacity = capacity;
+    }
+    if ((batch->paths[batch->count] = strdup(path)) == NULL) return 1;
+    memcpy(batch->digests[batch->count], digest, DIGEST_SIZE);
+    batch->count++;
+    return 0;
+}
+
+/**
+ * @brief Hilo trabajador: recupera los archivos pendientes del commit.
+ */
+static void *checkout_worker(void *arg) {
+    checkout_batch *batch = arg;
+    char hash[HASH_SIZE];
+    size_t i;
+
+    while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->count) {
+        digest_to_hex(batch->digests[i], hash);
+        if (retrieve_file(hash, batch->paths[i]) == VERSION_ERROR) {
+            fprintf(stderr, "No se puede obtener %s\n", batch->paths[i]);
+            __atomic_fetch_add(&batch->errors, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+return_code checkout(int number) {
+    checkout_batch batch = {NULL, NULL, 0, 0, 0, 0};
+    commit_info c;
+    return_code found;
+    size_t i;
+
+    if ((found = read_commit(number, &c)) != VERSION_OK) return found;
+
+    // Primero se listan los archivos; despues se recuperan en paralelo
+    if (tree_walk(c.tree, collect_checkout, &batch) == 0) run_workers(checkout_worker, &batch, batch.count);
+    else batch.errors++;
+
+    for (i = 0; i < batch.count; i++) free(batch.paths[i]);
+    free(batch.paths);
+    free(batch.digests);
+    return batch.errors > 0 ? VERSION_ERROR : FILE_ADDED;
+}
@@ -17,6 +17,7 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,25 +29,31 @@
 
 #define COMMENT_SIZE 80 /** < Longitud del comentario */
 #define HASH_SIZE 256 /**< Longitud del hash incluyendo NULL*/
+#define DIGEST_SIZE 32 /**< Longitud del digest binario */
 #define READ_CHUNK PATH_MAX
 
 #define VERSIONS_DB "versions.db" /**< Nombre de la base de datos de versiones. */
 #define VERSIONS_DIR ".versions" /**< Directorio del repositorio. */
 #define VERSIONS_DB_PATH VERSIONS_DIR "/" VERSIONS_DB /**< Ruta completa de la base de datos.*/
+#define HASHCACHE_PATH VERSIONS_DIR "/hashcache" /**< Cache de hashes de los archivos del directorio. */
+#define COMMIT_NAME "." /**< Nombre de los registros de commits en versions.db. */
 
 #define EQUALS(s1, s2) (strcmp(s1, s2) == 0) /**< Verdadero si dos cadenas son iguales.*/
 
 /**
  * @brief Version de un archivo.
  * Para cada version de un archivo se almacena el nombre original,
- * el comentario del usuario y el hash de su contenido.
- * El hash es a la vez el nombre del archivo dentro del
- * repositorio.
- */
-typedef  struct __attribute__((aligned(512))) {
-	char filename[PATH_MAX]; /**< Nombre del archivo original. */
-	char hash[HASH_SIZE];           /**< Hash del contenido del archivo. */
-	char comment[COMMENT_SIZE];	   /**< Comentario del usuario. */
+ * el comentario del usuario y el digest binario de su contenido.
+ * El digest en hexadecimal es a la vez el nombre del archivo dentro del
+ * repositorio; solo se convierte a hexadecimal al nombrar objetos y al
+ * mostrarlo. Los archivos grandes usan un digest de arbol en lugar de
+ * SHA-256 (ver vthash.h).
+ */
+typedef struct {
+	uint8_t digest[DIGEST_SIZE];    /**< Digest del contenido del archivo. */
+	char filename[PATH_MAX];        /**< Nombre del archivo original. */
+	char comment[COMMENT_SIZE];     /**< Comentario del usuario. */
+	uint8_t hash_type;              /**< Tipo de digest (VDB_HASH_*). */
 }file_version;
 
 /**
@@ -65,6 +72,93 @@ typedef enum {
 	/* .. */
 } return_code;
 
+/**
+ * @brief Version vista al recorrer el repositorio, sin copiarla.
+ * El nombre y el comentario no terminan en NULL.
+ */
+typedef struct {
+	int number;             /**< Numero de la version del archivo, 0 al listar todo el repositorio */
+	const char *filename;   /**< Nombre del archivo */
+	int filename_len;       /**< Longitud del nombre */
+	const uint8_t *digest;  /**< Digest del contenido (DIGEST_SIZE bytes) */
+	const char *comment;    /**< Comentario */
+	int comment_len;        /**< Longitud del comentario */
+} version_entry;
+
+/**
+ * @brief Recibe cada version al recorrer el repositorio.
+ *
+ * @param ctx Contexto del recorrido
+ * @param e Version; solo es valida durante la llamada
+ *
+ * @return 0 para continuar, otro valor para detener el recorrido.
+ */
+typedef int (*version_visitor)(void *ctx, const version_entry *e);
+
+/**
+ * @brief Recibe cada archivo que cambio en un commit.
+ *
+ * @param ctx Contexto del recorrido
+ * @param status 'A' adicionado, 'M' modificado o 'D' borrado
+ * @param path Ruta del archivo
+ * @param digest Digest del contenido nuevo (el borrado si status es 'D')
+ *
+ * @return 0 para continuar, otro valor para detener el recorrido.
+ */
+typedef int (*change_visitor)(void *ctx, char status, const char *path, const uint8_t *digest);
+
+/**
+ * @brief Convierte un digest binario a hexadecimal.
+ *
+ * @param digest Digest de DIGEST_SIZE bytes
+ * @param hex Buffer de al menos 2 * DIGEST_SIZE + 1 bytes
+ */
+void digest_to_hex(const uint8_t *digest, char *hex);
+
+/**
+ * @brief Convierte un hash hexadecimal a binario.
+ *
+ * @param hex Hash de 2 * DIGEST_SIZE caracteres
+ * @param digest Buffer de DIGEST_SIZE bytes
+ *
+ * @return 0 en caso de exito, -1 si el hash no es valido.
+ */
+int hex_to_digest(const char *hex, uint8_t *digest);
+
+/**
+ * @brief Inicializa el repositorio de versiones.
+ * Crea el directorio y la base de datos si no existen, y migra la base de
+ * datos del formato de registros de tamano fijo.
+ *
+ * @return 0 si se inicializa correctamente, -1 si ocurre algun error.
+ */
+int init_versions();
+
+/**
+ * @brief Activa el modo delta: las versiones nuevas se guardan como
+ * diferencias binarias contra la version anterior del mismo archivo.
+ *
+ * @param max_depth Profundidad maxima de las cadenas de diferencias, 0 para
+ * guardar siempre copias completas.
+ */
+void set_delta(int max_depth);
+
+/**
+ * @brief Activa el modo por bloques: los archivos nuevos se dividen en
+ * bloques definidos por su contenido y cada bloque se guarda una sola vez.
+ *
+ * @param enabled 1 para activarlo, 0 para guardar copias completas.
+ */
+void set_chunking(int enabled);
+
+/**
+ * @brief Activa o desactiva la compresion de los objetos nuevos. Esta
+ * activa por defecto; los objetos que no se reducen se guardan tal cual.
+ *
+ * @param enabled 1 para comprimir, 0 para guardar copias sin comprimir.
+ */
+void set_compression(int enabled);
+
 /**
  * @brief Adiciona un archivo al repositorio.
  *
@@ -76,11 +170,62 @@ typedef enum {
 return_code add(char * filename, char * comment);
 
 /**
- * @brief Lista las versiones de un archivo.
+ * @brief Adiciona varios archivos al repositorio.
+ * Los directorios se recorren recursivamente. Los hashes se calculan en
+ * paralelo, con un hilo por procesador, y todas las versiones nuevas se
+ * adicionan a la base de datos con una sola escritura.
+ *
+ * @param paths Archivos o directorios, relativos al directorio actual
+ * @param count Numero de rutas
+ * @param comment Comentario de las versiones
+ * @param added Versiones adicionadas (puede ser NULL)
+ * @param unchanged Archivos sin cambios (puede ser NULL)
+ *
+ * @return VERSION_ADDED si se adiciono alguna version,
+ * VERSION_ALREADY_EXISTS si ningun archivo cambio, VERSION_ERROR si algun
+ * archivo no se pudo adicionar.
+ */
+return_code add_files(char **paths, int count, char *comment, int *added, int *unchanged);
+
+/**
+ * @brief Compara los archivos del directorio con su ultima version.
+ * Los archivos se consultan en paralelo y solo se lee el contenido de los
+ * que no estan en la cache de hashes (su firma cambio desde la ultima vez).
+ *
+ * Despues de los archivos del directorio se visitan, en orden, los
+ * archivos con versiones que ya no estan en el.
+ *
+ * @param visit Funcion que recibe cada archivo: ' ' sin cambios, 'M'
+ * modificado, '?' sin versiones o 'D' borrado (con el digest de su ultima
+ * version)
+ * @param ctx Contexto de visit
  *
- * @param filename Nombre del archivo, NULL para listar todo el repositorio.
+ * @return Numero de archivos modificados, sin versiones o borrados, -1 si
+ * el directorio no se puede leer.
  */
-void list(char * filename);
+int status(change_visitor visit, void *ctx);
+
+/**
+ * @brief Recorre las versiones de un archivo, o todas las del repositorio.
+ *
+ * @param filename Nombre del archivo, NULL para recorrer todo el repositorio.
+ * @param visit Funcion que recibe cada version
+ * @param ctx Contexto de visit
+ *
+ * @return Versiones recorridas, -1 si no se puede leer la base de datos.
+ */
+int list(char * filename, version_visitor visit, void *ctx);
+
+/**
+ * @brief Busca una version de un archivo.
+ *
+ * @param v Estructura en la que se guarda el resultado
+ * @param filename Nombre del archivo
+ * @param version Numero secuencial de la version
+ *
+ * @return VERSION_OK si existe, VERSION_NOT_FOUND en caso contrario.
+ */
+int get_version(file_version *v, char *filename, int version);
 
 /**
  * @brief Obtiene una version del un archivo.
@@ -88,9 +233,57 @@ void list(char * filename);
  *
  * @param filename Nombre de archivo.
  * @param version Numero secuencial de la version.
+ * @param destination Archivo de destino, NULL para sobreescribir el archivo.
+ *
+ * @return FILE_ADDED en caso de exito, VERSION_NOT_FOUND si la version no
+ * existe, VERSION_ERROR si ocurre un error.
+ */
+return_code get(char * filename, int version, char *destination);
+
+/**
+ * @brief Guarda el estado de todo el directorio como un commit.
+ * Los archivos se leen en paralelo, como en add_files; sus contenidos y
+ * los arboles de los directorios se guardan como objetos, y un solo
+ * registro de COMMIT_NAME apunta al commit. Los commits se listan con
+ * list(COMMIT_NAME, ...).
+ *
+ * @param comment Comentario del commit
+ *
+ * @return VERSION_ADDED, VERSION_ALREADY_EXISTS si el directorio no
+ * cambio desde el ultimo commit, VERSION_ERROR si algun archivo no se pudo
+ * leer.
+ */
+return_code commit(char *comment);
+
+/**
+ * @brief Recorre los archivos que cambiaron en un commit respecto al
+ * anterior (en el primero, todos). Solo se leen los arboles de los
+ * directorios que cambiaron.
+ *
+ * @param number Numero del commit
+ * @param visit Funcion que recibe cada cambio
+ * @param ctx Contexto de visit
+ *
+ * @return VERSION_OK, VERSION_NOT_FOUND o VERSION_ERROR.
+ */
+return_code commit_changes(int number, change_visitor visit, void *ctx);
+
+/**
+ * @brief Recupera todos los archivos de un commit en el directorio actual,
+ * en paralelo. Sobreescribe los archivos existentes; los que no estan en
+ * el commit no se modifican.
+ *
+ * @param number Numero del commit
+ *
+ * @return FILE_ADDED, VERSION_NOT_FOUND o VERSION_ERROR.
+ */
+return_code checkout(int number);
+
+/**
+ * @brief Agrupa los objetos sueltos pequenos en un paquete.
  *
- * @return 1 en caso de exito, 0 si ocurre un error.
+ * @return Numero de objetos agrupados, -1 si ocurre un error.
  */
-return_code get(char * filename, int version);
+int repack(void);
 
 #endif
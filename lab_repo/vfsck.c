@@ -0,0 +1,470 @@
+/**
+ * @file
+ * @brief Implementacion de la verificacion de integridad
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ */
+
+#include "vfsck.h"
+#include "vchunk.h"
+#include "vdb.h"
+#include "vdelta.h"
+#include "vlz.h"
+#include "vobject.h"
+#include "vpack.h"
+#include "vthash.h"
+#include "vtree.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define FORM_LOOSE 1 /**< Objeto suelto sin comprimir */
+#define FORM_LZ 2 /**< Objeto suelto comprimido */
+#define FORM_DELTA 3 /**< Diferencia */
+#define FORM_CHUNK 4 /**< Lista de bloques */
+#define FORM_PACK 5 /**< Objeto de un paquete */
+
+#define STATUS_PENDING 0 /**< Sin verificar */
+#define STATUS_OK 1 /**< Contenido correcto */
+#define STATUS_CORRUPT 2 /**< Contenido danado o ilegible */
+
+#define HASH_ANY 0xff /**< Ningun registro nombra el objeto: su tipo de digest no se conoce */
+
+/**
+ * @brief Objeto guardado en una forma
+ */
+typedef struct {
+    uint8_t digest[DIGEST_SIZE]; /**< Digest del objeto */
+    uint8_t form;                /**< FORM_* */
+    uint8_t hash;                /**< Tipo del digest (VDB_HASH_*) o HASH_ANY */
+    uint8_t status;              /**< STATUS_* */
+} fsck_job;
+
+/**
+ * @brief Verificacion compartida por los hilos
+ */
+typedef struct {
+    fsck_job *jobs;         /**< Objetos */
+    size_t count;           /**< Numero de objetos */
+    size_t next;            /**< Siguiente objeto sin asignar */
+    double rate;            /**< Bytes por segundo, <= 0 sin limite */
+    struct timespec start;  /**< Inicio de la verificacion */
+    uint64_t bytes;         /**< Bytes leidos por todos los hilos */
+} fsck_ctx;
+
+/**
+ * @brief Hash en curso de un objeto
+ */
+typedef struct {
+    fsck_ctx *ctx;          /**< Verificacion */
+    int hash;               /**< Tipo del digest del objeto (VDB_HASH_*) o HASH_ANY */
+    int sha256;             /**< 1 si se calcula el SHA-256 del contenido */
+    int tree;               /**< 1 si se calcula el digest de arbol del contenido */
+    struct sha256_buff sha; /**< Hash SHA-256 del contenido */
+    thash_state thash;      /**< Digest de arbol del contenido */
+} hash_state;
+
+static double elapsed(const struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Reserva len bytes de la tasa de lectura. Si todos los hilos
+ * juntos van adelantados, espera hasta el momento en que esos bytes
+ * caben en la tasa.
+ */
+static void throttle(fsck_ctx *c, size_t len) {
+    uint64_t total = __atomic_add_fetch(&c->bytes, len, __ATOMIC_RELAXED);
+    double ahead;
+    struct timespec wait;
+
+    if (c->rate <= 0) return;
+    if ((ahead = total / c->rate - elapsed(&c->start)) <= 0) return;
+    wait.tv_sec = (time_t)ahead;
+    wait.tv_nsec = (long)((ahead - wait.tv_sec) * 1e9);
+    while (nanosleep(&wait, &wait) < 0 && errno == EINTR);
+}
+
+static int sink_hash(void *ctx, const void *data, size_t len) {
+    hash_state *h = ctx;
+
+    throttle(h->ctx, len);
+    if (h->tree) thash_update(&h->thash, data, len);
+    if (h->sha256) sha256_update(&h->sha, data, len);
+    return 0;
+}
+
+/**
+ * @brief Inicia el hash de un contenido de size bytes (-1 si no se
+ * conoce). Se usa el tipo de digest de los registros que nombran el
+ * objeto: un archivo grande guardado antes del digest de arbol conserva
+ * su SHA-256 (ver vthash.h). Si ningun registro lo nombra y es grande, se
+ * calculan los dos en la misma lectura.
+ */
+static void hash_begin(hash_state *h, int64_t size) {
+    if (h->hash != HASH_ANY) {
+        h->tree = h->hash == VDB_HASH_TREE;
+        h->sha256 = !h->tree;
+    } else {
+        h->tree = size >= 0 && THASH_TYPE(size) == VDB_HASH_TREE;
+        h->sha256 = 1;
+    }
+    if (h->tree) thash_init(&h->thash);
+    if (h->sha256) sha256_init(&h->sha);
+}
+
+/**
+ * @brief Calcula el hash de un descriptor desde su posicion actual, con
+ * lecturas secuenciales de OBJECT_BUFSIZE bytes.
+ * @return 0 en caso de exito, -1 si ocurre un error de lectura.
+ */
+static int hash_fd(hash_state *h, int fd, char *buf) {
+    ssize_t nread;
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    while ((nread = read(fd, buf, OBJECT_BUFSIZE)) != 0) {
+        if (nread < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        sink_hash(h, buf, nread);
+    }
+
+    // Las paginas leidas no se vuelven a usar
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    return 0;
+}
+
+/**
+ * @brief Hash de un descriptor completo, con el tipo que corresponde a su
+ * tamano.
+ * @return 0 en caso de exito, -1 si ocurre un error de lectura.
+ */
+static int hash_file_fd(hash_state *h, int fd, char *buf) {
+    struct stat s;
+
+    if (fstat(fd, &s) < 0) return -1;
+    hash_begin(h, s.st_size);
+    return hash_fd(h, fd, buf);
+}
+
+/**
+ * @brief Reconstruye un objeto en un temporal ya borrado.
+ * @return Descriptor del temporal al inicio, -1 si ocurre un error.
+ */
+static int reconstruct(const char *hash, int form) {
+    char path[PATH_MAX];
+    int fd, result;
+
+    snprintf(path, PATH_MAX, "%s/" OBJECT_TMP_PREFIX "XXXXXX", VERSIONS_DIR);
+    if ((fd = mkstemp(path)) < 0) return -1;
+    unlink(path);
+    result = form == FORM_DELTA ? delta_reconstruct(hash, fd) : chunk_reconstruct(hash, fd);
+    if (result < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Verifica un objeto en una de sus formas.
+ * @return STATUS_OK o STATUS_CORRUPT.
+ */
+static int verify(fsck_ctx *c, const fsck_job *job, char *buf) {
+    char hash[2 * DIGEST_SIZE + 1], path[PATH_MAX];
+    uint8_t digest[DIGEST_SIZE];
+    hash_state h;
+    int fd = -1, ok = 0, same = 0;
+
+    digest_to_hex(job->digest, hash);
+    h.ctx = c;
+    h.hash = job->hash;
+    hash_begin(&h, 0);
+    switch (job->form) {
+    case FORM_LOOSE:
+        if ((fd = open(object_path(hash, path), O_RDONLY)) >= 0) ok = hash_file_fd(&h, fd, buf) == 0;
+        break;
+    case FORM_LZ:
+        if ((fd = open(object_lz_path(hash, path), O_RDONLY)) >= 0) {
+            hash_begin(&h, lz_frame_size(fd, 0));
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            ok = lz_decode(fd, 0, sink_hash, &h) == 0;
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        }
+        break;
+    case FORM_DELTA:
+    case FORM_CHUNK:
+        // Se verifica el contenido reconstruido: una base o un bloque
+        // danado tambien dana este objeto
+        if ((fd = reconstruct(hash, job->form)) >= 0) ok = hash_file_fd(&h, fd, buf) == 0;
+        break;
+    default:
+        // Los paquetes no guardan el tamano antes del contenido: un objeto
+        // sin registros se verifica con SHA-256 (ver pack_repack)
+        hash_begin(&h, -1);
+        ok = pack_read(hash, sink_hash, &h) == 0;
+        break;
+    }
+    if (fd >= 0) close(fd);
+
+    if (h.tree) {
+        thash_final(&h.thash, digest);
+        same = memcmp(digest, job->digest, DIGEST_SIZE) == 0;
+    }
+    if (h.sha256) {
+        sha256_finalize(&h.sha);
+        sha256_read(&h.sha, digest);
+        same = same || memcmp(digest, job->digest, DIGEST_SIZE) == 0;
+    }
+    return ok && same ? STATUS_OK : STATUS_CORRUPT;
+}
+
+/**
+ * @brief Hilo trabajador: verifica los objetos pendientes.
+ */
+static void *fsck_worker(void *arg) {
+    fsck_ctx *c = arg;
+    char *buf;
+    size_t i;
+
+    if ((buf = malloc(OBJECT_BUFSIZE)) == NULL) return NULL;
+    while ((i = __atomic_fetch_add(&c->next, 1, __ATOMIC_RELAXED)) < c->count) {
+        c->jobs[i].status = verify(c, &c->jobs[i], buf);
+    }
+    free(buf);
+    return NULL;
+}
+
+/**
+ * @brief Agrega un objeto a la lista.
+ * @return 0 en caso de exito, -1 si no hay memoria.
+ */
+static int add_job(fsck_ctx *c, size_t *capacity, const uint8_t *digest, int form) {
+    fsck_job *grown;
+
+    if (c->count == *capacity) {
+        *capacity = *capacity ? 2 * *capacity : 1024;
+        if ((grown = realloc(c->jobs, *capacity * sizeof *grown)) == NULL) return -1;
+        c->jobs = grown;
+    }
+    memcpy(c->jobs[c->count].digest, digest, DIGEST_SIZE);
+    c->jobs[c->count].form = form;
+    c->jobs[c->count].hash = HASH_ANY;
+    c->jobs[c->count].status = STATUS_PENDING;
+    c->count++;
+    return 0;
+}
+
+/**
+ * @brief Lista los objetos sueltos y los de los paquetes.
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int list_objects(fsck_ctx *c) {
+    char hash[2 * DIGEST_SIZE + 1];
+    uint8_t digest[DIGEST_SIZE], *packed;
+    struct dirent *entry;
+    size_t capacity = 0;
+    ssize_t count, i;
+    DIR *dir;
+
+    if ((dir = opendir(VERSIONS_DIR)) == NULL) return -1;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *suffix = entry->d_name + 2 * DIGEST_SIZE;
+        int form;
+
+        if (strlen(entry->d_name) < 2 * DIGEST_SIZE) continue;
+        if (*suffix == 0) form = FORM_LOOSE;
+        else if (EQUALS(suffix, OBJECT_LZ_SUFFIX)) form = FORM_LZ;
+        else if (EQUALS(suffix, DELTA_SUFFIX)) form = FORM_DELTA;
+        else if (EQUALS(suffix, CHUNK_SUFFIX)) form = FORM_CHUNK;
+        else continue;
+
+        snprintf(hash, sizeof hash, "%.*s", 2 * DIGEST_SIZE, entry->d_name);
+        if (hex_to_digest(hash, digest) < 0) continue;
+        if (add_job(c, &capacity, digest, form) < 0) {
+            closedir(dir);
+            return -1;
+        }
+    }
+    closedir(dir);
+
+    if ((count = pack_list(&packed)) < 0) return -1;
+    for (i = 0; i < count; i++) {
+        if (add_job(c, &capacity, packed + i * DIGEST_SIZE, FORM_PACK) < 0) {
+            free(packed);
+            return -1;
+        }
+    }
+    free(packed);
+    return 0;
+}
+
+static int compare_jobs(const void *a, const void *b) {
+    return memcmp(((const fsck_job *)a)->digest, ((const fsck_job *)b)->digest, DIGEST_SIZE);
+}
+
+/**
+ * @brief Verifica si un objeto existe y todas sus formas son correctas.
+ * Los objetos estan ordenados por digest.
+ */
+static int valid(const fsck_ctx *c, const uint8_t *digest) {
+    fsck_job key;
+    const fsck_job *found, *first, *last, *end = c->jobs + c->count;
+
+    memcpy(key.digest, digest, DIGEST_SIZE);
+    if ((found = bsearch(&key, c->jobs, c->count, sizeof key, compare_jobs)) == NULL) return 0;
+    for (first = found; first > c->jobs && compare_jobs(first - 1, &key) == 0; first--);
+    for (last = found; last < end && compare_jobs(last, &key) == 0; last++) {
+        if (last->status != STATUS_OK) return 0;
+    }
+    for (; first < found; first++) {
+        if (first->status != STATUS_OK) return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Toma el tipo de digest de cada objeto de los registros que lo
+ * nombran. Los objetos estan ordenados por digest.
+ * @return 0 en caso de exito, -1 si no se puede leer la base de datos.
+ */
+static int set_hash_types(fsck_ctx *c) {
+    fsck_job key, *found, *first, *end = c->jobs + c->count;
+    vdb_record r;
+    off_t offset;
+    ssize_t len;
+
+    if (vdb_map() < 0) return -1;
+    vdb_advise(MADV_SEQUENTIAL);
+    for (offset = vdb_first(); (len = vdb_record_at(offset, &r)) > 0; offset += len) {
+        memcpy(key.digest, r.header->digest, DIGEST_SIZE);
+        if ((found = bsearch(&key, c->jobs, c->count, sizeof key, compare_jobs)) == NULL) continue;
+        for (first = found; first > c->jobs && compare_jobs(first - 1, &key) == 0; first--);
+        for (; first < end && compare_jobs(first, &key) == 0; first++) first->hash = VDB_HASH(r.header->type);
+    }
+    return len < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Contexto de la verificacion de los arboles de un commit
+ */
+typedef struct {
+    const fsck_ctx *c; /**< Objetos verificados */
+    long invalid;      /**< Archivos o arboles faltantes o danados */
+} tree_check;
+
+static int check_entry(void *ctx, const char *path, int kind, const uint8_t *digest) {
+    tree_check *t = ctx;
+    char hash[2 * DIGEST_SIZE + 1];
+
+    if (!valid(t->c, digest)) {
+        digest_to_hex(digest, hash);
+        fprintf(stderr, "%s %s: objeto faltante o danado %s\n", kind == TREE_DIR ? "Arbol" : "Archivo", path, hash);
+        t->invalid++;
+    }
+    return 0;
+}
+
+/**
+ * @brief Verifica que cada registro apunte a un objeto valido.
+ * @return 0 en caso de exito, -1 si no se puede leer la base de datos.
+ */
+static int check_records(const fsck_ctx *c, fsck_report *report) {
+    char hash[2 * DIGEST_SIZE + 1];
+    tree_check t = {c, 0};
+    commit_info commit;
+    vdb_record r;
+    off_t offset;
+    ssize_t len;
+
+    if (vdb_map() < 0) return -1;
+    vdb_advise(MADV_SEQUENTIAL);
+    for (offset = vdb_first(); (len = vdb_record_at(offset, &r)) > 0; offset += len) {
+        report->records++;
+        if (!valid(c, r.header->digest)) {
+            digest_to_hex(r.header->digest, hash);
+            fprintf(stderr, "Registro %.*s: objeto faltante o danado %s\n", r.header->filename_len, r.filename, hash);
+            report->missing++;
+            continue;
+        }
+
+        // Un commit valido tambien necesita sus arboles y sus archivos
+        if (VDB_KIND(r.header->type) == VDB_KIND_COMMIT) {
+            t.invalid = 0;
+            if (commit_read(r.header->digest, &commit) < 0 || !valid(c, commit.tree)
+                    || tree_walk(commit.tree, check_entry, &t) < 0 || t.invalid > 0) {
+                digest_to_hex(r.header->digest, hash);
+                fprintf(stderr, "Commit %s incompleto\n", hash);
+                report->missing++;
+            }
+        }
+    }
+    return len < 0 ? -1 : 0;
+}
+
+int fsck_run(int threads, double max_rate, fsck_report *report) {
+    fsck_ctx c;
+    pthread_t *workers = NULL;
+    long started = 0, i;
+    size_t j;
+    int result = -1;
+
+    memset(report, 0, sizeof *report);
+    memset(&c, 0, sizeof c);
+    c.rate = max_rate;
+    clock_gettime(CLOCK_MONOTONIC, &c.start);
+
+    // 1. Lista los objetos en todas sus formas, con el tipo de digest de
+    // sus registros
+    if (list_objects(&c) < 0) {
+        free(c.jobs);
+        return -1;
+    }
+    qsort(c.jobs, c.count, sizeof *c.jobs, compare_jobs);
+    if (set_hash_types(&c) < 0) {
+        free(c.jobs);
+        return -1;
+    }
+
+    // 2. Los verifica en paralelo. El hilo principal tambien trabaja
+    if (threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > (long)c.count) threads = c.count;
+    if (threads > 1 && (workers = malloc((threads - 1) * sizeof *workers)) != NULL) {
+        for (; started < threads - 1; started++) {
+            if (pthread_create(&workers[started], NULL, fsck_worker, &c) != 0) break;
+        }
+    }
+    fsck_worker(&c);
+    for (i = 0; i < started; i++) pthread_join(workers[i], NULL);
+    free(workers);
+
+    for (j = 0; j < c.count; j++) {
+        report->objects++;
+        if (c.jobs[j].status != STATUS_OK) {
+            char hash[2 * DIGEST_SIZE + 1];
+
+            digest_to_hex(c.jobs[j].digest, hash);
+            fprintf(stderr, "Objeto danado: %s%s\n", hash,
+                    c.jobs[j].form == FORM_LZ ? OBJECT_LZ_SUFFIX : c.jobs[j].form == FORM_DELTA ? DELTA_SUFFIX
+                    : c.jobs[j].form == FORM_CHUNK ? CHUNK_SUFFIX : c.jobs[j].form == FORM_PACK ? " (paquete)" : "");
+            report->corrupt++;
+        }
+    }
+
+    // 3. Cada registro debe apuntar a un objeto valido
+    if (check_records(&c, report) == 0) {
+        result = report->corrupt > 0 || report->missing > 0 ? 1 : 0;
+    }
+
+    report->bytes = c.bytes;
+    report->seconds = elapsed(&c.start);
+    free(c.jobs);
+    return result;
+}
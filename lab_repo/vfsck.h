@@ -0,0 +1,52 @@
+/**
+ * @file
+ * @brief Verificacion de integridad del repositorio
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * fsck verifica que cada objeto guardado (suelto, comprimido, diferencia,
+ * lista de bloques o dentro de un paquete) tenga el contenido que indica
+ * su nombre, y que cada registro de versions.db apunte a un objeto valido.
+ * Los commits se verifican con sus arboles y los archivos de estos.
+ *
+ * Los objetos se verifican en paralelo, con un hilo por procesador. Cada
+ * objeto se lee con lecturas secuenciales grandes, y al terminar se le
+ * indica al kernel que no conserve sus paginas en cache (posix_fadvise),
+ * para no desplazar los datos de otros procesos. La lectura se puede
+ * limitar a una tasa maxima para ejecutar fsck en un servidor en uso.
+ */
+
+#ifndef VFSCK_H
+#define VFSCK_H
+
+#include <stdint.h>
+
+#include "versions.h"
+
+/**
+ * @brief Resultado de una verificacion
+ */
+typedef struct {
+    long objects;   /**< Objetos verificados (cada forma guardada cuenta) */
+    long corrupt;   /**< Objetos danados o que no se pueden leer */
+    long records;   /**< Registros verificados */
+    long missing;   /**< Registros que apuntan a un objeto faltante o danado */
+    uint64_t bytes; /**< Bytes de contenido verificados */
+    double seconds; /**< Duracion de la verificacion */
+} fsck_report;
+
+/**
+ * @brief Verifica los objetos y los registros del repositorio. Cada
+ * problema se reporta en la salida de error.
+ *
+ * @param threads Hilos de verificacion (<= 0: uno por procesador)
+ * @param max_rate Bytes por segundo a leer como maximo (<= 0: sin limite)
+ * @param report Resultado de la verificacion
+ *
+ * @return 0 si el repositorio esta integro, 1 si hay problemas, -1 si
+ * ocurre un error.
+ */
+int fsck_run(int threads, double max_rate, fsck_report *report);
+
+#endif
@@ -0,0 +1,532 @@
+/**
+ * @file
+ * @brief Implementacion de la recoleccion de basura incremental
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ */
+
+#include "vgc.h"
+#include "vbloom.h"
+#include "vchunk.h"
+#include "vdb.h"
+#include "vdelta.h"
+#include "vindex.h"
+#include "vobject.h"
+#include "vpack.h"
+#include "vtree.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define GC_MAGIC 0x43475356 /**< "VSGC" en little endian */
+#define GC_FORMAT 3 /**< Version del formato (1: marcas sin ordenar; 2: recorrido con telldir) */
+#define GC_NAME_SIZE 80 /**< Longitud maxima del nombre de un objeto o temporal */
+
+#define GC_MARK 0 /**< Fase: marcar los objetos usados */
+#define GC_SWEEP 1 /**< Fase: borrar los objetos sin marcar */
+#define GC_COMPACT 2 /**< Fase: compactar versions.db */
+
+/**
+ * @brief Avance de la recoleccion, guardado en GC_STATE_PATH
+ */
+typedef struct {
+    uint32_t magic;             /**< GC_MAGIC */
+    uint32_t format;            /**< GC_FORMAT */
+    uint32_t phase;             /**< GC_MARK, GC_SWEEP o GC_COMPACT */
+    uint32_t reserved;          /**< Sin uso */
+    int64_t start;              /**< Inicio de la recoleccion */
+    uint64_t db_ino;            /**< Inodo de versions.db al iniciar */
+    uint64_t marked;            /**< Posicion del siguiente registro a marcar */
+    uint64_t marks_size;        /**< Bytes confirmados de GC_MARKS_PATH */
+    uint64_t duplicates;        /**< Registros duplicados vistos al marcar */
+    char cursor[GC_NAME_SIZE];  /**< Ultimo nombre revisado al borrar, vacio al inicio */
+    vdb_compaction compact;     /**< Avance de la compactacion */
+} gc_state;
+
+/**
+ * @brief Digests marcados en una ejecucion, antes de ordenarlos
+ */
+typedef struct {
+    uint8_t (*digests)[DIGEST_SIZE]; /**< Digests marcados */
+    size_t count;                    /**< Numero de digests */
+    size_t capacity;                 /**< Capacidad del arreglo */
+} mark_run;
+
+/**
+ * @brief Serie ordenada de GC_MARKS_PATH
+ */
+typedef struct {
+    const uint8_t *digests; /**< DIGEST_SIZE bytes por digest, ordenados */
+    uint64_t count;         /**< Numero de digests */
+} mark_segment;
+
+/**
+ * @brief Digests marcados: GC_MARKS_PATH mapeado en memoria. Se consulta
+ * con bsearch en cada serie, sin cargarlo ni ordenarlo de nuevo.
+ */
+typedef struct {
+    uint8_t *map;           /**< Inicio del mapeo, NULL si no hay marcas */
+    size_t size;            /**< Bytes mapeados */
+    mark_segment *segments; /**< Series del archivo */
+    size_t count;           /**< Numero de series */
+} mark_set;
+
+/**
+ * @brief Inicia una recoleccion nueva.
+ */
+static void reset_state(gc_state *st) {
+    memset(st, 0, sizeof *st);
+    st->magic = GC_MAGIC;
+    st->format = GC_FORMAT;
+    st->phase = GC_MARK;
+    st->start = time(NULL);
+    st->db_ino = vdb_ino();
+    st->marked = vdb_first();
+    truncate(GC_MARKS_PATH, 0);
+}
+
+/**
+ * @brief Guarda el avance de la recoleccion.
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int save_state(int fd, const gc_state *st) {
+    return pwrite(fd, st, sizeof *st, 0) == sizeof *st && fdatasync(fd) == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Agrega un digest a las marcas de la ejecucion.
+ * @return 0 en caso de exito, -1 si no hay memoria.
+ */
+static int add_mark(mark_run *run, const uint8_t *digest) {
+    uint8_t (*grown)[DIGEST_SIZE];
+    size_t capacity;
+
+    if (run->count == run->capacity) {
+        capacity = run->capacity ? 2 * run->capacity : 4096;
+        if ((grown = realloc(run->digests, capacity * DIGEST_SIZE)) == NULL) return -1;
+        run->digests = grown;
+        run->capacity = capacity;
+    }
+    memcpy(run->digests[run->count++], digest, DIGEST_SIZE);
+    return 0;
+}
+
+/**
+ * @brief Marca un objeto y los objetos de los que depende: la base de una
+ * diferencia (y la de esta, hasta el final de la cadena) o los bloques de
+ * una lista.
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int mark_object(mark_run *marks, const uint8_t *digest) {
+    char hash[2 * DIGEST_SIZE + 1], base[2 * DIGEST_SIZE + 1];
+    uint8_t current[DIGEST_SIZE], *chunks;
+    ssize_t count, i;
+
+    memcpy(current, digest, DIGEST_SIZE);
+    for (;;) {
+        if (add_mark(marks, current) < 0) return -1;
+        digest_to_hex(current, hash);
+        if ((count = chunk_list(hash, &chunks)) >= 0) {
+            for (i = 0; i < count && add_mark(marks, chunks + i * DIGEST_SIZE) == 0; i++);
+            free(chunks);
+            return i == count ? 0 : -1;
+        }
+        if (delta_base(hash, base) < 0 || hex_to_digest(base, current) < 0) return 0;
+    }
+}
+
+static int mark_tree_entry(void *ctx, const char *path, int kind, const uint8_t *digest) {
+    (void)path;
+    if (kind == TREE_DIR) return add_mark(ctx, digest) == 0 ? 0 : 1;
+    return mark_object(ctx, digest) == 0 ? 0 : 1;
+}
+
+/**
+ * @brief Marca un commit, sus arboles y los objetos de sus archivos. El
+ * commit anterior se marca con su propio registro.
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int mark_commit(mark_run *marks, const uint8_t *digest) {
+    commit_info c;
+
+    if (mark_object(marks, digest) < 0) return -1;
+    if (commit_read(digest, &c) < 0) return 0;
+    if (add_mark(marks, c.tree) < 0) return -1;
+    return tree_walk(c.tree, mark_tree_entry, marks) == 1 ? -1 : 0;
+}
+
+static int compare_digests(const void *a, const void *b) {
+    return memcmp(a, b, DIGEST_SIZE);
+}
+
+/**
+ * @brief Verifica si un registro repite el nombre y el digest de un
+ * registro anterior. El indice guarda la posicion del primero; un registro
+ * que no esta en el indice se conserva.
+ * @return 1 si es un duplicado, 0 en caso contrario.
+ */
+static int is_duplicate(const vdb_record *r, off_t offset, void *ctx) {
+    char filename[PATH_MAX];
+    off_t first;
+
+    (void)ctx;
+    memcpy(filename, r->filename, r->header->filename_len);
+    filename[r->header->filename_len] = 0;
+    first = vindex_first(filename, r->header->digest);
+    return first >= 0 && first < offset;
+}
+
+/**
+ * @brief Agrega a GC_MARKS_PATH las marcas de la ejecucion como una serie
+ * ordenada y sin repetidos: el numero de digests (uint64_t) seguido de los
+ * digests. Lo escrito despues de st->marks_size (una ejecucion
+ * interrumpida) se descarta.
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int write_run(gc_state *st, mark_run *run) {
+    uint64_t count = 0;
+    size_t i, len;
+    int fd, ok;
+
+    qsort(run->digests, run->count, DIGEST_SIZE, compare_digests);
+    for (i = 0; i < run->count; i++) {
+        if (count > 0 && memcmp(run->digests[count - 1], run->digests[i], DIGEST_SIZE) == 0) continue;
+        memmove(run->digests[count++], run->digests[i], DIGEST_SIZE);
+    }
+    if (count == 0) return 0;
+
+    // Las marcas deben estar en disco antes de guardar el avance
+    len = count * DIGEST_SIZE;
+    if ((fd = open(GC_MARKS_PATH, O_WRONLY | O_CREAT, 0644)) < 0) return -1;
+    ok = ftruncate(fd, st->marks_size) == 0
+        && pwrite(fd, &count, sizeof count, st->marks_size) == sizeof count
+        && pwrite(fd, run->digests, len, st->marks_size + sizeof count) == (ssize_t)len
+        && fdatasync(fd) == 0;
+    if (close(fd) != 0) ok = 0;
+    if (ok) st->marks_size += sizeof count + len;
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief Marca los objetos de los registros desde st->marked y cuenta los
+ * registros duplicados.
+ *
+ * @param limit Registros a marcar (< 0: hasta el final)
+ *
+ * @return Registros marcados, -1 si ocurre un error.
+ */
+static long mark_records(gc_state *st, long limit) {
+    mark_run run = {NULL, 0, 0};
+    vdb_record r;
+    ssize_t len = 0;
+    long count = 0;
+    int ok = 1;
+
+    vdb_advise(MADV_SEQUENTIAL);
+    while (ok && count != limit && (len = vdb_record_at(st->marked, &r)) > 0) {
+        if (VDB_KIND(r.header->type) == VDB_KIND_COMMIT) ok = mark_commit(&run, r.header->digest) == 0;
+        else ok = mark_object(&run, r.header->digest) == 0;
+        if (is_duplicate(&r, st->marked, NULL)) st->duplicates++;
+        st->marked += len;
+        count++;
+    }
+
+    ok = ok && len >= 0 && write_run(st, &run) == 0;
+    free(run.digests);
+    return ok ? count : -1;
+}
+
+/**
+ * @brief Verifica si termino de marcar los registros confirmados.
+ */
+static int marked_all(const gc_state *st) {
+    vdb_record r;
+    return vdb_record_at(st->marked, &r) == 0;
+}
+
+/**
+ * @brief Mapea los digests marcados y ubica sus series. El trabajo depende
+ * del numero de series, no del numero de digests.
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int open_marks(mark_set *set, uint64_t size) {
+    mark_segment *grown;
+    uint64_t count;
+    size_t offset = 0, capacity = 0;
+    int fd;
+
+    memset(set, 0, sizeof *set);
+    if (size == 0) return 0;
+    if ((fd = open(GC_MARKS_PATH, O_RDONLY)) < 0) return -1;
+    set->map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (set->map == MAP_FAILED) {
+        set->map = NULL;
+        return -1;
+    }
+    set->size = size;
+    madvise(set->map, size, MADV_RANDOM);
+
+    while (offset + sizeof count <= size) {
+        memcpy(&count, set->map + offset, sizeof count);
+        if (count > (size - offset - sizeof count) / DIGEST_SIZE) break;
+        if (set->count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            if ((grown = realloc(set->segments, capacity * sizeof *grown)) == NULL) break;
+            set->segments = grown;
+        }
+        set->segments[set->count].digests = set->map + offset + sizeof count;
+        set->segments[set->count].count = count;
+        set->count++;
+        offset += sizeof count + count * DIGEST_SIZE;
+    }
+    return offset == size ? 0 : -1;
+}
+
+/**
+ * @brief Libera el mapeo de los digests marcados.
+ */
+static void close_marks(mark_set *set) {
+    if (set->map != NULL) munmap(set->map, set->size);
+    free(set->segments);
+}
+
+static int is_marked(const uint8_t *digest, void *ctx) {
+    mark_set *set = ctx;
+    size_t i;
+
+    for (i = 0; i < set->count; i++) {
+        if (bsearch(digest, set->segments[i].digests, set->segments[i].count, DIGEST_SIZE, compare_digests) != NULL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Verifica si un nombre de .versions es un objeto: el hash
+ * seguido de un sufijo de objeto suelto, comprimido, diferencia o lista de
+ * bloques.
+ *
+ * @param name Nombre
+ * @param digest Digest del objeto
+ *
+ * @return 1 si es un objeto, 0 en caso contrario.
+ */
+static int object_name(const char *name, uint8_t *digest) {
+    char hash[2 * DIGEST_SIZE + 1];
+    const char *suffix = name + 2 * DIGEST_SIZE;
+
+    if (strlen(name) < 2 * DIGEST_SIZE) return 0;
+    if (*suffix != 0 && !EQUALS(suffix, OBJECT_LZ_SUFFIX) && !EQUALS(suffix, DELTA_SUFFIX)
+            && !EQUALS(suffix, CHUNK_SUFFIX)) {
+        return 0;
+    }
+    snprintf(hash, sizeof hash, "%.*s", 2 * DIGEST_SIZE, name);
+    return hex_to_digest(hash, digest) == 0;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(a, b);
+}
+
+/**
+ * @brief Restaura el orden del monticulo de nombres (el mayor en la raiz)
+ * desde la raiz.
+ */
+static void sift_name(char (*heap)[GC_NAME_SIZE], size_t count) {
+    char name[GC_NAME_SIZE];
+    size_t i = 0, child;
+
+    memcpy(name, heap[0], GC_NAME_SIZE);
+    while ((child = 2 * i + 1) < count) {
+        if (child + 1 < count && strcmp(heap[child + 1], heap[child]) > 0) child++;
+        if (strcmp(heap[child], name) <= 0) break;
+        memcpy(heap[i], heap[child], GC_NAME_SIZE);
+        i = child;
+    }
+    memcpy(heap[i], name, GC_NAME_SIZE);
+}
+
+/**
+ * @brief Agrega un nombre al monticulo, que conserva los limit menores.
+ * @return 0 en caso de exito, -1 si no hay memoria.
+ */
+static int keep_name(char (**heap)[GC_NAME_SIZE], size_t *count, size_t *capacity, size_t limit, const char *name) {
+    char (*grown)[GC_NAME_SIZE];
+    size_t i, parent;
+
+    if (*count == limit) {
+        if (strcmp(name, (*heap)[0]) >= 0) return 0;
+        snprintf((*heap)[0], GC_NAME_SIZE, "%s", name);
+        sift_name(*heap, *count);
+        return 0;
+    }
+    if (*count == *capacity) {
+        *capacity = *capacity ? 2 * *capacity : 1024;
+        if (*capacity > limit) *capacity = limit;
+        if ((grown = realloc(*heap, *capacity * GC_NAME_SIZE)) == NULL) return -1;
+        *heap = grown;
+    }
+    for (i = (*count)++; i > 0 && strcmp((*heap)[parent = (i - 1) / 2], name) < 0; i = parent) {
+        memcpy((*heap)[i], (*heap)[parent], GC_NAME_SIZE);
+    }
+    snprintf((*heap)[i], GC_NAME_SIZE, "%s", name);
+    return 0;
+}
+
+/**
+ * @brief Borra los objetos sin marcar y los temporales abandonados,
+ * recorriendo los nombres en orden desde st->cursor. Cada ejecucion lee
+ * los nombres de .versions, pero solo conserva y revisa los *budget
+ * siguientes al cursor, por lo que la memoria y las llamadas a lstat no
+ * dependen del tamano del directorio. El cursor es un nombre, no una
+ * posicion de readdir: vale en otro proceso aunque se hayan creado o
+ * borrado entradas. Una entrada creada durante el recorrido con un nombre
+ * anterior al cursor no se ve: es reciente y no se borraria.
+ *
+ * @param budget Entradas a revisar; se descuentan las revisadas
+ * @param report Resultado de la ejecucion
+ *
+ * @return 1 si se revisaron todas las entradas, 0 si quedan pendientes, -1
+ * si ocurre un error.
+ */
+static int sweep_objects(gc_state *st, const mark_set *set, long *budget, gc_report *report) {
+    char path[PATH_MAX];
+    char (*names)[GC_NAME_SIZE] = NULL;
+    uint8_t digest[DIGEST_SIZE];
+    struct dirent *entry;
+    struct stat s;
+    size_t count = 0, capacity = 0, limit = *budget, i;
+    int more = 0;
+    DIR *dir;
+
+    if ((dir = opendir(VERSIONS_DIR)) == NULL) return -1;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strlen(entry->d_name) >= GC_NAME_SIZE || strcmp(entry->d_name, st->cursor) <= 0) continue;
+        if (strncmp(entry->d_name, OBJECT_TMP_PREFIX, strlen(OBJECT_TMP_PREFIX)) != 0
+                && !object_name(entry->d_name, digest)) {
+            continue;
+        }
+        if (count == limit) more = 1;
+        if (keep_name(&names, &count, &capacity, limit, entry->d_name) < 0) {
+            free(names);
+            closedir(dir);
+            return -1;
+        }
+    }
+    closedir(dir);
+
+    if (count > 0) qsort(names, count, GC_NAME_SIZE, compare_names);
+    for (i = 0; i < count; i++) {
+        snprintf(path, PATH_MAX, "%s/%s", VERSIONS_DIR, names[i]);
+        if (lstat(path, &s) == 0 && s.st_mtime < st->start - GC_GRACE
+                && (!object_name(names[i], digest) || !is_marked(digest, (void *)set))
+                && unlink(path) == 0) {
+            report->removed++;
+        }
+        report->swept++;
+        memcpy(st->cursor, names[i], GC_NAME_SIZE);
+    }
+    *budget -= count;
+    free(names);
+    return !more;
+}
+
+int gc_run(long budget, gc_report *report) {
+    struct stat s, current;
+    gc_state st;
+    mark_set set;
+    long n;
+    int fd, result = 0;
+
+    memset(report, 0, sizeof *report);
+    if (budget <= 0) budget = GC_BUDGET;
+
+    // Una sola recoleccion a la vez; si la anterior termino mientras se
+    // esperaba, su avance ya fue borrado
+    if ((fd = open(GC_STATE_PATH, O_RDWR | O_CREAT, 0644)) < 0) return -1;
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        close(fd);
+        return errno == EWOULDBLOCK ? 2 : -1;
+    }
+    if (fstat(fd, &s) < 0 || stat(GC_STATE_PATH, &current) < 0 || s.st_ino != current.st_ino) {
+        close(fd);
+        return 2;
+    }
+
+    if (vdb_map() < 0) {
+        close(fd);
+        return -1;
+    }
+
+    // Los duplicados se reconocen con el indice (ver is_duplicate); si no
+    // esta disponible, no se elimina ninguno
+    vindex_open();
+
+    if (pread(fd, &st, sizeof st, 0) != sizeof st || st.magic != GC_MAGIC || st.format != GC_FORMAT) {
+        reset_state(&st);
+    }
+
+    // Las posiciones marcadas solo valen para la misma base de datos
+    if (st.phase != GC_COMPACT && st.db_ino != (uint64_t)vdb_ino()) reset_state(&st);
+
+    if (st.phase == GC_MARK) {
+        if ((n = mark_records(&st, budget)) < 0) goto error;
+        report->marked += n;
+        budget -= n;
+        if (marked_all(&st)) st.phase = GC_SWEEP;
+        if (save_state(fd, &st) < 0) goto error;
+    }
+
+    if (st.phase == GC_SWEEP && budget > 0) {
+        // Los registros adicionados desde la fase anterior tambien se marcan
+        if ((n = mark_records(&st, -1)) < 0) goto error;
+        report->marked += n;
+        if (open_marks(&set, st.marks_size) < 0) {
+            close_marks(&set);
+            goto error;
+        }
+
+        result = sweep_objects(&st, &set, &budget, report);
+        if (result == 1) {
+            report->packs = pack_prune(is_marked, &set, st.start - GC_GRACE);
+            st.phase = GC_COMPACT;
+            vdb_compact_begin(&st.compact);
+        }
+        close_marks(&set);
+        if (result < 0 || save_state(fd, &st) < 0) goto error;
+    }
+
+    // Sin duplicados no se reescribe versions.db. La compactacion copia a
+    // lo sumo budget registros por ejecucion
+    result = 0;
+    if (st.phase == GC_COMPACT && st.duplicates == 0) {
+        result = 1;
+    } else if (st.phase == GC_COMPACT && budget > 0) {
+        if ((result = vdb_compact_step(&st.compact, &budget, is_duplicate, NULL, &report->compacted)) < 0) {
+            goto error;
+        }
+
+        // Los registros eliminados siguen en el filtro: se reconstruye
+        if (result == 1) bloom_rebuild();
+        else if (save_state(fd, &st) < 0) goto error;
+    }
+
+    // Termino: la siguiente ejecucion inicia una recoleccion nueva
+    if (result == 1) {
+        unlink(GC_MARKS_PATH);
+        unlink(GC_STATE_PATH);
+    }
+
+    close(fd);
+    return result;
+
+error:
+    close(fd);
+    return -1;
+}
@@ -0,0 +1,70 @@
+/**
+ * @file
+ * @brief Recoleccion de basura incremental del repositorio
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * gc borra los objetos que ningun registro de versions.db usa y compacta
+ * la base de datos. El trabajo se divide en fases, y cada ejecucion hace
+ * a lo sumo una cantidad fija de trabajo y guarda su avance en
+ * .versions/gc.state, por lo que se puede ejecutar periodicamente (p.e.
+ * desde cron) sin detener a los demas procesos:
+ *
+ * - MARK: recorre los registros de la base de datos y agrega a
+ *   .versions/gc.marks el digest de cada objeto usado, de las bases de sus
+ *   diferencias y de sus bloques. Un registro de commit marca el commit,
+ *   sus arboles y los objetos de sus archivos. Cada ejecucion agrega sus
+ *   marcas como una serie ordenada, que se consulta con busqueda binaria
+ *   sobre el archivo mapeado. Tambien cuenta los registros duplicados
+ *   (mismo nombre y digest que un registro anterior, segun el indice).
+ * - SWEEP: marca los registros adicionados mientras tanto y continua el
+ *   recorrido de .versions en orden desde el ultimo nombre revisado;
+ *   borra los objetos que no estan marcados. Al final borra los paquetes
+ *   sin objetos marcados.
+ * - COMPACT: si hay duplicados, copia los registros unicos a una nueva
+ *   base de datos, a lo sumo GC_BUDGET por ejecucion (ver
+ *   vdb_compact_step), la publica y reconstruye el filtro de Bloom (ver
+ *   vbloom.h).
+ *
+ * Un objeto solo se borra si no se modifico desde un margen (GC_GRACE)
+ * antes del inicio de la recoleccion. add actualiza la fecha de los
+ * objetos que vuelve a usar (ver object_freshen), por lo que un objeto
+ * que se adiciona durante la recoleccion nunca se borra.
+ */
+
+#ifndef VGC_H
+#define VGC_H
+
+#include "versions.h"
+
+#define GC_STATE_PATH VERSIONS_DIR "/gc.state" /**< Avance de la recoleccion */
+#define GC_MARKS_PATH VERSIONS_DIR "/gc.marks" /**< Series ordenadas de digests marcados como usados */
+#define GC_BUDGET 100000 /**< Registros o entradas de .versions procesados por ejecucion */
+#define GC_GRACE 3600 /**< Segundos de margen antes del inicio de la recoleccion */
+
+/**
+ * @brief Resultado de una ejecucion de gc
+ */
+typedef struct {
+    long marked;    /**< Registros marcados */
+    long swept;     /**< Objetos revisados */
+    long removed;   /**< Objetos borrados */
+    long packs;     /**< Paquetes borrados */
+    long compacted; /**< Registros duplicados eliminados */
+} gc_report;
+
+/**
+ * @brief Continua la recoleccion de basura desde el ultimo avance
+ * guardado, o inicia una nueva.
+ *
+ * @param budget Registros o entradas de .versions a procesar (<= 0:
+ * GC_BUDGET)
+ * @param report Resultado de la ejecucion
+ *
+ * @return 1 si la recoleccion termino, 0 si queda trabajo pendiente, 2 si
+ * otro proceso esta ejecutando gc, -1 si ocurre un error.
+ */
+int gc_run(long budget, gc_report *report);
+
+#endif
@@ -0,0 +1,457 @@
+/**
+ * @file
+ * @brief Implementacion del indice persistente de versiones
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ */
+
+#include "vindex.h"
+#include "vdb.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#define VINDEX_MAGIC 0x58444956 /**< "VIDX" en little endian */
+#define VINDEX_FORMAT 3 /**< Version del formato del indice */
+#define VINDEX_MIN_SLOTS 1024 /**< Ranuras de un indice nuevo (potencia de 2) */
+
+/**
+ * @brief Tipo de llave de una ranura
+ */
+typedef enum {
+    SLOT_EMPTY,   /*!< Ranura libre */
+    SLOT_FILE,    /*!< nombre -> numero de versiones */
+    SLOT_VERSION, /*!< (nombre, numero) -> registro */
+    SLOT_CONTENT, /*!< (nombre, hash) -> registro */
+} slot_kind;
+
+/**
+ * @brief Encabezado del archivo de indice
+ */
+typedef struct {
+    uint32_t magic;   /**< VINDEX_MAGIC */
+    uint32_t format;  /**< VINDEX_FORMAT */
+    uint64_t nslots;  /**< Numero de ranuras (potencia de 2) */
+    uint64_t nused;   /**< Ranuras ocupadas */
+    uint64_t db_size; /**< Bytes de versions.db indexados */
+    uint64_t db_ino;  /**< Inodo de versions.db indexado */
+} vindex_header;
+
+/**
+ * @brief Ranura de la tabla hash
+ */
+typedef struct {
+    uint64_t key;    /**< Llave, 0 si la ranura esta libre */
+    uint64_t offset; /**< Posicion del registro en versions.db */
+    uint32_t aux;    /**< Numero de versiones (archivo) o de version */
+    uint32_t kind;   /**< slot_kind */
+} vindex_slot;
+
+/**
+ * @brief Estado del indice abierto por el proceso
+ */
+static struct {
+    int fd;                /**< Descriptor del indice */
+    vindex_header *header; /**< Inicio del mapeo */
+    vindex_slot *slots;    /**< Ranuras (siguen al encabezado) */
+    size_t map_size;       /**< Tamano del mapeo */
+} idx = {-1, NULL, NULL, 0};
+
+/**
+ * @brief Hash FNV-1a de 64 bits.
+ */
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    while (len--) {
+        h ^= *p++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/**
+ * @brief Mezcla final (splitmix64) para repartir los bits de la llave.
+ */
+static uint64_t mix(uint64_t h) {
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h ? h : 1;
+}
+
+static uint64_t key_of(slot_kind kind, const char *filename, size_t filename_len, const uint8_t *digest, uint32_t n) {
+    uint64_t h = fnv1a(0xcbf29ce484222325ULL, &kind, sizeof kind);
+    h = fnv1a(h, filename, filename_len);
+    h = fnv1a(h, "", 1);
+    if (digest != NULL) h = fnv1a(h, digest, DIGEST_SIZE);
+    if (n != 0) h = fnv1a(h, &n, sizeof n);
+    return mix(h);
+}
+
+/**
+ * @brief Mapea un archivo de indice con el numero de ranuras dado.
+ * @return Inicio del mapeo, NULL si ocurre un error.
+ */
+static vindex_header *map_index(int fd, uint64_t nslots, size_t *map_size) {
+    void *map;
+
+    *map_size = sizeof(vindex_header) + nslots * sizeof(vindex_slot);
+    map = mmap(NULL, *map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+/**
+ * @brief Crea un indice vacio en path.
+ * @return Descriptor del indice, -1 si ocurre un error.
+ */
+static int create_index(const char *path, uint64_t nslots, vindex_header **header, size_t *map_size) {
+    int fd;
+
+    if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) return -1;
+    if (ftruncate(fd, sizeof(vindex_header) + nslots * sizeof(vindex_slot)) < 0
+            || (*header = map_index(fd, nslots, map_size)) == NULL) {
+        close(fd);
+        return -1;
+    }
+    (*header)->magic = VINDEX_MAGIC;
+    (*header)->format = VINDEX_FORMAT;
+    (*header)->nslots = nslots;
+    (*header)->nused = 0;
+    (*header)->db_size = 0;
+    (*header)->db_ino = 0;
+    return fd;
+}
+
+/**
+ * @brief Ubica la primera ranura libre para una llave.
+ */
+static vindex_slot *free_slot(vindex_slot *slots, uint64_t nslots, uint64_t key) {
+    uint64_t mask = nslots - 1;
+    uint64_t i = key & mask;
+    while (slots[i].kind != SLOT_EMPTY) i = (i + 1) & mask;
+    return &slots[i];
+}
+
+/**
+ * @brief Nombre temporal, propio del proceso, para crear un indice.
+ */
+static char *tmp_index_path(char *path) {
+    snprintf(path, PATH_MAX, "%s.%d.tmp", VERSIONS_IDX_PATH, (int)getpid());
+    return path;
+}
+
+/**
+ * @brief Duplica el numero de ranuras del indice.
+ * Las llaves se reubican sin leer versions.db y el nuevo indice reemplaza
+ * al anterior mediante rename. Se llama con el candado del indice, que se
+ * toma tambien sobre el nuevo antes de publicarlo.
+ */
+static int grow(void) {
+    char tmp_path[PATH_MAX];
+    vindex_header *header;
+    vindex_slot *slots;
+    size_t map_size;
+    uint64_t i;
+    int fd;
+
+    fd = create_index(tmp_index_path(tmp_path), idx.header->nslots * 2, &header, &map_size);
+    if (fd < 0) return -1;
+    flock(fd, LOCK_EX);
+
+    slots = (vindex_slot *)(header + 1);
+    for (i = 0; i < idx.header->nslots; i++) {
+        if (idx.slots[i].kind != SLOT_EMPTY) {
+            *free_slot(slots, header->nslots, idx.slots[i].key) = idx.slots[i];
+        }
+    }
+    header->nused = idx.header->nused;
+    header->db_size = idx.header->db_size;
+    header->db_ino = idx.header->db_ino;
+
+    if (rename(tmp_path, VERSIONS_IDX_PATH) < 0) {
+        munmap(header, map_size);
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    munmap(idx.header, idx.map_size);
+    close(idx.fd);
+    idx.fd = fd;
+    idx.header = header;
+    idx.slots = slots;
+    idx.map_size = map_size;
+    return 0;
+}
+
+/**
+ * @brief Busca la ranura de una llave.
+ * Cada candidata se verifica contra el registro al que apunta.
+ *
+ * @return Ranura encontrada, NULL si no existe.
+ */
+static vindex_slot *lookup(slot_kind kind, const char *filename, const uint8_t *digest, uint32_t n, vdb_record *r) {
+    uint64_t key = key_of(kind, filename, strlen(filename), digest, n);
+    uint64_t mask = idx.header->nslots - 1;
+    uint64_t i;
+
+    for (i = key & mask; idx.slots[i].kind != SLOT_EMPTY; i = (i + 1) & mask) {
+        vindex_slot *slot = &idx.slots[i];
+        if (slot->key != key || slot->kind != kind) continue;
+        if (vdb_record_at(slot->offset, r) <= 0 || !vdb_filename_equals(r, filename)) continue;
+        if (kind == SLOT_VERSION && slot->aux != n) continue;
+        if (kind == SLOT_CONTENT && !digest_equals(digest, r->header->digest)) continue;
+        return slot;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Inserta una ranura nueva.
+ */
+static int insert(slot_kind kind, const vdb_record *r, uint32_t n, off_t offset, uint32_t aux) {
+    vindex_slot *slot;
+    uint64_t key;
+
+    if ((idx.header->nused + 1) * 2 > idx.header->nslots && grow() < 0) return -1;
+
+    key = key_of(kind, r->filename, r->header->filename_len,
+                 kind == SLOT_CONTENT ? r->header->digest : NULL, n);
+    slot = free_slot(idx.slots, idx.header->nslots, key);
+    slot->key = key;
+    slot->offset = offset;
+    slot->aux = aux;
+
+    // El tipo se escribe al final: un lector de otro proceso nunca ve una
+    // ranura ocupada a medio escribir
+    __atomic_store_n(&slot->kind, kind, __ATOMIC_RELEASE);
+    idx.header->nused++;
+    return 0;
+}
+
+/**
+ * @brief Agrega al indice el registro ubicado en offset.
+ */
+static int index_record(const vdb_record *r, off_t offset) {
+    char filename[PATH_MAX];
+    vdb_record tmp;
+    vindex_slot *file;
+    uint32_t n;
+
+    memcpy(filename, r->filename, r->header->filename_len);
+    filename[r->header->filename_len] = 0;
+
+    file = lookup(SLOT_FILE, filename, NULL, 0, &tmp);
+    n = file != NULL ? file->aux + 1 : 1;
+
+    if (insert(SLOT_VERSION, r, n, offset, n) < 0) return -1;
+
+    if (lookup(SLOT_CONTENT, filename, r->header->digest, 0, &tmp) == NULL
+            && insert(SLOT_CONTENT, r, 0, offset, 0) < 0) {
+        return -1;
+    }
+
+    // El numero de versiones se publica al final, cuando la ranura de la
+    // version ya existe. insert pudo reubicar las ranuras
+    if (n == 1) return insert(SLOT_FILE, r, 0, offset, n);
+    file = lookup(SLOT_FILE, filename, NULL, 0, &tmp);
+    file->offset = offset;
+    __atomic_store_n(&file->aux, n, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * @brief Reemplaza el indice por uno vacio, para una base de datos que fue
+ * reemplazada (por ejemplo al compactarla). El indice nuevo se crea aparte
+ * y se indexa completo antes de publicarlo con rename: los demas procesos
+ * siguen consultando el anterior, sin respuestas falsas, hasta que abren
+ * el nuevo. Se llama con el candado del indice.
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int rebuild(void) {
+    char tmp_path[PATH_MAX];
+    vindex_header *header;
+    vdb_record r;
+    size_t map_size;
+    uint64_t records = 0, nslots = VINDEX_MIN_SLOTS;
+    off_t offset;
+    ssize_t len;
+    int fd, old_fd = idx.fd;
+    vindex_header *old_header = idx.header;
+    size_t old_size = idx.map_size;
+
+    // Cada registro ocupa a lo sumo tres ranuras; con espacio para todas,
+    // el indice no crece (ni se publica) mientras se llena
+    for (offset = vdb_first(); (len = vdb_record_at(offset, &r)) > 0; offset += len) records++;
+    while (nslots < 2 * (3 * records + 1)) nslots *= 2;
+
+    fd = create_index(tmp_index_path(tmp_path), nslots, &header, &map_size);
+    if (fd < 0) return -1;
+    flock(fd, LOCK_EX);
+    header->db_ino = vdb_ino();
+    header->db_size = vdb_first();
+
+    idx.fd = fd;
+    idx.header = header;
+    idx.slots = (vindex_slot *)(header + 1);
+    idx.map_size = map_size;
+    for (offset = header->db_size; (len = vdb_record_at(offset, &r)) > 0; offset += len) {
+        if (index_record(&r, offset) < 0) break;
+        header->db_size = offset + len;
+    }
+
+    if (len != 0 || rename(tmp_path, VERSIONS_IDX_PATH) < 0) {
+        unlink(tmp_path);
+        munmap(header, map_size);
+        close(fd);
+        idx.fd = old_fd;
+        idx.header = old_header;
+        idx.slots = (vindex_slot *)(old_header + 1);
+        idx.map_size = old_size;
+        return -1;
+    }
+    munmap(old_header, old_size);
+    close(old_fd);
+    return 0;
+}
+
+int vindex_sync(void) {
+    vdb_record r;
+    off_t offset;
+    ssize_t len;
+
+    if (vdb_map() < 0) return -1;
+
+    // Al dia: no hay registros confirmados despues de lo indexado
+    if (idx.header->db_ino == (uint64_t)vdb_ino() && vdb_record_at(idx.header->db_size, &r) == 0) {
+        return 0;
+    }
+
+    // Un solo proceso actualiza el indice. Si otro lo esta haciendo no se
+    // espera: quien consulta lee versions.db directamente
+    if (flock(idx.fd, LOCK_EX | LOCK_NB) < 0) return -1;
+
+    // La base de datos es de solo adicion: si es menor que lo indexado, o
+    // es otro archivo, fue reemplazada y el indice se reconstruye. Un
+    // indice vacio solo toma el inodo
+    if (idx.header->db_size > (uint64_t)vdb_size() || idx.header->db_ino != (uint64_t)vdb_ino()) {
+        if (idx.header->nused > 0) {
+            int rebuilt = rebuild();
+            flock(idx.fd, LOCK_UN);
+            return rebuilt;
+        }
+        idx.header->db_size = 0;
+        idx.header->db_ino = vdb_ino();
+    }
+    if (idx.header->db_size < (uint64_t)vdb_first()) idx.header->db_size = vdb_first();
+
+    // Un registro incompleto al final se indexa cuando termine de escribirse
+    for (offset = idx.header->db_size; (len = vdb_record_at(offset, &r)) > 0; offset += len) {
+        if (index_record(&r, offset) < 0) {
+            flock(idx.fd, LOCK_UN);
+            return -1;
+        }
+        idx.header->db_size = offset + len;
+    }
+    flock(idx.fd, LOCK_UN);
+    return 0;
+}
+
+int vindex_open(void) {
+    char tmp_path[PATH_MAX];
+    struct stat s, current;
+
+    // Si otro proceso reemplazo el indice (al crecer), se abre el nuevo
+    if (idx.header != NULL) {
+        if (stat(VERSIONS_IDX_PATH, &current) == 0 && fstat(idx.fd, &s) == 0 && current.st_ino == s.st_ino) {
+            return vindex_sync();
+        }
+        vindex_close();
+    }
+
+    if (vdb_map() < 0) return -1;
+
+    idx.fd = open(VERSIONS_IDX_PATH, O_RDWR);
+    if (idx.fd >= 0 && fstat(idx.fd, &s) == 0 && (size_t)s.st_size >= sizeof(vindex_header)) {
+        vindex_header h;
+        if (pread(idx.fd, &h, sizeof h, 0) == sizeof h
+                && h.magic == VINDEX_MAGIC && h.format == VINDEX_FORMAT
+                && h.nslots >= VINDEX_MIN_SLOTS && (h.nslots & (h.nslots - 1)) == 0
+                && (size_t)s.st_size == sizeof(vindex_header) + h.nslots * sizeof(vindex_slot)) {
+            idx.header = map_index(idx.fd, h.nslots, &idx.map_size);
+        }
+    }
+
+    // Indice inexistente o invalido: se crea de nuevo aparte y se publica
+    // con rename, porque otro proceso puede tenerlo mapeado
+    if (idx.header == NULL) {
+        if (idx.fd >= 0) close(idx.fd);
+        idx.fd = create_index(tmp_index_path(tmp_path), VINDEX_MIN_SLOTS, &idx.header, &idx.map_size);
+        if (idx.fd < 0 || rename(tmp_path, VERSIONS_IDX_PATH) < 0) {
+            if (idx.fd >= 0) vindex_close();
+            unlink(tmp_path);
+            idx.header = NULL;
+            return -1;
+        }
+    }
+    idx.slots = (vindex_slot *)(idx.header + 1);
+
+    if (vindex_sync() < 0) {
+        vindex_close();
+        return -1;
+    }
+    return 0;
+}
+
+void vindex_close(void) {
+    if (idx.header != NULL) munmap(idx.header, idx.map_size);
+    if (idx.fd >= 0) close(idx.fd);
+    idx.header = NULL;
+    idx.slots = NULL;
+    idx.fd = -1;
+}
+
+return_code vindex_find(char *filename, const uint8_t *digest) {
+    vdb_record r;
+
+    return lookup(SLOT_CONTENT, filename, digest, 0, &r) != NULL ? VERSION_ALREADY_EXISTS : VERSION_NOT_FOUND;
+}
+
+off_t vindex_first(char *filename, const uint8_t *digest) {
+    vdb_record r;
+    vindex_slot *slot;
+
+    // La ranura del contenido apunta al primer registro con ese digest
+    if (idx.header == NULL || (slot = lookup(SLOT_CONTENT, filename, digest, 0, &r)) == NULL) return -1;
+    return slot->offset;
+}
+
+return_code vindex_get(file_version *v, char *filename, int version) {
+    vdb_record r;
+
+    if (version <= 0) return VERSION_NOT_FOUND;
+    if (lookup(SLOT_VERSION, filename, NULL, version, &r) == NULL) return VERSION_NOT_FOUND;
+    vdb_to_version(&r, v);
+    return VERSION_OK;
+}
+
+int vindex_count(char *filename) {
+    vdb_record r;
+    vindex_slot *file = lookup(SLOT_FILE, filename, NULL, 0, &r);
+    return file != NULL ? (int)file->aux : 0;
+}
+
+return_code vindex_latest(char *filename, uint8_t *digest) {
+    vdb_record r;
+
+    // La ranura del archivo apunta a su ultimo registro
+    if (lookup(SLOT_FILE, filename, NULL, 0, &r) == NULL) return VERSION_NOT_FOUND;
+    memcpy(digest, r.header->digest, DIGEST_SIZE);
+    return VERSION_OK;
+}
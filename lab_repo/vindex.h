@@ -0,0 +1,109 @@
+/**
+ * @file
+ * @brief Indice persistente de la base de datos de versiones
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * El indice es una tabla hash de direccionamiento abierto almacenada en
+ * .versions/versions.idx y mapeada en memoria. Cada ranura apunta a un
+ * registro de versions.db y guarda una de tres llaves:
+ *
+ * - Archivo: nombre -> numero de versiones y ultimo registro.
+ * - Version: (nombre, numero de version) -> registro.
+ * - Contenido: (nombre, hash) -> registro.
+ *
+ * Las ranuras se verifican contra el registro al que apuntan, por lo que
+ * una colision de la llave de 64 bits nunca produce un resultado erroneo.
+ * El encabezado guarda cuantos bytes de versions.db estan indexados; al
+ * abrir el indice se indexan solo los registros agregados despues.
+ *
+ * Varios procesos pueden usar el indice a la vez. Solo uno lo actualiza
+ * (flock sin espera); los demas consultan versions.db directamente
+ * mientras tanto. Las ranuras se publican cuando estan completas, por lo
+ * que las consultas no necesitan candado.
+ */
+
+#ifndef VINDEX_H
+#define VINDEX_H
+
+#include "versions.h"
+
+#define VERSIONS_IDX "versions.idx" /**< Nombre del indice de versiones. */
+#define VERSIONS_IDX_PATH VERSIONS_DIR "/" VERSIONS_IDX /**< Ruta completa del indice.*/
+
+/**
+ * @brief Abre el indice y lo sincroniza con versions.db.
+ * Si el indice no existe, o no corresponde a la base de datos, se
+ * reconstruye. Llamadas posteriores solo sincronizan.
+ *
+ * @return 0 en caso de exito, -1 si el indice no esta disponible.
+ */
+int vindex_open(void);
+
+/**
+ * @brief Indexa los registros agregados a versions.db desde la ultima
+ * sincronizacion.
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+int vindex_sync(void);
+
+/**
+ * @brief Libera el indice.
+ */
+void vindex_close(void);
+
+/**
+ * @brief Busca una version por nombre y digest.
+ *
+ * @param filename Nombre del archivo
+ * @param digest Digest del contenido
+ *
+ * @return VERSION_ALREADY_EXISTS si existe, VERSION_NOT_FOUND en caso contrario.
+ */
+return_code vindex_find(char *filename, const uint8_t *digest);
+
+/**
+ * @brief Posicion del primer registro con un nombre y un digest.
+ *
+ * @param filename Nombre del archivo
+ * @param digest Digest del contenido
+ *
+ * @return Posicion en versions.db, -1 si no esta en el indice.
+ */
+off_t vindex_first(char *filename, const uint8_t *digest);
+
+/**
+ * @brief Obtiene una version de un archivo.
+ *
+ * @param v Estructura en la que se guarda el resultado
+ * @param filename Nombre del archivo
+ * @param version Numero secuencial de la version (desde 1)
+ *
+ * @return VERSION_OK si existe, VERSION_NOT_FOUND en caso contrario.
+ */
+return_code vindex_get(file_version *v, char *filename, int version);
+
+/**
+ * @brief Obtiene el numero de versiones de un archivo.
+ *
+ * @param filename Nombre del archivo
+ *
+ * @return Numero de versiones, 0 si el archivo no tiene versiones.
+ */
+int vindex_count(char *filename);
+
+/**
+ * @brief Obtiene el digest de la ultima version de un archivo con una
+ * sola consulta.
+ *
+ * @param filename Nombre del archivo
+ * @param digest Buffer de DIGEST_SIZE bytes para el resultado
+ *
+ * @return VERSION_OK si el archivo tiene versiones, VERSION_NOT_FOUND en
+ * caso contrario.
+ */
+return_code vindex_latest(char *filename, uint8_t *digest);
+
+#endif
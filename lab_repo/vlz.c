@@ -0,0 +1,398 @@
+/**
+ * @file
+ * @brief Implementacion de la compresion LZ
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ */
+
+#include "vlz.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LZ_MAGIC 0x315a4c56 /**< "VLZ1" en little endian */
+#define LZ_RAW 0x80000000u /**< Bloque guardado sin comprimir */
+#define LZ_HASH_BITS 14 /**< Entradas de la tabla de coincidencias (log2) */
+#define LZ_MIN_MATCH 4 /**< Longitud minima de una coincidencia */
+#define LZ_LAST_LITERALS 5 /**< Las coincidencias terminan antes de los ultimos bytes */
+#define LZ_SLACK 32 /**< Bytes adicionales de los buffers de descompresion */
+
+/**
+ * @brief Encabezado del flujo
+ */
+typedef struct {
+    uint32_t magic;    /**< LZ_MAGIC */
+    uint32_t reserved; /**< Sin uso */
+    uint64_t size;     /**< Tamano sin comprimir */
+} lz_header;
+
+/**
+ * @brief Encabezado de un bloque
+ */
+typedef struct {
+    uint32_t size;   /**< Tamano sin comprimir, 0 al final del flujo */
+    uint32_t stored; /**< Bytes guardados, con LZ_RAW si no esta comprimido */
+} lz_block_header;
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static uint32_t hash4(const uint8_t *p) {
+    return (read32(p) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * @brief Escribe una longitud que no cabe en 4 bits.
+ */
+static uint8_t *put_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+/**
+ * @brief Escribe una secuencia: literales y, si match_len > 0, la
+ * coincidencia.
+ * @return Fin de la salida, NULL si no cabe en el buffer.
+ */
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *op_end, const uint8_t *literals,
+                             size_t lit_len, size_t offset, size_t match_len) {
+    size_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+    uint8_t *token;
+
+    // Cota de la secuencia: token, longitudes, literales y distancia
+    if ((size_t)(op_end - op) < 1 + lit_len + lit_len / 255 + ml / 255 + 8) return NULL;
+    token = op++;
+
+    *token = (lit_len < 15 ? lit_len : 15) << 4;
+    if (lit_len >= 15) op = put_length(op, lit_len - 15);
+    memcpy(op, literals, lit_len);
+    op += lit_len;
+
+    if (match_len) {
+        *op++ = offset & 0xff;
+        *op++ = offset >> 8;
+        *token |= ml < 15 ? ml : 15;
+        if (ml >= 15) op = put_length(op, ml - 15);
+    }
+    return op;
+}
+
+/**
+ * @brief Comprime un bloque.
+ * @return Bytes comprimidos, 0 si el resultado no es menor que la entrada.
+ */
+static size_t compress_block(const uint8_t *in, size_t len, uint8_t *out) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    const uint8_t *out_end = out + len;
+    uint8_t *op = out;
+    size_t ip = 0, anchor = 0;
+    size_t limit = len > 12 ? len - 12 : 0;
+
+    memset(table, 0, sizeof table);
+    while (ip < limit) {
+        uint32_t h = hash4(in + ip);
+        size_t ref = table[h];
+        size_t match_len;
+
+        // Posiciones guardadas como ip + 1: 0 es una entrada libre
+        table[h] = ip + 1;
+        if (ref == 0 || ip - (ref - 1) > 0xffff || read32(in + ref - 1) != read32(in + ip)) {
+            // Sin coincidencia: se avanza mas rapido en datos poco compresibles
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+        ref--;
+
+        // La coincidencia se extiende hacia atras, sobre los literales, y
+        // hacia adelante
+        while (ip > anchor && ref > 0 && in[ip - 1] == in[ref - 1]) {
+            ip--;
+            ref--;
+        }
+        // Se comparan 8 bytes a la vez; el primer byte distinto se ubica
+        // con los ceros finales del xor
+        match_len = LZ_MIN_MATCH;
+        while (ip + match_len + 8 <= len - LZ_LAST_LITERALS) {
+            uint64_t diff = read64(in + ref + match_len) ^ read64(in + ip + match_len);
+            if (diff != 0) {
+                match_len += __builtin_ctzll(diff) >> 3;
+                break;
+            }
+            match_len += 8;
+        }
+        if (ip + match_len + 8 > len - LZ_LAST_LITERALS) {
+            while (ip + match_len < len - LZ_LAST_LITERALS && in[ref + match_len] == in[ip + match_len]) {
+                match_len++;
+            }
+        }
+
+        if ((op = put_sequence(op, out_end, in + anchor, ip - anchor, ip - ref, match_len)) == NULL) return 0;
+        ip += match_len;
+        anchor = ip;
+        if (ip < limit) table[hash4(in + ip - 2)] = ip - 1;
+    }
+
+    if ((op = put_sequence(op, out_end, in + anchor, len - anchor, 0, 0)) == NULL) return 0;
+    return (size_t)(op - out) < len ? (size_t)(op - out) : 0;
+}
+
+/**
+ * @brief Lee una longitud extendida.
+ * @return 0 en caso de exito, -1 si la entrada termina antes.
+ */
+static int get_length(const uint8_t **ip, const uint8_t *end, size_t *len) {
+    uint8_t b;
+
+    do {
+        if (*ip >= end) return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+/**
+ * @brief Descomprime un bloque verificando todos los limites.
+ * Ambos buffers deben tener LZ_SLACK bytes adicionales: los literales
+ * cortos y las coincidencias se copian en trozos fijos de 16 bytes que
+ * pueden pasar del final.
+ * @return 0 en caso de exito, -1 si el bloque no es valido.
+ */
+static int decompress_block(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len) {
+    const uint8_t *ip = in, *end = in + in_len;
+    uint8_t *op = out, *op_end = out + out_len;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t lit_len = token >> 4, match_len = token & 15, offset;
+        const uint8_t *ref;
+        uint8_t *match_end;
+
+        if (lit_len == 15 && get_length(&ip, end, &lit_len) < 0) return -1;
+        if (lit_len > (size_t)(end - ip) || lit_len > (size_t)(op_end - op)) return -1;
+        if (lit_len <= 16) memcpy(op, ip, 16);
+        else memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        // La ultima secuencia solo tiene literales
+        if (ip == end) break;
+
+        if (end - ip < 2) return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (match_len == 15 && get_length(&ip, end, &match_len) < 0) return -1;
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - out) || match_len > (size_t)(op_end - op)) return -1;
+
+        // Las coincidencias pueden solaparse con la salida: se copian en
+        // trozos de a lo sumo offset bytes
+        ref = op - offset;
+        match_end = op + match_len;
+        if (offset >= 16) {
+            do {
+                memcpy(op, ref, 16);
+                op += 16;
+                ref += 16;
+            } while (op < match_end);
+        } else if (offset >= 8) {
+            do {
+                memcpy(op, ref, 8);
+                op += 8;
+                ref += 8;
+            } while (op < match_end);
+        } else {
+            while (op < match_end) *op++ = *ref++;
+        }
+        op = match_end;
+    }
+    return op == op_end ? 0 : -1;
+}
+
+size_t lz_frame_begin(uint8_t *out, uint64_t size) {
+    lz_header h = {LZ_MAGIC, 0, size};
+    memcpy(out, &h, sizeof h);
+    return sizeof h;
+}
+
+size_t lz_frame_block(const uint8_t *in, size_t len, uint8_t *out) {
+    lz_block_header h;
+    size_t stored = compress_block(in, len, out + sizeof h);
+
+    h.size = len;
+    if (stored == 0) {
+        // Bloque incompresible: se guarda tal cual
+        memcpy(out + sizeof h, in, len);
+        h.stored = len | LZ_RAW;
+        stored = len;
+    } else {
+        h.stored = stored;
+    }
+    memcpy(out, &h, sizeof h);
+    return sizeof h + stored;
+}
+
+size_t lz_frame_end(uint8_t *out) {
+    lz_block_header h = {0, 0};
+    memcpy(out, &h, sizeof h);
+    return sizeof h;
+}
+
+int lz_frame_set_size(int fd, off_t offset, uint64_t size) {
+    return pwrite(fd, &size, sizeof size, offset + offsetof(lz_header, size)) == sizeof size ? 0 : -1;
+}
+
+int64_t lz_frame_size(int fd, off_t offset) {
+    lz_header h;
+
+    if (pread(fd, &h, sizeof h, offset) != sizeof h || h.magic != LZ_MAGIC) return -1;
+    return h.size;
+}
+
+/**
+ * @brief Lee exactamente len bytes en la posicion dada.
+ * @return 0 en caso de exito, -1 si ocurre un error o el archivo termina.
+ */
+static int pread_all(int fd, void *buf, size_t len, off_t offset) {
+    char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+int lz_decode(int fd, off_t offset, lz_sink sink, void *ctx) {
+    lz_block_header b;
+    uint8_t *in, *out;
+    uint64_t total = 0;
+    int64_t size;
+    int result = -1;
+
+    if ((size = lz_frame_size(fd, offset)) < 0) return -1;
+    offset += sizeof(lz_header);
+
+    in = malloc(LZ_BLOCK + LZ_SLACK);
+    out = malloc(LZ_BLOCK + LZ_SLACK);
+    while (in != NULL && out != NULL && pread_all(fd, &b, sizeof b, offset) == 0) {
+        size_t stored = b.stored & ~LZ_RAW;
+
+        offset += sizeof b;
+        if (b.size == 0) {
+            result = total == (uint64_t)size ? 0 : -1;
+            break;
+        }
+        if (b.size > LZ_BLOCK || stored > LZ_BLOCK || pread_all(fd, in, stored, offset) < 0) break;
+        offset += stored;
+
+        if (b.stored & LZ_RAW) {
+            if (stored != b.size || sink(ctx, in, stored) < 0) break;
+        } else if (decompress_block(in, stored, out, b.size) < 0 || sink(ctx, out, b.size) < 0) {
+            break;
+        }
+        total += b.size;
+    }
+
+    free(in);
+    free(out);
+    return result;
+}
+
+int lz_sink_fd(void *ctx, const void *data, size_t len) {
+    int fd = *(int *)ctx;
+    const char *p = data;
+
+    while (len > 0) {
+        ssize_t nwritten = write(fd, p, len);
+        if (nwritten < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += nwritten;
+        len -= nwritten;
+    }
+    return 0;
+}
+
+int lz_sink_sparse(void *ctx, const void *data, size_t len) {
+    const uint8_t *p = data;
+
+    // Un bloque en ceros se salta; si el descriptor no admite lseek se
+    // escribe
+    if (len >= 4096 && p[0] == 0 && memcmp(p, p + 1, len - 1) == 0
+            && lseek(*(int *)ctx, len, SEEK_CUR) >= 0) {
+        return 0;
+    }
+    return lz_sink_fd(ctx, data, len);
+}
+
+int lz_compress_file(const char *source, const char *destination) {
+    uint8_t *in, *out;
+    uint64_t total = 0;
+    ssize_t nread;
+    size_t len;
+    int src, dst = -1, result = -1;
+
+    if ((src = open(source, O_RDONLY)) < 0) return -1;
+    in = malloc(LZ_BLOCK);
+    out = malloc(LZ_FRAME_HEADER + LZ_BLOCK_BOUND);
+    if (in == NULL || out == NULL) goto done;
+
+    while ((nread = read(src, in, LZ_BLOCK)) != 0) {
+        if (nread < 0) {
+            if (errno == EINTR) continue;
+            goto done;
+        }
+        len = dst < 0 ? lz_frame_begin(out, 0) : 0;
+        len += lz_frame_block(in, nread, out + len);
+
+        // El primer bloque decide si vale la pena comprimir el archivo
+        if (dst < 0) {
+            if (!lz_worth((size_t)nread + LZ_FRAME_HEADER, len)) {
+                result = 1;
+                goto done;
+            }
+            if ((dst = open(destination, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) goto done;
+        }
+        if (lz_sink_fd(&dst, out, len) < 0) goto done;
+        total += nread;
+    }
+
+    if (dst >= 0) {
+        len = lz_frame_end(out);
+        if (lz_sink_fd(&dst, out, len) == 0 && lz_frame_set_size(dst, 0, total) == 0) result = 0;
+    } else {
+        // Archivo vacio
+        result = 1;
+    }
+
+done:
+    if (dst >= 0 && close(dst) < 0) result = -1;
+    if (dst >= 0 && result != 0) unlink(destination);
+    close(src);
+    free(in);
+    free(out);
+    return result;
+}
@@ -0,0 +1,490 @@
+/**
+ * @file
+ * @brief Implementacion del almacen de objetos
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ */
+
+#include "vobject.h"
+#include "fcopy.h"
+#include "vchunk.h"
+#include "vdb.h"
+#include "vdelta.h"
+#include "vlz.h"
+#include "vpack.h"
+#include "vstats.h"
+#include "vthash.h"
+
+#include <errno.h>
+
+#define FORM_LOOSE 1 /**< Objeto suelto sin comprimir */
+#define FORM_LZ 2 /**< Objeto suelto comprimido */
+#define FORM_DELTA 3 /**< Diferencia */
+#define FORM_CHUNK 4 /**< Lista de bloques */
+#define FORM_PACK 5 /**< Objeto de un paquete */
+
+#define LOCATE_SLOTS 4096 /**< Entradas de la cache de ubicaciones */
+
+/**
+ * @brief Cache de la forma en que esta guardado cada objeto leido: 56 bits
+ * del hash y la forma en los 8 bits bajos. Evita buscar el objeto en cada
+ * forma (una llamada al sistema por forma) cuando un proceso lo lee varias
+ * veces. Una entrada vieja (gc, repack) o una colision solo hace que se
+ * busque de nuevo.
+ */
+static uint64_t located[LOCATE_SLOTS];
+
+/**
+ * @brief Escribe todo el buffer en un descriptor.
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t nwritten = write(fd, buf, len);
+        if (nwritten < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += nwritten;
+        len -= nwritten;
+    }
+    return 0;
+}
+
+char *object_path(const char *hash, char *path) {
+    snprintf(path, PATH_MAX, "%s/%s", VERSIONS_DIR, hash);
+    return path;
+}
+
+char *object_lz_path(const char *hash, char *path) {
+    snprintf(path, PATH_MAX, "%s/%s" OBJECT_LZ_SUFFIX, VERSIONS_DIR, hash);
+    return path;
+}
+
+int object_exists(const char *hash) {
+    char path[PATH_MAX];
+    struct stat s;
+    return stat(object_path(hash, path), &s) == 0
+        || stat(object_lz_path(hash, path), &s) == 0
+        || stat(delta_path(hash, path), &s) == 0
+        || stat(chunk_path(hash, path), &s) == 0
+        || pack_contains(hash);
+}
+
+int object_freshen(const char *hash) {
+    char path[PATH_MAX], other[HASH_SIZE];
+    uint8_t *digests;
+    ssize_t count, i;
+
+    if (utimensat(AT_FDCWD, object_path(hash, path), NULL, 0) == 0
+            || utimensat(AT_FDCWD, object_lz_path(hash, path), NULL, 0) == 0) {
+        return 1;
+    }
+
+    // Una diferencia usa su cadena de bases y una lista usa sus bloques
+    if (utimensat(AT_FDCWD, delta_path(hash, path), NULL, 0) == 0) {
+        if (delta_base(hash, other) == 0) object_freshen(other);
+        return 1;
+    }
+    if (utimensat(AT_FDCWD, chunk_path(hash, path), NULL, 0) == 0) {
+        if ((count = chunk_list(hash, &digests)) > 0) {
+            for (i = 0; i < count; i++) {
+                digest_to_hex(digests + i * DIGEST_SIZE, other);
+                object_freshen(other);
+            }
+            free(digests);
+        }
+        return 1;
+    }
+    return pack_freshen(hash);
+}
+
+/**
+ * @brief Clave de un hash en la cache de ubicaciones.
+ */
+static uint64_t locate_key(const char *hash) {
+    uint64_t key = 0;
+    int i;
+
+    for (i = 0; i < 14 && hash[i] != 0; i++) {
+        key = (key << 4) | (hash[i] <= '9' ? hash[i] - '0' : (hash[i] | 0x20) - 'a' + 10);
+    }
+    return key << 8;
+}
+
+/**
+ * @brief Escribe el contenido de un objeto guardado en una forma.
+ * @return 0 en caso de exito, 1 si el objeto no esta en esa forma, -1 si
+ * ocurre un error.
+ */
+static int append_form(const char *hash, int form, int dst) {
+    char path[PATH_MAX];
+    struct stat s;
+    int src, result;
+
+    switch (form) {
+    case FORM_LOOSE:
+        if ((src = open(object_path(hash, path), O_RDONLY)) < 0) return 1;
+        result = fstat(src, &s) < 0 || fcopy_range(src, 0, s.st_size, dst) < 0 ? -1 : 0;
+        close(src);
+        return result;
+    case FORM_LZ:
+        // Se descomprime por bloques, con buffers de tamano fijo
+        if ((src = open(object_lz_path(hash, path), O_RDONLY)) < 0) return 1;
+        result = lz_decode(src, 0, lz_sink_sparse, &dst);
+        close(src);
+        return result;
+    case FORM_DELTA:
+        if (access(delta_path(hash, path), F_OK) < 0) return 1;
+        return delta_reconstruct(hash, dst);
+    case FORM_CHUNK:
+        if (access(chunk_path(hash, path), F_OK) < 0) return 1;
+        return chunk_reconstruct(hash, dst);
+    default:
+        if (!pack_contains(hash)) return 1;
+        return pack_write(hash, dst);
+    }
+}
+
+/**
+ * @brief Crea un temporal ya borrado del directorio del repositorio.
+ * @return Descriptor del temporal, -1 si ocurre un error.
+ */
+static int anonymous_tmp(void) {
+    char path[PATH_MAX];
+    int fd;
+
+    snprintf(path, PATH_MAX, "%s/" OBJECT_TMP_PREFIX "XXXXXX", VERSIONS_DIR);
+    if ((fd = mkstemp(path)) >= 0) unlink(path);
+    return fd;
+}
+
+/**
+ * @brief Extiende un archivo regular hasta la posicion actual: los bloques
+ * en ceros del final se dejaron como hueco sin escribirlos.
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int extend_to_position(int dst) {
+    struct stat s;
+    off_t end;
+
+    if ((end = lseek(dst, 0, SEEK_CUR)) < 0 || fstat(dst, &s) < 0 || !S_ISREG(s.st_mode)) return 0;
+    return s.st_size < end ? ftruncate(dst, end) : 0;
+}
+
+int object_append(const char *hash, int dst) {
+    uint64_t key = locate_key(hash), *slot = &located[key >> 8 & (LOCATE_SLOTS - 1)];
+    uint64_t entry = __atomic_load_n(slot, __ATOMIC_RELAXED);
+    int form, result = -1;
+
+    // Primero la forma en que se encontro la ultima vez
+    if ((entry & ~0xffULL) == key && (result = append_form(hash, entry & 0xff, dst)) != 1) {
+        return result == 0 ? extend_to_position(dst) : result;
+    }
+
+    for (form = FORM_LOOSE; form <= FORM_PACK; form++) {
+        if ((result = append_form(hash, form, dst)) != 1) {
+            if (result == 0) __atomic_store_n(slot, key | form, __ATOMIC_RELAXED);
+            return result == 0 ? extend_to_position(dst) : result;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Escribe el contenido de un objeto en un descriptor vacio.
+ * Un objeto suelto sin comprimir se copia con fcopy_fd (puede clonarse).
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int object_write(const char *hash, int dst) {
+    char path[PATH_MAX];
+    int src, result;
+
+    if ((src = open(object_path(hash, path), O_RDONLY)) >= 0) {
+        result = fcopy_fd(src, dst) < 0 ? -1 : 0;
+        close(src);
+        return result;
+    }
+    return object_append(hash, dst);
+}
+
+int object_open(const char *hash) {
+    char path[PATH_MAX];
+    int fd;
+
+    if ((fd = open(object_path(hash, path), O_RDONLY)) >= 0) return fd;
+
+    if ((fd = anonymous_tmp()) < 0) return -1;
+    if (object_write(hash, fd) < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int object_retrieve(const char *hash, const char *destination) {
+    int dst, result;
+
+    if ((dst = open(destination, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) return -1;
+    result = object_write(hash, dst);
+    if (close(dst) < 0) return -1;
+    return result;
+}
+
+void object_remove(const char *hash) {
+    char path[PATH_MAX];
+
+    unlink(object_path(hash, path));
+    unlink(object_lz_path(hash, path));
+    unlink(delta_path(hash, path));
+    unlink(chunk_path(hash, path));
+}
+
+/**
+ * @brief Comprime un buffer completo como flujo LZ.
+ * @return Bytes del flujo, 0 si comprimir no ahorra espacio o no hay
+ * memoria.
+ */
+static size_t compress_buffer(const uint8_t *data, size_t len, uint8_t **result) {
+    size_t nblocks = (len + LZ_BLOCK - 1) / LZ_BLOCK;
+    size_t offset, out_len;
+    uint8_t *out;
+
+    if (len == 0 || (out = malloc(LZ_FRAME_HEADER + nblocks * LZ_BLOCK_BOUND + LZ_FRAME_END)) == NULL) {
+        return 0;
+    }
+    out_len = lz_frame_begin(out, len);
+    for (offset = 0; offset < len; offset += LZ_BLOCK) {
+        out_len += lz_frame_block(data + offset, len - offset < LZ_BLOCK ? len - offset : LZ_BLOCK, out + out_len);
+    }
+    out_len += lz_frame_end(out + out_len);
+
+    if (!lz_worth(len, out_len)) {
+        free(out);
+        return 0;
+    }
+    *result = out;
+    return out_len;
+}
+
+return_code object_store_buffer(const char *hash, const void *data, size_t len, int compress) {
+    char tmp_path[PATH_MAX], path[PATH_MAX];
+    uint8_t *lz = NULL;
+    size_t lz_len = 0;
+    int fd, ok;
+
+    if (object_freshen(hash)) return VERSION_ALREADY_EXISTS;
+
+    snprintf(tmp_path, PATH_MAX, "%s/" OBJECT_TMP_PREFIX "XXXXXX", VERSIONS_DIR);
+    if ((fd = mkstemp(tmp_path)) < 0) return VERSION_ERROR;
+    fchmod(fd, 0644);
+
+    if (compress) lz_len = compress_buffer(data, len, &lz);
+    ok = lz_len > 0 ? write_all(fd, (char *)lz, lz_len) == 0 : write_all(fd, data, len) == 0;
+    free(lz);
+
+    if (!ok || close(fd) < 0) {
+        unlink(tmp_path);
+        return VERSION_ERROR;
+    }
+    if (rename(tmp_path, lz_len > 0 ? object_lz_path(hash, path) : object_path(hash, path)) < 0) {
+        unlink(tmp_path);
+        return VERSION_ERROR;
+    }
+    return FILE_ADDED;
+}
+
+/**
+ * @brief Escribe un bloque leido en el temporal, comprimido si el objeto
+ * se comprime.
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int stage_write(int dst, const uint8_t *buf, size_t len, uint8_t *lz, int compressed) {
+    size_t offset, lz_len = 0;
+
+    if (!compressed) return write_all(dst, (const char *)buf, len);
+
+    for (offset = 0; offset < len; offset += LZ_BLOCK) {
+        lz_len += lz_frame_block(buf + offset, len - offset < LZ_BLOCK ? len - offset : LZ_BLOCK, lz + lz_len);
+    }
+    return write_all(dst, (char *)lz, lz_len);
+}
+
+/**
+ * @brief Comprime el primer bloque de un objeto, que decide si todo el
+ * objeto se comprime (ver lz_worth).
+ * @return Bytes del inicio del flujo comprimido en lz.
+ */
+static size_t compress_first(const uint8_t *buf, size_t len, uint8_t *lz) {
+    size_t lz_len = lz_frame_begin(lz, 0);
+    size_t offset;
+
+    for (offset = 0; offset < len; offset += LZ_BLOCK) {
+        lz_len += lz_frame_block(buf + offset, len - offset < LZ_BLOCK ? len - offset : LZ_BLOCK, lz + lz_len);
+    }
+    return lz_len;
+}
+
+/**
+ * @brief Decide con el primer bloque si un archivo se comprime, antes de
+ * copiarlo.
+ * @return 1 si se comprime, 0 en caso contrario.
+ */
+static int first_block_compresses(int src, char *buf, uint8_t *lz) {
+    ssize_t nread;
+
+    while ((nread = pread(src, buf, OBJECT_BUFSIZE, 0)) < 0 && errno == EINTR);
+    if (nread <= 0) return 0;
+    return lz_worth((size_t)nread, compress_first((uint8_t *)buf, nread, lz));
+}
+
+int object_stage(const char *filename, staged_object *o, int compress) {
+    struct sha256_buff sha;
+    thash_state thash;
+    struct stat s, after;
+    char *buf;
+    uint8_t *lz = NULL;
+    ssize_t nread;
+    off_t offset = 0;
+    int64_t phase_start;
+    int src, dst, hole, tree;
+    int ok = 1;
+
+    if ((src = open(filename, O_RDONLY)) < 0) return -1;
+    if (fstat(src, &s) < 0) {
+        close(src);
+        return -1;
+    }
+
+    // Un archivo disperso se guarda sin comprimir y con los mismos
+    // huecos: ocupa en el repositorio lo mismo que sus datos
+    if ((off_t)s.st_blocks * 512 < s.st_size) compress = 0;
+
+    // Un archivo grande se nombra con su digest de arbol (ver vthash.h)
+    o->size = 0;
+    o->compressed = 0;
+    tree = THASH_TYPE(s.st_size) == VDB_HASH_TREE;
+
+    snprintf(o->tmp_path, PATH_MAX, "%s/" OBJECT_TMP_PREFIX "XXXXXX", VERSIONS_DIR);
+    if ((dst = mkstemp(o->tmp_path)) < 0) {
+        close(src);
+        return -1;
+    }
+    fchmod(dst, 0644);
+
+    buf = malloc(OBJECT_BUFSIZE);
+    if (compress) lz = malloc(LZ_FRAME_HEADER + OBJECT_BUFSIZE / LZ_BLOCK * LZ_BLOCK_BOUND);
+    if (buf == NULL || (compress && lz == NULL)) {
+        free(buf);
+        free(lz);
+        close(src);
+        close(dst);
+        unlink(o->tmp_path);
+        return -1;
+    }
+
+    // Un archivo grande que no se comprime se copia en paralelo: cada hoja
+    // del digest de arbol se lee una vez, con su hash, y se escribe en la
+    // misma posicion del temporal (se mide con el hash)
+    if (tree && compress) compress = first_block_compresses(src, buf, lz);
+    if (tree && !compress) {
+        phase_start = stats_start();
+        ok = thash_copy(src, s.st_size, dst, o->digest) == 0;
+        stats_stop(STATS_HASH, phase_start);
+        o->size = s.st_size;
+    }
+
+    // En otro caso cada bloque se lee una sola vez: se agrega al hash y se
+    // escribe, comprimido si el inicio del archivo resulto compresible. Los
+    // huecos no se leen: se agregan al hash como ceros y se saltan en el
+    // temporal
+    sha256_init(&sha);
+    thash_init(&thash);
+    phase_start = stats_start();
+    while (ok && (!tree || compress) && (nread = fcopy_read_sparse(src, buf, OBJECT_BUFSIZE, &offset, s.st_size, &hole)) != 0) {
+        stats_stop(STATS_READ, phase_start);
+        if (nread < 0) {
+            ok = 0;
+            continue;
+        }
+        phase_start = stats_start();
+        if (tree) thash_update(&thash, buf, nread);
+        else sha256_update(&sha, buf, nread);
+        stats_stop(STATS_HASH, phase_start);
+        stats_hashed(nread);
+
+        phase_start = stats_start();
+        if (compress && o->size == 0) {
+            // El primer bloque decide si el objeto se comprime
+            size_t lz_len = compress_first((uint8_t *)buf, nread, lz);
+
+            o->compressed = lz_worth((size_t)nread, lz_len);
+            ok = o->compressed ? write_all(dst, (char *)lz, lz_len) == 0 : write_all(dst, buf, nread) == 0;
+        } else if (hole && !o->compressed) {
+            ok = lseek(dst, nread, SEEK_CUR) >= 0;
+        } else {
+            ok = stage_write(dst, (uint8_t *)buf, nread, lz, o->compressed) == 0;
+        }
+        o->size += nread;
+        stats_stop(STATS_STORE, phase_start);
+        phase_start = stats_start();
+    }
+
+    // Un hueco al final no extiende el temporal
+    if (ok && !o->compressed) ok = ftruncate(dst, o->size) == 0;
+    if (tree && !compress) {
+        // Las hojas cubren el tamano inicial: el archivo no debe haber
+        // cambiado de tamano
+        ok = ok && fstat(src, &after) == 0 && after.st_size == s.st_size;
+    } else if (tree) {
+        thash_final(&thash, o->digest);
+    } else {
+        sha256_finalize(&sha);
+        sha256_read(&sha, o->digest);
+    }
+    digest_to_hex(o->digest, o->hash);
+
+    // El tipo del digest depende del tamano leido (ver vthash.h)
+    ok = ok && THASH_TYPE(o->size) == (tree ? VDB_HASH_TREE : VDB_HASH_SHA256);
+
+    if (ok && o->compressed) {
+        size_t len = lz_frame_end(lz);
+        ok = write_all(dst, (char *)lz, len) == 0 && lz_frame_set_size(dst, 0, o->size) == 0;
+    }
+
+    free(buf);
+    free(lz);
+    close(src);
+    if (close(dst) < 0) ok = 0;
+
+    if (!ok) {
+        unlink(o->tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+return_code object_commit(staged_object *o) {
+    char path[PATH_MAX];
+
+    object_path(o->hash, path);
+
+    // Objetos con el mismo hash tienen el mismo contenido, suelto o en un
+    // paquete
+    if (object_freshen(o->hash)) {
+        object_discard(o);
+        return VERSION_ALREADY_EXISTS;
+    }
+
+    if (o->compressed) object_lz_path(o->hash, path);
+    if (rename(o->tmp_path, path) < 0) {
+        object_discard(o);
+        return VERSION_ERROR;
+    }
+    return FILE_ADDED;
+}
+
+void object_discard(staged_object *o) {
+    unlink(o->tmp_path);
+}
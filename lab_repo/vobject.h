@@ -0,0 +1,173 @@
+/**
+ * @file
+ * @brief Almacen de objetos del repositorio
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * Cada version se guarda en .versions/ con su hash como nombre. Un archivo
+ * nuevo se lee una sola vez: cada bloque se agrega al hash y se escribe en
+ * un archivo temporal dentro de .versions/. Al conocer el hash, el temporal
+ * se renombra con el nombre del objeto, o se descarta si el objeto ya
+ * existe.
+ *
+ * Un objeto puede estar suelto (.versions/<hash>), suelto y comprimido
+ * (.versions/<hash>.z, ver vlz.h), guardado como diferencia
+ * contra otra version (.versions/<hash>.d, ver vdelta.h), como lista de
+ * bloques (.versions/<hash>.c, ver vchunk.h) o agrupado en un paquete (ver
+ * vpack.h).
+ */
+
+#ifndef VOBJECT_H
+#define VOBJECT_H
+
+#include "versions.h"
+
+#define OBJECT_BUFSIZE (1 << 20) /**< Bloque de lectura al almacenar un archivo */
+#define OBJECT_TMP_PREFIX "tmp-" /**< Prefijo de los archivos temporales */
+#define OBJECT_LZ_SUFFIX ".z" /**< Sufijo de los objetos comprimidos (ver vlz.h) */
+
+/**
+ * @brief Archivo leido y copiado al repositorio, pendiente de confirmar.
+ */
+typedef struct {
+    char tmp_path[PATH_MAX]; /**< Archivo temporal dentro de .versions */
+    uint8_t digest[DIGEST_SIZE]; /**< Digest del contenido */
+    char hash[HASH_SIZE];    /**< Digest en hexadecimal: nombre del objeto */
+    off_t size;              /**< Bytes leidos del archivo */
+    int compressed;          /**< 1 si el temporal es un flujo comprimido */
+} staged_object;
+
+/**
+ * @brief Lee un archivo una vez, calculando su hash y copiandolo a un
+ * archivo temporal del repositorio.
+ * Si se pide compresion, el primer bloque leido decide: si se reduce al
+ * comprimirlo, todo el archivo se escribe como flujo comprimido (cada
+ * bloque incompresible se guarda tal cual dentro del flujo).
+ * Los archivos de al menos THASH_MIN_SIZE bytes se nombran con su digest
+ * de arbol; si no se comprimen, se copian en paralelo mientras se calcula
+ * (ver thash_copy).
+ *
+ * @param filename Archivo a almacenar
+ * @param o Objeto pendiente
+ * @param compress 1 para comprimir el contenido
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+int object_stage(const char *filename, staged_object *o, int compress);
+
+/**
+ * @brief Confirma un objeto pendiente con su hash como nombre.
+ * Si el objeto ya existe, el temporal se descarta.
+ *
+ * @param o Objeto pendiente
+ *
+ * @return FILE_ADDED si se creo el objeto, VERSION_ALREADY_EXISTS si ya
+ * existia, VERSION_ERROR si ocurre un error.
+ */
+return_code object_commit(staged_object *o);
+
+/**
+ * @brief Almacena un objeto que ya esta en memoria.
+ *
+ * @param hash Hash del contenido
+ * @param data Contenido
+ * @param len Bytes del contenido
+ * @param compress 1 para comprimirlo si eso ahorra espacio
+ *
+ * @return FILE_ADDED si se creo el objeto, VERSION_ALREADY_EXISTS si ya
+ * existia, VERSION_ERROR si ocurre un error.
+ */
+return_code object_store_buffer(const char *hash, const void *data, size_t len, int compress);
+
+/**
+ * @brief Descarta un objeto pendiente.
+ *
+ * @param o Objeto pendiente
+ */
+void object_discard(staged_object *o);
+
+/**
+ * @brief Verifica si un objeto existe en el repositorio.
+ *
+ * @param hash Hash del objeto
+ *
+ * @return 1 si existe, 0 en caso contrario.
+ */
+int object_exists(const char *hash);
+
+/**
+ * @brief Verifica si un objeto existe y actualiza su fecha de
+ * modificacion (y la de los objetos de los que depende), para que gc no lo
+ * borre mientras se vuelve a usar.
+ *
+ * @param hash Hash del objeto
+ *
+ * @return 1 si existe, 0 en caso contrario.
+ */
+int object_freshen(const char *hash);
+
+/**
+ * @brief Abre el contenido de un objeto para lectura.
+ * Los objetos sueltos se abren directamente; los de un paquete o guardados
+ * como diferencia se reconstruyen en un temporal ya borrado del directorio.
+ *
+ * @param hash Hash del objeto
+ *
+ * @return Descriptor posicionado al inicio del contenido, -1 si ocurre un
+ * error.
+ */
+int object_open(const char *hash);
+
+/**
+ * @brief Escribe el contenido de un objeto en la posicion actual de un
+ * descriptor, en cualquiera de sus formas.
+ *
+ * @param hash Hash del objeto
+ * @param dst Descriptor de destino
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+int object_append(const char *hash, int dst);
+
+/**
+ * @brief Copia el contenido de un objeto a un archivo.
+ * El destino se crea o se trunca.
+ *
+ * @param hash Hash del objeto
+ * @param destination Ruta del archivo de destino
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+int object_retrieve(const char *hash, const char *destination);
+
+/**
+ * @brief Borra un objeto suelto (comprimido o no), guardado como
+ * diferencia o como lista de bloques. Los bloques de la lista se
+ * conservan: pueden ser de otros objetos.
+ *
+ * @param hash Hash del objeto
+ */
+void object_remove(const char *hash);
+
+/**
+ * @brief Obtiene la ruta de un objeto suelto comprimido.
+ *
+ * @param hash Hash del objeto
+ * @param path Buffer de PATH_MAX bytes
+ *
+ * @return Referencia al buffer
+ */
+char *object_lz_path(const char *hash, char *path);
+
+/**
+ * @brief Obtiene la ruta de un objeto.
+ *
+ * @param hash Hash del objeto
+ * @param path Buffer de PATH_MAX bytes
+ *
+ * @return Referencia al buffer
+ */
+char *object_path(const char *hash, char *path);
+
+#endif
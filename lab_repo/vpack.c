@@ -0,0 +1,646 @@
+/**
+ * @file
+ * @brief Implementacion de los paquetes de objetos
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ */
+
+#include "vpack.h"
+#include "fcopy.h"
+#include "vdb.h"
+#include "vlz.h"
+#include "vobject.h"
+#include "vthash.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#define PACK_MAGIC 0x4b415056 /**< "VPAK" en little endian */
+#define PACK_IDX_MAGIC 0x58495056 /**< "VPIX" en little endian */
+#define PACK_FORMAT 1 /**< Version del formato */
+#define PACK_COMPRESSED (1ULL << 63) /**< Bit de la longitud: el objeto es un flujo comprimido */
+
+/**
+ * @brief Encabezado del paquete y de su indice
+ */
+typedef struct {
+    uint32_t magic;  /**< PACK_MAGIC o PACK_IDX_MAGIC */
+    uint32_t format; /**< PACK_FORMAT */
+    uint64_t count;  /**< Numero de objetos */
+} pack_header;
+
+/**
+ * @brief Entrada del indice de un paquete
+ */
+typedef struct {
+    uint8_t digest[DIGEST_SIZE]; /**< Digest del objeto */
+    uint64_t offset;             /**< Posicion del contenido en el paquete */
+    uint64_t length;             /**< Longitud del contenido, con PACK_COMPRESSED si esta comprimido */
+} pack_entry;
+
+/**
+ * @brief Paquete abierto por el proceso
+ */
+typedef struct {
+    int fd;                    /**< Descriptor del paquete */
+    void *map;                 /**< Mapeo del indice */
+    size_t map_size;           /**< Tamano del mapeo */
+    uint64_t count;            /**< Numero de objetos */
+    const uint32_t *fanout;    /**< Tabla fan-out */
+    const pack_entry *entries; /**< Entradas ordenadas por digest */
+} pack_file;
+
+/**
+ * @brief Paquetes del repositorio, cargados en la primera consulta. Los
+ * hilos que leen objetos comparten el candado; cargarlos de nuevo toma el
+ * candado de escritura.
+ */
+static struct {
+    pthread_rwlock_t lock; /**< Protege los paquetes cargados */
+    int loaded;            /**< 1 si ya se leyo el directorio de paquetes */
+    struct timespec mtime; /**< Modificacion del directorio al leerlo */
+    pack_file *packs;      /**< Paquetes */
+    size_t count;          /**< Numero de paquetes */
+} store = {PTHREAD_RWLOCK_INITIALIZER, 0, {0, 0}, NULL, 0};
+
+/**
+ * @brief Mapea el indice de un paquete y abre el paquete.
+ * @return 0 en caso de exito, -1 si el paquete no es valido.
+ */
+static int open_pack(const char *idx_path, pack_file *p) {
+    char pack_path[PATH_MAX];
+    const pack_header *h;
+    struct stat s;
+    int fd;
+
+    if ((fd = open(idx_path, O_RDONLY)) < 0) return -1;
+    if (fstat(fd, &s) < 0 || (size_t)s.st_size < sizeof *h + 256 * sizeof(uint32_t)) {
+        close(fd);
+        return -1;
+    }
+    p->map = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p->map == MAP_FAILED) return -1;
+    p->map_size = s.st_size;
+
+    h = p->map;
+    p->count = h->count;
+    p->fanout = (const uint32_t *)(h + 1);
+    p->entries = (const pack_entry *)(p->fanout + 256);
+    if (h->magic != PACK_IDX_MAGIC || h->format != PACK_FORMAT
+            || p->map_size != sizeof *h + 256 * sizeof(uint32_t) + p->count * sizeof(pack_entry)
+            || p->fanout[255] != p->count) {
+        munmap(p->map, p->map_size);
+        return -1;
+    }
+
+    // pack-<id>.idx -> pack-<id>.pack
+    snprintf(pack_path, PATH_MAX, "%.*s.pack", (int)(strlen(idx_path) - 4), idx_path);
+    if ((p->fd = open(pack_path, O_RDONLY)) < 0) {
+        munmap(p->map, p->map_size);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Carga los paquetes del repositorio.
+ */
+static void load_packs(void) {
+    char path[PATH_MAX];
+    struct dirent *entry;
+    struct stat s;
+    pack_file *packs;
+    size_t len;
+    DIR *dir;
+
+    if (store.loaded) return;
+    store.loaded = 1;
+
+    if ((dir = opendir(PACK_DIR)) == NULL) return;
+    if (fstat(dirfd(dir), &s) == 0) store.mtime = s.st_mtim;
+    while ((entry = readdir(dir)) != NULL) {
+        len = strlen(entry->d_name);
+        if (strncmp(entry->d_name, "pack-", 5) != 0 || len < 9
+                || !EQUALS(entry->d_name + len - 4, ".idx")) {
+            continue;
+        }
+        if ((packs = realloc(store.packs, (store.count + 1) * sizeof *packs)) == NULL) break;
+        store.packs = packs;
+
+        snprintf(path, PATH_MAX, "%s/%s", PACK_DIR, entry->d_name);
+        if (open_pack(path, &store.packs[store.count]) == 0) store.count++;
+    }
+    closedir(dir);
+}
+
+/**
+ * @brief Libera los paquetes cargados. Se llama con el candado de
+ * escritura.
+ */
+static void unload_packs(void) {
+    size_t i;
+
+    for (i = 0; i < store.count; i++) {
+        munmap(store.packs[i].map, store.packs[i].map_size);
+        close(store.packs[i].fd);
+    }
+    free(store.packs);
+    store.packs = NULL;
+    store.count = 0;
+    store.loaded = 0;
+}
+
+void pack_unload(void) {
+    pthread_rwlock_wrlock(&store.lock);
+    unload_packs();
+    pthread_rwlock_unlock(&store.lock);
+}
+
+/**
+ * @brief Carga los paquetes con el candado de escritura; se llama y
+ * retorna con el candado de lectura. Si seen no es NULL, los paquetes se
+ * leen de nuevo salvo que otro hilo ya los haya leido con esa fecha de
+ * modificacion del directorio.
+ */
+static void reload_packs(const struct timespec *seen) {
+    pthread_rwlock_unlock(&store.lock);
+    pthread_rwlock_wrlock(&store.lock);
+    if (seen != NULL && (seen->tv_sec != store.mtime.tv_sec || seen->tv_nsec != store.mtime.tv_nsec)) {
+        unload_packs();
+    }
+    load_packs();
+    pthread_rwlock_unlock(&store.lock);
+    pthread_rwlock_rdlock(&store.lock);
+}
+
+/**
+ * @brief Busca un objeto en los paquetes cargados.
+ * @return Entrada del objeto, NULL si no esta en ningun paquete.
+ */
+static const pack_entry *search(const uint8_t *digest, const pack_file **pack) {
+    size_t i;
+
+    for (i = 0; i < store.count; i++) {
+        const pack_file *p = &store.packs[i];
+        uint64_t lo = digest[0] == 0 ? 0 : p->fanout[digest[0] - 1];
+        uint64_t hi = p->fanout[digest[0]];
+
+        // Busqueda binaria entre los objetos con el mismo primer byte
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            int cmp = memcmp(p->entries[mid].digest, digest, DIGEST_SIZE);
+
+            if (cmp == 0) {
+                *pack = p;
+                return &p->entries[mid];
+            }
+            if (cmp < 0) lo = mid + 1;
+            else hi = mid;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Busca un objeto en los paquetes, con el candado de lectura.
+ * Si no esta y otro proceso cambio el directorio de paquetes (un repack
+ * pudo agrupar el objeto y borrarlo suelto), los paquetes se leen de nuevo.
+ * @return Entrada del objeto, NULL si no esta en ningun paquete. La
+ * entrada es valida mientras se tenga el candado.
+ */
+static const pack_entry *find(const uint8_t *digest, const pack_file **pack) {
+    const pack_entry *e;
+    struct stat s;
+
+    if (!store.loaded) reload_packs(NULL);
+    if ((e = search(digest, pack)) != NULL) return e;
+
+    if (stat(PACK_DIR, &s) < 0 || (s.st_mtim.tv_sec == store.mtime.tv_sec && s.st_mtim.tv_nsec == store.mtime.tv_nsec)) {
+        return NULL;
+    }
+    reload_packs(&s.st_mtim);
+    return search(digest, pack);
+}
+
+int pack_contains(const char *hash) {
+    const pack_file *p;
+    uint8_t digest[DIGEST_SIZE];
+    int found;
+
+    if (hex_to_digest(hash, digest) < 0) return 0;
+    pthread_rwlock_rdlock(&store.lock);
+    found = find(digest, &p) != NULL;
+    pthread_rwlock_unlock(&store.lock);
+    return found;
+}
+
+int pack_write(const char *hash, int dst) {
+    const pack_entry *e;
+    const pack_file *p;
+    uint8_t digest[DIGEST_SIZE];
+    int result = -1;
+
+    if (hex_to_digest(hash, digest) < 0) return -1;
+    pthread_rwlock_rdlock(&store.lock);
+    if ((e = find(digest, &p)) != NULL) {
+        if (e->length & PACK_COMPRESSED) result = lz_decode(p->fd, e->offset, lz_sink_sparse, &dst);
+        else result = fcopy_range(p->fd, e->offset, e->length, dst) < 0 ? -1 : 0;
+    }
+    pthread_rwlock_unlock(&store.lock);
+    return result;
+}
+
+int pack_read(const char *hash, lz_sink sink, void *ctx) {
+    const pack_entry *e;
+    const pack_file *p;
+    uint8_t digest[DIGEST_SIZE];
+    char *buf;
+    int result = -1;
+
+    if (hex_to_digest(hash, digest) < 0) return -1;
+    pthread_rwlock_rdlock(&store.lock);
+    if ((e = find(digest, &p)) != NULL) {
+        if (e->length & PACK_COMPRESSED) {
+            result = lz_decode(p->fd, e->offset, sink, ctx);
+        } else if ((buf = malloc(e->length + 1)) != NULL) {
+            // Los objetos sin comprimir de un paquete son pequenos
+            if (pread(p->fd, buf, e->length, e->offset) == (ssize_t)e->length) result = sink(ctx, buf, e->length);
+            free(buf);
+        }
+    }
+    pthread_rwlock_unlock(&store.lock);
+    return result;
+}
+
+ssize_t pack_list(uint8_t **digests) {
+    uint8_t *result = NULL;
+    size_t count = 0, i;
+    uint64_t j;
+
+    pthread_rwlock_rdlock(&store.lock);
+    if (!store.loaded) reload_packs(NULL);
+    for (i = 0; i < store.count; i++) count += store.packs[i].count;
+    if ((result = malloc(count * DIGEST_SIZE + 1)) != NULL) {
+        for (i = 0, count = 0; i < store.count; i++) {
+            for (j = 0; j < store.packs[i].count; j++) {
+                memcpy(result + count++ * DIGEST_SIZE, store.packs[i].entries[j].digest, DIGEST_SIZE);
+            }
+        }
+    }
+    pthread_rwlock_unlock(&store.lock);
+
+    *digests = result;
+    return result != NULL ? (ssize_t)count : -1;
+}
+
+int pack_freshen(const char *hash) {
+    const pack_entry *e;
+    const pack_file *p;
+    uint8_t digest[DIGEST_SIZE];
+    int found;
+
+    if (hex_to_digest(hash, digest) < 0) return 0;
+    pthread_rwlock_rdlock(&store.lock);
+    if ((found = (e = find(digest, &p)) != NULL)) futimens(p->fd, NULL);
+    pthread_rwlock_unlock(&store.lock);
+    return found;
+}
+
+int pack_prune(int (*marked)(const uint8_t *digest, void *ctx), void *ctx, time_t before) {
+    char idx_path[PATH_MAX], pack_path[PATH_MAX];
+    struct dirent *entry;
+    struct stat s;
+    pack_file p;
+    uint64_t i;
+    size_t len;
+    int removed = 0;
+    DIR *dir;
+
+    if ((dir = opendir(PACK_DIR)) == NULL) return 0;
+    while ((entry = readdir(dir)) != NULL) {
+        len = strlen(entry->d_name);
+        if (strncmp(entry->d_name, "pack-", 5) != 0 || len < 9
+                || !EQUALS(entry->d_name + len - 4, ".idx")) {
+            continue;
+        }
+        snprintf(idx_path, PATH_MAX, "%s/%s", PACK_DIR, entry->d_name);
+        if (open_pack(idx_path, &p) < 0) continue;
+
+        for (i = 0; i < p.count && !marked(p.entries[i].digest, ctx); i++);
+        if (i == p.count && fstat(p.fd, &s) == 0 && s.st_mtime < before) {
+            // Sin el indice el paquete deja de ser visible
+            snprintf(pack_path, PATH_MAX, "%s/%.*s.pack", PACK_DIR, (int)(len - 4), entry->d_name);
+            if (unlink(idx_path) == 0 && unlink(pack_path) == 0) removed++;
+        }
+        munmap(p.map, p.map_size);
+        close(p.fd);
+    }
+    closedir(dir);
+    pack_unload();
+    return removed;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return memcmp(((const pack_entry *)a)->digest, ((const pack_entry *)b)->digest, DIGEST_SIZE);
+}
+
+/**
+ * @brief Escribe todo el buffer en un descriptor.
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t nwritten = write(fd, p, len);
+        if (nwritten < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += nwritten;
+        len -= nwritten;
+    }
+    return 0;
+}
+
+/**
+ * @brief Lista los objetos sueltos candidatos a agrupar.
+ * @return Numero de objetos, -1 si ocurre un error.
+ */
+static ssize_t loose_objects(pack_entry **result) {
+    pack_entry *entries = NULL, *grown;
+    size_t count = 0, capacity = 0;
+    char path[PATH_MAX];
+    struct dirent *entry;
+    struct stat s;
+    DIR *dir;
+
+    if ((dir = opendir(VERSIONS_DIR)) == NULL) return -1;
+    while ((entry = readdir(dir)) != NULL) {
+        char hash[2 * DIGEST_SIZE + 1];
+        uint8_t digest[DIGEST_SIZE];
+        size_t len = strlen(entry->d_name);
+        int compressed = len > 2 * DIGEST_SIZE && EQUALS(entry->d_name + 2 * DIGEST_SIZE, OBJECT_LZ_SUFFIX);
+
+        // Los objetos sueltos se llaman como su hash, con ".z" si estan
+        // comprimidos
+        if (len != 2 * DIGEST_SIZE && !compressed) continue;
+        snprintf(hash, sizeof hash, "%.*s", 2 * DIGEST_SIZE, entry->d_name);
+        if (hex_to_digest(hash, digest) < 0) continue;
+        snprintf(path, PATH_MAX, "%s/%s", VERSIONS_DIR, entry->d_name);
+        if (lstat(path, &s) < 0 || !S_ISREG(s.st_mode) || s.st_size > PACK_MAX_OBJECT) continue;
+
+        if (count == capacity) {
+            capacity = capacity ? 2 * capacity : 256;
+            if ((grown = realloc(entries, capacity * sizeof *entries)) == NULL) {
+                free(entries);
+                closedir(dir);
+                return -1;
+            }
+            entries = grown;
+        }
+        memcpy(entries[count].digest, digest, DIGEST_SIZE);
+        entries[count].offset = 0;
+        entries[count].length = s.st_size | (compressed ? PACK_COMPRESSED : 0);
+        count++;
+    }
+    closedir(dir);
+
+    *result = entries;
+    return count;
+}
+
+/**
+ * @brief Receptor que calcula el hash del contenido descomprimido.
+ */
+static int sink_hash(void *ctx, const void *data, size_t len) {
+    sha256_update(ctx, data, len);
+    return 0;
+}
+
+/**
+ * @brief Obtiene el digest del contenido de un objeto suelto.
+ * @return 0 en caso de exito, -1 si el objeto no se puede leer.
+ */
+static int loose_digest(int src, const char *buf, size_t len, int compressed, uint8_t *digest) {
+    struct sha256_buff sha;
+
+    if (!compressed) {
+        sha256_hash(buf, len, digest);
+        return 0;
+    }
+    sha256_init(&sha);
+    if (lz_decode(src, 0, sink_hash, &sha) < 0) return -1;
+    sha256_finalize(&sha);
+    sha256_read(&sha, digest);
+    return 0;
+}
+
+/**
+ * @brief Obtiene la ruta de un objeto suelto candidato a agrupar.
+ */
+static char *loose_path(const pack_entry *e, char *path) {
+    char hash[2 * DIGEST_SIZE + 1];
+
+    digest_to_hex(e->digest, hash);
+    snprintf(path, PATH_MAX, "%s/%s%s", VERSIONS_DIR, hash, e->length & PACK_COMPRESSED ? OBJECT_LZ_SUFFIX : "");
+    return path;
+}
+
+/**
+ * @brief Escribe el contenido de los objetos en el paquete y completa sus
+ * posiciones. Los objetos que no se pueden leer o cuyo contenido no
+ * coincide con su hash se marcan con longitud -1 y quedan sueltos.
+ * @return 0 en caso de exito, -1 si falla la escritura.
+ */
+static int write_objects(int fd, pack_entry *entries, size_t count) {
+    pack_header h = {PACK_MAGIC, PACK_FORMAT, 0};
+    uint64_t offset = sizeof h;
+    char hash[2 * DIGEST_SIZE + 1], path[PATH_MAX];
+    uint8_t digest[DIGEST_SIZE];
+    char *buf;
+    size_t i;
+
+    if ((buf = malloc(PACK_MAX_OBJECT)) == NULL) return -1;
+    if (write_all(fd, &h, sizeof h) < 0) {
+        free(buf);
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        pack_entry *e = &entries[i];
+        int compressed = (e->length & PACK_COMPRESSED) != 0;
+        ssize_t nread;
+        int src, ok;
+
+        digest_to_hex(e->digest, hash);
+        if ((src = open(loose_path(e, path), O_RDONLY)) < 0) {
+            e->length = (uint64_t)-1;
+            continue;
+        }
+        nread = read(src, buf, PACK_MAX_OBJECT);
+
+        // Los objetos con digest de arbol (contenido grande muy
+        // compresible) quedan sueltos: los paquetes solo tienen SHA-256
+        if (compressed && lz_frame_size(src, 0) >= THASH_MIN_SIZE) {
+            close(src);
+            e->length = (uint64_t)-1;
+            continue;
+        }
+
+        // El objeto se verifica antes de agruparlo: un objeto danado no
+        // debe ocultarse dentro de un paquete. Los comprimidos se guardan
+        // tal cual, pero se verifica su contenido descomprimido
+        ok = nread >= 0 && (uint64_t)nread == (e->length & ~PACK_COMPRESSED)
+            && loose_digest(src, buf, nread, compressed, digest) == 0
+            && memcmp(digest, e->digest, DIGEST_SIZE) == 0;
+        close(src);
+        if (!ok) {
+            fprintf(stderr, "Objeto danado, no se agrupa: %s\n", hash);
+            e->length = (uint64_t)-1;
+            continue;
+        }
+
+        if (write_all(fd, buf, nread) < 0) {
+            free(buf);
+            return -1;
+        }
+        e->offset = offset;
+        offset += nread;
+    }
+
+    free(buf);
+    return 0;
+}
+
+/**
+ * @brief Escribe un archivo temporal del directorio de paquetes y lo
+ * publica con rename despues de sincronizarlo.
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int publish(int fd, const char *tmp_path, const char *path) {
+    if (fsync(fd) < 0) {
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+    if (close(fd) < 0 || rename(tmp_path, path) < 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Agrupa los objetos sueltos. Se llama con el candado de repack.
+ * @return Numero de objetos agrupados, -1 si ocurre un error.
+ */
+static int repack_objects(void) {
+    char tmp_path[PATH_MAX], path[PATH_MAX];
+    char id[2 * DIGEST_SIZE + 1];
+    struct sha256_buff sha;
+    pack_header h = {PACK_IDX_MAGIC, PACK_FORMAT, 0};
+    uint32_t fanout[256];
+    pack_entry *entries;
+    ssize_t count;
+    size_t i, packed = 0;
+    int fd, dir_fd;
+
+    if ((count = loose_objects(&entries)) <= 0) return count;
+
+    qsort(entries, count, sizeof *entries, compare_entries);
+
+    // 1. El contenido se escribe en un paquete temporal
+    snprintf(tmp_path, PATH_MAX, "%s/tmp-XXXXXX", PACK_DIR);
+    if ((fd = mkstemp(tmp_path)) < 0) {
+        free(entries);
+        return -1;
+    }
+    fchmod(fd, 0444);
+    if (write_objects(fd, entries, count) < 0) {
+        close(fd);
+        unlink(tmp_path);
+        free(entries);
+        return -1;
+    }
+
+    // Los objetos que no se agruparon se retiran de la lista; el nombre
+    // del paquete es el hash de los digests que contiene
+    sha256_init(&sha);
+    memset(fanout, 0, sizeof fanout);
+    for (i = 0; i < (size_t)count; i++) {
+        if (entries[i].length == (uint64_t)-1) continue;
+        entries[packed++] = entries[i];
+        sha256_update(&sha, entries[i].digest, DIGEST_SIZE);
+        fanout[entries[i].digest[0]]++;
+    }
+    sha256_finalize(&sha);
+    sha256_read_hex(&sha, id);
+    for (i = 1; i < 256; i++) fanout[i] += fanout[i - 1];
+    h.count = packed;
+
+    if (packed == 0) {
+        close(fd);
+        unlink(tmp_path);
+        free(entries);
+        return 0;
+    }
+
+    snprintf(path, PATH_MAX, "%s/pack-%s.pack", PACK_DIR, id);
+    if (publish(fd, tmp_path, path) < 0) {
+        free(entries);
+        return -1;
+    }
+
+    // 2. El indice se publica despues del paquete: desde ese momento los
+    // objetos se leen del paquete
+    snprintf(tmp_path, PATH_MAX, "%s/tmp-XXXXXX", PACK_DIR);
+    if ((fd = mkstemp(tmp_path)) < 0) {
+        free(entries);
+        return -1;
+    }
+    fchmod(fd, 0444);
+    if (write_all(fd, &h, sizeof h) < 0
+            || write_all(fd, fanout, sizeof fanout) < 0
+            || write_all(fd, entries, packed * sizeof *entries) < 0) {
+        close(fd);
+        unlink(tmp_path);
+        free(entries);
+        return -1;
+    }
+    snprintf(path, PATH_MAX, "%s/pack-%s.idx", PACK_DIR, id);
+    if (publish(fd, tmp_path, path) < 0) {
+        free(entries);
+        return -1;
+    }
+    if ((dir_fd = open(PACK_DIR, O_RDONLY | O_DIRECTORY)) >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    // 3. Los objetos agrupados ya no se necesitan sueltos
+    for (i = 0; i < packed; i++) unlink(loose_path(&entries[i], path));
+
+    free(entries);
+    pack_unload();
+    return packed;
+}
+
+int pack_repack(void) {
+    int lock_fd, packed;
+
+    // Un solo repack a la vez: dos procesos agruparian los mismos objetos
+    mkdir(PACK_DIR, 0755);
+    if ((lock_fd = open(PACK_DIR, O_RDONLY | O_DIRECTORY)) < 0) return -1;
+    if (flock(lock_fd, LOCK_EX) < 0) {
+        close(lock_fd);
+        return -1;
+    }
+    packed = repack_objects();
+    close(lock_fd);
+    return packed;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file
+ * @brief Paquetes de objetos pequenos
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * Un paquete agrupa muchos objetos en un solo archivo para no gastar un
+ * inodo, una entrada de directorio y un open por cada objeto pequeno. Cada
+ * paquete se compone de dos archivos en .versions/pack/:
+ *
+ * - pack-<id>.pack: encabezado seguido del contenido de los objetos, uno
+ *   tras otro (los objetos comprimidos conservan su flujo comprimido). Se
+ *   escribe una sola vez y nunca se modifica.
+ * - pack-<id>.idx: encabezado, tabla fan-out de 256 entradas y las
+ *   entradas (digest, posicion, longitud y si esta comprimido) ordenadas
+ *   por digest. La entrada fan-out b cuenta los objetos cuyo digest
+ *   inicia con un byte <= b, por lo que la busqueda binaria se limita a
+ *   los objetos del primer byte.
+ *
+ * El paquete se escribe y sincroniza antes que su indice, y el indice se
+ * publica al final con rename: un paquete sin indice no es visible. Un
+ * solo proceso agrupa a la vez; los lectores vuelven a leer los paquetes si
+ * un objeto que buscan fue agrupado despues de cargarlos. Las consultas
+ * se pueden hacer desde varios hilos.
+ */
+
+#ifndef VPACK_H
+#define VPACK_H
+
+#include "versions.h"
+#include "vlz.h"
+
+#define PACK_DIR VERSIONS_DIR "/pack" /**< Directorio de los paquetes */
+#define PACK_MAX_OBJECT (1 << 20) /**< Los objetos (guardados) mas grandes quedan sueltos */
+
+/**
+ * @brief Verifica si un objeto esta en algun paquete.
+ *
+ * @param hash Hash del objeto
+ *
+ * @return 1 si esta en un paquete, 0 en caso contrario.
+ */
+int pack_contains(const char *hash);
+
+/**
+ * @brief Copia un objeto de un paquete, descomprimido, a la posicion actual
+ * de un descriptor. Los bloques en ceros quedan como huecos; un hueco al
+ * final no extiende el destino (ver lz_sink_sparse).
+ *
+ * @param hash Hash del objeto
+ * @param dst Descriptor de destino
+ *
+ * @return 0 en caso de exito, -1 si el objeto no esta en un paquete o
+ * ocurre un error.
+ */
+int pack_write(const char *hash, int dst);
+
+/**
+ * @brief Entrega el contenido de un objeto de un paquete, descomprimido,
+ * a un receptor.
+ *
+ * @param hash Hash del objeto
+ * @param sink Receptor del contenido
+ * @param ctx Contexto del receptor
+ *
+ * @return 0 en caso de exito, -1 si el objeto no esta en un paquete, no
+ * se puede leer o el receptor aborta.
+ */
+int pack_read(const char *hash, lz_sink sink, void *ctx);
+
+/**
+ * @brief Lista los objetos de todos los paquetes.
+ *
+ * @param digests Digests de los objetos (DIGEST_SIZE bytes cada uno),
+ * liberar con free
+ *
+ * @return Numero de objetos, -1 si ocurre un error.
+ */
+ssize_t pack_list(uint8_t **digests);
+
+/**
+ * @brief Actualiza la fecha de modificacion del paquete que contiene un
+ * objeto, para que gc no lo borre mientras se vuelve a usar.
+ *
+ * @param hash Hash del objeto
+ *
+ * @return 1 si el objeto esta en un paquete, 0 en caso contrario.
+ */
+int pack_freshen(const char *hash);
+
+/**
+ * @brief Borra los paquetes en los que ningun objeto esta marcado y que
+ * no se modificaron desde before.
+ *
+ * @param marked Indica si un digest esta marcado como usado
+ * @param ctx Contexto de marked
+ * @param before Fecha limite de modificacion
+ *
+ * @return Numero de paquetes borrados.
+ */
+int pack_prune(int (*marked)(const uint8_t *digest, void *ctx), void *ctx, time_t before);
+
+/**
+ * @brief Libera los paquetes cargados. Se cargan de nuevo en la siguiente
+ * busqueda.
+ */
+void pack_unload(void);
+
+/**
+ * @brief Agrupa los objetos sueltos de hasta PACK_MAX_OBJECT bytes en un
+ * paquete nuevo y borra los objetos sueltos agrupados. Los objetos con
+ * digest de arbol (ver vthash.h) quedan sueltos.
+ *
+ * @return Numero de objetos agrupados, -1 si ocurre un error.
+ */
+int pack_repack(void);
+
+#endif
@@ -0,0 +1,170 @@
+/**
+ * @file
+ * @brief Implementacion de la medicion por fases
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ */
+
+#include "vstats.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STATS_OP_SIZE 32 /**< Longitud maxima del nombre del comando */
+
+/** Nombres de las fases, en el orden de stats_phase */
+static const char *const phase_names[STATS_PHASES] = {
+    "stat", "read", "hash", "store", "retrieve", "index", "db"
+};
+
+/**
+ * @brief Contadores de /proc/self/io
+ */
+typedef struct {
+    uint64_t rchar; /**< Bytes leidos con read y similares */
+    uint64_t wchar; /**< Bytes escritos con write y similares */
+    uint64_t syscr; /**< Llamadas al sistema de lectura */
+    uint64_t syscw; /**< Llamadas al sistema de escritura */
+} io_counters;
+
+int stats_mode = STATS_OFF;
+
+/**
+ * @brief Medicion del comando en curso
+ */
+static struct {
+    char operation[STATS_OP_SIZE]; /**< Nombre del comando */
+    int64_t started;               /**< Inicio del comando */
+    io_counters io;                /**< Contadores al iniciar */
+    int64_t phases[STATS_PHASES];  /**< Nanosegundos por fase */
+    uint64_t hashed;               /**< Bytes procesados por el hash */
+} stats;
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Lee los contadores de E/S del proceso; quedan en 0 si el sistema
+ * no los ofrece.
+ */
+static void read_io(io_counters *io) {
+    char name[32];
+    unsigned long long value;
+    FILE *f;
+
+    memset(io, 0, sizeof *io);
+    if ((f = fopen("/proc/self/io", "r")) == NULL) return;
+    while (fscanf(f, "%31[^:]: %llu\n", name, &value) == 2) {
+        if (strcmp(name, "rchar") == 0) io->rchar = value;
+        else if (strcmp(name, "wchar") == 0) io->wchar = value;
+        else if (strcmp(name, "syscr") == 0) io->syscr = value;
+        else if (strcmp(name, "syscw") == 0) io->syscw = value;
+    }
+    fclose(f);
+}
+
+int stats_parse(const char *value) {
+    if (strcmp(value, "text") == 0 || strcmp(value, "1") == 0) return STATS_TEXT;
+    if (strcmp(value, "json") == 0) return STATS_JSON;
+    if (strcmp(value, "0") == 0 || value[0] == 0) return STATS_OFF;
+    return -1;
+}
+
+int64_t stats_start(void) {
+    return stats_mode != STATS_OFF ? now_ns() : 0;
+}
+
+void stats_stop(stats_phase phase, int64_t start) {
+    if (start != 0) __atomic_fetch_add(&stats.phases[phase], now_ns() - start, __ATOMIC_RELAXED);
+}
+
+void stats_hashed(uint64_t bytes) {
+    if (stats_mode != STATS_OFF) __atomic_fetch_add(&stats.hashed, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Emite el reporte del comando (registrada con atexit).
+ */
+static void report(void) {
+    char line[1024];
+    io_counters io;
+    struct rusage usage;
+    double wall, hash_rate;
+    int len, i, fd;
+    const char *path;
+
+    wall = (now_ns() - stats.started) / 1e9;
+    read_io(&io);
+    io.rchar -= stats.io.rchar;
+    io.wchar -= stats.io.wchar;
+    io.syscr -= stats.io.syscr;
+    io.syscw -= stats.io.syscw;
+    getrusage(RUSAGE_SELF, &usage);
+    hash_rate = stats.phases[STATS_HASH] > 0 ? stats.hashed / 1e6 / (stats.phases[STATS_HASH] / 1e9) : 0;
+
+    if (stats_mode == STATS_TEXT) {
+        fprintf(stderr, "versions %s: %.3f s (usuario %.3f s, sistema %.3f s)\n", stats.operation, wall,
+                usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+                usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6);
+        for (i = 0; i < STATS_PHASES; i++) {
+            if (stats.phases[i] > 0) fprintf(stderr, "  %-9s %10.3f s\n", phase_names[i], stats.phases[i] / 1e9);
+        }
+        if (stats.hashed > 0) fprintf(stderr, "  hash: %.1f MB a %.1f MB/s\n", stats.hashed / 1e6, hash_rate);
+        fprintf(stderr, "  leidos: %.1f MB en %llu llamadas, escritos: %.1f MB en %llu llamadas\n",
+                io.rchar / 1e6, (unsigned long long)io.syscr, io.wchar / 1e6, (unsigned long long)io.syscw);
+        return;
+    }
+
+    // Una linea JSON plana por comando, escrita con un solo write para que
+    // las lineas de procesos concurrentes no se mezclen
+    len = snprintf(line, sizeof line, "{\"op\":\"%s\",\"time\":%lld,\"wall_s\":%.6f,\"user_s\":%.6f,\"sys_s\":%.6f",
+                   stats.operation, (long long)time(NULL), wall,
+                   usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+                   usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6);
+    for (i = 0; i < STATS_PHASES; i++) {
+        len += snprintf(line + len, sizeof line - len, ",\"%s_s\":%.6f", phase_names[i], stats.phases[i] / 1e9);
+    }
+    len += snprintf(line + len, sizeof line - len,
+                    ",\"hash_bytes\":%llu,\"hash_mb_s\":%.1f,\"read_bytes\":%llu,\"write_bytes\":%llu"
+                    ",\"read_syscalls\":%llu,\"write_syscalls\":%llu}\n",
+                    (unsigned long long)stats.hashed, hash_rate, (unsigned long long)io.rchar,
+                    (unsigned long long)io.wchar, (unsigned long long)io.syscr, (unsigned long long)io.syscw);
+
+    path = getenv(STATS_FILE_ENV);
+    if (path == NULL || path[0] == 0 || (fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0) {
+        fputs(line, stderr);
+        return;
+    }
+    if (write(fd, line, len) != len) fputs(line, stderr);
+    close(fd);
+}
+
+void stats_enable(int mode, const char *operation) {
+    size_t i, j;
+
+    if (mode == STATS_OFF || stats_mode != STATS_OFF) return;
+
+    // El nombre va dentro de la linea JSON: solo se conservan letras,
+    // digitos y guiones
+    for (i = 0, j = 0; operation != NULL && operation[i] != 0 && j < STATS_OP_SIZE - 1; i++) {
+        char c = operation[i];
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-') {
+            stats.operation[j++] = c;
+        }
+    }
+    stats.operation[j] = 0;
+
+    read_io(&stats.io);
+    stats.started = now_ns();
+    stats_mode = mode;
+    atexit(report);
+}
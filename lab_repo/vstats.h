@@ -0,0 +1,93 @@
+/**
+ * @file
+ * @brief Medicion por fases de los comandos de versions
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * Con --stats (o la variable de entorno VERSIONS_STATS) cada comando
+ * reporta al terminar el tiempo de cada fase (stat, lectura, hash,
+ * almacenamiento, recuperacion, indice y versions.db), los bytes leidos y
+ * escritos, el throughput del hash y el numero de llamadas al sistema de
+ * lectura y escritura.
+ *
+ * El tiempo de una fase es la suma del tiempo de todos los hilos que la
+ * ejecutaron, por lo que en las fases paralelas puede superar el tiempo
+ * total del comando. Los bytes y las llamadas al sistema se toman de
+ * /proc/self/io al iniciar y al terminar el comando; las lecturas de
+ * archivos mapeados en memoria no aparecen ahi.
+ *
+ * En modo json se emite una linea JSON por comando, en la salida de error
+ * o adicionada al archivo de VERSIONS_STATS_FILE, para procesarla con
+ * otras herramientas. Sin --stats, medir una fase solo cuesta comparar
+ * una variable.
+ */
+
+#ifndef VSTATS_H
+#define VSTATS_H
+
+#include <stdint.h>
+
+#define STATS_ENV "VERSIONS_STATS" /**< Variable de entorno: text o json */
+#define STATS_FILE_ENV "VERSIONS_STATS_FILE" /**< Archivo al que se adicionan las lineas JSON */
+
+#define STATS_OFF 0  /**< Sin medicion */
+#define STATS_TEXT 1 /**< Reporte legible en la salida de error */
+#define STATS_JSON 2 /**< Una linea JSON por comando */
+
+/**
+ * @brief Fases medidas
+ */
+typedef enum {
+    STATS_STAT,     /**< stat de los archivos y consulta de la cache de hashes */
+    STATS_READ,     /**< Lectura de los archivos a adicionar */
+    STATS_HASH,     /**< Calculo del hash */
+    STATS_STORE,    /**< Escritura de los objetos en el repositorio */
+    STATS_RETRIEVE, /**< Recuperacion de archivos del repositorio */
+    STATS_INDEX,    /**< Consultas y actualizacion del indice y el filtro */
+    STATS_DB,       /**< Escrituras en versions.db */
+    STATS_PHASES    /**< Numero de fases */
+} stats_phase;
+
+/** Modo de medicion del proceso (STATS_OFF si no se mide) */
+extern int stats_mode;
+
+/**
+ * @brief Interpreta el valor de --stats= o de VERSIONS_STATS.
+ *
+ * @param value "text", "json", "1" (text) o "0" (sin medicion)
+ *
+ * @return Modo de medicion, -1 si el valor no es valido.
+ */
+int stats_parse(const char *value);
+
+/**
+ * @brief Inicia la medicion de un comando; el reporte se emite al
+ * terminar el proceso.
+ *
+ * @param mode STATS_TEXT o STATS_JSON
+ * @param operation Nombre del comando (p.e. "add")
+ */
+void stats_enable(int mode, const char *operation);
+
+/**
+ * @brief Inicio de una fase.
+ *
+ * @return Momento actual en nanosegundos, 0 si no se mide.
+ */
+int64_t stats_start(void);
+
+/**
+ * @brief Fin de una fase: suma el tiempo desde start.
+ *
+ * @param phase Fase medida
+ * @param start Valor de stats_start
+ */
+void stats_stop(stats_phase phase, int64_t start);
+
+/**
+ * @brief Suma bytes procesados por el hash.
+ */
+void stats_hashed(uint64_t bytes);
+
+#endif
@@ -0,0 +1,336 @@
+/**
+ * @file
+ * @brief Implementacion del digest de arbol
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ */
+
+#define _GNU_SOURCE
+#include "vthash.h"
+#include "vobject.h"
+#include "vstats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint8_t leaf_prefix = 0x00; /**< Prefijo del hash de una hoja */
+static const uint8_t node_prefix = 0x01; /**< Prefijo del hash de un nodo */
+static const uint8_t root_prefix = 0x02; /**< Prefijo del hash del nombre */
+
+/**
+ * @brief Valor inicial del hash del nombre: la parte fraccionaria de las
+ * raices cuadradas de los primos 23 a 53. SHA-256 usa las de 2 a 19
+ */
+static const uint32_t root_iv[8] = {
+    0xcbbb9d5d, 0x629a292a, 0x9159015a, 0x152fecd8, 0x67332667, 0x8eb44a87, 0xdb0c2e0d, 0x47b5481d
+};
+
+/**
+ * @brief Calculo paralelo de las hojas de un archivo
+ */
+typedef struct {
+    int fd;                         /**< Descriptor del archivo */
+    int dst;                        /**< Copia del archivo, -1 si no se copia */
+    off_t size;                     /**< Bytes del contenido */
+    size_t count;                   /**< Numero de hojas */
+    size_t next;                    /**< Siguiente hoja sin asignar */
+    uint8_t (*digests)[DIGEST_SIZE]; /**< Hash de cada hoja */
+    int error;                      /**< 1 si alguna hoja no se pudo leer */
+} thash_job;
+
+/**
+ * @brief Agrega el hash de una hoja terminada y une los subarboles
+ * completos de la misma altura.
+ */
+static void push_leaf(thash_state *t, const uint8_t *leaf) {
+    struct sha256_buff sha;
+    uint8_t node[DIGEST_SIZE];
+    int height = 0;
+
+    memcpy(node, leaf, DIGEST_SIZE);
+    while (t->top > 0 && t->height[t->top - 1] == height) {
+        sha256_init(&sha);
+        sha256_update(&sha, &node_prefix, 1);
+        sha256_update(&sha, t->stack[t->top - 1], DIGEST_SIZE);
+        sha256_update(&sha, node, DIGEST_SIZE);
+        sha256_finalize(&sha);
+        sha256_read(&sha, node);
+        t->top--;
+        height++;
+    }
+    memcpy(t->stack[t->top], node, DIGEST_SIZE);
+    t->height[t->top] = height;
+    t->top++;
+    t->leaves++;
+}
+
+void thash_init(thash_state *t) {
+    t->leaf_len = 0;
+    t->leaves = 0;
+    t->top = 0;
+    sha256_init(&t->leaf);
+    sha256_update(&t->leaf, &leaf_prefix, 1);
+}
+
+void thash_update(thash_state *t, const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint8_t leaf[DIGEST_SIZE];
+
+    while (len > 0) {
+        size_t n = THASH_LEAF - t->leaf_len < len ? THASH_LEAF - t->leaf_len : len;
+
+        sha256_update(&t->leaf, p, n);
+        t->leaf_len += n;
+        p += n;
+        len -= n;
+
+        // Una hoja se cierra en cuanto se llena
+        if (t->leaf_len == THASH_LEAF) {
+            sha256_finalize(&t->leaf);
+            sha256_read(&t->leaf, leaf);
+            push_leaf(t, leaf);
+            t->leaf_len = 0;
+            sha256_init(&t->leaf);
+            sha256_update(&t->leaf, &leaf_prefix, 1);
+        }
+    }
+}
+
+void thash_final(thash_state *t, uint8_t *digest) {
+    struct sha256_buff sha;
+    uint8_t leaf[DIGEST_SIZE];
+
+    // La ultima hoja puede ser incompleta; un contenido vacio es una hoja
+    // vacia
+    if (t->leaf_len > 0 || t->leaves == 0) {
+        sha256_finalize(&t->leaf);
+        sha256_read(&t->leaf, leaf);
+        push_leaf(t, leaf);
+    }
+
+    // Los subarboles que quedan se unen de derecha a izquierda
+    while (t->top > 1) {
+        sha256_init(&sha);
+        sha256_update(&sha, &node_prefix, 1);
+        sha256_update(&sha, t->stack[t->top - 2], DIGEST_SIZE);
+        sha256_update(&sha, t->stack[t->top - 1], DIGEST_SIZE);
+        sha256_finalize(&sha);
+        sha256_read(&sha, t->stack[t->top - 2]);
+        t->top--;
+    }
+
+    // La raiz es el SHA-256 de una hoja o de un nodo, que un archivo
+    // pequeno puede reproducir. El nombre se calcula con otro valor
+    // inicial: no es el SHA-256 de ningun contenido conocido
+    sha256_init(&sha);
+    memcpy(sha.h, root_iv, sizeof root_iv);
+    sha256_update(&sha, &root_prefix, 1);
+    sha256_update(&sha, t->stack[0], DIGEST_SIZE);
+    sha256_finalize(&sha);
+    sha256_read(&sha, digest);
+}
+
+void thash_leaf(const void *data, size_t len, uint8_t *digest) {
+    struct sha256_buff sha;
+
+    sha256_init(&sha);
+    sha256_update(&sha, &leaf_prefix, 1);
+    sha256_update(&sha, data, len);
+    sha256_finalize(&sha);
+    sha256_read(&sha, digest);
+}
+
+/**
+ * @brief Lee len bytes desde una posicion.
+ * @return 0 en caso de exito, -1 si ocurre un error o el archivo termina
+ * antes.
+ */
+static int read_at(int fd, char *buf, size_t len, off_t offset) {
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = pread(fd, buf, len, offset)) < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Escribe len bytes en una posicion.
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int write_at(int fd, const char *buf, size_t len, off_t offset) {
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = pwrite(fd, buf, len, offset)) < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Lee una hoja que tiene datos, y la copia si el calculo tiene
+ * copia. Solo se leen y se escriben los rangos con datos; los huecos
+ * quedan en ceros en buf y como huecos en la copia.
+ *
+ * @param data Primera posicion con datos de la hoja, o su inicio si no se
+ * conoce
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int read_leaf(thash_job *job, char *buf, off_t offset, size_t len, off_t data) {
+    off_t end = offset + (off_t)len, hole;
+
+    memset(buf, 0, data - offset);
+    while (data < end) {
+        if ((hole = lseek(job->fd, data, SEEK_HOLE)) < 0 || hole > end) hole = end;
+        if (read_at(job->fd, buf + (data - offset), hole - data, data) < 0) return -1;
+        if (job->dst >= 0 && write_at(job->dst, buf + (data - offset), hole - data, data) < 0) return -1;
+        if (hole == end) break;
+        if ((data = lseek(job->fd, hole, SEEK_DATA)) < 0 || data > end) data = end;
+        memset(buf + (hole - offset), 0, data - hole);
+    }
+    return 0;
+}
+
+/**
+ * @brief Hilo trabajador: lee, copia y calcula el hash de las hojas
+ * pendientes.
+ */
+static void *leaf_worker(void *arg) {
+    thash_job *job = arg;
+    uint8_t zero_leaf[DIGEST_SIZE];
+    int have_zero = 0;
+    char *buf;
+    size_t i;
+
+    if ((buf = malloc(THASH_LEAF)) == NULL) {
+        job->error = 1;
+        return NULL;
+    }
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+        off_t offset = (off_t)i * THASH_LEAF;
+        size_t len = job->size - offset < THASH_LEAF ? (size_t)(job->size - offset) : THASH_LEAF;
+        off_t data;
+
+        // Una hoja que cae completa en un hueco no se lee ni se copia: son
+        // ceros, y todas las hojas completas de ceros tienen el mismo hash
+        data = lseek(job->fd, offset, SEEK_DATA);
+        if (data >= offset + (off_t)len || (data < 0 && errno == ENXIO)) {
+            if (len == THASH_LEAF && have_zero) {
+                memcpy(job->digests[i], zero_leaf, DIGEST_SIZE);
+                continue;
+            }
+            memset(buf, 0, len);
+            thash_leaf(buf, len, job->digests[i]);
+            if (len == THASH_LEAF) {
+                memcpy(zero_leaf, job->digests[i], DIGEST_SIZE);
+                have_zero = 1;
+            }
+            continue;
+        }
+
+        // Sin SEEK_DATA toda la hoja se trata como datos
+        if (data < offset) data = offset;
+        if (read_leaf(job, buf, offset, len, data) < 0) {
+            job->error = 1;
+            break;
+        }
+        thash_leaf(buf, len, job->digests[i]);
+        stats_hashed(len);
+    }
+    free(buf);
+    return NULL;
+}
+
+int thash_fd(int fd, off_t size, uint8_t *digest) {
+    return thash_copy(fd, size, -1, digest);
+}
+
+int thash_copy(int fd, off_t size, int dst, uint8_t *digest) {
+    thash_job job = {fd, dst, size, 0, 0, NULL, 0};
+    thash_state t;
+    pthread_t *threads = NULL;
+    long nthreads, started = 0, i;
+    off_t position = lseek(fd, 0, SEEK_CUR);
+    size_t j;
+
+    job.count = (size + THASH_LEAF - 1) / THASH_LEAF;
+    if ((job.digests = malloc((job.count + 1) * DIGEST_SIZE)) == NULL) return -1;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // Un hilo por procesador, sin pasar del numero de hojas. El hilo
+    // principal tambien trabaja
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads > (long)job.count) nthreads = job.count;
+    if (nthreads > 1 && (threads = malloc((nthreads - 1) * sizeof *threads)) != NULL) {
+        for (; started < nthreads - 1; started++) {
+            if (pthread_create(&threads[started], NULL, leaf_worker, &job) != 0) break;
+        }
+    }
+    leaf_worker(&job);
+    for (i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    free(threads);
+
+    // La busqueda de huecos mueve la posicion del descriptor
+    if (position >= 0) lseek(fd, position, SEEK_SET);
+
+    // Los huecos del final no extienden la copia
+    if (dst >= 0 && !job.error && ftruncate(dst, size) < 0) job.error = 1;
+
+    // Las hojas se combinan en orden, como en el calculo secuencial
+    if (!job.error) {
+        thash_init(&t);
+        for (j = 0; j < job.count; j++) push_leaf(&t, job.digests[j]);
+        thash_final(&t, digest);
+    }
+    free(job.digests);
+    return job.error ? -1 : 0;
+}
+
+int thash_content(int fd, off_t size, uint8_t *digest) {
+    return thash_content_type(fd, size, THASH_TYPE(size), digest);
+}
+
+int thash_content_type(int fd, off_t size, int type, uint8_t *digest) {
+    struct sha256_buff sha;
+    struct stat s;
+    char *buf;
+    ssize_t nread;
+    off_t total = 0;
+
+    if (type == VDB_HASH_TREE) {
+        // Las hojas cubren size bytes: si el archivo cambio de tamano, el
+        // digest no corresponde a su contenido
+        if (thash_fd(fd, size, digest) < 0) return -1;
+        return fstat(fd, &s) == 0 && s.st_size == size ? 0 : -1;
+    }
+
+    if ((buf = malloc(OBJECT_BUFSIZE)) == NULL) return -1;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    sha256_init(&sha);
+    while ((nread = read(fd, buf, OBJECT_BUFSIZE)) != 0) {
+        if (nread < 0 && errno == EINTR) continue;
+        if (nread < 0) break;
+        sha256_update(&sha, buf, nread);
+        stats_hashed(nread);
+        total += nread;
+    }
+    free(buf);
+    if (nread < 0 || total != size) return -1;
+    sha256_finalize(&sha);
+    sha256_read(&sha, digest);
+    return 0;
+}
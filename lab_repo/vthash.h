@@ -0,0 +1,146 @@
+/**
+ * @file
+ * @brief Digest de arbol (Merkle) para archivos grandes
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * SHA-256 es secuencial: el hash de un archivo de varios GB usa un solo
+ * procesador. Los archivos de al menos THASH_MIN_SIZE bytes se nombran en
+ * cambio con un digest de arbol: el contenido se divide en hojas de
+ * THASH_LEAF bytes, el hash de cada hoja se calcula en paralelo y los
+ * hashes se combinan por pares hasta la raiz.
+ *
+ * Las hojas y los nodos se calculan con prefijos distintos (0x00 para una
+ * hoja, 0x01 para un nodo). Los nodos se combinan como un contador
+ * binario: cada subarbol completo se une con el anterior de la misma
+ * altura, y al final los subarboles que quedan se unen de derecha a
+ * izquierda. Una hoja sin pareja sube sin cambios.
+ *
+ * La raiz sola no sirve de nombre: es el SHA-256 de 0x00 y la hoja, o de
+ * 0x01 y dos hashes, y un archivo pequeno con esos bytes tendria el mismo
+ * nombre que el archivo grande en el directorio de objetos. El nombre es
+ * el hash de 0x02 y la raiz calculado con un valor inicial propio (ver
+ * thash_final): encontrar un contenido cuyo SHA-256 sea ese nombre es
+ * tan dificil como invertir SHA-256.
+ *
+ * El tipo de digest de un contenido nuevo depende solo de su tamano
+ * (THASH_TYPE). Los registros de versions.db guardan el tipo
+ * (VDB_HASH_TREE), porque un archivo grande guardado antes con SHA-256
+ * conserva ese nombre mientras no cambie.
+ */
+
+#ifndef VTHASH_H
+#define VTHASH_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "sha256.h"
+#include "vdb.h"
+
+#define THASH_LEAF (1 << 20) /**< Bytes de una hoja */
+#define THASH_MIN_SIZE ((off_t)64 << 20) /**< Contenidos desde este tamano usan el digest de arbol */
+#define THASH_MAX_HEIGHT 64 /**< Altura maxima del arbol */
+
+/** Tipo de digest (VDB_HASH_*) de un contenido de size bytes */
+#define THASH_TYPE(size) ((off_t)(size) >= THASH_MIN_SIZE ? VDB_HASH_TREE : VDB_HASH_SHA256)
+
+/**
+ * @brief Calculo secuencial de un digest de arbol
+ */
+typedef struct {
+    struct sha256_buff leaf;                        /**< Hoja en curso */
+    size_t leaf_len;                                /**< Bytes de la hoja en curso */
+    uint64_t leaves;                                /**< Hojas terminadas */
+    int top;                                        /**< Subarboles en la pila */
+    uint8_t height[THASH_MAX_HEIGHT];               /**< Altura de cada subarbol */
+    uint8_t stack[THASH_MAX_HEIGHT][DIGEST_SIZE];   /**< Raiz de cada subarbol */
+} thash_state;
+
+/**
+ * @brief Inicia un calculo secuencial.
+ */
+void thash_init(thash_state *t);
+
+/**
+ * @brief Agrega datos al contenido.
+ */
+void thash_update(thash_state *t, const void *data, size_t len);
+
+/**
+ * @brief Termina el calculo.
+ *
+ * @param t Calculo en curso
+ * @param digest Buffer de DIGEST_SIZE bytes para el nombre del contenido
+ */
+void thash_final(thash_state *t, uint8_t *digest);
+
+/**
+ * @brief Calcula el hash de una hoja.
+ *
+ * @param data Contenido de la hoja (a lo sumo THASH_LEAF bytes)
+ * @param len Bytes de la hoja
+ * @param digest Buffer de DIGEST_SIZE bytes
+ */
+void thash_leaf(const void *data, size_t len, uint8_t *digest);
+
+/**
+ * @brief Calcula el digest de arbol de un archivo, con un hilo por
+ * procesador. Las hojas se leen con pread; las que caen completas en un
+ * hueco de un archivo disperso no se leen. Al terminar, el descriptor
+ * queda en la posicion en que estaba.
+ *
+ * @param fd Descriptor del archivo
+ * @param size Bytes del contenido
+ * @param digest Buffer de DIGEST_SIZE bytes
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error de lectura o el
+ * archivo es mas corto que size.
+ */
+int thash_fd(int fd, off_t size, uint8_t *digest);
+
+/**
+ * @brief Copia un archivo mientras calcula su digest de arbol, con una
+ * sola lectura: cada hilo lee una hoja, calcula su hash y la escribe en la
+ * misma posicion de la copia. Los huecos del archivo quedan como huecos
+ * en la copia, que termina con size bytes.
+ *
+ * @param fd Descriptor del archivo
+ * @param size Bytes del contenido
+ * @param dst Descriptor de la copia, abierto para escritura
+ * @param digest Buffer de DIGEST_SIZE bytes
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error o el archivo es mas
+ * corto que size.
+ */
+int thash_copy(int fd, off_t size, int dst, uint8_t *digest);
+
+/**
+ * @brief Calcula el digest de un archivo con el tipo que corresponde a su
+ * tamano: SHA-256 o digest de arbol.
+ *
+ * @param fd Descriptor del archivo, en la posicion 0
+ * @param size Bytes del contenido (st_size)
+ * @param digest Buffer de DIGEST_SIZE bytes
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error de lectura o el
+ * tamano del archivo cambio.
+ */
+int thash_content(int fd, off_t size, uint8_t *digest);
+
+/**
+ * @brief Calcula el digest de un archivo con un tipo dado, por ejemplo el
+ * SHA-256 de un archivo grande guardado antes del digest de arbol.
+ *
+ * @param fd Descriptor del archivo, en la posicion 0
+ * @param size Bytes del contenido (st_size)
+ * @param type VDB_HASH_SHA256 o VDB_HASH_TREE
+ * @param digest Buffer de DIGEST_SIZE bytes
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error de lectura o el
+ * tamano del archivo cambio.
+ */
+int thash_content_type(int fd, off_t size, int type, uint8_t *digest);
+
+#endif
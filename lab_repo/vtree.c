@@ -0,0 +1,351 @@
+/**
+ * @file
+ * @brief Implementacion de los arboles y commits
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ */
+
+#include "vtree.h"
+
+#define TREE_MAGIC 0x45525456 /**< "VTRE" en little endian */
+#define COMMIT_MAGIC 0x544d4356 /**< "VCMT" en little endian */
+#define TREE_FORMAT 1 /**< Version del formato de arboles y commits */
+
+/**
+ * @brief Encabezado de un arbol
+ */
+typedef struct {
+    uint32_t magic;  /**< TREE_MAGIC */
+    uint32_t format; /**< TREE_FORMAT */
+    uint64_t count;  /**< Numero de entradas */
+} tree_header;
+
+/**
+ * @brief Entrada de un arbol guardado, seguida del nombre terminado en NULL
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t kind;                /**< TREE_FILE o TREE_DIR */
+    uint8_t reserved;            /**< Sin uso */
+    uint16_t name_len;           /**< Longitud del nombre, sin el NULL */
+    uint8_t digest[DIGEST_SIZE]; /**< Digest del archivo o del arbol */
+} tree_record;
+
+/**
+ * @brief Commit guardado
+ */
+typedef struct {
+    uint32_t magic;              /**< COMMIT_MAGIC */
+    uint32_t format;             /**< TREE_FORMAT */
+    int64_t time;                /**< Fecha del commit */
+    uint8_t tree[DIGEST_SIZE];   /**< Arbol del directorio */
+    uint8_t parent[DIGEST_SIZE]; /**< Commit anterior, en ceros si no hay */
+} commit_record;
+
+/**
+ * @brief Buffer dinamico en el que se construye un arbol
+ */
+typedef struct {
+    uint8_t *data;   /**< Contenido */
+    size_t len;      /**< Bytes usados */
+    size_t capacity; /**< Bytes reservados */
+} tree_buffer;
+
+/**
+ * @brief Guarda un objeto con el hash de su contenido como nombre.
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int store(const void *data, size_t len, int compress, uint8_t *digest) {
+    char hash[2 * DIGEST_SIZE + 1];
+
+    sha256_hash(data, len, digest);
+    digest_to_hex(digest, hash);
+    return object_store_buffer(hash, data, len, compress) == VERSION_ERROR ? -1 : 0;
+}
+
+/**
+ * @brief Lee un objeto completo en memoria.
+ * @return Contenido reservado con malloc, NULL si ocurre un error.
+ */
+static uint8_t *load(const uint8_t *digest, size_t *len) {
+    char hash[2 * DIGEST_SIZE + 1];
+    struct stat s;
+    uint8_t *data = NULL;
+    size_t done = 0;
+    ssize_t n = 0;
+    int fd;
+
+    digest_to_hex(digest, hash);
+    if ((fd = object_open(hash)) < 0) return NULL;
+    if (fstat(fd, &s) == 0 && (data = malloc(s.st_size + 1)) != NULL) {
+        while (done < (size_t)s.st_size && (n = read(fd, data + done, s.st_size - done)) > 0) done += n;
+        if (done < (size_t)s.st_size) {
+            free(data);
+            data = NULL;
+        }
+    }
+    close(fd);
+    *len = done;
+    return data;
+}
+
+static int append(tree_buffer *b, const void *data, size_t len) {
+    if (b->len + len > b->capacity) {
+        size_t capacity = b->capacity ? b->capacity : 4096;
+        uint8_t *grown;
+
+        while (b->len + len > capacity) capacity *= 2;
+        if ((grown = realloc(b->data, capacity)) == NULL) return -1;
+        b->data = grown;
+        b->capacity = capacity;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return 0;
+}
+
+static int append_entry(tree_buffer *b, int kind, const char *name, size_t name_len, const uint8_t *digest) {
+    tree_record r;
+
+    if (name_len == 0 || name_len > UINT16_MAX) return -1;
+    r.kind = kind;
+    r.reserved = 0;
+    r.name_len = name_len;
+    memcpy(r.digest, digest, DIGEST_SIZE);
+    return append(b, &r, sizeof r) == 0 && append(b, name, name_len) == 0 && append(b, "", 1) == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Guarda el arbol de los archivos [start, end), que comparten los
+ * primeros prefix bytes de su ruta (el directorio y la "/").
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+static int build(char **paths, uint8_t (*digests)[DIGEST_SIZE], size_t start, size_t end, size_t prefix,
+                 int compress, uint8_t *digest) {
+    tree_buffer b = {NULL, 0, 0};
+    tree_header h = {TREE_MAGIC, TREE_FORMAT, 0};
+    uint8_t sub[DIGEST_SIZE];
+    size_t i = start, j, dir_len;
+    int ok;
+
+    ok = append(&b, &h, sizeof h) == 0;
+    while (ok && i < end) {
+        const char *name = paths[i] + prefix;
+        const char *slash = strchr(name, '/');
+
+        if (slash == NULL) {
+            ok = append_entry(&b, TREE_FILE, name, strlen(name), digests[i]) == 0;
+            i++;
+        } else {
+            // Las rutas del subdirectorio son contiguas en el orden de strcmp
+            dir_len = slash - name;
+            for (j = i + 1; j < end && strncmp(paths[j] + prefix, name, dir_len + 1) == 0; j++);
+            ok = build(paths, digests, i, j, prefix + dir_len + 1, compress, sub) == 0
+                && append_entry(&b, TREE_DIR, name, dir_len, sub) == 0;
+            i = j;
+        }
+        h.count++;
+    }
+
+    if (ok) {
+        memcpy(b.data, &h, sizeof h);
+        ok = store(b.data, b.len, compress, digest) == 0;
+    }
+    free(b.data);
+    return ok ? 0 : -1;
+}
+
+int tree_build(char **paths, uint8_t (*digests)[DIGEST_SIZE], size_t count, int compress, uint8_t *digest) {
+    return build(paths, digests, 0, count, 0, compress, digest);
+}
+
+int tree_read(const uint8_t *digest, tree *t) {
+    const tree_header *h;
+    size_t len, offset, i;
+
+    memset(t, 0, sizeof *t);
+    if ((t->data = load(digest, &len)) == NULL) return -1;
+    h = (const tree_header *)t->data;
+    if (len < sizeof *h || h->magic != TREE_MAGIC || h->format != TREE_FORMAT
+            || h->count > (len - sizeof *h) / sizeof(tree_record)
+            || (t->entries = malloc((h->count + 1) * sizeof *t->entries)) == NULL) {
+        tree_free(t);
+        return -1;
+    }
+
+    for (i = 0, offset = sizeof *h; i < h->count; i++) {
+        const tree_record *r = (const tree_record *)(t->data + offset);
+
+        if (offset + sizeof *r > len || offset + sizeof *r + r->name_len + 1 > len
+                || (r->kind != TREE_FILE && r->kind != TREE_DIR) || r->name_len == 0
+                || t->data[offset + sizeof *r + r->name_len] != 0) {
+            tree_free(t);
+            return -1;
+        }
+        t->entries[i].kind = r->kind;
+        t->entries[i].name = (const char *)(r + 1);
+        t->entries[i].name_len = r->name_len;
+        t->entries[i].digest = r->digest;
+        offset += sizeof *r + r->name_len + 1;
+    }
+    t->count = h->count;
+    return 0;
+}
+
+void tree_free(tree *t) {
+    free(t->entries);
+    free(t->data);
+    memset(t, 0, sizeof *t);
+}
+
+/**
+ * @brief Une el directorio y el nombre de una entrada.
+ * @return 0 en caso de exito, -1 si la ruta es demasiado larga.
+ */
+static int join(char *path, const char *prefix, const char *name) {
+    int len = prefix[0] ? snprintf(path, PATH_MAX, "%s/%s", prefix, name) : snprintf(path, PATH_MAX, "%s", name);
+    return len < PATH_MAX ? 0 : -1;
+}
+
+/**
+ * @brief Recorre el arbol de un directorio.
+ * @return 0, 1 si visit detuvo el recorrido, -1 si ocurre un error.
+ */
+static int walk(const uint8_t *digest, const char *prefix, tree_visitor visit, void *ctx) {
+    char path[PATH_MAX];
+    tree t;
+    size_t i;
+    int result = 0;
+
+    if (tree_read(digest, &t) < 0) return -1;
+    for (i = 0; result == 0 && i < t.count; i++) {
+        if (join(path, prefix, t.entries[i].name) < 0) result = -1;
+        else if (visit(ctx, path, t.entries[i].kind, t.entries[i].digest) != 0) result = 1;
+        else if (t.entries[i].kind == TREE_DIR) result = walk(t.entries[i].digest, path, visit, ctx);
+    }
+    tree_free(&t);
+    return result;
+}
+
+int tree_walk(const uint8_t *digest, tree_visitor visit, void *ctx) {
+    return walk(digest, "", visit, ctx);
+}
+
+/**
+ * @brief Compara dos entradas en el orden en que se guardan: el de las
+ * rutas completas, en el que un directorio se ordena como "nombre/".
+ */
+static int compare_entries(const tree_entry *a, const tree_entry *b) {
+    size_t len = a->name_len < b->name_len ? a->name_len : b->name_len;
+    int cmp = memcmp(a->name, b->name, len);
+    unsigned char ca, cb;
+
+    if (cmp != 0) return cmp;
+    ca = len < a->name_len ? a->name[len] : a->kind == TREE_DIR ? '/' : 0;
+    cb = len < b->name_len ? b->name[len] : b->kind == TREE_DIR ? '/' : 0;
+    return ca - cb;
+}
+
+/**
+ * @brief Contexto para reportar todos los archivos de un subdirectorio
+ * adicionado o borrado.
+ */
+typedef struct {
+    char status;                  /**< 'A' o 'D' */
+    tree_change_visitor visit;    /**< Funcion de la comparacion */
+    void *ctx;                    /**< Contexto de la comparacion */
+} whole_change;
+
+static int report_file(void *ctx, const char *path, int kind, const uint8_t *digest) {
+    whole_change *w = ctx;
+    return kind == TREE_FILE ? w->visit(w->ctx, w->status, path, digest) : 0;
+}
+
+/**
+ * @brief Reporta una entrada adicionada o borrada; si es un directorio,
+ * cada uno de sus archivos.
+ */
+static int report_entry(const tree_entry *e, char status, const char *path, tree_change_visitor visit, void *ctx) {
+    whole_change w = {status, visit, ctx};
+
+    if (e->kind == TREE_FILE) return visit(ctx, status, path, e->digest) != 0 ? 1 : 0;
+    return walk(e->digest, path, report_file, &w);
+}
+
+/**
+ * @brief Compara los arboles de un directorio.
+ * @return 0, 1 si visit detuvo la comparacion, -1 si ocurre un error.
+ */
+static int diff(const uint8_t *old, const uint8_t *new, const char *prefix, tree_change_visitor visit, void *ctx) {
+    char path[PATH_MAX];
+    tree a = {NULL, NULL, 0}, b;
+    size_t i = 0, j = 0;
+    int result = 0, cmp;
+
+    if ((old != NULL && tree_read(old, &a) < 0) || tree_read(new, &b) < 0) {
+        tree_free(&a);
+        return -1;
+    }
+
+    while (result == 0 && (i < a.count || j < b.count)) {
+        const tree_entry *x = i < a.count ? &a.entries[i] : NULL;
+        const tree_entry *y = j < b.count ? &b.entries[j] : NULL;
+
+        cmp = x == NULL ? 1 : y == NULL ? -1 : compare_entries(x, y);
+        if (join(path, prefix, cmp <= 0 ? x->name : y->name) < 0) {
+            result = -1;
+        } else if (cmp < 0) {
+            result = report_entry(x, 'D', path, visit, ctx);
+            i++;
+        } else if (cmp > 0) {
+            result = report_entry(y, 'A', path, visit, ctx);
+            j++;
+        } else {
+            // Un archivo o subdirectorio con el mismo digest no cambio
+            if (memcmp(x->digest, y->digest, DIGEST_SIZE) != 0) {
+                if (x->kind == TREE_DIR) result = diff(x->digest, y->digest, path, visit, ctx);
+                else result = visit(ctx, 'M', path, y->digest) != 0 ? 1 : 0;
+            }
+            i++;
+            j++;
+        }
+    }
+
+    tree_free(&a);
+    tree_free(&b);
+    return result;
+}
+
+int tree_diff(const uint8_t *old, const uint8_t *new, tree_change_visitor visit, void *ctx) {
+    return diff(old, new, "", visit, ctx);
+}
+
+int commit_write(const commit_info *c, int compress, uint8_t *digest) {
+    commit_record r;
+
+    memset(&r, 0, sizeof r);
+    r.magic = COMMIT_MAGIC;
+    r.format = TREE_FORMAT;
+    r.time = c->time;
+    memcpy(r.tree, c->tree, DIGEST_SIZE);
+    if (c->has_parent) memcpy(r.parent, c->parent, DIGEST_SIZE);
+    return store(&r, sizeof r, compress, digest);
+}
+
+int commit_read(const uint8_t *digest, commit_info *c) {
+    static const uint8_t zero[DIGEST_SIZE];
+    commit_record *r;
+    size_t len;
+    int ok;
+
+    if ((r = (commit_record *)load(digest, &len)) == NULL) return -1;
+    ok = len == sizeof *r && r->magic == COMMIT_MAGIC && r->format == TREE_FORMAT;
+    if (ok) {
+        c->time = r->time;
+        memcpy(c->tree, r->tree, DIGEST_SIZE);
+        memcpy(c->parent, r->parent, DIGEST_SIZE);
+        c->has_parent = memcmp(r->parent, zero, DIGEST_SIZE) != 0;
+    }
+    free(r);
+    return ok ? 0 : -1;
+}
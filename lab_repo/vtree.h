@@ -0,0 +1,164 @@
+/**
+ * @file
+ * @brief Arboles y commits de las instantaneas del repositorio
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * Una instantanea (commit) guarda el estado de todo el directorio con un
+ * solo registro en versions.db. El registro apunta a un objeto commit,
+ * que apunta al arbol del directorio y al commit anterior.
+ *
+ * Un arbol es un objeto con la lista ordenada de las entradas de un
+ * directorio: nombre, tipo (archivo o subdirectorio) y digest. El digest
+ * de un subdirectorio es el de su propio arbol, por lo que un
+ * subdirectorio sin cambios tiene el mismo digest en todos los commits y
+ * su arbol se guarda una sola vez. Por la misma razon, dos arboles se
+ * comparan sin recorrer los subdirectorios con el mismo digest: comparar
+ * dos commits cuesta en proporcion a los archivos que cambiaron.
+ *
+ * Los arboles y commits son objetos comunes (ver vobject.h): se nombran
+ * por el hash de su contenido, se pueden comprimir y agrupar en paquetes.
+ */
+
+#ifndef VTREE_H
+#define VTREE_H
+
+#include "vobject.h"
+#include "vdb.h"
+
+#define TREE_FILE 1 /**< Entrada de un archivo */
+#define TREE_DIR 2 /**< Entrada de un subdirectorio */
+
+/**
+ * @brief Entrada de un arbol
+ */
+typedef struct {
+    int kind;              /**< TREE_FILE o TREE_DIR */
+    const char *name;      /**< Nombre, terminado en NULL */
+    size_t name_len;       /**< Longitud del nombre */
+    const uint8_t *digest; /**< Digest del archivo o del arbol del subdirectorio */
+} tree_entry;
+
+/**
+ * @brief Arbol leido del repositorio
+ */
+typedef struct {
+    uint8_t *data;        /**< Contenido del objeto */
+    tree_entry *entries;  /**< Entradas, en orden */
+    size_t count;         /**< Numero de entradas */
+} tree;
+
+/**
+ * @brief Commit: estado del directorio en un momento
+ */
+typedef struct {
+    int64_t time;                  /**< Fecha del commit (segundos desde 1970) */
+    uint8_t tree[DIGEST_SIZE];     /**< Digest del arbol del directorio */
+    uint8_t parent[DIGEST_SIZE];   /**< Digest del commit anterior */
+    int has_parent;                /**< 0 para el primer commit */
+} commit_info;
+
+/**
+ * @brief Recibe cada archivo o directorio al recorrer un arbol.
+ *
+ * @param ctx Contexto del recorrido
+ * @param path Ruta relativa a la raiz del arbol
+ * @param kind TREE_FILE o TREE_DIR (el directorio se visita antes de su
+ * contenido)
+ * @param digest Digest del archivo o del arbol
+ *
+ * @return 0 para continuar, otro valor para detener el recorrido.
+ */
+typedef int (*tree_visitor)(void *ctx, const char *path, int kind, const uint8_t *digest);
+
+/**
+ * @brief Recibe cada archivo que cambio entre dos arboles.
+ *
+ * @param ctx Contexto de la comparacion
+ * @param status 'A' adicionado, 'M' modificado o 'D' borrado
+ * @param path Ruta relativa a la raiz del arbol
+ * @param digest Digest del archivo nuevo (del borrado si status es 'D')
+ *
+ * @return 0 para continuar, otro valor para detener la comparacion.
+ */
+typedef int (*tree_change_visitor)(void *ctx, char status, const char *path, const uint8_t *digest);
+
+/**
+ * @brief Guarda los arboles de una lista de archivos.
+ *
+ * @param paths Rutas de los archivos, ordenadas con strcmp y sin repetir
+ * @param digests Digest de cada archivo
+ * @param count Numero de archivos
+ * @param compress 1 para comprimir los arboles nuevos
+ * @param digest Digest del arbol de la raiz
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+int tree_build(char **paths, uint8_t (*digests)[DIGEST_SIZE], size_t count, int compress, uint8_t *digest);
+
+/**
+ * @brief Lee un arbol.
+ *
+ * @param digest Digest del arbol
+ * @param t Arbol leido; se libera con tree_free
+ *
+ * @return 0 en caso de exito, -1 si el objeto no es un arbol valido.
+ */
+int tree_read(const uint8_t *digest, tree *t);
+
+/**
+ * @brief Libera un arbol leido.
+ *
+ * @param t Arbol
+ */
+void tree_free(tree *t);
+
+/**
+ * @brief Recorre un arbol y sus subdirectorios en orden.
+ *
+ * @param digest Digest del arbol
+ * @param visit Funcion que recibe cada entrada
+ * @param ctx Contexto de visit
+ *
+ * @return 0 en caso de exito, 1 si visit detuvo el recorrido, -1 si algun
+ * arbol no se puede leer.
+ */
+int tree_walk(const uint8_t *digest, tree_visitor visit, void *ctx);
+
+/**
+ * @brief Compara dos arboles. Los subdirectorios con el mismo digest no se
+ * recorren.
+ *
+ * @param old Digest del arbol anterior, NULL si no hay (todo es nuevo)
+ * @param new Digest del arbol nuevo
+ * @param visit Funcion que recibe cada archivo que cambio
+ * @param ctx Contexto de visit
+ *
+ * @return 0 en caso de exito, 1 si visit detuvo la comparacion, -1 si
+ * algun arbol no se puede leer.
+ */
+int tree_diff(const uint8_t *old, const uint8_t *new, tree_change_visitor visit, void *ctx);
+
+/**
+ * @brief Guarda un commit.
+ *
+ * @param c Commit
+ * @param compress 1 para comprimir el objeto
+ * @param digest Digest del commit
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+int commit_write(const commit_info *c, int compress, uint8_t *digest);
+
+/**
+ * @brief Lee un commit.
+ *
+ * @param digest Digest del commit
+ * @param c Commit leido
+ *
+ * @return 0 en caso de exito, -1 si el objeto no es un commit valido.
+ */
+int commit_read(const uint8_t *digest, commit_info *c);
+
+#endif
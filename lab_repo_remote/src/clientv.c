@@ -80,7 +80,7 @@ pres_code client_get(int s, char *filename, int version) {
     cres_code cres;
     ssize_t sent, received;
     char server_hash[HASH_SIZE];
-    char local_hash[HASH_SIZE];
+    uint8_t server_digest[DIGEST_SIZE], local_digest[DIGEST_SIZE];
     char buf[BUFSZ];
 
     // 1. Enviar el método
@@ -105,10 +105,12 @@ pres_code client_get(int s, char *filename, int version) {
     // 4. Recibe el hash de la versión
     received = read(s, server_hash, HASH_SIZE);
     if (received != HASH_SIZE) return RSOCKET_ERROR;
+    server_hash[HASH_SIZE - 1] = 0;
 
     // 5. responde si el archivo local ya esta actualizado
-    cres = get_file_hash(filename, local_hash) != NULL &&
-                   EQUALS(server_hash, local_hash)
+    cres = hex_to_digest(server_hash, server_digest) == 0 &&
+                   get_file_digest(filename, local_digest) != NULL &&
+                   digest_equals(server_digest, local_digest)
                ? DENY
                : CONFIRM;
     sent = write(s, &cres, sizeof(cres_code));
@@ -133,6 +135,7 @@ pres_code client_list(int s, char *filename) {
     pres_code rserver;
     cres_code rclient;
     file_version v;
+    char hash[HASH_SIZE];
     char buf[BUFSZ];
     ssize_t received;
     ssize_t to_receive;
@@ -170,8 +173,9 @@ pres_code client_list(int s, char *filename) {
             return RSOCKET_ERROR;
         if (receive_string(s, v.filename, sizeof(v.filename)) == -1)
             return RSOCKET_ERROR;
-        if (receive_string(s, v.hash, sizeof(v.hash)) == -1)
+        if (receive_string(s, hash, sizeof(hash)) == -1)
             return RSOCKET_ERROR;
+        if (hex_to_digest(hash, v.digest) < 0) return RERROR;
 
         if (filename != NULL) {
             printf("%i ", ++counter);
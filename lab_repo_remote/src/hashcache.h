@@ -0,0 +1,85 @@
+/**
+ * @file
+ * @brief Cache persistente de hashes indexada por el estado de los archivos
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * Guarda el ultimo hash calculado de cada archivo junto con su firma
+ * (dispositivo, inodo, tamano, mtime y ctime en nanosegundos). Mientras la
+ * firma no cambie, el hash se obtiene de la cache sin leer el archivo.
+ *
+ * Como en el indice de git, una entrada cuyo mtime o ctime cae en el mismo
+ * segundo (o despues) del momento en que se calculo el hash es "racy": el
+ * archivo pudo cambiar sin que cambiara su firma, por lo que se vuelve a
+ * calcular el hash.
+ */
+
+#ifndef HASHCACHE_H
+#define HASHCACHE_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Abre (o crea) la cache.
+ * Llamadas posteriores no tienen efecto.
+ *
+ * @param path Ruta del archivo de la cache
+ *
+ * @return 0 en caso de exito, -1 si la cache no esta disponible.
+ */
+int hashcache_open(const char *path);
+
+/**
+ * @brief Libera la cache.
+ */
+void hashcache_close(void);
+
+/**
+ * @brief Busca el hash de un archivo por su firma.
+ *
+ * @param s Estado actual del archivo
+ * @param digest Buffer para el digest binario (32 bytes)
+ *
+ * @return 0 si la entrada es valida, -1 si se debe calcular el hash.
+ */
+int hashcache_lookup(const struct stat *s, uint8_t *digest);
+
+/**
+ * @brief Guarda el hash de un archivo.
+ *
+ * @param s Estado del archivo antes de leerlo
+ * @param digest Digest binario (32 bytes)
+ * @param hashed_at Momento (hashcache_now) en que se empezo a leer el archivo
+ */
+void hashcache_store(const struct stat *s, const uint8_t *digest, int64_t hashed_at);
+
+/**
+ * @brief Hora actual en nanosegundos.
+ */
+int64_t hashcache_now(void);
+
+/**
+ * @brief Obtiene el digest binario de un archivo regular, usando la cache
+ * si esta abierta.
+ *
+ * @param filename Nombre del archivo
+ * @param digest Buffer para el digest binario (32 bytes)
+ *
+ * @return Referencia al buffer, NULL si ocurre un error.
+ */
+uint8_t *hashcache_file_digest(const char *filename, uint8_t *digest);
+
+/**
+ * @brief Obtiene el hash de un archivo regular, usando la cache si esta
+ * abierta.
+ *
+ * @param filename Nombre del archivo
+ * @param hash Buffer para el hash en hexadecimal (65 bytes)
+ *
+ * @return Referencia al buffer, NULL si ocurre un error.
+ */
+char *hashcache_file_hash(const char *filename, char *hash);
+
+#endif
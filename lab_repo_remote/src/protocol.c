@@ -6,8 +6,10 @@
  * @copyright MIT License
  */
 #include "protocol.h"
+#include "vlz.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <linux/limits.h>
 #include <stdio.h>
 #include <string.h>
@@ -92,6 +94,48 @@ int send_file(int s, char *filename) {
     return 0;
 }
 
+/**
+ * @brief Receptor de lz_decode que envia los datos al socket
+ */
+static int sink_socket(void *ctx, const void *data, size_t len) {
+    int s = *(int *)ctx;
+    const char *ptr = data;
+
+    while (len > 0) {
+        ssize_t sent = send(s, ptr, len, 0);
+        if (sent == -1) return -1;
+        ptr += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+int send_compressed_file(int s, char *filename) {
+    content_size file_size;
+    int64_t size;
+    int fd, result;
+
+    // 0. Consulta el tamaño original en el encabezado del flujo
+    if ((fd = open(filename, O_RDONLY)) == -1) return -1;
+    size = lz_frame_size(fd, 0);
+    if (size < 0 || size > content_max) {
+        close(fd);
+        return -1;
+    }
+    file_size = (content_size)size;
+
+    // 1. Envia el tamaño del archivo
+    if (write(s, &file_size, sizeof(content_size)) != sizeof(content_size)) {
+        close(fd);
+        return -1;
+    }
+
+    // 2. Envia el contenido a medida que se descomprime
+    result = lz_decode(fd, 0, sink_socket, &s);
+    close(fd);
+    return result;
+}
+
 int receive_file(int s, char *endpath) {
     FILE *fp;
     content_size file_size;
@@ -57,11 +57,12 @@ struct get_request {
 };
 
 /**
- * Estructura de peticion de add
+ * Estructura de peticion de add. El digest viaja en hexadecimal y se
+ * convierte al recibirlo.
  */
 struct add_request {
+    uint8_t digest[DIGEST_SIZE];
     char filename[PATH_MAX];
-    char hash[HASH_SIZE];
     char comment[COMMENT_SIZE];
 };
 
@@ -96,6 +97,17 @@ int receive_greeting(int s, const int greeter);
  */
 int send_file(int s, char *filepath);
 
+/**
+ * @brief Envía el contenido descomprimido de un archivo comprimido (ver
+ * vlz.h). El socket recibe lo mismo que con send_file sobre el archivo
+ * original.
+ *
+ * @param s socket de destino
+ * @param filepath ruta donde se encuentra el archivo comprimido
+ * @return int 0 en caso de exito, -1 en caso de error
+ */
+int send_compressed_file(int s, char *filepath);
+
 /**
  * @brief Recibe un archivo del socket
  *
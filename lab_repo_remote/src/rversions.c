@@ -98,6 +98,10 @@ int main(int argc, char *argv[]) {
             exit(EXIT_FAILURE);
         }
 
+        // Los hashes de los archivos locales se guardan en la cache del
+        // usuario, no en el directorio actual
+        open_client_cache();
+
         server_socket = make_connection(arg_ip, arg_port);
         if (server_socket == -1) {
             perror("Error connecting to server");
@@ -24,6 +24,7 @@
 #include "protocol.h"
 #include "userauth.h"
 #include "versions.h"
+#include "vlz.h"
 
 /**
  * @brief Envia las versiones del repositorio al cliente
@@ -158,34 +159,48 @@ int server_add(int s, user_session *session) {
     pres_code rserver;
     file_version v;
     ssize_t sent;  // bytes recibidos
-    char filename_buf[PATH_MAX], buf[BUFSZ];
+    char filename_buf[PATH_MAX], buf[BUFSZ], hash[HASH_SIZE];
 
-    // 1. recibe la peticion
+    // 1. recibe la peticion; el hash llega en hexadecimal
     memset(&request, 0, sizeof(request));
     if (receive_string(s, request.filename, sizeof(request.filename)) == -1)
         return RSOCKET_ERROR;
-    if (receive_string(s, request.hash, sizeof(request.hash)) == -1)
+    if (receive_string(s, hash, sizeof(hash)) == -1)
         return RSOCKET_ERROR;
     if (receive_string(s, request.comment, sizeof(request.comment)) == -1)
         return RSOCKET_ERROR;
 
     // 2. comprueba si el archivo ya existe
     puts("Comprobando version...");
-    rserver =
-        version_exists(request.filename, request.hash, get_user_versionsdb_path(session, filename_buf)) == VERSION_ALREADY_EXISTS
-            ? RFILE_TO_DATE
-            : RSERVER_OK;
+    if (hex_to_digest(hash, request.digest) < 0) {
+        rserver = RERROR;
+    } else {
+        rserver =
+            version_exists(request.filename, request.digest, get_user_versionsdb_path(session, filename_buf)) == VERSION_ALREADY_EXISTS
+                ? RFILE_TO_DATE
+                : RSERVER_OK;
+    }
 
     // 3. responde indicando si se debe de subir el archivo
     sent = write(s, &rserver, sizeof(pres_code));
     if (sent != sizeof(pres_code)) return -1;
     if (rserver == RFILE_TO_DATE) return 0;
+    if (rserver == RERROR) return -1;
 
-    // 4. recibe el archivo
+    // 4. recibe el archivo; se guarda con el digest en hexadecimal como nombre
     puts("Recibiendo archivo...");
-    snprintf(filename_buf, PATH_MAX, "%s/%s", VERSIONS_DIR, request.hash);
+    digest_to_hex(request.digest, hash);
+    snprintf(filename_buf, PATH_MAX, "%s/%s", VERSIONS_DIR, hash);
     rserver = receive_file(s, filename_buf) == 0 ? RSERVER_OK : RERROR;
 
+    // 4.1 guarda el archivo comprimido si eso ahorra espacio; el protocolo
+    // siempre transfiere el contenido original
+    if (rserver == RSERVER_OK) {
+        char lz_path[PATH_MAX];
+        snprintf(lz_path, PATH_MAX, "%s.z", filename_buf);
+        if (lz_compress_file(filename_buf, lz_path) == 0) unlink(filename_buf);
+    }
+
     // 5. responde indicando si se pudo subir el archivo
     sent = write(s, &rserver, sizeof(pres_code));
     if (sent != sizeof(pres_code)) return -1;
@@ -195,7 +210,7 @@ int server_add(int s, user_session *session) {
     memset(&v, 0, sizeof(file_version));
     strcpy(v.filename, request.filename);
     strcpy(v.comment, request.comment);
-    strcpy(v.hash, request.hash);
+    memcpy(v.digest, request.digest, DIGEST_SIZE);
 
     if (add_new_version(&v, get_user_versionsdb_path(session, filename_buf)) ==
         VERSION_ERROR) {
@@ -214,6 +229,7 @@ int server_get(int s, user_session *session) {
     ssize_t sent;
     file_version v;
     char filepath_buf[PATH_MAX];
+    char hash[HASH_SIZE];
     char buf[BUFSZ];
     int aux;
 
@@ -233,8 +249,10 @@ int server_get(int s, user_session *session) {
     if (sent != sizeof(pres_code)) return -1;
     if (rserver == RFILE_NOT_FOUND) return 0;
 
-    // 4. envía el hash de la versión
-    sent = write(s, v.hash, HASH_SIZE);
+    // 4. envía el hash de la versión, en hexadecimal
+    memset(hash, 0, HASH_SIZE);
+    digest_to_hex(v.digest, hash);
+    sent = write(s, hash, HASH_SIZE);
     if (sent != HASH_SIZE) return -1;
 
     // 5. recibe confirmación del cliente para descargar el archivo
@@ -244,8 +262,13 @@ int server_get(int s, user_session *session) {
 
     // 6. envia el archivo
     puts("Enviando archivo...");
-    snprintf(filepath_buf, PATH_MAX, VERSIONS_DIR "/%s", v.hash);
-    if (send_file(s, filepath_buf) == -1) return -1;
+    snprintf(filepath_buf, PATH_MAX, VERSIONS_DIR "/%s.z", hash);
+    if (access(filepath_buf, F_OK) == 0) {
+        if (send_compressed_file(s, filepath_buf) == -1) return -1;
+    } else {
+        snprintf(filepath_buf, PATH_MAX, VERSIONS_DIR "/%s", hash);
+        if (send_file(s, filepath_buf) == -1) return -1;
+    }
 
     printf("Archivo %s enviado!\n", request.filename);
     return RSERVER_OK;
@@ -276,6 +299,7 @@ int send_versions(int s, char *filename, user_session *session) {
     file_version v;
     int counter;
     char versions_path[PATH_MAX];
+    char hash[HASH_SIZE];
     get_user_versionsdb_path(session, versions_path);
     // Calcula el tamaño de la lista
     fp = fopen(versions_path, "r");
@@ -304,7 +328,8 @@ int send_versions(int s, char *filename, user_session *session) {
         if ((filename[0] == 0 || EQUALS(filename, v.filename))) {
             if (send_string(s, v.comment) == -1) break;
             if (send_string(s, v.filename) == -1) break;
-            if (send_string(s, v.hash) == -1) break;
+            digest_to_hex(v.digest, hash);
+            if (send_string(s, hash) == -1) break;
             counter--;
         }
     }
@@ -340,9 +365,19 @@ int authenticate_session(int s, char *username) {
     if (sent != sizeof(pres_code)) return RSOCKET_ERROR;
 
     if (rcode == RSERVER_OK) {
+        char old_path[PATH_MAX], path[PATH_MAX];
+
         printf("Usuario %s autentificado\n", req.username);
         memset(username, 0, USERNAME_SIZE);
         strcpy(username, req.username);
+
+        // Las versiones guardadas con el formato anterior se migran al
+        // primer inicio de sesion
+        snprintf(old_path, PATH_MAX, USER_DB_V1_FORMAT, username);
+        snprintf(path, PATH_MAX, USER_DB_FORMAT, username);
+        if (upgrade_versions_db(old_path, path) < 0) {
+            fprintf(stderr, "No se pueden migrar las versiones de %s\n", username);
+        }
     }
     return rcode;
 }
@@ -388,7 +423,6 @@ int send_server_response(int s, pres_code response) {
 }
 
 char *get_user_versionsdb_path(user_session *session, char *result) {
-    snprintf(result, PATH_MAX, VERSIONS_DIR "/versions-%s.db",
-             session->username);
+    snprintf(result, PATH_MAX, USER_DB_FORMAT, session->username);
     return result;
 }
\ No newline at end of file
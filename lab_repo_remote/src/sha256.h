@@ -65,6 +65,17 @@ void sha256_hash_hex(const void* data, size_t size, char* hex);
 /* Hashes a file */
 void sha256_hash_file_hex(char * path, char * hex);
 
+/* Name of the block function in use ("sha-ni", "avx2", "ssse3" or "scalar").
+   The fastest one supported by the CPU is selected at startup */
+const char* sha256_kernel(void);
+
+/* Name of the i-th known block function, NULL past the last one */
+const char* sha256_kernel_at(size_t i);
+
+/* Selects a block function by name. Returns 0 on success, -1 if the CPU does not
+   support it */
+int sha256_set_kernel(const char* name);
+
 #ifdef __cplusplus
 }
 
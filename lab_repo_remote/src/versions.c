@@ -8,8 +8,11 @@
  */
 
 #include "versions.h"
+#include "hashcache.h"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <sys/file.h>
 #include <libgen.h>
 #include <stdio.h>
 
@@ -39,7 +42,7 @@ int init_versions() {
 return_code create_version(char *filename, char *comment,
                            file_version *result) {
     struct stat s;
-    char hash[HASH_SIZE];
+    uint8_t digest[DIGEST_SIZE];
 
     // 1. Valida que el archivo exista y sea un archivo regular
     if (stat(filename, &s) < 0 || !S_ISREG(s.st_mode)) {
@@ -47,7 +50,7 @@ return_code create_version(char *filename, char *comment,
     }
 
     // 2. Obtiene el HASH del archivo
-    get_file_hash(filename, hash);
+    if (get_file_digest(filename, digest) == NULL) return VERSION_ERROR;
 
     // Se limpia la estructura
     memset(result, 0, sizeof *result);
@@ -55,7 +58,7 @@ return_code create_version(char *filename, char *comment,
     // Llena todos los atributos de la estructura y retorna VERSION_CREATED
     strcpy(result->filename, filename);
     strcpy(result->comment, comment);
-    strcpy(result->hash, hash);
+    memcpy(result->digest, digest, DIGEST_SIZE);
 
     // En caso de fallar alguna validacion, retorna VERSION_ERROR
 
@@ -63,19 +66,30 @@ return_code create_version(char *filename, char *comment,
 }
 
 return_code add_new_version(file_version *v, char* versions_db_path) {
-    FILE *fp;
-    fp = fopen(versions_db_path, "ab");
-    if (fp == NULL) {
+    struct stat s;
+    int fd, ok;
+
+    fd = open(versions_db_path, O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) {
         return VERSION_ERROR;
     }
-    flockfile(fp);
 
-    // Adiciona un nuevo registro (estructura) al archivo versions.db
-    fwrite(v, sizeof *v, 1, fp);
+    // Un solo escritor a la vez. Un registro incompleto al final (escritura
+    // interrumpida) se descarta antes de adicionar el nuevo
+    if (flock(fd, LOCK_EX) < 0 || fstat(fd, &s) < 0) {
+        close(fd);
+        return VERSION_ERROR;
+    }
+    s.st_size -= s.st_size % sizeof *v;
 
-    funlockfile(fp);
-    fclose(fp);
-    return VERSION_CREATED;
+    // Adiciona un nuevo registro (estructura) al archivo versions.db y lo
+    // sincroniza antes de responder
+    ok = ftruncate(fd, s.st_size) == 0
+        && pwrite(fd, v, sizeof *v, s.st_size) == sizeof *v
+        && fdatasync(fd) == 0;
+
+    close(fd);
+    return ok ? VERSION_CREATED : VERSION_ERROR;
 }
 
 char *get_file_hash(char *filename, char *restrict hash) {
@@ -87,12 +101,101 @@ char *get_file_hash(char *filename, char *restrict hash) {
         return NULL;
     }
     
-    sha256_hash_file_hex(filename, hash);
+    // Solo se lee el archivo si cambio desde la ultima vez (ver
+    // open_client_cache)
+    return hashcache_file_hash(filename, hash);
+}
 
-    return hash;
+uint8_t *get_file_digest(char *filename, uint8_t *digest) {
+    // La cache guarda el digest binario: no se convierte a hexadecimal
+    return hashcache_file_digest(filename, digest);
+}
+
+int open_client_cache(void) {
+    char path[PATH_MAX];
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int len;
+
+    // Solo se crean los directorios que faltan; ~/.cache es del usuario
+    if (base != NULL && base[0] == '/') {
+        len = snprintf(path, sizeof path, "%s", base);
+    } else if (home != NULL && home[0] != 0) {
+        len = snprintf(path, sizeof path, "%s/.cache", home);
+        if (len < (int)sizeof path) mkdir(path, 0700);
+    } else {
+        return -1;
+    }
+    len += snprintf(path + len, sizeof path - len, "/" HASHCACHE_DIR);
+    if (len >= (int)sizeof path || (mkdir(path, 0700) < 0 && errno != EEXIST)) return -1;
+    if (snprintf(path + len, sizeof path - len, "/" HASHCACHE_FILE) >= (int)sizeof path - len) return -1;
+    return hashcache_open(path);
+}
+
+void digest_to_hex(const uint8_t *digest, char *hex) {
+    static const char lut[] = "0123456789abcdef";
+    int i;
+
+    for (i = 0; i < DIGEST_SIZE; i++) {
+        hex[2 * i] = lut[digest[i] >> 4];
+        hex[2 * i + 1] = lut[digest[i] & 15];
+    }
+    hex[2 * DIGEST_SIZE] = 0;
 }
 
-int version_exists(char *filename, char *hash, char* versions_db_path) {
+int hex_to_digest(const char *hex, uint8_t *digest) {
+    int i;
+
+    for (i = 0; i < 2 * DIGEST_SIZE; i++) {
+        char c = hex[i];
+        int nibble;
+
+        if (c >= '0' && c <= '9') nibble = c - '0';
+        else if (c >= 'a' && c <= 'f') nibble = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') nibble = c - 'A' + 10;
+        else return -1;
+
+        if (i % 2 == 0) digest[i / 2] = nibble << 4;
+        else digest[i / 2] |= nibble;
+    }
+    return hex[2 * DIGEST_SIZE] == 0 ? 0 : -1;
+}
+
+int upgrade_versions_db(const char *old_path, const char *path) {
+    char tmp_path[PATH_MAX];
+    file_version_v1 old;
+    file_version v;
+    FILE *src, *dst;
+    int ok = 1;
+
+    if (access(path, F_OK) == 0 || (src = fopen(old_path, "rb")) == NULL) return 0;
+
+    // La base de datos nueva se escribe aparte y reemplaza a la anterior
+    // con rename: una migracion interrumpida no pierde datos
+    snprintf(tmp_path, PATH_MAX, "%s.tmp", path);
+    if ((dst = fopen(tmp_path, "wb")) == NULL) {
+        fclose(src);
+        return -1;
+    }
+    while (ok && fread(&old, sizeof old, 1, src) == 1) {
+        memset(&v, 0, sizeof v);
+        memcpy(v.filename, old.filename, PATH_MAX - 1);
+        memcpy(v.comment, old.comment, COMMENT_SIZE - 1);
+        ok = hex_to_digest(old.hash, v.digest) == 0 && fwrite(&v, sizeof v, 1, dst) == 1;
+    }
+    ok = ok && !ferror(src) && fflush(dst) == 0 && fsync(fileno(dst)) == 0;
+    fclose(src);
+    if (fclose(dst) != 0) ok = 0;
+
+    if (!ok || rename(tmp_path, path) < 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    unlink(old_path);
+    return 0;
+}
+
+int version_exists(char *filename, const uint8_t *digest, char* versions_db_path) {
     FILE *fp;
     ssize_t nread;
     file_version v;
@@ -100,9 +203,11 @@ int version_exists(char *filename, char *hash, char* versions_db_path) {
     // abrimos el archivo de versiones para leer el contenido
     if ((fp = fopen(versions_db_path, "r")) == NULL) return -1;
 
+    // El digest va primero en cada registro: casi todos se descartan sin
+    // comparar el nombre
     flockfile(fp);
     while (nread = fread(&v, sizeof v, 1, fp), nread > 0) {
-        if (EQUALS(filename, v.filename) && EQUALS(hash, v.hash)) {
+        if (digest_equals(digest, v.digest) && EQUALS(filename, v.filename)) {
             funlockfile(fp);
             fclose(fp);
             return VERSION_ALREADY_EXISTS;
@@ -133,7 +238,9 @@ int get_version(file_version *v, char *filename, int version, char* versions_db_
 }
 
 void print_version(const file_version *v) {
-    int hash_length = strlen(v->hash);
-    printf("%s %.3s...%.3s %s\n", v->filename, v->hash,
-           (v->hash + hash_length - 3), v->comment);
+    char hash[HASH_SIZE];
+
+    digest_to_hex(v->digest, hash);
+    printf("%s %.3s...%.3s %s\n", v->filename, hash,
+           (hash + 2 * DIGEST_SIZE - 3), v->comment);
 }
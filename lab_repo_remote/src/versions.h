@@ -17,12 +17,18 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "sha256.h"
 
@@ -30,6 +36,8 @@
 #define COMMENT_SIZE 80
 /** Longitud del hash incluyendo NULL*/
 #define HASH_SIZE 256
+/** Longitud del digest binario */
+#define DIGEST_SIZE 32
 /* TAmaño de leida de un archivo */
 #define READ_CHUNK PATH_MAX
 /** Nombre de la base de datos de versiones. */
@@ -38,21 +46,40 @@
 #define VERSIONS_DIR "files"
 /** Ruta completa de la base de datos.*/
 #define VERSIONS_DB_PATH VERSIONS_DIR "/" VERSIONS_DB
+/** Formato de la base de datos de un usuario del formato anterior (hash en hexadecimal). */
+#define USER_DB_V1_FORMAT VERSIONS_DIR "/versions-%s.db"
+/** Formato de la base de datos de un usuario. */
+#define USER_DB_FORMAT VERSIONS_DIR "/versions-%s.vdb"
+/** Directorio de la cache de hashes del cliente, dentro de $XDG_CACHE_HOME o ~/.cache. */
+#define HASHCACHE_DIR "versions"
+/** Archivo de la cache de hashes de los archivos locales del cliente. */
+#define HASHCACHE_FILE "hashcache"
 /** Verdadero si dos cadenas son iguales.*/
 #define EQUALS(s1, s2) (strcmp(s1, s2) == 0)
 
 /**
  * @brief Version de un archivo.
  * Para cada version de un archivo se almacena el nombre original,
- * el comentario del usuario y el hash de su contenido.
- * El hash es a la vez el nombre del archivo dentro del
- * repositorio.
+ * el comentario del usuario y el digest binario de su contenido.
+ * El digest en hexadecimal es a la vez el nombre del archivo dentro del
+ * repositorio y la forma en que viaja en el protocolo; solo se convierte
+ * en esos bordes.
+ */
+typedef struct {
+    uint8_t digest[DIGEST_SIZE]; /**< Digest del contenido del archivo. */
+    char filename[PATH_MAX];     /**< Nombre del archivo original. */
+    char comment[COMMENT_SIZE];  /**< Comentario del usuario. */
+} file_version;
+
+/**
+ * @brief Version de un archivo en el formato anterior, con el hash en
+ * hexadecimal. Solo se usa para migrar las bases de datos existentes.
  */
 typedef struct __attribute__((aligned(512))) {
     char filename[PATH_MAX];    /**< Nombre del archivo original. */
     char hash[HASH_SIZE];       /**< Hash del contenido del archivo. */
     char comment[COMMENT_SIZE]; /**< Comentario del usuario. */
-} file_version;
+} file_version_v1;
 
 /**
  * @brief Codigo de retorno de operacion
@@ -73,11 +100,21 @@ typedef enum {
  */
 int init_versions();
 
+/**
+ * @brief Migra la base de datos de un usuario del formato anterior. Si
+ * la base de datos nueva ya existe o no hay una anterior, no hace nada.
+ *
+ * @param old_path Ruta de la base de datos anterior
+ * @param path Ruta de la base de datos nueva
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+int upgrade_versions_db(const char *old_path, const char *path);
+
 /**
  * @brief Crea una version en memoria del archivo
  * Valida si el archivo especificado existe y crea su hash
  * @param filename Nombre del archivo
- * @param hash Hash del contenido del archivo
  * @param comment Comentario
  * @param result Nueva version en memoria
  *
@@ -95,6 +132,17 @@ return_code create_version(char *filename, char *comment, file_version *result);
  */
 return_code add_new_version(file_version *v, char* versions_db_path);
 
+/**
+ * @brief Abre la cache de hashes del cliente, propia del usuario:
+ * $XDG_CACHE_HOME/versions/hashcache, o ~/.cache/versions/hashcache. La
+ * cache se indexa por dispositivo e inodo, por lo que sirve en cualquier
+ * directorio en que se ejecute el cliente. Sin cache, los hashes se
+ * calculan leyendo los archivos.
+ *
+ * @return 0 en caso de exito, -1 si la cache no esta disponible.
+ */
+int open_client_cache(void);
+
 /**
  * @brief Obtiene el hash de un archivo.
  * @param filename Nombre del archivo a obtener el hash
@@ -103,6 +151,54 @@ return_code add_new_version(file_version *v, char* versions_db_path);
  */
 char *get_file_hash(char *filename, char *hash);
 
+/**
+ * @brief Obtiene el digest binario de un archivo.
+ * @param filename Nombre del archivo a obtener el digest
+ * @param digest Buffer para almacenar el digest (DIGEST_SIZE)
+ * @return Referencia al buffer, NULL si ocurre error
+ */
+uint8_t *get_file_digest(char *filename, uint8_t *digest);
+
+/**
+ * @brief Convierte un digest binario a hexadecimal.
+ *
+ * @param digest Digest de DIGEST_SIZE bytes
+ * @param hex Buffer de al menos 2 * DIGEST_SIZE + 1 bytes
+ */
+void digest_to_hex(const uint8_t *digest, char *hex);
+
+/**
+ * @brief Convierte un hash hexadecimal a binario.
+ *
+ * @param hex Hash de 2 * DIGEST_SIZE caracteres
+ * @param digest Buffer de DIGEST_SIZE bytes
+ *
+ * @return 0 en caso de exito, -1 si el hash no es valido.
+ */
+int hex_to_digest(const char *hex, uint8_t *digest);
+
+/**
+ * @brief Compara dos digests con cargas de ancho fijo (una de 256 bits
+ * con AVX2, dos de 128 bits con SSE2), sin recorrerlos byte a byte.
+ *
+ * @return 1 si son iguales, 0 en caso contrario.
+ */
+static inline int digest_equals(const uint8_t *a, const uint8_t *b) {
+#ifdef __AVX2__
+    __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)a), _mm256_loadu_si256((const __m256i *)b));
+    return _mm256_testz_si256(x, x);
+#elif defined(__SSE2__)
+    __m128i lo = _mm_xor_si128(_mm_loadu_si128((const __m128i *)a), _mm_loadu_si128((const __m128i *)b));
+    __m128i hi = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(a + 16)), _mm_loadu_si128((const __m128i *)(b + 16)));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(lo, hi), _mm_setzero_si128())) == 0xffff;
+#else
+    uint64_t x[4], y[4];
+    memcpy(x, a, DIGEST_SIZE);
+    memcpy(y, b, DIGEST_SIZE);
+    return ((x[0] ^ y[0]) | (x[1] ^ y[1]) | (x[2] ^ y[2]) | (x[3] ^ y[3])) == 0;
+#endif
+}
+
 /**
  * @brief imprime la estructura que guarda la version
  * @param v version de archivo que se imprimirá
@@ -113,11 +209,11 @@ void print_version(const file_version *v);
  * @brief Verifica si existe una version para un archivo
  *
  * @param filename Nombre del archivo
- * @param hash Hash del contenido
+ * @param digest Digest del contenido
  *
  * @return 1 si la version existe, 0 en caso contrario.
  */
-int version_exists(char *filename, char *hash, char* versions_db_path);
+int version_exists(char *filename, const uint8_t *digest, char* versions_db_path);
 
 /**
  * @brief retorna la version del archivo indicada
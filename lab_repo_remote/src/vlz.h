@@ -0,0 +1,141 @@
+/**
+ * @file
+ * @brief Compresion LZ por bloques con formato de flujo
+ * @author Fredy Esteban Anaya Salazar <fredyanaya@unicauca.edu.co>
+ * @author Jorge Andres Martinez Varon <jorgeandre@unicauca.edu.co>
+ * @copyright MIT License
+ *
+ * Compresor de la familia LZ77, sin dependencias, del estilo de LZ4. Un
+ * flujo comprimido (frame) tiene:
+ *
+ * - Encabezado: magic, tamano total sin comprimir.
+ * - Bloques de hasta LZ_BLOCK bytes sin comprimir, cada uno con su
+ *   encabezado (tamano original, tamano guardado y si esta comprimido).
+ *   Un bloque que no se reduce al comprimirlo se guarda tal cual.
+ * - Un bloque de tamano 0 que marca el final.
+ *
+ * Dentro de un bloque comprimido hay secuencias: un byte con la longitud
+ * de los literales (4 bits altos) y de la coincidencia menos 4 (4 bits
+ * bajos), las longitudes que no caben en 4 bits en bytes adicionales (255
+ * significa "continua"), los literales, y la distancia de 2 bytes a la
+ * coincidencia. La ultima secuencia del bloque solo tiene literales.
+ *
+ * La descompresion usa dos buffers de LZ_BLOCK bytes, sin importar el
+ * tamano del flujo.
+ */
+
+#ifndef VLZ_H
+#define VLZ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define LZ_BLOCK (64 << 10) /**< Tamano maximo de un bloque sin comprimir */
+#define LZ_BLOCK_BOUND (LZ_BLOCK + 8) /**< Tamano maximo de un bloque con su encabezado */
+#define LZ_FRAME_HEADER 16 /**< Tamano del encabezado del flujo */
+#define LZ_FRAME_END 8 /**< Tamano de la marca de fin */
+
+/**
+ * @brief Recibe los datos descomprimidos.
+ *
+ * @param ctx Contexto del receptor
+ * @param data Datos
+ * @param len Bytes
+ *
+ * @return 0 para continuar, -1 para abortar.
+ */
+typedef int (*lz_sink)(void *ctx, const void *data, size_t len);
+
+/**
+ * @brief Escribe el encabezado de un flujo.
+ * Si el tamano aun no se conoce, se escribe 0 y se completa al final con
+ * lz_frame_set_size.
+ *
+ * @param out Buffer de al menos LZ_FRAME_HEADER bytes
+ * @param size Tamano sin comprimir
+ *
+ * @return Bytes escritos.
+ */
+size_t lz_frame_begin(uint8_t *out, uint64_t size);
+
+/**
+ * @brief Comprime un bloque y lo escribe con su encabezado.
+ *
+ * @param in Datos (hasta LZ_BLOCK bytes)
+ * @param len Bytes
+ * @param out Buffer de al menos LZ_BLOCK_BOUND bytes
+ *
+ * @return Bytes escritos.
+ */
+size_t lz_frame_block(const uint8_t *in, size_t len, uint8_t *out);
+
+/**
+ * @brief Escribe la marca de fin del flujo.
+ *
+ * @param out Buffer de al menos LZ_FRAME_END bytes
+ *
+ * @return Bytes escritos.
+ */
+size_t lz_frame_end(uint8_t *out);
+
+/**
+ * @brief Completa el tamano sin comprimir en el encabezado de un flujo.
+ *
+ * @param fd Descriptor del archivo con el flujo
+ * @param offset Posicion del flujo en el archivo
+ * @param size Tamano sin comprimir
+ *
+ * @return 0 en caso de exito, -1 si ocurre un error.
+ */
+int lz_frame_set_size(int fd, off_t offset, uint64_t size);
+
+/**
+ * @brief Lee el tamano sin comprimir de un flujo.
+ *
+ * @param fd Descriptor del archivo con el flujo
+ * @param offset Posicion del flujo en el archivo
+ *
+ * @return Tamano sin comprimir, -1 si el flujo no es valido.
+ */
+int64_t lz_frame_size(int fd, off_t offset);
+
+/**
+ * @brief Descomprime un flujo bloque por bloque.
+ *
+ * @param fd Descriptor del archivo con el flujo
+ * @param offset Posicion del flujo en el archivo
+ * @param sink Receptor de los datos descomprimidos
+ * @param ctx Contexto del receptor
+ *
+ * @return 0 en caso de exito, -1 si el flujo no es valido o el receptor
+ * aborta.
+ */
+int lz_decode(int fd, off_t offset, lz_sink sink, void *ctx);
+
+/**
+ * @brief Receptor que escribe en un descriptor.
+ *
+ * @param ctx Apuntador al descriptor (int *)
+ */
+int lz_sink_fd(void *ctx, const void *data, size_t len);
+
+/**
+ * @brief Comprime un archivo completo.
+ * Si el inicio del archivo no se reduce al comprimirlo, no se crea el
+ * destino.
+ *
+ * @param source Archivo de origen
+ * @param destination Archivo comprimido
+ *
+ * @return 0 si se creo el destino, 1 si el archivo no es compresible, -1
+ * si ocurre un error.
+ */
+int lz_compress_file(const char *source, const char *destination);
+
+/**
+ * @brief Verifica si comprimir ahorra suficiente espacio (al menos 1/8).
+ */
+#define lz_worth(in, out) ((out) < (in) - (in) / 8)
+
+#endif